@@ -23,6 +23,7 @@
 #define _PILOT_ADDRESS_H_
 
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 #include "pi-buffer.h"
 
 #ifdef __cplusplus
@@ -77,6 +78,9 @@ extern "C" {
 	  PI_ARGS((Address_t *));
 	extern int unpack_Address
 	  PI_ARGS((Address_t *, const pi_buffer_t *buf, addressType type));
+	extern int unpack_Address_arena
+	  PI_ARGS((Address_t *, const pi_buffer_t *buf, addressType type,
+		pi_arena_t *arena));
 	extern int pack_Address
 	  PI_ARGS((const Address_t *, pi_buffer_t *buf, addressType type));
 	extern int unpack_AddressAppInfo
@@ -0,0 +1,185 @@
+/*
+ * $Id$
+ *
+ * pi-archive.h: Single-file backup archive interface
+ *
+ * Copyright (c) 2026, pilot-link developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-archive.h
+ *  @brief Single-file container for a complete device backup
+ *
+ * A backup archive stores every database of one backup set in a single
+ * local file, instead of one PRC/PDB/PQA file per database. Each member is
+ * the unmodified image pi_file_close() would have written, so it can be
+ * accessed with the regular pi-file functions through
+ * pi_archive_open_file().
+ *
+ * The archive is laid out as a short header, the member images, and a
+ * central index followed by a fixed-size trailer at the very end of the
+ * file:
+ *
+ * @verbatim
+   header:   4 magic 'PLAR', 2 version, 2 reserved
+   images:   one PDB/PRC image per member, back to back
+   index:    one 64 byte entry per member, sorted by name
+               32 name, 4 creator, 4 type, 2 flags, 2 version,
+               4 offset, 4 size, 4 modification time (Palm OS time),
+               4 modification number, 4 reserved
+   trailer:  4 index offset, 4 entry count, 4 reserved, 4 magic 'PLIX'
+   @endverbatim
+ *
+ * Archives are only ever appended to: updating a member writes a new
+ * image after the existing data and a new index after it. The space used
+ * by superseded or removed images is not reclaimed.
+ */
+
+#ifndef _PILOT_ARCHIVE_H_
+#define _PILOT_ARCHIVE_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#include "pi-args.h"
+#include "pi-file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PI_ARCHIVE_VERSION	1	/**< Current archive format version */
+
+	/** @brief Index entry describing one database stored in an archive */
+	typedef struct pi_archive_entry {
+		char	name[32];		/**< Database name */
+		unsigned long creator;		/**< Database creator */
+		unsigned long type;		/**< Database type */
+		int	flags;			/**< Database flags (see #dlpDBFlags) */
+		int	version;		/**< Database version */
+		unsigned long offset;		/**< Offset of the image in the archive */
+		unsigned long size;		/**< Size of the image */
+		time_t	modifyDate;		/**< Database modification date */
+		unsigned long modnum;		/**< Database modification number */
+	} pi_archive_entry_t;
+
+	typedef struct pi_archive pi_archive_t;
+
+	/** @brief Open a backup archive
+	 *
+	 * With @p for_writing set, the archive is created if it doesn't
+	 * exist and members may be added or removed. An existing archive
+	 * is never truncated: use pi_archive_create() to start afresh.
+	 *
+	 * @param name Access path of the archive
+	 * @param for_writing Non-zero to allow modifications
+	 * @return A new archive handle or NULL
+	 */
+	extern pi_archive_t *pi_archive_open
+		PI_ARGS((const char *name, int for_writing));
+
+	/** @brief Create a new, empty backup archive
+	 *
+	 * Any existing file with the same name is replaced.
+	 *
+	 * @param name Access path of the archive
+	 * @return A new archive handle open for writing, or NULL
+	 */
+	extern pi_archive_t *pi_archive_create
+		PI_ARGS((const char *name));
+
+	/** @brief Close an archive
+	 *
+	 * For an archive open for writing, the index is written out if
+	 * anything changed.
+	 *
+	 * @param ar The archive handle, disposed of by this call
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_archive_close
+		PI_ARGS((pi_archive_t *ar));
+
+	/** @brief Number of databases in the archive */
+	extern int pi_archive_count
+		PI_ARGS((const pi_archive_t *ar));
+
+	/** @brief Index entry by position
+	 *
+	 * Entries are sorted by database name.
+	 *
+	 * @param ar An open archive
+	 * @param index Entry index, from 0 to pi_archive_count() - 1
+	 * @return Pointer to the entry (don't modify it) or NULL
+	 */
+	extern const pi_archive_entry_t *pi_archive_get_entry
+		PI_ARGS((const pi_archive_t *ar, int index));
+
+	/** @brief Look up a database by name
+	 *
+	 * @param ar An open archive
+	 * @param name Database name
+	 * @return Pointer to the entry (don't modify it) or NULL
+	 */
+	extern const pi_archive_entry_t *pi_archive_find
+		PI_ARGS((const pi_archive_t *ar, const char *name));
+
+	/** @brief Open a database stored in the archive for reading
+	 *
+	 * The returned file is independent of the archive handle and
+	 * must be disposed of with pi_file_close().
+	 *
+	 * @param ar An open archive
+	 * @param name Database name
+	 * @return A read-only pi_file_t or NULL
+	 */
+	extern pi_file_t *pi_archive_open_file
+		PI_ARGS((pi_archive_t *ar, const char *name));
+
+	/** @brief Store a new database in the archive
+	 *
+	 * Takes a file created with pi_file_create() and writes it to the
+	 * archive instead of to disk, replacing any member with the same
+	 * database name. The file is always disposed of, as with
+	 * pi_file_close().
+	 *
+	 * @param ar An archive open for writing
+	 * @param pf A file open for write
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_archive_close_file
+		PI_ARGS((pi_archive_t *ar, pi_file_t *pf));
+
+	/** @brief Remove a database from the archive index
+	 *
+	 * @param ar An archive open for writing
+	 * @param name Database name
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_archive_remove
+		PI_ARGS((pi_archive_t *ar, const char *name));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PILOT_ARCHIVE_H_ */
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,140 @@
+/*
+ * $Id$
+ *
+ * pi-arena.h:  region allocator for unpacked records
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-arena.h
+ *  @brief Region allocator for unpacked records
+ *
+ * An arena hands out memory from large chunks and releases all of it at
+ * once. The unpack_*_arena() functions of the record packers place every
+ * string and sub-structure of the records they unpack in an arena, so
+ * unpacking a whole database costs a handful of allocations, and freeing
+ * it a single pi_arena_reset() or pi_arena_free() call. Records unpacked
+ * this way must not be passed to the matching free_*() function.
+ *
+ * @code
+ *	pi_arena_t *arena = pi_arena_new(0);
+ *
+ *	for (i = 0; dlp_ReadRecordByIndex(sd, db, i, buf, ...) >= 0; i++) {
+ *		unpack_Address_arena(&addr, buf, address_v1, arena);
+ *		// ... use addr ...
+ *		pi_arena_reset(arena);
+ *	}
+ *	pi_arena_free(arena);
+ * @endcode
+ *
+ * Read-only consumers that print records and throw them away can go
+ * further with a borrowing arena from pi_arena_new_borrowing(): strings
+ * are then not copied at all, the unpacked record points at the
+ * null-terminated strings in the record buffer itself. Such a record is
+ * valid only as long as the buffer is unchanged, and its strings must not
+ * be modified.
+ *
+ * Every allocation function accepts a NULL arena, in which case memory
+ * comes from malloc() and is released with free() as usual.
+ */
+
+#ifndef _PILOT_ARENA_H_
+#define _PILOT_ARENA_H_
+
+#include <stddef.h>
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+	/** @brief Opaque arena structure */
+	typedef struct pi_arena pi_arena_t;
+
+	/** @brief Create an arena
+	 *
+	 * Dispose of it with pi_arena_free()
+	 *
+	 * @param chunk_size Size of the chunks memory is taken from, 0 for the default
+	 * @return The new arena, or NULL if out of memory
+	 */
+	extern pi_arena_t *pi_arena_new
+		PI_ARGS((size_t chunk_size));
+
+	/** @brief Create an arena that borrows strings instead of copying them
+	 *
+	 * pi_arena_strdup() on this arena returns its argument, so records
+	 * unpacked into it refer to the strings in the record buffer. Other
+	 * allocations work as in any arena. Dispose of it with
+	 * pi_arena_free()
+	 *
+	 * @param chunk_size Size of the chunks memory is taken from, 0 for the default
+	 * @return The new arena, or NULL if out of memory
+	 */
+	extern pi_arena_t *pi_arena_new_borrowing
+		PI_ARGS((size_t chunk_size));
+
+	/** @brief Release everything allocated from an arena, keeping it usable
+	 *
+	 * The chunks are merged into one kept for reuse, so an arena reset
+	 * after each record stops allocating once it has grown to fit the
+	 * largest one.
+	 *
+	 * @param arena The arena
+	 */
+	extern void pi_arena_reset
+		PI_ARGS((pi_arena_t *arena));
+
+	/** @brief Dispose of an arena and everything allocated from it
+	 *
+	 * @param arena The arena, may be NULL
+	 */
+	extern void pi_arena_free
+		PI_ARGS((pi_arena_t *arena));
+
+	/** @brief Allocate memory, suitably aligned for any structure
+	 *
+	 * @param arena The arena, or NULL to use malloc()
+	 * @param size Number of bytes
+	 * @return The memory, or NULL if out of memory
+	 */
+	extern void *pi_arena_alloc
+		PI_ARGS((pi_arena_t *arena, size_t size));
+
+	/** @brief Copy a block of memory
+	 *
+	 * @param arena The arena, or NULL to use malloc()
+	 * @param data Data to copy
+	 * @param size Number of bytes
+	 * @return The copy, or NULL if out of memory
+	 */
+	extern void *pi_arena_memdup
+		PI_ARGS((pi_arena_t *arena, PI_CONST void *data, size_t size));
+
+	/** @brief Copy a null-terminated string
+	 *
+	 * @param arena The arena, or NULL to use malloc()
+	 * @param s String to copy
+	 * @return The copy, s itself if the arena borrows strings, or NULL
+	 *	if out of memory
+	 */
+	extern char *pi_arena_strdup
+		PI_ARGS((pi_arena_t *arena, PI_CONST char *s));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,6 +25,7 @@
 #include <stdint.h>
 
 #include <pi-appinfo.h>
+#include <pi-arena.h>
 #include <pi-buffer.h>
 
 /* This is the blob that has the timezone data in it */
@@ -51,6 +52,9 @@ extern "C" {
 
 	extern int unpack_Blob_p
 	PI_ARGS((Blob_t *blob, const unsigned char *data, const size_t position));
+	extern int unpack_Blob_p_arena
+	PI_ARGS((Blob_t *blob, const unsigned char *data, const size_t position,
+		pi_arena_t *arena));
 
 	extern int pack_Blob
 	PI_ARGS((const Blob_t *blob, pi_buffer_t *buf));
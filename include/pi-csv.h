@@ -0,0 +1,202 @@
+/*
+ * $Id$
+ *
+ * pi-csv.h: Buffered CSV reader and writer for the conduits
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-csv.h
+ *  @brief Streaming CSV (RFC 4180) reader and writer
+ *
+ * The reader fills a large buffer with fread() and splits one record at a
+ * time in place: quotes and escapes are removed where the data lies and
+ * each field is terminated with a nul, so the fields returned point into
+ * the buffer and are never copied. They remain valid until the next call
+ * to pi_csv_read_record(). Quoted fields may span several lines. A record
+ * that straddles the end of the buffer is parsed on from where it stopped
+ * once more data has been read, so every byte is looked at only once.
+ *
+ * The writer looks characters up in a table built once, and writes the
+ * runs that need no quoting or escaping with a single fwrite().
+ *
+ * Label tables map the fixed size label arrays of the application info
+ * blocks (categories, phone labels) to their index without comparing
+ * every label with strncasecmp().
+ *
+ * @code
+ *	pi_csv_reader_t *r = pi_csv_reader_new(in, ',', PI_CSV_TRIM);
+ *	int n;
+ *
+ *	while ((n = pi_csv_read_record(r)) > 0)
+ *		for (i = 0; i < n; i++)
+ *			puts(r->fields[i].data);
+ *	pi_csv_reader_free(r);
+ * @endcode
+ */
+
+#ifndef _PILOT_CSV_H_
+#define _PILOT_CSV_H_
+
+#include <stdio.h>
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @name Flags of readers and writers */
+/*@{*/
+#define PI_CSV_BACKSLASH	0x01	/**< Backslash escapes (\\n, \\t, \\\\...) in fields, as pilot-addresses writes them */
+#define PI_CSV_TRIM		0x02	/**< Reader: skip blanks around fields and after the closing quote */
+#define PI_CSV_COMMENTS		0x04	/**< Reader: skip records that start with '#' */
+#define PI_CSV_QUOTE_ALL	0x08	/**< Writer: quote every field, not only those that need it */
+/*@}*/
+
+/** Number of slots of a label table, twice the most labels it holds */
+#define PI_CSV_LABEL_SLOTS	32
+
+	/** @brief A field of the record last read */
+	typedef struct pi_csv_field {
+		char	*data;		/**< Nul terminated data, in the reader's buffer */
+		size_t	offset;		/**< Offset of @a data in the buffer */
+		size_t	len;		/**< Length of the data */
+		int	quoted;		/**< Non-zero if the field was quoted */
+		int	term;		/**< What ended the field: the delimiter, an extra separator, '\\n', or EOF */
+	} pi_csv_field_t;
+
+	/** @brief State of a reader */
+	typedef struct pi_csv_reader {
+		FILE	*in;		/**< Where the records come from */
+		int	delimiter;	/**< Field delimiter */
+		int	flags;		/**< PI_CSV_* flags */
+		PI_CONST char *separators;	/**< Characters that may also end a quoted field, or NULL */
+		char	*buf;		/**< Read buffer */
+		size_t	size;		/**< Size of @a buf */
+		size_t	start;		/**< Start of the data not parsed yet */
+		size_t	end;		/**< End of the data read */
+		int	eof;		/**< Non-zero once the stream has no more data */
+		pi_csv_field_t *fields;	/**< Fields of the record last read */
+		int	allocated;	/**< Number of entries of @a fields */
+		unsigned char special[256];	/**< Characters that end a run of plain data */
+
+		/* Where the parser stopped when a record didn't end in the buffer */
+		size_t	pos;		/**< Next byte to look at */
+		size_t	field;		/**< Start of the field being parsed */
+		size_t	out;		/**< End of its data so far */
+		int	count;		/**< Fields of the record already parsed */
+		int	phase;		/**< Part of the field being parsed */
+		int	quoted;		/**< Non-zero if it is quoted */
+	} pi_csv_reader_t;
+
+	/** @brief State of a writer */
+	typedef struct pi_csv_writer {
+		FILE	*out;		/**< Where the records go */
+		int	delimiter;	/**< Field delimiter */
+		int	flags;		/**< PI_CSV_* flags */
+		unsigned char special[256];	/**< Non-zero for characters to quote or escape */
+	} pi_csv_writer_t;
+
+	/** @brief Case insensitive lookup of fixed size labels */
+	typedef struct pi_csv_labels {
+		size_t	width;		/**< Characters compared, one less than the label size */
+		char	folded[PI_CSV_LABEL_SLOTS][32];	/**< Lower case labels */
+		signed char index[PI_CSV_LABEL_SLOTS];	/**< Index of each slot's label, -1 if empty */
+	} pi_csv_labels_t;
+
+	/** @brief Create a reader
+	 *
+	 * @param in Stream to read from; it is not closed by pi_csv_reader_free()
+	 * @param delimiter Field delimiter, such as ',', ';' or '\\t'
+	 * @param flags PI_CSV_BACKSLASH, PI_CSV_TRIM, PI_CSV_COMMENTS
+	 * @return The reader, or NULL if out of memory
+	 */
+	extern pi_csv_reader_t *pi_csv_reader_new
+		PI_ARGS((FILE *in, int delimiter, int flags));
+
+	/** @brief Dispose of a reader
+	 *
+	 * @param r The reader, may be NULL
+	 */
+	extern void pi_csv_reader_free
+		PI_ARGS((pi_csv_reader_t *r));
+
+	/** @brief Read the next record
+	 *
+	 * A CR before the end of a line is dropped. A blank line is a record
+	 * with one empty field.
+	 *
+	 * @param r The reader
+	 * @return Number of fields in r->fields, 0 at the end of the stream,
+	 *	PI_ERR_GENERIC_MEMORY or PI_ERR_GENERIC_SYSTEM
+	 */
+	extern int pi_csv_read_record
+		PI_ARGS((pi_csv_reader_t *r));
+
+	/** @brief Set up a writer
+	 *
+	 * @param w Writer to set up
+	 * @param out Stream to write to
+	 * @param delimiter Field delimiter
+	 * @param flags PI_CSV_BACKSLASH, PI_CSV_QUOTE_ALL
+	 */
+	extern void pi_csv_writer_init
+		PI_ARGS((pi_csv_writer_t *w, FILE *out, int delimiter,
+			int flags));
+
+	/** @brief Write a field
+	 *
+	 * @param w The writer
+	 * @param s Nul terminated data, NULL for an empty field
+	 * @param sep Written after the field: 0 for the delimiter, '\\n' to
+	 *	end the record, or any other separator
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_csv_write_field
+		PI_ARGS((pi_csv_writer_t *w, PI_CONST char *s, int sep));
+
+	/** @brief Build a label table
+	 *
+	 * Empty labels are left out; of labels that are the same but for
+	 * case, the first one is found.
+	 *
+	 * @param t Table to build
+	 * @param labels First character of an array of fixed size labels,
+	 *	such as AddressAppInfo.phoneLabels or CategoryAppInfo.name
+	 * @param count Number of labels, at most PI_CSV_LABEL_SLOTS / 2
+	 * @param size Size of each label, at most 32
+	 */
+	extern void pi_csv_labels_init
+		PI_ARGS((pi_csv_labels_t *t, PI_CONST char *labels, int count,
+			size_t size));
+
+	/** @brief Find a label, ignoring case
+	 *
+	 * Only the first size - 1 characters of @p s are compared, as
+	 * strncasecmp() with the label size would.
+	 *
+	 * @param t The table
+	 * @param s Label to look for
+	 * @return Index of the label, or -1 if there is none
+	 */
+	extern int pi_csv_labels_find
+		PI_ARGS((PI_CONST pi_csv_labels_t *t, PI_CONST char *s));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * $Id$
+ *
+ * pi-diff.h: Record and resource level comparison of databases
+ *
+ * Copyright (c) 2026, pilot-link developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-diff.h
+ *  @brief Record and resource level comparison of databases
+ *
+ * Compares two versions of the same database and reports which records
+ * (matched by unique ID) or resources (matched by type and ID) were added,
+ * removed, modified or only had their attributes changed. Contents are
+ * compared through a 64-bit hash (see pi_hash64()), so only one record of
+ * each database is looked at at a time and the comparison runs in linear
+ * time.
+ *
+ * A diff can be saved as a text patch with pi_diff_write() and loaded back
+ * with pi_diff_read(). The patch describes the changes but doesn't carry
+ * the data: the record contents come from the newer database when the
+ * patch is applied.
+ *
+ * @verbatim
+   PILOT-DIFF 1
+   db		<name>	<0 for records, 1 for resources>
+   appinfo	<0 or 1>	<old hash>	<new hash>
+   sortinfo	<0 or 1>	<old hash>	<new hash>
+   <op>	<key>	<old attrs>	<new attrs>	<old size>	<new size>	<old hash>	<new hash>
+   ...
+   end		<number of change lines>
+   @endverbatim
+ *
+ * Fields are separated by a single tab. @a op is one of @c + (added),
+ * @c - (removed), @c M (modified) and @c A (attributes only). @a key is the
+ * record unique ID in decimal, or the resource type and ID as
+ * @c TTTTTTTT:id with the type in hexadecimal. Attributes include the
+ * category in their low four bits. Hashes are 16 hexadecimal digits.
+ */
+
+#ifndef _PILOT_DIFF_H_
+#define _PILOT_DIFF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pi-args.h"
+#include "pi-file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PI_DIFF_VERSION		1	/**< Current patch format version */
+
+	/** @brief Kinds of change reported in a diff */
+	enum piDiffChange {
+		PI_DIFF_ADDED = 1,	/**< Only in the new database */
+		PI_DIFF_REMOVED,	/**< Only in the old database */
+		PI_DIFF_MODIFIED,	/**< Contents differ (attributes may too) */
+		PI_DIFF_ATTRIBUTES	/**< Same contents, different attributes or category */
+	};
+
+	/** @brief Summary of one record or resource, as compared */
+	typedef struct pi_diff_item {
+		recordid_t uid;			/**< For records, record unique ID */
+		unsigned long type;		/**< For resources, resource type */
+		int	resource_id;		/**< For resources, resource ID */
+		int	attrs;			/**< Record attributes and category */
+		size_t	size;			/**< Size of the data */
+		uint64_t hash;			/**< pi_hash64() of the data */
+	} pi_diff_item_t;
+
+	/** @brief One change between two databases */
+	typedef struct pi_diff_entry {
+		int	change;			/**< See #piDiffChange */
+		recordid_t uid;			/**< For records, record unique ID */
+		unsigned long type;		/**< For resources, resource type */
+		int	resource_id;		/**< For resources, resource ID */
+		int	old_index;		/**< Index in the old list, or -1 */
+		int	new_index;		/**< Index in the new list, or -1 */
+		int	old_attrs;		/**< Attributes and category before */
+		int	new_attrs;		/**< Attributes and category after */
+		size_t	old_size;		/**< Data size before */
+		size_t	new_size;		/**< Data size after */
+		uint64_t old_hash;		/**< Data hash before */
+		uint64_t new_hash;		/**< Data hash after */
+	} pi_diff_entry_t;
+
+	/** @brief Result of a comparison */
+	typedef struct pi_diff {
+		char	name[32];		/**< Database name */
+		int	resource_flag;		/**< Non-zero for resource databases */
+		int	app_info_changed;	/**< Non-zero if the appInfo blocks differ */
+		int	sort_info_changed;	/**< Non-zero if the sortInfo blocks differ */
+		uint64_t old_app_info_hash;
+		uint64_t new_app_info_hash;
+		uint64_t old_sort_info_hash;
+		uint64_t new_sort_info_hash;
+		int	added;			/**< Number of #PI_DIFF_ADDED entries */
+		int	removed;		/**< Number of #PI_DIFF_REMOVED entries */
+		int	modified;		/**< Number of #PI_DIFF_MODIFIED entries */
+		int	attributes;		/**< Number of #PI_DIFF_ATTRIBUTES entries */
+		int	num_entries;		/**< Number of entries */
+		int	num_entries_allocated;
+		pi_diff_entry_t *entries;	/**< Changes, new entries first in new order, then removals */
+	} pi_diff_t;
+
+	/** @brief Compare two versions of a database
+	 *
+	 * Both files should be open for reading. They are best opened with
+	 * pi_file_open_mapped() so record data doesn't need to be copied.
+	 *
+	 * @param from Old version
+	 * @param to New version
+	 * @return A new diff to dispose of with pi_diff_free(), or NULL if
+	 *	   the databases are not of the same kind or on error
+	 */
+	extern pi_diff_t *pi_diff_files
+		PI_ARGS((pi_file_t *from, pi_file_t *to));
+
+	/** @brief Compare two lists of record or resource summaries
+	 *
+	 * This is the engine behind pi_diff_files(), exposed so the lists
+	 * may come from elsewhere (e.g. from a device).
+	 *
+	 * @param resource_flag Non-zero if the items are resources
+	 * @param from Old items
+	 * @param from_count Number of old items
+	 * @param to New items
+	 * @param to_count Number of new items
+	 * @return A new diff with no name and unchanged appInfo and sortInfo,
+	 *	   or NULL if out of memory
+	 */
+	extern pi_diff_t *pi_diff_items
+		PI_ARGS((int resource_flag, const pi_diff_item_t *from,
+			 int from_count, const pi_diff_item_t *to,
+			 int to_count));
+
+	/** @brief Summarize the records or resources of a file
+	 *
+	 * @param pf A file open for reading
+	 * @param items On return, a malloc()'ed array of summaries in file
+	 *	  order, to free() after use
+	 * @param count On return, the number of items
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_diff_file_items
+		PI_ARGS((pi_file_t *pf, pi_diff_item_t **items, int *count));
+
+	/** @brief Dispose of a diff */
+	extern void pi_diff_free
+		PI_ARGS((pi_diff_t *diff));
+
+	/** @brief Write a diff as a text patch
+	 *
+	 * @param diff The diff
+	 * @param f Stream to write to
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_diff_write
+		PI_ARGS((const pi_diff_t *diff, FILE *f));
+
+	/** @brief Read a text patch written by pi_diff_write()
+	 *
+	 * The @a old_index and @a new_index fields of the entries are set
+	 * to -1.
+	 *
+	 * @param f Stream to read from
+	 * @return A new diff or NULL if the patch is invalid
+	 */
+	extern pi_diff_t *pi_diff_read
+		PI_ARGS((FILE *f));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PILOT_DIFF_H_ */
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -23,6 +23,7 @@
 
 #include <time.h>
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -107,6 +108,9 @@ extern "C" {
 	  PI_ARGS((struct Expense *));
 	extern int unpack_Expense
 	  PI_ARGS((struct Expense *, unsigned char *record, int len));
+	extern int unpack_Expense_arena
+	  PI_ARGS((struct Expense *, unsigned char *record, int len,
+		pi_arena_t *arena));
 	extern int pack_Expense
 	  PI_ARGS((struct Expense *, unsigned char *record, int len));
 	extern int unpack_ExpensePref
@@ -81,6 +81,11 @@ typedef struct pi_file {
 	unsigned long unique_id_seed;	/**< Database file's unique ID seed as read from an existing file */
 	struct 	DBInfo info;		/**< Database information and attributes */
 	struct 	pi_file_entry *entries;	/**< Array of records / resources */
+	void	*map;			/**< Whole file in memory for files opened with pi_file_open_mapped(), or NULL */
+	size_t	map_size;		/**< Size of the @a map block */
+	int	map_allocated;		/**< Non-zero if @a map was allocated rather than mmap'ed */
+	recordid_t *uid_table;		/**< Open addressing set of the record UIDs appended to a file open for write, or NULL */
+	size_t	uid_table_size;		/**< Number of slots in @a uid_table, a power of two */
 } pi_file_t;
 
 /** @brief Transfer progress callback structure
@@ -141,6 +146,35 @@ enum piProgressType {
 	extern pi_file_t *pi_file_open
 		PI_ARGS((const char *name));
 
+	/** @brief Open a database for read-only access, in memory
+	 *
+	 * Same as pi_file_open(), but the file is mapped in memory (or
+	 * read in one go where mmap() is not available). The record and
+	 * resource read functions then return pointers directly into the
+	 * mapped file, which remain valid until pi_file_close(), and no
+	 * file descriptor is kept open.
+	 *
+	 * @param name The access path to the database to open on the local machine
+	 * @return An initialized pi_file_t structure or NULL.
+	 */
+	extern pi_file_t *pi_file_open_mapped
+		PI_ARGS((const char *name));
+
+	/** @brief Open a database stored in a section of a larger file
+	 *
+	 * Same as pi_file_open(), but the database image is expected to
+	 * start at byte @p start of the local file and span @p length
+	 * bytes. This is used to access databases stored in a container
+	 * such as a backup archive (see pi-archive.h).
+	 *
+	 * @param name The access path to the file containing the database
+	 * @param start Offset of the first byte of the database image
+	 * @param length Size of the image, or -1 to extend to end of file
+	 * @return An initialized pi_file_t structure or NULL.
+	 */
+	extern pi_file_t *pi_file_open_section
+		PI_ARGS((const char *name, long start, long length));
+
 	/** @brief Create a new database file
 	 *
 	 * A new database file is created on the local machine.
@@ -161,6 +195,28 @@ enum piProgressType {
 	 * @return An error code (see file pi-error.h)
 	 */
 	extern int pi_file_close PI_ARGS((pi_file_t *pf));
+
+	/** @brief Write the image of a file open for write to a stream
+	 *
+	 * Serializes the database exactly as pi_file_close() would, but
+	 * to the current position of an already open stream, and leaves
+	 * the file open. The stream is not closed.
+	 *
+	 * @param pf	A file created with pi_file_create()
+	 * @param f	Stream to write to
+	 * @return An error code (see file pi-error.h)
+	 */
+	extern int pi_file_write_stream PI_ARGS((pi_file_t *pf, FILE *f));
+
+	/** @brief Dispose of a file without writing it
+	 *
+	 * For files opened with pi_file_create(), any data added so far
+	 * is dropped and nothing is written to disk. For files opened
+	 * read-only, this is the same as pi_file_close().
+	 *
+	 * @param pf	The pi_file_t structure is being disposed of by this function
+	 */
+	extern void pi_file_discard PI_ARGS((pi_file_t *pf));
 /*@}*/
 
 /** @name Reading from open files */
@@ -408,6 +464,39 @@ enum piProgressType {
 	extern int pi_file_merge
 	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
 			progress_func report_progress));
+
+	struct pi_diff;
+
+	/** @brief Bring a database on the handheld in line with a local file
+	 *
+	 * Instead of deleting and re-creating the database like
+	 * pi_file_install() does, only the records that differ are
+	 * written or deleted, and the appInfo block is only written if it
+	 * changed. Without @p diff, the record list of the database on
+	 * the handheld is read and each record is compared with the local
+	 * file through its hash. Records deleted on the handheld but not
+	 * purged yet count as absent. With a @p diff whose old side
+	 * describes the current contents of the handheld database (see
+	 * pi_diff_read()), only the record IDs are read back to check it
+	 * still applies; if not, the handheld is compared with instead.
+	 * The database header (flags, version and dates) is then set
+	 * from the file.
+	 *
+	 * Resource databases, databases not yet present on the handheld
+	 * or with another creator or type, and databases whose records
+	 * can't be read back, are installed with pi_file_install().
+	 *
+	 * @param pf An open file
+	 * @param socket Socket to the connected handheld
+	 * @param cardno Card number to install to (usually 0)
+	 * @param diff Changes to apply, or NULL to compare with the handheld
+	 * @param report_progress Progress function callback or NULL (see #pi_progress_t structure)
+	 * @return Negative code on error
+	 */
+	extern int pi_file_install_delta
+	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
+			const struct pi_diff *diff,
+			progress_func report_progress));
 /*@}*/
 
 /** @name Time utilities */
@@ -22,6 +22,7 @@
 #define _PILOT_HINOTE_H_
 
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,6 +42,9 @@ extern "C" {
 	extern void free_HiNoteNote PI_ARGS((struct HiNoteNote *));
 	extern int unpack_HiNoteNote
 	    PI_ARGS((struct HiNoteNote *, unsigned char *record, int len));
+	extern int unpack_HiNoteNote_arena
+	    PI_ARGS((struct HiNoteNote *, unsigned char *record, int len,
+		pi_arena_t *arena));
 	extern int pack_HiNoteNote
 	    PI_ARGS((struct HiNoteNote *, unsigned char *record, int len));
 	extern int unpack_HiNoteAppInfo
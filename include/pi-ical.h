@@ -0,0 +1,130 @@
+/*
+ * $Id$
+ *
+ * pi-ical.h: Write datebook, calendar and todo records as iCalendar
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-ical.h
+ *  @brief Streaming iCalendar (RFC 5545) writer
+ *
+ * Each record is written as one VEVENT or VTODO as soon as it has been
+ * unpacked, so a whole database is exported in constant memory. Repeat
+ * rules become RRULE and EXDATE properties; occurrences are never
+ * expanded. Times are written as floating local times, which is what the
+ * handheld stores.
+ *
+ * Strings are written as they are, so convert them to UTF-8 first.
+ *
+ * @code
+ *	pi_ical_t ical;
+ *
+ *	pi_ical_begin(&ical, stdout, "-//pilot-link//example//EN");
+ *	for (each record) {
+ *		unpack_Appointment(&a, buf, datebook_v1);
+ *		pi_ical_write_appointment(&ical, uid, attrs, &a);
+ *		free_Appointment(&a);
+ *	}
+ *	pi_ical_end(&ical);
+ * @endcode
+ */
+
+#ifndef _PILOT_ICAL_H_
+#define _PILOT_ICAL_H_
+
+#include <stdio.h>
+
+#include "pi-args.h"
+#include "pi-dlp.h"
+#include "pi-datebook.h"
+#include "pi-calendar.h"
+#include "pi-todo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** @brief State of a writer */
+	typedef struct pi_ical {
+		FILE	*out;		/**< Where the calendar goes */
+		char	stamp[17];	/**< DTSTAMP of every component */
+		int	column;		/**< Octets on the current line, for folding */
+	} pi_ical_t;
+
+	/** @brief Start a calendar
+	 *
+	 * @param ical Writer to set up
+	 * @param out Stream to write to
+	 * @param prodid Product identifier, such as "-//pilot-link//pilot-read-ical//EN"
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_ical_begin
+		PI_ARGS((pi_ical_t *ical, FILE *out, PI_CONST char *prodid));
+
+	/** @brief Finish a calendar
+	 *
+	 * The stream is flushed, not closed.
+	 *
+	 * @param ical Writer
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_ical_end
+		PI_ARGS((pi_ical_t *ical));
+
+	/** @brief Write an appointment as a VEVENT
+	 *
+	 * @param ical Writer
+	 * @param uid Unique ID of the record, part of the UID property
+	 * @param attrs Record attributes; secret records are marked private
+	 * @param a Appointment
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_ical_write_appointment
+		PI_ARGS((pi_ical_t *ical, recordid_t uid, int attrs,
+			PI_CONST struct Appointment *a));
+
+	/** @brief Write a calendar event as a VEVENT
+	 *
+	 * The location goes in a LOCATION property. Time zones are ignored.
+	 *
+	 * @param ical Writer
+	 * @param uid Unique ID of the record, part of the UID property
+	 * @param attrs Record attributes; secret records are marked private
+	 * @param e Event
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_ical_write_calendar_event
+		PI_ARGS((pi_ical_t *ical, recordid_t uid, int attrs,
+			PI_CONST CalendarEvent_t *e));
+
+	/** @brief Write a todo as a VTODO
+	 *
+	 * @param ical Writer
+	 * @param uid Unique ID of the record, part of the UID property
+	 * @param attrs Record attributes; secret records are marked private
+	 * @param category Name of the record's category, or NULL for none
+	 * @param t Todo
+	 * @return 0, or PI_ERR_GENERIC_SYSTEM if writing failed
+	 */
+	extern int pi_ical_write_todo
+		PI_ARGS((pi_ical_t *ical, recordid_t uid, int attrs,
+			PI_CONST char *category, PI_CONST struct ToDo *t));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
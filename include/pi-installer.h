@@ -0,0 +1,166 @@
+/*
+ * $Id$
+ *
+ * pi-installer.h: Bulk installation of records into an open database
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-installer.h
+ *  @brief Install many records into a database on the handheld
+ *
+ * The install conduits parse their input into items, queue them with
+ * pi_installer_add() and leave the rest to pi_installer_run(). Records are
+ * packed in batches by a callback. When threads are available the packing
+ * runs on a worker thread, one batch ahead of the writes, so the next
+ * records are ready while the handheld acknowledges the previous ones.
+ * Each batch is packed into an arena that is reset once it was written,
+ * so no buffer is allocated per record.
+ *
+ * With #PI_INSTALL_SKIP_DUPLICATES the records already in the database
+ * are read and hashed first, and a record whose data and category match
+ * one of them is not written again. The outcome of every record is passed
+ * to a report callback, so a failure doesn't stop the rest of the install
+ * unless the connection is lost.
+ *
+ * @code
+ *	static int pack(void *ctx, void *item, pi_buffer_t *buf)
+ *	{
+ *		return pack_ToDo(item, buf, todo_v1);
+ *	}
+ *
+ *	pi_installer_t *inst = pi_installer_new(sd, db,
+ *		PI_INSTALL_SKIP_DUPLICATES, pack, report, NULL);
+ *
+ *	for (i = 0; i < count; i++)
+ *		pi_installer_add(inst, &todos[i], 0);
+ *	written = pi_installer_run(inst, NULL);
+ *	pi_installer_free(inst);
+ * @endcode
+ */
+
+#ifndef _PILOT_INSTALLER_H_
+#define _PILOT_INSTALLER_H_
+
+#include "pi-args.h"
+#include "pi-buffer.h"
+#include "pi-dlp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @name Installer flags */
+/*@{*/
+#define PI_INSTALL_SKIP_DUPLICATES	0x01	/**< Don't write records that are already in the database */
+/*@}*/
+
+/** @name Outcome of a record, besides negative error codes */
+/*@{*/
+#define PI_INSTALL_WRITTEN		0	/**< The record was written */
+#define PI_INSTALL_DUPLICATE		1	/**< The same record was already in the database */
+/*@}*/
+
+	/** @brief Opaque installer structure */
+	typedef struct pi_installer pi_installer_t;
+
+	/** @brief Counts of a finished install */
+	typedef struct pi_installer_stats {
+		int	written;	/**< Records written */
+		int	duplicates;	/**< Records skipped as duplicates */
+		int	failed;		/**< Records that couldn't be packed or written */
+	} pi_installer_stats_t;
+
+	/** @brief Pack an item
+	 *
+	 * May be called on a thread of its own, so it must not use the
+	 * socket or state shared with the report callback. It is never
+	 * called for two items at once.
+	 *
+	 * @param ctx Context given to pi_installer_new()
+	 * @param item Item given to pi_installer_add()
+	 * @param buf Empty buffer to pack the record into
+	 * @return Negative error code if the item can't be packed
+	 */
+	typedef int (*pi_installer_pack_t)
+		PI_ARGS((void *ctx, void *item, pi_buffer_t *buf));
+
+	/** @brief Report the outcome of a record
+	 *
+	 * Called on the calling thread of pi_installer_run(), in the order
+	 * the items were added, right after the record was written, so
+	 * pi_palmos_error() still tells why a write failed.
+	 *
+	 * @param ctx Context given to pi_installer_new()
+	 * @param index Index of the item, counting from 0
+	 * @param item Item given to pi_installer_add()
+	 * @param result #PI_INSTALL_WRITTEN, #PI_INSTALL_DUPLICATE or a
+	 *	negative error code
+	 * @param id Unique ID of the new record if it was written
+	 */
+	typedef void (*pi_installer_report_t)
+		PI_ARGS((void *ctx, int index, void *item, int result,
+			recordid_t id));
+
+	/** @brief Create an installer
+	 *
+	 * @param sd Socket number
+	 * @param db Handle of the database, opened for writing
+	 * @param flags #PI_INSTALL_SKIP_DUPLICATES or 0
+	 * @param pack Packs each item
+	 * @param report Reports each record, or NULL
+	 * @param ctx Passed to @p pack and @p report
+	 * @return The installer, or NULL if out of memory
+	 */
+	extern pi_installer_t *pi_installer_new
+		PI_ARGS((int sd, int db, int flags, pi_installer_pack_t pack,
+			pi_installer_report_t report, void *ctx));
+
+	/** @brief Dispose of an installer
+	 *
+	 * @param inst The installer, may be NULL
+	 */
+	extern void pi_installer_free
+		PI_ARGS((pi_installer_t *inst));
+
+	/** @brief Queue an item
+	 *
+	 * @param inst The installer
+	 * @param item Item to pack; it must stay valid until
+	 *	pi_installer_run() returns
+	 * @param category Category of the record
+	 * @return Index of the item, or PI_ERR_GENERIC_MEMORY
+	 */
+	extern int pi_installer_add
+		PI_ARGS((pi_installer_t *inst, void *item, int category));
+
+	/** @brief Pack and write the queued items
+	 *
+	 * The queue is empty on return.
+	 *
+	 * @param inst The installer
+	 * @param stats If not NULL, receives the counts of the install
+	 * @return Number of records written, or a negative error code if
+	 *	the existing records couldn't be read or the connection was
+	 *	lost; the records left are then reported with that error
+	 */
+	extern int pi_installer_run
+		PI_ARGS((pi_installer_t *inst, pi_installer_stats_t *stats));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,6 +25,7 @@
 #include <stdint.h>
 
 #include <pi-appinfo.h>
+#include <pi-arena.h>
 #include <pi-buffer.h>
 
 #ifdef __cplusplus
@@ -95,8 +96,13 @@ extern "C" {
 	PI_ARGS((Timezone_t *tz, const pi_buffer_t *buf));
 	extern int unpack_Timezone_p
 	PI_ARGS((Timezone_t *tz, const unsigned char *data, const size_t position));
+	extern int unpack_Timezone_p_arena
+	PI_ARGS((Timezone_t *tz, const unsigned char *data, const size_t position,
+		pi_arena_t *arena));
 	extern int unpack_Location
 	PI_ARGS((Location_t *tz, const pi_buffer_t *buf));
+	extern int unpack_Location_arena
+	PI_ARGS((Location_t *tz, const pi_buffer_t *buf, pi_arena_t *arena));
 
 	extern int pack_DST
 	PI_ARGS((const DST_t *dst, pi_buffer_t *buf));
@@ -23,6 +23,7 @@
 
 #include <time.h>
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -106,6 +107,9 @@ extern "C" {
 
 	extern int unpack_Mail
 	    PI_ARGS((struct Mail *, unsigned char *record, size_t len));
+	extern int unpack_Mail_arena
+	    PI_ARGS((struct Mail *, unsigned char *record, size_t len,
+		pi_arena_t *arena));
 
 	extern int pack_Mail
 	    PI_ARGS((struct Mail *, unsigned char *record, size_t len));
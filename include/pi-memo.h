@@ -26,6 +26,7 @@ extern "C" {
 #endif
 
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 #include "pi-buffer.h"
 
 	typedef enum {
@@ -49,6 +50,9 @@ extern "C" {
 	extern void free_Memo PI_ARGS((struct Memo *));
 	extern int unpack_Memo
 	    PI_ARGS((struct Memo *, const pi_buffer_t *record, memoType type));
+	extern int unpack_Memo_arena
+	    PI_ARGS((struct Memo *, const pi_buffer_t *record, memoType type,
+		pi_arena_t *arena));
 	extern int pack_Memo
 	    PI_ARGS((const struct Memo *, pi_buffer_t *record, memoType type));
 	extern int unpack_MemoAppInfo
@@ -35,6 +35,8 @@ extern "C"
 /* flags values */
 #define PALMPIX_COLOUR_CORRECTION    1
 #define PALMPIX_HISTOGRAM_STRETCH    2
+/* Decode with the portable code only, not the vector kernels */
+#define PALMPIX_SCALAR               4
 
 struct PalmPixState {
    /* This callback should read record #RECNO into BUFFER and BUFSIZE, and
@@ -0,0 +1,261 @@
+/*
+ * $Id$
+ *
+ * pi-recurrence.h: Repeating appointments, and an index of their
+ * occurrences
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-recurrence.h
+ *  @brief Expand the repeat rules of datebook and calendar events
+ *
+ * The repeat fields of an Appointment_t or CalendarEvent_t are compiled
+ * into a pi_recurrence_t, which finds the next occurrence on or after any
+ * day directly rather than by walking day by day. All times are the wall
+ * clock times stored on the handheld: no time zone or daylight saving
+ * time is applied, and mktime() is never called.
+ *
+ * A pi_datebook_index_t holds the rules of a whole database in an
+ * interval tree keyed by the time span of each event, so the occurrences
+ * between two times are found in logarithmic time plus the number of
+ * events that actually overlap the range. Records are added, replaced
+ * and removed by unique ID, one at a time, as they change during a sync.
+ *
+ * @code
+ *	pi_datebook_index_t *idx = pi_datebook_index_new();
+ *
+ *	pi_datebook_index_read_file(idx, pf);
+ *	pi_datebook_index_query(idx, &from, &to, print_occurrence, NULL);
+ *	...
+ *	pi_datebook_index_set_appointment(idx, uid, &appointment);
+ *	pi_datebook_index_remove(idx, deleted_uid);
+ *	...
+ *	pi_datebook_index_free(idx);
+ * @endcode
+ */
+
+#ifndef _PILOT_RECURRENCE_H_
+#define _PILOT_RECURRENCE_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#include "pi-args.h"
+#include "pi-datebook.h"
+#include "pi-calendar.h"
+#include "pi-file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Last day of a rule that repeats forever */
+#define PI_RECURRENCE_FOREVER	2147483647L
+
+	/** @brief A compiled repeat rule
+	 *
+	 * Days are counted from 1970-01-01, times of day in minutes from
+	 * midnight.
+	 */
+	typedef struct pi_recurrence {
+		int	type;		/**< One of enum repeatTypes */
+		int	frequency;	/**< Every frequency days, weeks, months or years */
+		long	first;		/**< Day of the first occurrence (the begin date) */
+		long	last;		/**< Last day an occurrence may fall on, or PI_RECURRENCE_FOREVER */
+		int	start;		/**< Start time of each occurrence */
+		int	duration;	/**< Length of each occurrence, a whole day for untimed events */
+		int	event;		/**< Non-zero for untimed events */
+		int	weekdays;	/**< Weekly: bit n set to repeat on day n, Sunday being 0 */
+		int	weekstart;	/**< Weekly: first day of the week, 0 for Sunday */
+		long	first_month;	/**< Monthly and yearly: month of the begin date, counted from year 0 */
+		int	month;		/**< Yearly: month of the begin date, 0-11 */
+		int	day;		/**< Monthly by date and yearly: day of the month */
+		int	week;		/**< Monthly by day: week of the month, 0-3, 4 for the last */
+		int	weekday;	/**< Monthly by day: day of the week */
+		int	num_exceptions;	/**< Number of days in exceptions */
+		long	*exceptions;	/**< Days without an occurrence, sorted */
+	} pi_recurrence_t;
+
+	/** @brief Iterator over the occurrences of a rule in a time range */
+	typedef struct pi_recurrence_iter {
+		PI_CONST pi_recurrence_t *rule;
+		long	day;		/**< First day still to look at */
+		long	until;		/**< End of the range, in minutes */
+	} pi_recurrence_iter_t;
+
+	/** @brief Opaque occurrence index */
+	typedef struct pi_datebook_index pi_datebook_index_t;
+
+	/** @brief Called for each occurrence found by pi_datebook_index_query()
+	 *
+	 * @param id Unique ID of the record
+	 * @param begin Start of the occurrence
+	 * @param end End of the occurrence
+	 * @param data As passed to pi_datebook_index_query()
+	 * @return 0 to go on, non-zero to stop the query
+	 */
+	typedef int (*pi_occurrence_func)
+		PI_ARGS((recordid_t id, PI_CONST struct tm *begin,
+			PI_CONST struct tm *end, void *data));
+
+	/** @brief Compile the repeat rule of an appointment
+	 *
+	 * Weekly appointments with no day set repeat on the weekday of the
+	 * begin date. A zero frequency counts as one.
+	 *
+	 * @param rule Rule to fill in, release it with pi_recurrence_free()
+	 * @param a Appointment
+	 * @return 0, or PI_ERR_GENERIC_MEMORY
+	 */
+	extern int pi_recurrence_from_appointment
+		PI_ARGS((pi_recurrence_t *rule, PI_CONST struct Appointment *a));
+
+	/** @brief Compile the repeat rule of a calendar event
+	 *
+	 * @param rule Rule to fill in, release it with pi_recurrence_free()
+	 * @param e Event
+	 * @return 0, or PI_ERR_GENERIC_MEMORY
+	 */
+	extern int pi_recurrence_from_calendar_event
+		PI_ARGS((pi_recurrence_t *rule, PI_CONST CalendarEvent_t *e));
+
+	/** @brief Release the exceptions of a rule
+	 *
+	 * @param rule The rule
+	 */
+	extern void pi_recurrence_free
+		PI_ARGS((pi_recurrence_t *rule));
+
+	/** @brief Find the first occurrence on or after a day
+	 *
+	 * Months and years that lack the day of the month of a monthly or
+	 * yearly rule (the 31st, February 29th) are skipped.
+	 *
+	 * @param rule The rule
+	 * @param day Day, counted from 1970-01-01
+	 * @return Day of the occurrence, or -1 if there are no more
+	 */
+	extern long pi_recurrence_next_day
+		PI_ARGS((PI_CONST pi_recurrence_t *rule, long day));
+
+	/** @brief Start iterating over the occurrences overlapping a range
+	 *
+	 * @param it Iterator
+	 * @param rule The rule, which must outlive the iterator
+	 * @param from Start of the range
+	 * @param to End of the range, not included
+	 */
+	extern void pi_recurrence_iter_init
+		PI_ARGS((pi_recurrence_iter_t *it, PI_CONST pi_recurrence_t *rule,
+			PI_CONST struct tm *from, PI_CONST struct tm *to));
+
+	/** @brief Get the next occurrence of an iterator
+	 *
+	 * @param it Iterator
+	 * @param begin Start of the occurrence returned
+	 * @param end End of the occurrence returned
+	 * @return 1 if there was one, 0 at the end of the range
+	 */
+	extern int pi_recurrence_iter_next
+		PI_ARGS((pi_recurrence_iter_t *it, struct tm *begin,
+			struct tm *end));
+
+	/** @brief Create an empty occurrence index
+	 *
+	 * @return The index, or NULL if out of memory
+	 */
+	extern pi_datebook_index_t *pi_datebook_index_new
+		PI_ARGS((void));
+
+	/** @brief Dispose of an index
+	 *
+	 * @param idx The index, may be NULL
+	 */
+	extern void pi_datebook_index_free
+		PI_ARGS((pi_datebook_index_t *idx));
+
+	/** @brief Add every record of a DatebookDB or CalendarDB-PDat file
+	 *
+	 * Deleted and archived records are left out.
+	 *
+	 * @param idx The index
+	 * @param pf An open file
+	 * @return Number of records added, or a negative error code
+	 */
+	extern int pi_datebook_index_read_file
+		PI_ARGS((pi_datebook_index_t *idx, pi_file_t *pf));
+
+	/** @brief Add an appointment, or replace the record with its ID
+	 *
+	 * @param idx The index
+	 * @param id Unique ID of the record
+	 * @param a Appointment
+	 * @return 0, or PI_ERR_GENERIC_MEMORY
+	 */
+	extern int pi_datebook_index_set_appointment
+		PI_ARGS((pi_datebook_index_t *idx, recordid_t id,
+			PI_CONST struct Appointment *a));
+
+	/** @brief Add a calendar event, or replace the record with its ID
+	 *
+	 * @param idx The index
+	 * @param id Unique ID of the record
+	 * @param e Event
+	 * @return 0, or PI_ERR_GENERIC_MEMORY
+	 */
+	extern int pi_datebook_index_set_calendar_event
+		PI_ARGS((pi_datebook_index_t *idx, recordid_t id,
+			PI_CONST CalendarEvent_t *e));
+
+	/** @brief Remove a record
+	 *
+	 * @param idx The index
+	 * @param id Unique ID of the record
+	 * @return 1 if it was there, 0 if not
+	 */
+	extern int pi_datebook_index_remove
+		PI_ARGS((pi_datebook_index_t *idx, recordid_t id));
+
+	/** @brief Number of records in an index
+	 *
+	 * @param idx The index
+	 * @return Number of records
+	 */
+	extern int pi_datebook_index_count
+		PI_ARGS((PI_CONST pi_datebook_index_t *idx));
+
+	/** @brief Find the occurrences that overlap a range
+	 *
+	 * Occurrences come record by record, in order of the begin times of
+	 * the records, and in time order within a record.
+	 *
+	 * @param idx The index
+	 * @param from Start of the range
+	 * @param to End of the range, not included
+	 * @param func Called for each occurrence
+	 * @param data Passed to func
+	 * @return Number of occurrences found
+	 */
+	extern int pi_datebook_index_query
+		PI_ARGS((PI_CONST pi_datebook_index_t *idx,
+			PI_CONST struct tm *from, PI_CONST struct tm *to,
+			pi_occurrence_func func, void *data));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * $Id$
+ *
+ * pi-screenshot.h: ScreenShot database support
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PILOT_SCREENSHOT_H
+#define PILOT_SCREENSHOT_H
+
+#include <stddef.h>
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ScreenShot_DB "ScreenShotDB"
+
+/* Size of every record but the last of a screenshot that spans several */
+#define SCREENSHOT_RECORD_SIZE	61440
+
+/* flags values */
+/* Convert with the portable code only, not the vector kernels */
+#define SCREENSHOT_SCALAR	1
+
+struct ScreenShotHeader {
+   int width, height;
+
+   /* Bits per pixel: 1, 2 and 4 are shades of grey, 8 indexes the colour
+      table at the end of the data, 16 is RGB565 */
+   int depth;
+
+   /* Number of records the screenshot spans, starting with this one */
+   int num_records;
+
+   /* Bytes before the pixel data in the first record */
+   int offset;
+};
+
+/* Returns 1 if the record is the first of a screenshot, filling in H, or
+   0 if it isn't. Old screenshots have no header, they are recognised by
+   their size. */
+extern int unpack_ScreenShotHeader
+     PI_ARGS ((struct ScreenShotHeader *h, const unsigned char *record,
+	       size_t len));
+
+/* Returns the number of bytes of pixel data, colour table included, that
+   unpack_ScreenShot needs */
+extern size_t ScreenShot_data_size
+     PI_ARGS ((const struct ScreenShotHeader *h));
+
+/* Convert the pixel data of a screenshot, the records with the header
+   skipped and put end to end, into width * height RGB pixels. Returns 1
+   on success, 0 if the data is too short or the depth unknown. */
+extern int unpack_ScreenShot
+     PI_ARGS ((const struct ScreenShotHeader *h, const unsigned char *data,
+	       size_t len, unsigned char *pixmap, int flags));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
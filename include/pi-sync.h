@@ -29,11 +29,17 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #include "pi-macros.h"
+#include "pi-buffer.h"
 
 	typedef struct _SyncHandler SyncHandler;
 	typedef struct _DesktopRecord DesktopRecord;
 	typedef struct _PilotRecord PilotRecord;
+	typedef struct _PilotRecordData PilotRecordData;
+	typedef struct _SyncIndex SyncIndex;
+	typedef struct _SyncCache SyncCache;
 
 	struct _DesktopRecord {
 		int recID;
@@ -47,6 +53,11 @@ extern "C" {
 		int flags;
 		void *buffer;
 		size_t len;
+
+		/* Storage behind buffer, which records are received into.
+		   NULL when buffer was set by the conduit (e.g. in
+		   Prepare). */
+		PilotRecordData *data;
 	};
 
 	struct _SyncHandler {
@@ -82,17 +93,88 @@ extern "C" {
 
 		int (*Prepare) (SyncHandler *, DesktopRecord *,
 				PilotRecord *);
+
+		/* Set by sync_UseIndex() */
+		SyncIndex *index;
+
+		/* Optional, see sync_OpenCache() */
+		SyncCache *cache;
+
+		/* Number of device records read ahead while the conduit
+		   handles earlier ones, 0 to read them one at a time.
+		   Only used when libpisync is built with thread support. */
+		int pipeline;
+
+		/* Threads running Match, and Compare in slow syncs without
+		   a cache, on the records read ahead. Leave at 0 unless
+		   these callbacks can run in other threads at the same
+		   time as the other callbacks. */
+		int match_workers;
+
+		/* Non-zero to resolve records changed on both sides
+		   against their state after the last sync, kept in the
+		   cache, instead of always duplicating them. A side whose
+		   record is still the same as then simply loses to the
+		   other. Otherwise, if Merge is set, the cache keeps the
+		   record bodies and Merge is asked to merge the changes
+		   field by field. */
+		int three_way;
+
+		/* Merge the changes made on the device since base into the
+		   desktop record, which has changes of its own. Return 0
+		   when merged, the engine then stores the desktop record
+		   on the device; 1 if the same field changed on both
+		   sides, leaving the desktop record as it was, to get
+		   both versions as separate records; or a negative error. */
+		int (*Merge) (SyncHandler *, const PilotRecord * base,
+			      PilotRecord *, DesktopRecord *);
 	};
 
 	PilotRecord *sync_NewPilotRecord(int buf_size);
 	PilotRecord *sync_CopyPilotRecord(const PilotRecord * precord);
 	void sync_FreePilotRecord(PilotRecord * precord);
+	pi_buffer_t *sync_PilotRecordBuffer(PilotRecord * precord);
+	void sync_PilotRecordReceived(PilotRecord * precord);
 
 	DesktopRecord *sync_NewDesktopRecord(void);
 	DesktopRecord *sync_CopyDesktopRecord(const DesktopRecord *
 					      drecord);
 	void sync_FreeDesktopRecord(DesktopRecord * drecord);
 
+	/* Hash index of desktop records. Add all desktop records with
+	   sync_IndexAdd() and call sync_UseIndex() to get Match,
+	   FreeMatch, ForEach and ForEachModified callbacks for free. The
+	   AddRecord callback should add the records it creates, and
+	   SetPilotID should call sync_IndexUpdate() after changing the
+	   record ID. */
+	SyncIndex *sync_NewIndex(void);
+	void sync_FreeIndex(SyncIndex * index);
+	int sync_IndexAdd(SyncIndex * index, DesktopRecord * drecord);
+	int sync_IndexUpdate(SyncIndex * index, DesktopRecord * drecord);
+	DesktopRecord *sync_IndexFind(const SyncIndex * index,
+				      recordid_t id);
+	void sync_UseIndex(SyncHandler * sh, SyncIndex * index);
+
+	/* Hashes of the device records as of the last successful sync.
+	   Set the handler's cache to the result of sync_OpenCache() to
+	   let slow syncs tell changed device records from their hash
+	   instead of calling Compare; the engine keeps it up to date and
+	   saves it after each successful sync. */
+	SyncCache *sync_OpenCache(const char *dir, unsigned long user_id,
+				  const char *db_name);
+	int sync_SaveCache(SyncCache * cache);
+	void sync_FreeCache(SyncCache * cache);
+	int sync_CacheLookup(const SyncCache * cache, recordid_t id,
+			     int *catID, int *attrs, uint64_t * hash);
+	int sync_CacheSet(SyncCache * cache, recordid_t id, int catID,
+			  int attrs, uint64_t hash);
+	int sync_CacheSetBody(SyncCache * cache, recordid_t id,
+			      const void *data, size_t len);
+	int sync_CacheBody(const SyncCache * cache, recordid_t id,
+			   const void **data, size_t * len);
+	void sync_CacheRemove(SyncCache * cache, recordid_t id);
+	void sync_CacheClear(SyncCache * cache);
+
 	int sync_CopyToPilot(SyncHandler * sh);
 	int sync_CopyFromPilot(SyncHandler * sh);
 
@@ -28,6 +28,7 @@ extern "C" {
 
 #include <time.h>
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 #include "pi-buffer.h"
 
 	typedef enum {
@@ -53,6 +54,9 @@ extern "C" {
 	extern void free_ToDo PI_ARGS((ToDo_t *));
 	extern int unpack_ToDo
 	    PI_ARGS((ToDo_t *, const pi_buffer_t *record, todoType type));
+	extern int unpack_ToDo_arena
+	    PI_ARGS((ToDo_t *, const pi_buffer_t *record, todoType type,
+		pi_arena_t *arena));
 	extern int pack_ToDo
 	    PI_ARGS((const ToDo_t *, pi_buffer_t *record, todoType type));
 	extern int unpack_ToDoAppInfo
@@ -30,7 +30,10 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #include "pi-args.h"
+#include "pi-buffer.h"
 
 /* pi_mktag Turn a sequence of characters into a long (er.. 32 bit quantity)
             like those used on the PalmOS device to identify creators and
@@ -79,6 +82,64 @@ extern "C" {
 		PI_ARGS((const char *charset, const char *ptext, int bytes,
 		     char **text));
 
+	/** @brief Convert many strings to the handheld's charset at once
+	 *
+	 * All the converted strings are stored in a single allocation, so a
+	 * whole database worth of fields costs one malloc() and one free().
+	 * Converters are cached per thread, and CP1252 <-> UTF-8 (the usual
+	 * case) is done without iconv.
+	 *
+	 * @param charset Desktop charset of the strings
+	 * @param pi_charset Handheld charset, or NULL for the PILOT_CHARSET environment variable or CP1252
+	 * @param count Number of strings
+	 * @param texts Strings to convert, NULL entries give NULL results
+	 * @param bytes Number of bytes of each string
+	 * @param ptexts On return, the converted null-terminated strings
+	 * @param arena On return, the allocation to free() when done with @p ptexts
+	 * @return 0 on success, -1 if any string can't be converted
+	 */
+	extern int convert_ToPilotChar_Batch
+		PI_ARGS((const char *charset, const char *pi_charset, int count,
+		     const char *const *texts, const int *bytes,
+		     char **ptexts, char **arena));
+
+	/** @brief Convert many strings from the handheld's charset at once
+	 *
+	 * See convert_ToPilotChar_Batch().
+	 *
+	 * @param charset Desktop charset to convert to
+	 * @param pi_charset Handheld charset, or NULL for the PILOT_CHARSET environment variable or CP1252
+	 * @param count Number of strings
+	 * @param ptexts Strings to convert, NULL entries give NULL results
+	 * @param bytes Number of bytes of each string
+	 * @param texts On return, the converted null-terminated strings
+	 * @param arena On return, the allocation to free() when done with @p texts
+	 * @return 0 on success, -1 if any string can't be converted
+	 */
+	extern int convert_FromPilotChar_Batch
+		PI_ARGS((const char *charset, const char *pi_charset, int count,
+		     const char *const *ptexts, const int *bytes,
+		     char **texts, char **arena));
+
+	/** @brief Convert text from the handheld's charset into a buffer
+	 *
+	 * Unlike the other conversions this one doesn't fail on bytes the
+	 * handheld's charset leaves undefined, such as 0x81 in CP1252: they
+	 * are replaced by U+FFFD, or by '?' if @p charset isn't UTF-8.
+	 * Appending all the fields of a record to one buffer keeps them in
+	 * a single allocation, as convert_FromPilotChar_Batch() does.
+	 *
+	 * @param charset Desktop charset to convert to
+	 * @param pi_charset Handheld charset, or NULL for the PILOT_CHARSET environment variable or CP1252
+	 * @param ptext Text to convert
+	 * @param bytes Number of bytes of @p ptext
+	 * @param out Buffer to append the converted text and a null byte to
+	 * @return 0 on success, -1 if out of memory or the charsets can't be converted
+	 */
+	extern int convert_FromPilotChar_Append
+		PI_ARGS((const char *charset, const char *pi_charset,
+		     const char *ptext, int bytes, pi_buffer_t *out));
+
 	/** @brief Convert a milliseconds timeout value to an absolute timespec
 	 *
 	 * @param timeout Timeout value from now, in milliseconds
@@ -106,6 +167,20 @@ extern "C" {
 	extern int pi_timeout_expired
 		PI_ARGS((const struct timespec *ts));
 
+	/** @brief 64-bit hash of a block of data
+	 *
+	 * Fast non-cryptographic hash (MurmurHash64A) used to compare
+	 * record and resource contents without keeping them around. The
+	 * result does not depend on host byte order or alignment, so
+	 * hashes may be stored and compared across machines.
+	 *
+	 * @param data Data to hash
+	 * @param len Length of the data in bytes
+	 * @return The 64-bit hash value
+	 */
+	extern uint64_t pi_hash64
+		PI_ARGS((const void *data, size_t len));
+
 #ifdef __cplusplus
 }
 #endif
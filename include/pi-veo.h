@@ -42,6 +42,10 @@ typedef struct VeoAppInfo {
 #define VEO_OUT_PPM       0x01
 #define VEO_OUT_PNG       0x02
 
+/* Picture flags */
+#define VEO_COLOUR_CORRECT 0x01
+#define VEO_BIAS           0x02
+
 typedef struct Veo {
    unsigned char   res1[1];
 
@@ -61,12 +65,39 @@ typedef struct Veo {
    char            name[32];
 } Veo_t;
 
+/* State of a picture decoded with unpack_VeoPicture */
+typedef struct VeoState {
+   /* This callback should read record #RECNO of the picture's database
+      into BUFFER and BUFSIZE, and return 0 when successful, just like
+      pi_file_read_record(). Record 0 is the header unpacked by
+      unpack_Veo(), the picture data starts at record 1. */
+   int (*getrecord) (struct VeoState *self, int recno, void **buffer,
+		     size_t *bufsize);
+
+   /* The output brightness adjustment used with VEO_BIAS: 0..50
+      darkens, 50..100 lightens */
+   int bias;
+
+   /* VEO_COLOUR_CORRECT and VEO_BIAS */
+   int flags;
+
+   /* This will be filled in by unpack_VeoPicture: width * height RGB
+      pixels, row by row */
+   unsigned char *pixmap;
+} VeoState_t;
+
 void free_Veo(Veo_t *v );
 int unpack_Veo(Veo_t *v, unsigned char *buffer, size_t len);
 int unpack_VeoAppInfo(VeoAppInfo_t *vai, unsigned char *record, size_t len);
 int pack_Veo(Veo_t *v, unsigned char *buffer, size_t len);
 int pack_VeoAppInfo(VeoAppInfo_t *vai, unsigned char *record, size_t len);
 
+/* Decode the picture whose header is V into STATE->pixmap. Returns 1 on
+   success, 0 if the picture has an unknown size or its records can't be
+   read. Free the pixmap with free_VeoPicture. */
+int unpack_VeoPicture(VeoState_t *state, const Veo_t *v);
+void free_VeoPicture(VeoState_t *state);
+
 #ifdef __cplusplus
 }
 #endif				/*__cplusplus*/
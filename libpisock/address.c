@@ -70,6 +70,27 @@ free_Address(Address_t *addr)
  ***********************************************************************/
 int
 unpack_Address(Address_t *addr, const pi_buffer_t *buf, addressType type)
+{
+	return unpack_Address_arena(addr, buf, type, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_Address_arena
+ *
+ * Summary:     Fill in the address structure based on the raw record 
+ *		data, allocating the strings from an arena
+ *
+ * Parameters:  Address_t*, pi_buffer_t *buf, record type, arena (NULL
+ *		to allocate the strings with malloc)
+ *
+ * Returns:     -1 on error, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Address_arena(Address_t *addr, const pi_buffer_t *buf,
+		     addressType type, pi_arena_t *arena)
 {
 	unsigned long	contents,
 			v;
@@ -107,7 +128,8 @@ unpack_Address(Address_t *addr, const pi_buffer_t *buf, addressType type)
 		if (contents & (1 << v)) {
 			if ((buf->used - ofs) < 1)
 				return 0;
-			addr->entry[v] = strdup((char *) (buf->data + ofs));
+			addr->entry[v] = pi_arena_strdup(arena,
+				(char *) (buf->data + ofs));
                   	ofs += strlen(addr->entry[v]) + 1;
 		} else {
 			addr->entry[v] = 0;
@@ -112,6 +112,25 @@ dup_Blob(const Blob_t *blob)
  ***********************************************************************/
 int
 unpack_Blob_p(Blob_t *blob, const unsigned char *data, const size_t position) {
+	return unpack_Blob_p_arena(blob, data, position, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_Blob_p_arena
+ *
+ * Summary:     Unpack a blob starting at position in data, allocating
+ *		its data from an arena
+ *
+ * Parameters:  Blob_t*, unsigned char*, size_t, arena (NULL to use
+ *		malloc)
+ *
+ * Returns:     the number of bytes read or -1 on error
+ *
+ ***********************************************************************/
+int
+unpack_Blob_p_arena(Blob_t *blob, const unsigned char *data,
+		    const size_t position, pi_arena_t *arena) {
 	size_t localPosition = position;
   
 	memcpy(blob->type, (char *)data+localPosition, 4);
@@ -121,7 +140,7 @@ unpack_Blob_p(Blob_t *blob, const unsigned char *data, const size_t position) {
 	localPosition += 2;
 	if(blob->length > 0) {
 		//printf("blob->length = %d\n", blob->length);
-		blob->data = (uint8_t *)malloc(blob->length);
+		blob->data = (uint8_t *)pi_arena_alloc(arena, blob->length);
 		if(NULL == blob->data) {
 			printf("Malloc failed!\n");
 			return -1;
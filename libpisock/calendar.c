@@ -260,6 +260,26 @@ free_CalendarEvent(CalendarEvent_t *a)
  ***********************************************************************/
 int
 unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType type)
+{
+	return unpack_CalendarEvent_arena(a, buf, type, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_CalendarEvent_arena
+ *
+ * Summary:     Fill in the calendar event structure based on the raw 
+ *		record data, allocating its members from an arena
+ *
+ * Parameters:  CalendarEvent_t*, pi_buffer_t * of buffer, calendarType,
+ *		arena (NULL to allocate the members with malloc)
+ *
+ * Returns:     -1 on fail, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_CalendarEvent_arena(CalendarEvent_t *a, const pi_buffer_t *buf,
+			   calendarType type, pi_arena_t *arena)
 {
 	int 	iflags,
 		j,
@@ -375,7 +395,8 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 	if (iflags & exceptFlag) {
 		a->exceptions = get_short(p2);
 		p2 += 2;
-		a->exception = malloc(sizeof(struct tm) * a->exceptions);
+		a->exception = pi_arena_alloc(arena,
+			sizeof(struct tm) * a->exceptions);
 
 		for (j = 0; j < a->exceptions; j++, p2 += 2) {
 			d = (unsigned short int) get_short(p2);
@@ -395,20 +416,20 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 	}
 
 	if (iflags & descFlag) {
-		a->description = strdup((char *)p2);
+		a->description = pi_arena_strdup(arena, (char *)p2);
 		p2 += strlen((char *)p2) + 1;
 	} else
 		a->description = 0;
 
 	if (iflags & noteFlag) {
-		a->note = strdup((char *)p2);
+		a->note = pi_arena_strdup(arena, (char *)p2);
 		p2 += strlen((char *)p2) + 1;
 	} else {
 		a->note = 0;
 	}
 
 	if (iflags & locFlag) {
-		a->location = strdup((char *)p2);
+		a->location = pi_arena_strdup(arena, (char *)p2);
 		p2 += strlen((char *)p2) + 1;
 	} else {
 		a->location = 0;
@@ -431,8 +452,10 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 				return -1;
 			}
 
-			a->blob[blob_count] = (Blob_t *)malloc(sizeof(Blob_t));
-			result = unpack_Blob_p(a->blob[blob_count], p2, 0);
+			a->blob[blob_count] = (Blob_t *)pi_arena_alloc(arena,
+				sizeof(Blob_t));
+			result = unpack_Blob_p_arena(a->blob[blob_count], p2, 0,
+				arena);
 			if(-1 == result) {
 				return -1;
 			} else {
@@ -445,11 +468,15 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 				int result;
 				if(NULL != a->tz) {
 					printf("Warning: Found more than one timezone blob! Freeing the previous one and starting again\n");
-					free_Timezone(a->tz);
-					free(a->tz);
+					if (arena == NULL) {
+						free_Timezone(a->tz);
+						free(a->tz);
+					}
 				}
-				a->tz = (Timezone_t *)malloc(sizeof(Timezone_t));
-				result = unpack_Timezone_p(a->tz, a->blob[blob_count]->data, 0);
+				a->tz = (Timezone_t *)pi_arena_alloc(arena,
+					sizeof(Timezone_t));
+				result = unpack_Timezone_p_arena(a->tz,
+					a->blob[blob_count]->data, 0, arena);
 				if(-1 == result) {
 					printf("Error unpacking timezone blob\n");
 					return -1;
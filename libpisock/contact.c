@@ -79,6 +79,25 @@ void free_Contact(struct Contact *c)
  *
  ***********************************************************************/
 int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
+{
+   return unpack_Contact_arena(c, buf, type, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:   unpack_Contact_arena
+ *
+ * Summary:    Fill in the contact structure based on the raw record
+ *             data, allocating its members from an arena
+ *
+ * Parameters: Arena, NULL to allocate the members with malloc
+ *
+ * Returns:    -1 on error, 
+ *             The length of the data used from the buffer on success
+ *
+ ***********************************************************************/
+int unpack_Contact_arena(struct Contact *c, pi_buffer_t *buf,
+                         contactsType type, pi_arena_t *arena)
 {
    unsigned long contents1;
    unsigned long contents2;
@@ -133,7 +152,7 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
       if (contents1 & (1 << i)) {
          if (len < 1)
             return 0;
-         c->entry[field_num] = strdup((char *) Pbuf);
+         c->entry[field_num] = pi_arena_strdup(arena, (char *) Pbuf);
          Pbuf += strlen((char *) Pbuf) + 1;
          len -= strlen(c->entry[field_num]) + 1;
       } else {
@@ -144,7 +163,7 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
       if (contents2 & (1 << i)) {
          if (len < 1)
             return 0;
-         c->entry[field_num] = strdup((char *) Pbuf);
+         c->entry[field_num] = pi_arena_strdup(arena, (char *) Pbuf);
          Pbuf += strlen((char *) Pbuf) + 1;
          len -= strlen(c->entry[field_num]) + 1;
       } else {
@@ -203,16 +222,18 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
          /* Too many blobs were found. */
          return (Pbuf - record);
       }
-      c->blob[blob_count] = malloc(sizeof(Blob_t));
+      c->blob[blob_count] = pi_arena_alloc(arena, sizeof(Blob_t));
       strncpy(c->blob[blob_count]->type, (char *)Pbuf, 4);
       c->blob[blob_count]->length = get_short(Pbuf+4);
-      c->blob[blob_count]->data = malloc(c->blob[blob_count]->length);
+      c->blob[blob_count]->data = pi_arena_alloc(arena,
+         c->blob[blob_count]->length);
       if (c->blob[blob_count]->data) {
          memcpy(c->blob[blob_count]->data, Pbuf+6, c->blob[blob_count]->length);
       }
       if (! strncmp(c->blob[blob_count]->type, BLOB_TYPE_PICTURE_ID, 4)) {
          if (!(c->picture)) {
-            c->picture = malloc(sizeof(struct ContactPicture));
+            c->picture = pi_arena_alloc(arena,
+               sizeof(struct ContactPicture));
          }
          c->picture->dirty = get_short(c->blob[blob_count]->data);
          c->picture->length = c->blob[blob_count]->length - 2;
@@ -0,0 +1,588 @@
+/*
+ * $Id$
+ *
+ * csv.c:  Buffered CSV (RFC 4180) reader and writer
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-error.h"
+#include "pi-csv.h"
+
+/* Initial size of the read buffer; it grows to hold the longest record */
+#define CSV_BUFFER_SIZE		65536
+
+/* parse() found the record doesn't end in the buffer yet */
+#define CSV_MORE		(-1000)
+
+/* Where parse() stopped within a field, in pi_csv_reader_t.phase */
+#define CSV_START		0	/* before the field */
+#define CSV_IN_QUOTES		1	/* between the quotes */
+#define CSV_AFTER_QUOTES	2	/* just after the closing quote */
+#define CSV_PLAIN		3	/* in unquoted data */
+
+/* Bits of pi_csv_writer_t.special */
+#define CSV_QUOTE		0x01	/* the field must be quoted */
+#define CSV_ESCAPE		0x02	/* the character is written as an escape */
+
+/* Bits of pi_csv_reader_t.special */
+#define CSV_STOP_QUOTED		0x01	/* may end a run of quoted data */
+#define CSV_STOP_PLAIN		0x02	/* may end a run of unquoted data */
+
+#define is_blank(r, c) \
+	((c) == ' ' || ((c) == '\t' && (r)->delimiter != '\t'))
+
+
+/***********************************************************************
+ *
+ * Function:    unescape
+ *
+ * Summary:     Decode the character after a backslash
+ *
+ * Parameters:  character
+ *
+ * Returns:     The character it stands for, or -1 if this is not an
+ *		escape and the backslash is kept
+ *
+ ***********************************************************************/
+static int
+unescape(int c)
+{
+	switch (c) {
+	case 'b':
+		return '\b';
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case 'v':
+		return '\v';
+	case '\\':
+		return '\\';
+	}
+	return -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    escape
+ *
+ * Summary:     Encode a character as the letter after a backslash
+ *
+ * Parameters:  character, which must be one unescape() returns
+ *
+ * Returns:     The letter
+ *
+ ***********************************************************************/
+static int
+escape(int c)
+{
+	switch (c) {
+	case '\b':
+		return 'b';
+	case '\f':
+		return 'f';
+	case '\n':
+		return 'n';
+	case '\t':
+		return 't';
+	case '\r':
+		return 'r';
+	case '\v':
+		return 'v';
+	}
+	return '\\';
+}
+
+
+/***********************************************************************
+ *
+ * Function:    parse
+ *
+ * Summary:     Split the record at the start of the buffer, removing
+ *		quotes and escapes in place. When the data read so far
+ *		ends within the record, where the parser stands is kept
+ *		in the reader so that it carries on from there once more
+ *		data has been read, and no byte is looked at twice.
+ *
+ * Parameters:  reader
+ *
+ * Returns:     Number of fields, CSV_MORE if more data must be read,
+ *		or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+parse(pi_csv_reader_t *r)
+{
+	char 	*buf 	= r->buf;
+	size_t 	p 	= r->pos,
+		end 	= r->end,
+		field 	= r->field,
+		w 	= r->out;
+	int 	eof 	= r->eof,
+		n 	= r->count,
+		quoted 	= r->quoted,
+		c,
+		e,
+		i,
+		term;
+
+	switch (r->phase) {
+	case CSV_IN_QUOTES:
+		goto in_quotes;
+	case CSV_AFTER_QUOTES:
+		goto after_quotes;
+	case CSV_PLAIN:
+		goto plain;
+	}
+
+  next_field:
+	if (r->flags & PI_CSV_TRIM)
+		while (p < end && (is_blank(r, buf[p]) || buf[p] == '\r'))
+			p++;
+	if (p == end && !eof)
+		goto more;
+
+	w = field = p;
+	quoted 	= 0;
+	term 	= EOF;
+	if (p < end && buf[p] == '"') {
+		quoted 	= 1;
+		w = field = ++p;
+
+  in_quotes:
+		r->phase = CSV_IN_QUOTES;
+		for (;;) {
+			size_t 	run = p;
+
+			while (p < end && !(r->special[(unsigned char) buf[p]]
+				& CSV_STOP_QUOTED))
+				p++;
+			if (w != run)
+				memmove(buf + w, buf + run, p - run);
+			w += p - run;
+
+			if (p == end) {
+				if (!eof)
+					goto more;
+				term = EOF;	/* unterminated */
+				goto done;
+			}
+			c = buf[p];
+			if (p + 1 == end && !eof)
+				goto more;
+			if (c == '"') {
+				if (p + 1 == end || buf[p + 1] != '"') {
+					p++;
+					break;
+				}
+				p++;
+			} else if (p + 1 < end
+			    && (e = unescape(buf[p + 1])) >= 0) {
+				c = e;
+				p++;
+			}
+			buf[w++] = c;
+			p++;
+		}
+
+  after_quotes:
+		r->phase = CSV_AFTER_QUOTES;
+		if (r->flags & PI_CSV_TRIM)
+			while (p < end && is_blank(r, buf[p]))
+				p++;
+		if (p == end && !eof)
+			goto more;
+		if (p < end && buf[p] != '\0' && r->separators
+		    && buf[p] != r->delimiter
+		    && strchr(r->separators, buf[p])) {
+			term = buf[p++];
+			goto done;
+		}
+	}
+
+	/* Unquoted data, or anything after the closing quote */
+  plain:
+	r->phase = CSV_PLAIN;
+	for (;;) {
+		size_t 	run = p;
+
+		while (p < end && !(r->special[(unsigned char) buf[p]]
+			& CSV_STOP_PLAIN))
+			p++;
+		if (w != run)
+			memmove(buf + w, buf + run, p - run);
+		w += p - run;
+
+		if (p == end) {
+			if (!eof)
+				goto more;
+			term = EOF;
+			break;
+		}
+		c = buf[p];
+		if (c == r->delimiter || c == '\n') {
+			term = c;
+			p++;
+			break;
+		}
+		if (p + 1 == end && !eof)
+			goto more;
+		if (c == '\r') {
+			if (p + 1 < end && buf[p + 1] == '\n') {
+				term = '\n';
+				p += 2;
+				break;
+			}
+		} else if (p + 1 < end && (e = unescape(buf[p + 1])) >= 0) {
+			c = e;
+			p++;
+		}
+		buf[w++] = c;
+		p++;
+	}
+
+  done:
+	if (n == r->allocated) {
+		int 	size = r->allocated * 2;
+		pi_csv_field_t *f = realloc(r->fields, size * sizeof(*f));
+
+		if (f == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		r->fields 	= f;
+		r->allocated 	= size;
+	}
+	buf[w] = '\0';
+	r->fields[n].offset 	= field;
+	r->fields[n].len 	= w - field;
+	r->fields[n].quoted 	= quoted;
+	r->fields[n].term 	= term;
+	n++;
+	r->phase = CSV_START;
+
+	if (term != '\n' && term != EOF)
+		goto next_field;
+
+	/* The buffer doesn't move any more until the next record */
+	for (i = 0; i < n; i++)
+		r->fields[i].data = buf + r->fields[i].offset;
+	r->start = r->pos = p;
+	r->count = 0;
+	return n;
+
+  more:
+	r->pos 		= p;
+	r->field 	= field;
+	r->out 		= w;
+	r->count 	= n;
+	r->quoted 	= quoted;
+	return CSV_MORE;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    refill
+ *
+ * Summary:     Move the data not parsed yet to the start of the buffer,
+ *		grow it if it is full, and read more. One byte is always
+ *		left free for the nul after the last field.
+ *
+ * Parameters:  reader
+ *
+ * Returns:     0, PI_ERR_GENERIC_MEMORY or PI_ERR_GENERIC_SYSTEM
+ *
+ ***********************************************************************/
+static int
+refill(pi_csv_reader_t *r)
+{
+	size_t 	got,
+		shift = r->start;
+	int 	i;
+
+	if (shift > 0) {
+		memmove(r->buf, r->buf + shift, r->end - shift);
+		r->start 	= 0;
+		r->end 		-= shift;
+		r->pos 		-= shift;
+		r->field 	-= shift;
+		r->out 		-= shift;
+		for (i = 0; i < r->count; i++)
+			r->fields[i].offset -= shift;
+	}
+
+	if (r->end + 1 >= r->size) {
+		char 	*buf = realloc(r->buf, r->size * 2);
+
+		if (buf == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		r->buf 	= buf;
+		r->size *= 2;
+	}
+
+	got = fread(r->buf + r->end, 1, r->size - 1 - r->end, r->in);
+	if (got == 0) {
+		if (ferror(r->in))
+			return PI_ERR_GENERIC_SYSTEM;
+		r->eof = 1;
+	}
+	r->end += got;
+
+	return 0;
+}
+
+
+pi_csv_reader_t *
+pi_csv_reader_new(FILE *in, int delimiter, int flags)
+{
+	pi_csv_reader_t *r = calloc(1, sizeof(pi_csv_reader_t));
+
+	if (r == NULL)
+		return NULL;
+
+	r->in 		= in;
+	r->delimiter 	= delimiter;
+	r->flags 	= flags;
+
+	r->special['"'] = CSV_STOP_QUOTED;
+	r->special[(unsigned char) delimiter] |= CSV_STOP_PLAIN;
+	r->special['\n'] |= CSV_STOP_PLAIN;
+	r->special['\r'] |= CSV_STOP_PLAIN;
+	if (flags & PI_CSV_BACKSLASH)
+		r->special['\\'] |= CSV_STOP_QUOTED | CSV_STOP_PLAIN;
+	r->size 	= CSV_BUFFER_SIZE;
+	r->allocated 	= 32;
+	r->buf 		= malloc(r->size);
+	r->fields 	= malloc(r->allocated * sizeof(pi_csv_field_t));
+	if (r->buf == NULL || r->fields == NULL) {
+		pi_csv_reader_free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+
+void
+pi_csv_reader_free(pi_csv_reader_t *r)
+{
+	if (r == NULL)
+		return;
+	free(r->buf);
+	free(r->fields);
+	free(r);
+}
+
+
+int
+pi_csv_read_record(pi_csv_reader_t *r)
+{
+	int 	n;
+
+	for (;;) {
+		int 	fresh = r->phase == CSV_START && r->count == 0
+			&& r->pos == r->start;
+
+		if (fresh && r->start == r->end) {
+			if (r->eof)
+				return 0;
+		} else if (fresh && (r->flags & PI_CSV_COMMENTS)
+		    && r->buf[r->start] == '#') {
+			char 	*nl = memchr(r->buf + r->start, '\n',
+					r->end - r->start);
+
+			if (nl != NULL || r->eof) {
+				r->start = r->pos = nl
+					? (size_t)(nl - r->buf) + 1 : r->end;
+				continue;
+			}
+		} else if ((n = parse(r)) != CSV_MORE) {
+			return n;
+		}
+
+		if ((n = refill(r)) < 0)
+			return n;
+	}
+}
+
+
+void
+pi_csv_writer_init(pi_csv_writer_t *w, FILE *out, int delimiter, int flags)
+{
+	static const char escaped[] = "\b\f\n\t\r\v\\";
+	int 	i;
+
+	w->out 		= out;
+	w->delimiter 	= delimiter;
+	w->flags 	= flags;
+
+	memset(w->special, 0, sizeof(w->special));
+	w->special['"'] = CSV_QUOTE | CSV_ESCAPE;
+	w->special[(unsigned char) delimiter] |= CSV_QUOTE;
+	if (flags & PI_CSV_BACKSLASH) {
+		for (i = 0; escaped[i]; i++)
+			w->special[(unsigned char) escaped[i]] |= CSV_ESCAPE;
+	} else {
+		w->special['\n'] |= CSV_QUOTE;
+		w->special['\r'] |= CSV_QUOTE;
+	}
+}
+
+
+int
+pi_csv_write_field(pi_csv_writer_t *w, const char *s, int sep)
+{
+	const unsigned char *p,
+		*run;
+	int 	quote 	= w->flags & PI_CSV_QUOTE_ALL;
+	size_t 	len;
+
+	if (s == NULL)
+		s = "";
+	p = (const unsigned char *) s;
+
+	/* Blanks at either end would be trimmed by a reader */
+	len = strlen(s);
+	if (!quote && len > 0 && (p[0] == ' ' || p[0] == '\t'
+		|| p[len - 1] == ' ' || p[len - 1] == '\t'))
+		quote = 1;
+	for (; !quote && *p; p++)
+		if (w->special[*p] & CSV_QUOTE)
+			quote = 1;
+
+	if (quote)
+		putc('"', w->out);
+
+	for (run = p = (const unsigned char *) s; ; p++) {
+		if (*p && !(w->special[*p] & CSV_ESCAPE))
+			continue;
+		if (p > run)
+			fwrite(run, 1, p - run, w->out);
+		if (*p == '\0')
+			break;
+		if (*p == '"') {
+			putc('"', w->out);
+			putc('"', w->out);
+		} else {
+			putc('\\', w->out);
+			putc(escape(*p), w->out);
+		}
+		run = p + 1;
+	}
+
+	if (quote)
+		putc('"', w->out);
+	putc(sep ? sep : w->delimiter, w->out);
+
+	return ferror(w->out) ? PI_ERR_GENERIC_SYSTEM : 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    fold_label
+ *
+ * Summary:     Copy at most width characters of a label in lower case
+ *
+ * Parameters:  destination of at least width + 1 bytes, label, width
+ *
+ * Returns:     Hash of the folded label
+ *
+ ***********************************************************************/
+static unsigned int
+fold_label(char *dest, const char *s, size_t width)
+{
+	unsigned int h = 2166136261U;
+	size_t 	i;
+
+	for (i = 0; i < width && s[i]; i++) {
+		int 	c = (unsigned char) s[i];
+
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		dest[i] = c;
+		h = (h ^ c) * 16777619U;
+	}
+	dest[i] = '\0';
+
+	return h;
+}
+
+
+void
+pi_csv_labels_init(pi_csv_labels_t *t, const char *labels, int count,
+	size_t size)
+{
+	int 	i;
+
+	if (size > sizeof(t->folded[0]))
+		size = sizeof(t->folded[0]);
+	if (count > PI_CSV_LABEL_SLOTS / 2)
+		count = PI_CSV_LABEL_SLOTS / 2;
+
+	t->width = size - 1;
+	memset(t->index, -1, sizeof(t->index));
+
+	for (i = 0; i < count; i++) {
+		const char *label = labels + i * size;
+		char 	folded[sizeof(t->folded[0])];
+		unsigned int slot;
+
+		if (label[0] == '\0' || pi_csv_labels_find(t, label) >= 0)
+			continue;
+		slot = fold_label(folded, label, t->width);
+		for (slot &= PI_CSV_LABEL_SLOTS - 1; t->index[slot] >= 0;
+		     slot = (slot + 1) & (PI_CSV_LABEL_SLOTS - 1))
+			;
+		strcpy(t->folded[slot], folded);
+		t->index[slot] = i;
+	}
+}
+
+
+int
+pi_csv_labels_find(const pi_csv_labels_t *t, const char *s)
+{
+	char 	folded[sizeof(t->folded[0])];
+	unsigned int slot;
+
+	slot = fold_label(folded, s, t->width);
+	for (slot &= PI_CSV_LABEL_SLOTS - 1; t->index[slot] >= 0;
+	     slot = (slot + 1) & (PI_CSV_LABEL_SLOTS - 1))
+		if (strcmp(t->folded[slot], folded) == 0)
+			return t->index[slot];
+
+	return -1;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
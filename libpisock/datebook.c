@@ -100,6 +100,26 @@ free_Appointment(Appointment_t *a)
  ***********************************************************************/
 int
 unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
+{
+	return unpack_Appointment_arena(a, buf, type, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_Appointment_arena
+ *
+ * Summary:     Fill in the appointment structure based on the raw 
+ *		record data, allocating its members from an arena
+ *
+ * Parameters:  Appointment_t*, pi_buffer_t * of buffer, datebook type,
+ *		arena (NULL to allocate the members with malloc)
+ *
+ * Returns:     -1 on fail, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Appointment_arena(Appointment_t *a, const pi_buffer_t *buf,
+			 datebookType type, pi_arena_t *arena)
 {
 	int 	iflags,
 		j,
@@ -228,7 +248,8 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 	if (iflags & exceptFlag) {
 		a->exceptions = get_short(p2);
 		p2 += 2;
-		a->exception = malloc(sizeof(struct tm) * a->exceptions);
+		a->exception = pi_arena_alloc(arena,
+			sizeof(struct tm) * a->exceptions);
 
 		for (j = 0; j < a->exceptions; j++, p2 += 2) {
 			d = (unsigned short int) get_short(p2);
@@ -248,13 +269,13 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 	}
 
 	if (iflags & descFlag) {
-		a->description = strdup((char *)p2);
+		a->description = pi_arena_strdup(arena, (char *)p2);
 		p2 += strlen((char *)p2) + 1;
 	} else
 		a->description = 0;
 
 	if (iflags & noteFlag) {
-		a->note = strdup((char *)p2);
+		a->note = pi_arena_strdup(arena, (char *)p2);
 		p2 += strlen((char *)p2) + 1;
 	} else {
 		a->note = 0;
@@ -2204,7 +2204,11 @@ dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
 			*c++ = 0;
 	}
 
-	if (pi_write(sd, dlp_buf->data, (size_t)(c - dlp_buf->data)) > 0) {
+	err = pi_write(sd, dlp_buf->data, (size_t)(c - dlp_buf->data));
+	if (err <= 0) {
+		if (err == 0)
+			err = PI_ERR_SOCK_IO;
+	} else {
 		err = 0;
 		if (p->reply) {
 			int l = pi_read(sd, dlp_buf, (size_t)(c - dlp_buf->data + 2));
@@ -2223,6 +2227,12 @@ dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
 				A0 = get_long(dlp_buf->data + 12);
 				c = dlp_buf->data + 18;
 				for (i = p->args - 1; i >= 0; i--) {
+					if (c + 2 + p->param[i].size >
+					    dlp_buf->data + l) {
+						/* truncated reply */
+						err = PI_ERR_DLP_COMMAND;
+						break;
+					}
 					if (p->param[i].byRef && p->param[i].data)
 						memcpy(p->param[i].data, c + 2,
 							   p->param[i].size);
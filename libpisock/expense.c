@@ -108,6 +108,26 @@ free_Expense(Expense_t *expense)
  ***********************************************************************/
 int
 unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
+{
+	return unpack_Expense_arena(expense, buffer, len, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_Expense_arena
+ *
+ * Summary:     unpack Expense records, allocating the strings from an arena
+ *
+ * Parameters:  Expense_t*, char* to buffer, length of buffer, arena (NULL
+ *		to allocate the strings with malloc)
+ *
+ * Returns:     effective buffer length
+ *
+ ***********************************************************************/
+int
+unpack_Expense_arena(Expense_t *expense, unsigned char *buffer, int len,
+		     pi_arena_t *arena)
 {
 	unsigned long d;
 	unsigned char *start = buffer;
@@ -136,7 +156,7 @@ unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
 		return 0;
 
 	if (*buffer) {
-		expense->amount = strdup((char *)buffer);
+		expense->amount = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen(expense->amount);
 		len -= strlen(expense->amount);
 	} else {
@@ -149,7 +169,7 @@ unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
 		return 0;
 
 	if (*buffer) {
-		expense->vendor = strdup((char *)buffer);
+		expense->vendor = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen(expense->vendor);
 		len -= strlen(expense->vendor);
 	} else {
@@ -162,7 +182,7 @@ unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
 		return 0;
 
 	if (*buffer) {
-		expense->city = strdup((char *)buffer);
+		expense->city = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen(expense->city);
 		len -= strlen(expense->city);
 	} else {
@@ -175,7 +195,7 @@ unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
 		return 0;
 
 	if (*buffer) {
-		expense->attendees = strdup((char *)buffer);
+		expense->attendees = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen(expense->attendees);
 		len -= strlen(expense->attendees);
 	} else {
@@ -188,7 +208,7 @@ unpack_Expense(Expense_t *expense, unsigned char *buffer, int len)
 		return 0;
 
 	if (*buffer) {
-		expense->note = strdup((char *)buffer);
+		expense->note = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen(expense->note);
 		len -= strlen(expense->note);
 	} else {
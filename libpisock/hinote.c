@@ -59,13 +59,33 @@ free_HiNoteNote(HiNoteNote_t *hinote)
  ***********************************************************************/
 int
 unpack_HiNoteNote(HiNoteNote_t *hinote, unsigned char *buffer, int len)
+{
+	return unpack_HiNoteNote_arena(hinote, buffer, len, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_HiNoteNote_arena
+ *
+ * Summary:     Unpack a HiNote record, allocating the text from an arena
+ *
+ * Parameters:  HiNoteNote_t*, char* to buffer, buffer length, arena (NULL to
+ *		allocate the text with malloc)
+ *
+ * Returns:     effective buffer length
+ *
+ ***********************************************************************/
+int
+unpack_HiNoteNote_arena(HiNoteNote_t *hinote, unsigned char *buffer,
+			int len, pi_arena_t *arena)
 {
 	if (len < 3)
 		return 0;
 
 	hinote->flags 	= buffer[0];
 	hinote->level 	= buffer[1];
-	hinote->text 	= strdup((char *) &buffer[2]);
+	hinote->text 	= pi_arena_strdup(arena, (char *) &buffer[2]);
 
 	return strlen((char *) &buffer[2]) + 3;
 }
@@ -0,0 +1,669 @@
+/*
+ * $Id$
+ *
+ * ical.c:  Write datebook, calendar and todo records as iCalendar
+ *          (RFC 5545)
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-error.h"
+#include "pi-ical.h"
+
+/* Content lines are folded at this many octets */
+#define ICAL_LINE_LENGTH	75
+
+/* Room for any DATE or DATE-TIME value, whatever is in the struct tm */
+#define ICAL_DATE_SIZE		48
+
+/* The fields of an appointment or calendar event that are written */
+typedef struct {
+	const char *kind;
+	int 	event;
+	const struct tm *begin,
+		*end;
+	int 	alarm,
+		advance,
+		advance_units;
+	int 	repeat_type,
+		repeat_forever;
+	const struct tm *repeat_end;
+	int 	repeat_frequency,
+		repeat_day;
+	const int *repeat_days;
+	int 	repeat_weekstart,
+		exceptions;
+	const struct tm *exception;
+	const char *description,
+		*note,
+		*location;
+} ical_event;
+
+static const char *weekdays[7] = { "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+
+
+/***********************************************************************
+ *
+ * Function:    put_raw
+ *
+ * Summary:     Write part of a content line, folding it when it grows
+ *		too long. Lines are never folded inside a UTF-8 sequence.
+ *
+ * Parameters:  Writer, string
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_raw(pi_ical_t *ical, const char *s)
+{
+	const unsigned char *p = (const unsigned char *) s;
+	int 	n;
+
+	for (; *p; p++) {
+		if ((*p & 0xc0) != 0x80) {
+			n = *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : *p >= 0xc0 ? 2 : 1;
+			if (ical->column + n > ICAL_LINE_LENGTH) {
+				fputs("\r\n ", ical->out);
+				ical->column = 1;
+			}
+		}
+		putc(*p, ical->out);
+		ical->column++;
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_text
+ *
+ * Summary:     Write a TEXT value, escaping backslashes, semicolons,
+ *		commas and line breaks
+ *
+ * Parameters:  Writer, text
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_text(pi_ical_t *ical, const char *s)
+{
+	char 	run[64];
+	int 	n = 0;
+
+	/* plain characters are gathered in runs, escapes written at once */
+	for (; *s; s++) {
+		const char *escape = NULL;
+
+		switch (*s) {
+		case '\\':
+			escape = "\\\\";
+			break;
+		case ';':
+			escape = "\\;";
+			break;
+		case ',':
+			escape = "\\,";
+			break;
+		case '\n':
+			escape = "\\n";
+			break;
+		case '\r':
+			escape = "";
+			break;
+		default:
+			run[n++] = *s;
+			if (n < (int) sizeof(run) - 1)
+				continue;
+			break;
+		}
+		run[n] = '\0';
+		put_raw(ical, run);
+		n = 0;
+
+		/* an escape is never split by folding */
+		if (escape && *escape) {
+			if (ical->column + (int) strlen(escape)
+			    > ICAL_LINE_LENGTH) {
+				fputs("\r\n ", ical->out);
+				ical->column = 1;
+			}
+			fputs(escape, ical->out);
+			ical->column += strlen(escape);
+		}
+	}
+	run[n] = '\0';
+	put_raw(ical, run);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    end_line
+ *
+ * Summary:     End a content line
+ *
+ * Parameters:  Writer
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void end_line(pi_ical_t *ical)
+{
+	fputs("\r\n", ical->out);
+	ical->column = 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_line
+ *
+ * Summary:     Write a whole content line whose value needs no escaping
+ *
+ * Parameters:  Writer, name, value
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_line(pi_ical_t *ical, const char *name, const char *value)
+{
+	put_raw(ical, name);
+	put_raw(ical, value);
+	end_line(ical);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_text_line
+ *
+ * Summary:     Write a content line with a TEXT value, unless the text
+ *		is missing or empty
+ *
+ * Parameters:  Writer, name with its colon, text
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_text_line(pi_ical_t *ical, const char *name, const char *text)
+{
+	if (text == NULL || *text == '\0')
+		return;
+	put_raw(ical, name);
+	put_text(ical, text);
+	end_line(ical);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    format_date
+ *
+ * Summary:     Format a DATE or DATE-TIME value
+ *
+ * Parameters:  Buffer of ICAL_DATE_SIZE bytes, date, time of day in
+ *		minutes or -1 for a DATE
+ *
+ * Returns:     The buffer
+ *
+ ***********************************************************************/
+static char *format_date(char *buf, const struct tm *t, int minutes)
+{
+	if (minutes < 0)
+		sprintf(buf, "%04d%02d%02d", t->tm_year + 1900, t->tm_mon + 1,
+			t->tm_mday);
+	else
+		sprintf(buf, "%04d%02d%02dT%02d%02d00", t->tm_year + 1900,
+			t->tm_mon + 1, t->tm_mday, minutes / 60, minutes % 60);
+	return buf;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    day_of_week
+ *
+ * Summary:     Day of the week of a date, whether or not tm_wday has
+ *		been filled in
+ *
+ * Parameters:  Date
+ *
+ * Returns:     0 for Sunday to 6 for Saturday
+ *
+ ***********************************************************************/
+static int day_of_week(const struct tm *t)
+{
+	static const int offset[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+	int 	y = t->tm_year + 1900 - (t->tm_mon < 2);
+
+	return (y + y / 4 - y / 100 + y / 400 + offset[t->tm_mon]
+		+ t->tm_mday) % 7;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    next_day
+ *
+ * Summary:     The date after a date
+ *
+ * Parameters:  Date, next date returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void next_day(const struct tm *t, struct tm *next)
+{
+	static const int length[12] =
+		{ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int 	y = t->tm_year + 1900,
+		leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+
+	*next = *t;
+	if (++next->tm_mday > length[t->tm_mon] + (t->tm_mon == 1 && leap)) {
+		next->tm_mday = 1;
+		if (++next->tm_mon == 12) {
+			next->tm_mon = 0;
+			next->tm_year++;
+		}
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_uid
+ *
+ * Summary:     Write the UID and DTSTAMP of a component
+ *
+ * Parameters:  Writer, record unique ID, kind of record
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_uid(pi_ical_t *ical, recordid_t uid, const char *kind)
+{
+	char 	buf[48];
+
+	sprintf(buf, "%lx.%s@pilot-link", (unsigned long) uid, kind);
+	put_line(ical, "UID:", buf);
+	put_line(ical, "DTSTAMP:", ical->stamp);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_rrule
+ *
+ * Summary:     Write the RRULE and EXDATE of a repeating event
+ *
+ * Parameters:  Writer, event, start time in minutes or -1 for an
+ *		untimed event
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_rrule(pi_ical_t *ical, const ical_event *e, int start)
+{
+	static const char *freq[] = {
+		NULL, "DAILY", "WEEKLY", "MONTHLY", "MONTHLY", "YEARLY"
+	};
+	char 	buf[ICAL_DATE_SIZE];
+	int 	i,
+		days;
+
+	if (e->repeat_type <= repeatNone || e->repeat_type > repeatYearly)
+		return;
+
+	put_raw(ical, "RRULE:FREQ=");
+	put_raw(ical, freq[e->repeat_type]);
+	if (e->repeat_frequency > 1) {
+		sprintf(buf, ";INTERVAL=%d", e->repeat_frequency);
+		put_raw(ical, buf);
+	}
+
+	switch (e->repeat_type) {
+	case repeatWeekly:
+		put_raw(ical, ";BYDAY=");
+		for (i = days = 0; i < 7; i++) {
+			if (!e->repeat_days[i])
+				continue;
+			if (days++)
+				put_raw(ical, ",");
+			put_raw(ical, weekdays[i]);
+		}
+		/* no day at all means the day of the first one */
+		if (days == 0)
+			put_raw(ical, weekdays[day_of_week(e->begin)]);
+		put_raw(ical, ";WKST=");
+		put_raw(ical, weekdays[(e->repeat_weekstart % 7 + 7) % 7]);
+		break;
+	case repeatMonthlyByDay:
+		/* week 4 is the last one, be it the fourth or the fifth */
+		sprintf(buf, ";BYDAY=%d%s",
+			e->repeat_day / 7 == 4 ? -1 : e->repeat_day / 7 + 1,
+			weekdays[e->repeat_day % 7]);
+		put_raw(ical, buf);
+		break;
+	case repeatMonthlyByDate:
+		sprintf(buf, ";BYMONTHDAY=%d", e->begin->tm_mday);
+		put_raw(ical, buf);
+		break;
+	}
+
+	/* the end date is the last day an occurrence may fall on */
+	if (!e->repeat_forever) {
+		put_raw(ical, ";UNTIL=");
+		if (start < 0)
+			put_raw(ical, format_date(buf, e->repeat_end, -1));
+		else
+			put_raw(ical, format_date(buf, e->repeat_end, 23 * 60 + 59));
+	}
+	end_line(ical);
+
+	if (e->exceptions <= 0)
+		return;
+	put_raw(ical, start < 0 ? "EXDATE;VALUE=DATE:" : "EXDATE:");
+	for (i = 0; i < e->exceptions; i++) {
+		if (i)
+			put_raw(ical, ",");
+		put_raw(ical, format_date(buf, &e->exception[i], start));
+	}
+	end_line(ical);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_alarm
+ *
+ * Summary:     Write the VALARM of an event with an alarm
+ *
+ * Parameters:  Writer, event
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_alarm(pi_ical_t *ical, const ical_event *e)
+{
+	char 	buf[32];
+
+	if (!e->alarm)
+		return;
+
+	switch (e->advance_units) {
+	case advMinutes:
+		sprintf(buf, "-PT%dM", e->advance);
+		break;
+	case advHours:
+		sprintf(buf, "-PT%dH", e->advance);
+		break;
+	case advDays:
+		sprintf(buf, "-P%dD", e->advance);
+		break;
+	default:
+		return;
+	}
+
+	put_line(ical, "BEGIN:", "VALARM");
+	put_line(ical, "ACTION:", "DISPLAY");
+	put_line(ical, "TRIGGER:", buf);
+	if (e->description && *e->description)
+		put_text_line(ical, "DESCRIPTION:", e->description);
+	else
+		put_line(ical, "DESCRIPTION:", "Reminder");
+	put_line(ical, "END:", "VALARM");
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_event
+ *
+ * Summary:     Write an appointment or calendar event as a VEVENT
+ *
+ * Parameters:  Writer, record unique ID, record attributes, event
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+static int
+write_event(pi_ical_t *ical, recordid_t uid, int attrs, const ical_event *e)
+{
+	char 	buf[ICAL_DATE_SIZE];
+	int 	start = -1,
+		end;
+
+	put_line(ical, "BEGIN:", "VEVENT");
+	put_uid(ical, uid, e->kind);
+
+	if (e->event) {
+		struct tm next;
+
+		/* an untimed event takes the whole day */
+		put_line(ical, "DTSTART;VALUE=DATE:",
+			format_date(buf, e->begin, -1));
+		next_day(e->begin, &next);
+		put_line(ical, "DTEND;VALUE=DATE:", format_date(buf, &next, -1));
+	} else {
+		start = e->begin->tm_hour * 60 + e->begin->tm_min;
+		end = e->end->tm_hour * 60 + e->end->tm_min;
+		if (end < start)
+			end = start;
+		put_line(ical, "DTSTART:", format_date(buf, e->begin, start));
+		put_line(ical, "DTEND:", format_date(buf, e->begin, end));
+	}
+
+	put_text_line(ical, "SUMMARY:", e->description);
+	put_text_line(ical, "DESCRIPTION:", e->note);
+	put_text_line(ical, "LOCATION:", e->location);
+	if (attrs & dlpRecAttrSecret)
+		put_line(ical, "CLASS:", "PRIVATE");
+	put_rrule(ical, e, start);
+	put_alarm(ical, e);
+	put_line(ical, "END:", "VEVENT");
+
+	return ferror(ical->out) ? PI_ERR_GENERIC_SYSTEM : 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_ical_begin
+ *
+ * Summary:     Start a calendar
+ *
+ * Parameters:  Writer to set up, stream, product identifier
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+int
+pi_ical_begin(pi_ical_t *ical, FILE *out, const char *prodid)
+{
+	time_t 	now = time(NULL);
+
+	ical->out = out;
+	ical->column = 0;
+	strftime(ical->stamp, sizeof(ical->stamp), "%Y%m%dT%H%M%SZ",
+		gmtime(&now));
+
+	put_line(ical, "BEGIN:", "VCALENDAR");
+	put_line(ical, "VERSION:", "2.0");
+	put_line(ical, "PRODID:", prodid);
+	put_line(ical, "CALSCALE:", "GREGORIAN");
+
+	return ferror(out) ? PI_ERR_GENERIC_SYSTEM : 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_ical_end
+ *
+ * Summary:     Finish a calendar and flush the stream
+ *
+ * Parameters:  Writer
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+int
+pi_ical_end(pi_ical_t *ical)
+{
+	put_line(ical, "END:", "VCALENDAR");
+
+	if (fflush(ical->out) != 0 || ferror(ical->out))
+		return PI_ERR_GENERIC_SYSTEM;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_ical_write_appointment
+ *
+ * Summary:     Write an appointment as a VEVENT
+ *
+ * Parameters:  Writer, record unique ID, record attributes, appointment
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+int
+pi_ical_write_appointment(pi_ical_t *ical, recordid_t uid, int attrs,
+	const struct Appointment *a)
+{
+	ical_event e;
+
+	e.kind 			= "datebook";
+	e.event 		= a->event;
+	e.begin 		= &a->begin;
+	e.end 			= &a->end;
+	e.alarm 		= a->alarm;
+	e.advance 		= a->advance;
+	e.advance_units 	= a->advanceUnits;
+	e.repeat_type 		= a->repeatType;
+	e.repeat_forever 	= a->repeatForever;
+	e.repeat_end 		= &a->repeatEnd;
+	e.repeat_frequency 	= a->repeatFrequency;
+	e.repeat_day 		= a->repeatDay;
+	e.repeat_days 		= a->repeatDays;
+	e.repeat_weekstart 	= a->repeatWeekstart;
+	e.exceptions 		= a->exceptions;
+	e.exception 		= a->exception;
+	e.description 		= a->description;
+	e.note 			= a->note;
+	e.location 		= NULL;
+
+	return write_event(ical, uid, attrs, &e);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_ical_write_calendar_event
+ *
+ * Summary:     Write a calendar event as a VEVENT
+ *
+ * Parameters:  Writer, record unique ID, record attributes, event
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+int
+pi_ical_write_calendar_event(pi_ical_t *ical, recordid_t uid, int attrs,
+	const CalendarEvent_t *ce)
+{
+	ical_event e;
+
+	/* the calendar enums list the same values as the datebook ones */
+	e.kind 			= "calendar";
+	e.event 		= ce->event;
+	e.begin 		= &ce->begin;
+	e.end 			= &ce->end;
+	e.alarm 		= ce->alarm;
+	e.advance 		= ce->advance;
+	e.advance_units 	= ce->advanceUnits;
+	e.repeat_type 		= ce->repeatType;
+	e.repeat_forever 	= ce->repeatForever;
+	e.repeat_end 		= &ce->repeatEnd;
+	e.repeat_frequency 	= ce->repeatFrequency;
+	e.repeat_day 		= ce->repeatDay;
+	e.repeat_days 		= ce->repeatDays;
+	e.repeat_weekstart 	= ce->repeatWeekstart;
+	e.exceptions 		= ce->exceptions;
+	e.exception 		= ce->exception;
+	e.description 		= ce->description;
+	e.note 			= ce->note;
+	e.location 		= ce->location;
+
+	return write_event(ical, uid, attrs, &e);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_ical_write_todo
+ *
+ * Summary:     Write a todo as a VTODO
+ *
+ * Parameters:  Writer, record unique ID, record attributes, category
+ *		name or NULL, todo
+ *
+ * Returns:     0, or PI_ERR_GENERIC_SYSTEM if writing failed
+ *
+ ***********************************************************************/
+int
+pi_ical_write_todo(pi_ical_t *ical, recordid_t uid, int attrs,
+	const char *category, const struct ToDo *t)
+{
+	char 	buf[ICAL_DATE_SIZE];
+
+	put_line(ical, "BEGIN:", "VTODO");
+	put_uid(ical, uid, "todo");
+	put_text_line(ical, "SUMMARY:", t->description);
+	put_text_line(ical, "DESCRIPTION:", t->note);
+	if (!t->indefinite)
+		put_line(ical, "DUE;VALUE=DATE:", format_date(buf, &t->due, -1));
+
+	/* priorities 1 to 5 spread over the 1 to 9 of iCalendar */
+	if (t->priority >= 1 && t->priority <= 5) {
+		sprintf(buf, "%d", t->priority * 2 - 1);
+		put_line(ical, "PRIORITY:", buf);
+	}
+	put_line(ical, "STATUS:", t->complete ? "COMPLETED" : "NEEDS-ACTION");
+	put_text_line(ical, "CATEGORIES:", category);
+	if (attrs & dlpRecAttrSecret)
+		put_line(ical, "CLASS:", "PRIVATE");
+	put_line(ical, "END:", "VTODO");
+
+	return ferror(ical->out) ? PI_ERR_GENERIC_SYSTEM : 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
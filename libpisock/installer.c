@@ -0,0 +1,483 @@
+/*
+ * $Id$
+ *
+ * installer.c:  Bulk installation of records into an open database
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-arena.h"
+#include "pi-util.h"
+#include "pi-installer.h"
+
+/* Records packed at a time; two batches are in memory at once */
+#define INSTALL_BATCH		32
+
+typedef struct install_item {
+	void	*item;
+	int	category;
+	int	result;		/* of pack, then of the write */
+	void	*data;		/* packed record, in the batch's arena */
+	size_t	len;
+	uint64_t hash;
+} install_item_t;
+
+typedef struct install_hash {
+	uint64_t hash;
+	int	category;
+} install_hash_t;
+
+struct pi_installer {
+	int	sd;
+	int	db;
+	int	flags;
+	pi_installer_pack_t pack;
+	pi_installer_report_t report;
+	void	*ctx;
+
+	install_item_t *items;
+	size_t	count;
+	size_t	allocated;
+
+	size_t	reported;		/* items whose outcome was reported */
+
+	install_hash_t *existing;	/* sorted hashes of the records on the handheld */
+	size_t	existing_count;
+
+	pi_arena_t *arenas[2];		/* batch k is packed into arenas[k % 2] */
+
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;		/* protects packed, written, stop */
+	pthread_cond_t cond;
+	size_t	packed;			/* batches packed so far */
+	size_t	written;		/* batches written so far */
+	int	stop;			/* the writes gave up */
+#endif
+};
+
+
+/***********************************************************************
+ *
+ * Function:    compare_hashes
+ *
+ * Summary:     qsort() and bsearch() callback ordering install_hash_t
+ *
+ * Parameters:  two install_hash_t
+ *
+ * Returns:     <0, 0 or >0
+ *
+ ***********************************************************************/
+static int
+compare_hashes(const void *a, const void *b)
+{
+	const install_hash_t *x = a,
+		*y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->category - y->category;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    read_existing
+ *
+ * Summary:     Hash the records already in the database. Deleted and
+ *		archived records are left out, as they will be gone
+ *		after the next sync.
+ *
+ * Parameters:  installer
+ *
+ * Returns:     0, or a negative error code if the connection failed
+ *
+ ***********************************************************************/
+static int
+read_existing(pi_installer_t *inst)
+{
+	int	records,
+		i,
+		attr,
+		category,
+		result;
+	pi_buffer_t *buf;
+
+	result = dlp_ReadOpenDBInfo(inst->sd, inst->db, &records);
+	if (result < 0)
+		return result;
+	if (records == 0)
+		return 0;
+
+	inst->existing = malloc(records * sizeof(install_hash_t));
+	buf = pi_buffer_new(0xffff);
+	if (inst->existing == NULL || buf == NULL) {
+		pi_buffer_free(buf);
+		return PI_ERR_GENERIC_MEMORY;
+	}
+
+	for (i = 0; i < records; i++) {
+		result = dlp_ReadRecordByIndex(inst->sd, inst->db, i, buf,
+			NULL, &attr, &category);
+		if (result < 0) {
+			if (!pi_socket_connected(inst->sd))
+				break;
+			continue;
+		}
+		if (attr & (dlpRecAttrDeleted | dlpRecAttrArchived))
+			continue;
+
+		inst->existing[inst->existing_count].hash =
+			pi_hash64(buf->data, buf->used);
+		inst->existing[inst->existing_count].category = category;
+		inst->existing_count++;
+	}
+	pi_buffer_free(buf);
+	if (i < records)
+		return result;
+
+	qsort(inst->existing, inst->existing_count, sizeof(install_hash_t),
+		compare_hashes);
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pack_batch
+ *
+ * Summary:     Pack the items of a batch into its arena
+ *
+ * Parameters:  installer, batch number, scratch buffer
+ *
+ * Returns:     Nothing; the outcome is in each item's result
+ *
+ ***********************************************************************/
+static void
+pack_batch(pi_installer_t *inst, size_t batch, pi_buffer_t *buf)
+{
+	size_t	i,
+		last = (batch + 1) * INSTALL_BATCH;
+	pi_arena_t *arena = inst->arenas[batch % 2];
+	install_item_t *it;
+
+	if (last > inst->count)
+		last = inst->count;
+
+	for (i = batch * INSTALL_BATCH; i < last; i++) {
+		it = &inst->items[i];
+		if (buf == NULL) {
+			it->result = PI_ERR_GENERIC_MEMORY;
+			continue;
+		}
+
+		pi_buffer_clear(buf);
+		it->result = inst->pack(inst->ctx, it->item, buf);
+		if (it->result < 0)
+			continue;
+		if (buf->used == 0) {
+			it->result = PI_ERR_GENERIC_ARGUMENT;
+			continue;
+		}
+
+		it->data = pi_arena_memdup(arena, buf->data, buf->used);
+		if (it->data == NULL) {
+			it->result = PI_ERR_GENERIC_MEMORY;
+			continue;
+		}
+		it->len = buf->used;
+		it->result = PI_INSTALL_WRITTEN;
+		if (inst->existing_count)
+			it->hash = pi_hash64(it->data, it->len);
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_batch
+ *
+ * Summary:     Write the packed records of a batch and report each of
+ *		them
+ *
+ * Parameters:  installer, batch number, counts to update
+ *
+ * Returns:     0, or a negative error code if the connection was lost
+ *
+ ***********************************************************************/
+static int
+write_batch(pi_installer_t *inst, size_t batch, pi_installer_stats_t *stats)
+{
+	size_t	i,
+		last = (batch + 1) * INSTALL_BATCH;
+	install_item_t *it;
+	install_hash_t key;
+	recordid_t id;
+
+	if (last > inst->count)
+		last = inst->count;
+
+	for (i = batch * INSTALL_BATCH; i < last; i++) {
+		it = &inst->items[i];
+		id = 0;
+
+		if (it->result >= 0 && inst->existing_count) {
+			key.hash = it->hash;
+			key.category = it->category;
+			if (bsearch(&key, inst->existing, inst->existing_count,
+					sizeof(install_hash_t),
+					compare_hashes) != NULL)
+				it->result = PI_INSTALL_DUPLICATE;
+		}
+
+		if (it->result == PI_INSTALL_WRITTEN) {
+			it->result = dlp_WriteRecord(inst->sd, inst->db, 0, 0,
+				it->category, it->data, it->len, &id);
+			if (it->result >= 0)
+				it->result = PI_INSTALL_WRITTEN;
+		}
+
+		if (it->result == PI_INSTALL_WRITTEN)
+			stats->written++;
+		else if (it->result == PI_INSTALL_DUPLICATE)
+			stats->duplicates++;
+		else
+			stats->failed++;
+
+		if (inst->report)
+			inst->report(inst->ctx, (int) i, it->item, it->result,
+				id);
+		inst->reported = i + 1;
+
+		if (it->result < 0 && !pi_socket_connected(inst->sd))
+			return it->result;
+	}
+	return 0;
+}
+
+
+#if HAVE_PTHREAD
+/***********************************************************************
+ *
+ * Function:    pack_worker
+ *
+ * Summary:     Thread packing the batches, staying at most one batch
+ *		ahead of the writes
+ *
+ * Parameters:  installer
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+pack_worker(void *arg)
+{
+	pi_installer_t *inst = arg;
+	pi_buffer_t *buf = pi_buffer_new(0xffff);
+	size_t	batch,
+		batches = (inst->count + INSTALL_BATCH - 1) / INSTALL_BATCH;
+	int	stop;
+
+	for (batch = 0; batch < batches; batch++) {
+		pthread_mutex_lock(&inst->lock);
+		while (!inst->stop && batch >= inst->written + 2)
+			pthread_cond_wait(&inst->cond, &inst->lock);
+		stop = inst->stop;
+		pthread_mutex_unlock(&inst->lock);
+		if (stop)
+			break;
+
+		pack_batch(inst, batch, buf);
+
+		pthread_mutex_lock(&inst->lock);
+		inst->packed = batch + 1;
+		pthread_cond_broadcast(&inst->cond);
+		pthread_mutex_unlock(&inst->lock);
+	}
+
+	pi_buffer_free(buf);
+	return NULL;
+}
+#endif
+
+
+pi_installer_t *
+pi_installer_new(int sd, int db, int flags, pi_installer_pack_t pack,
+	pi_installer_report_t report, void *ctx)
+{
+	pi_installer_t *inst;
+
+	inst = (pi_installer_t *) calloc(1, sizeof(pi_installer_t));
+	if (inst == NULL)
+		return NULL;
+
+	inst->sd 	= sd;
+	inst->db 	= db;
+	inst->flags 	= flags;
+	inst->pack 	= pack;
+	inst->report 	= report;
+	inst->ctx 	= ctx;
+
+	inst->arenas[0] = pi_arena_new(0);
+	inst->arenas[1] = pi_arena_new(0);
+	if (inst->arenas[0] == NULL || inst->arenas[1] == NULL) {
+		pi_installer_free(inst);
+		return NULL;
+	}
+
+#if HAVE_PTHREAD
+	pthread_mutex_init(&inst->lock, NULL);
+	pthread_cond_init(&inst->cond, NULL);
+#endif
+	return inst;
+}
+
+void
+pi_installer_free(pi_installer_t *inst)
+{
+	if (inst == NULL)
+		return;
+
+#if HAVE_PTHREAD
+	if (inst->arenas[0] != NULL && inst->arenas[1] != NULL) {
+		pthread_mutex_destroy(&inst->lock);
+		pthread_cond_destroy(&inst->cond);
+	}
+#endif
+	pi_arena_free(inst->arenas[0]);
+	pi_arena_free(inst->arenas[1]);
+	free(inst->items);
+	free(inst->existing);
+	free(inst);
+}
+
+int
+pi_installer_add(pi_installer_t *inst, void *item, int category)
+{
+	install_item_t *items;
+	size_t	allocated;
+
+	if (inst->count == inst->allocated) {
+		allocated = inst->allocated ? inst->allocated * 2 : 64;
+		items = realloc(inst->items, allocated * sizeof(install_item_t));
+		if (items == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		inst->items = items;
+		inst->allocated = allocated;
+	}
+
+	memset(&inst->items[inst->count], 0, sizeof(install_item_t));
+	inst->items[inst->count].item = item;
+	inst->items[inst->count].category = category;
+	return (int) inst->count++;
+}
+
+int
+pi_installer_run(pi_installer_t *inst, pi_installer_stats_t *stats)
+{
+	pi_installer_stats_t counts;
+	pi_buffer_t *buf = NULL;
+	size_t	batch,
+		batches = (inst->count + INSTALL_BATCH - 1) / INSTALL_BATCH,
+		i;
+	int	result = 0,
+		threaded = 0;
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+
+	memset(&counts, 0, sizeof(counts));
+	inst->reported = 0;
+
+	if (inst->count && (inst->flags & PI_INSTALL_SKIP_DUPLICATES)
+	    && inst->existing == NULL)
+		result = read_existing(inst);
+
+#if HAVE_PTHREAD
+	inst->packed = 0;
+	inst->written = 0;
+	inst->stop = 0;
+	if (result == 0 && batches > 1
+	    && pthread_create(&thread, NULL, pack_worker, inst) == 0)
+		threaded = 1;
+#endif
+	if (!threaded)
+		buf = pi_buffer_new(0xffff);
+
+	for (batch = 0; result == 0 && batch < batches; batch++) {
+#if HAVE_PTHREAD
+		if (threaded) {
+			pthread_mutex_lock(&inst->lock);
+			while (inst->packed <= batch)
+				pthread_cond_wait(&inst->cond, &inst->lock);
+			pthread_mutex_unlock(&inst->lock);
+		}
+#endif
+		if (!threaded)
+			pack_batch(inst, batch, buf);
+
+		result = write_batch(inst, batch, &counts);
+		pi_arena_reset(inst->arenas[batch % 2]);
+
+#if HAVE_PTHREAD
+		if (threaded) {
+			pthread_mutex_lock(&inst->lock);
+			inst->written = batch + 1;
+			if (result < 0)
+				inst->stop = 1;
+			pthread_cond_broadcast(&inst->cond);
+			pthread_mutex_unlock(&inst->lock);
+		}
+#endif
+	}
+
+#if HAVE_PTHREAD
+	if (threaded)
+		pthread_join(thread, NULL);
+#endif
+	pi_buffer_free(buf);
+
+	/* Report what couldn't be written once the connection failed */
+	for (i = inst->reported; result < 0 && i < inst->count; i++) {
+		counts.failed++;
+		if (inst->report)
+			inst->report(inst->ctx, (int) i, inst->items[i].item,
+				result, 0);
+	}
+
+	inst->count = 0;
+	if (stats)
+		*stats = counts;
+	return result < 0 ? result : counts.written;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
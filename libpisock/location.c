@@ -397,6 +397,17 @@ unpack_Timezone(Timezone_t *tz, const pi_buffer_t *buf) {
  */
 int
 unpack_Timezone_p(Timezone_t *tz, const unsigned char *data, const size_t position) {
+	return unpack_Timezone_p_arena(tz, data, position, NULL);
+}
+/**
+ * unpack_Timezone_p, allocating the name from an arena (NULL to use
+ * malloc).
+ * 
+ * Returns:     -1 on error, number of bytes read on success
+ */
+int
+unpack_Timezone_p_arena(Timezone_t *tz, const unsigned char *data,
+			const size_t position, pi_arena_t *arena) {
 	uint8_t byte;
 	size_t localPosition = position;
   
@@ -464,7 +475,7 @@ unpack_Timezone_p(Timezone_t *tz, const unsigned char *data, const size_t positi
 		tz->name = NULL;
 		++localPosition;
 	} else {
-		tz->name = strdup((char *)(data+localPosition));
+		tz->name = pi_arena_strdup(arena, (char *)(data+localPosition));
 		localPosition += strlen(tz->name) + 1;
 	}
 
@@ -485,10 +496,31 @@ unpack_Timezone_p(Timezone_t *tz, const unsigned char *data, const size_t positi
  ***********************************************************************/
 int
 unpack_Location(Location_t *loc, const pi_buffer_t *buf)
+{
+	return unpack_Location_arena(loc, buf, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_Location_arena
+ *
+ * Summary:     Fill in the location structure based on the raw record 
+ *		data, allocating the strings from an arena
+ *
+ * Parameters:  Location_t*, pi_buffer_t *buf, arena (NULL to use
+ *		malloc)
+ *
+ * Returns:     -1 on error, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Location_arena(Location_t *loc, const pi_buffer_t *buf,
+		      pi_arena_t *arena)
 {
 	size_t localPosition = 0;
   
-	localPosition = unpack_Timezone_p(&(loc->tz), buf->data, localPosition);
+	localPosition = unpack_Timezone_p_arena(&(loc->tz), buf->data,
+		localPosition, arena);
 	if(localPosition < 0) {
 		return -1;
 	}
@@ -549,7 +581,8 @@ unpack_Location(Location_t *loc, const pi_buffer_t *buf)
 		loc->note = NULL;
 		++localPosition;
 	} else {
-		loc->note = strdup((char *)(buf->data+localPosition));
+		loc->note = pi_arena_strdup(arena,
+			(char *)(buf->data+localPosition));
 		localPosition += strlen(loc->note) + 1;
 	}
 
@@ -181,6 +181,26 @@ free_MailSignaturePref(MailSignaturePref_t *pref)
  ***********************************************************************/
 int
 unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
+{
+	return unpack_Mail_arena(mail, buffer, len, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_Mail_arena
+ *
+ * Summary:     unpacks Mail, allocating the strings from an arena
+ *
+ * Parameters:  Mail_t*, char* to buffer, buffer length, arena (NULL to
+ *		allocate the strings with malloc)
+ *
+ * Returns:     effective buffer length
+ *
+ ***********************************************************************/
+int
+unpack_Mail_arena(Mail_t *mail, unsigned char *buffer, size_t len,
+		  pi_arena_t *arena)
 {
 	int 	flags;
 	unsigned long d;
@@ -219,7 +239,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->subject = strdup((char *)buffer);
+		mail->subject = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -229,7 +249,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->from = strdup((char *)buffer);
+		mail->from = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -239,7 +259,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->to = strdup((char *)buffer);
+		mail->to = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -249,7 +269,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->cc = strdup((char *)buffer);
+		mail->cc = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -259,7 +279,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->bcc = strdup((char *)buffer);
+		mail->bcc = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -269,7 +289,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->replyTo = strdup((char *)buffer);
+		mail->replyTo = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -279,7 +299,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->sentTo = strdup((char *)buffer);
+		mail->sentTo = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
@@ -289,7 +309,7 @@ unpack_Mail(Mail_t *mail, unsigned char *buffer, size_t len)
 	if (len < 1)
 		return 0;
 	if (get_byte(buffer)) {
-		mail->body = strdup((char *)buffer);
+		mail->body = pi_arena_strdup(arena, (char *)buffer);
 		buffer += strlen((char *)buffer);
 		len -= strlen((char *)buffer);
 	} else
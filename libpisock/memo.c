@@ -61,13 +61,34 @@ free_Memo(Memo_t *memo)
  ***********************************************************************/
 int
 unpack_Memo(Memo_t *memo, const pi_buffer_t *record, memoType type)
+{
+	return unpack_Memo_arena(memo, record, type, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_Memo_arena
+ *
+ * Summary:     Unpack the memo structure from the buffer, allocating the
+ *		text from an arena
+ *
+ * Parameters:  Memo_t*, pi_buffer_t * of record, memo type, arena (NULL to
+ *		allocate the text with malloc)
+ *
+ * Returns:     -1 on error, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Memo_arena(Memo_t *memo, const pi_buffer_t *record, memoType type,
+		  pi_arena_t *arena)
 {
 	if (type != memo_v1)
 		/* Don't support anything else yet */
 		return -1;
 	if (record == NULL || record->data == NULL || record->used < 1)
 		return -1;
-	memo->text = strdup((char *) record->data);
+	memo->text = pi_arena_strdup(arena, (char *) record->data);
 	return 0;
 }
 
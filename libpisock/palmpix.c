@@ -66,6 +66,19 @@
 #include "pi-macros.h"
 #include "pi-palmpix.h"
 
+/* SSE2 is part of every x86-64 processor and NEON of every AArch64 one,
+   so the vector kernels are chosen when compiling. PALMPIX_SCALAR in the
+   state's flags selects the portable code at run time. */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define PALMPIX_VECTOR 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define PALMPIX_VECTOR 1
+#else
+# define PALMPIX_VECTOR 0
+#endif
+
 #define max(a,b) (( a > b ) ? a : b )
 #define min(a,b) (( a < b ) ? a : b )
 
@@ -1122,22 +1135,101 @@ static void Bias( double bias, int width, int height, uint8_t *data )
 {
    int i;
    double num, denom, t;
-      
-   fprintf( stderr, "Bias factor : %lf\n", bias );
-   
-   for( i=0; i<width*height; i++ )
+   uint8_t lut[256];
+
+   /* The curve only depends on the pixel value, so work it out once for
+      each of the 256 values instead of for every pixel */
+   for( i=0; i<256; i++ )
      {
-	t = (double)data[i]/256.0;
+	t = (double)i/256.0;
 	num = t;
 	denom = (1.0/bias - 2) * (1.0 - t) + 1;
-	data[i] = num/denom * 256.0;     
+	lut[i] = num/denom * 256.0;
      }
+
+   for( i=0; i<width*height; i++ )
+     data[i] = lut[data[i]];
+}
+
+#if PALMPIX_VECTOR
+/***********************************************************************
+ * Minimum and sum of a colour plane, 16 pixels at a time. The sum is
+ * exact, unlike the running float sum of the portable code.
+ ***********************************************************************/
+static void PlaneStats( const uint8_t *p, int n, uint8_t *minp, uint32_t *sump )
+{
+	uint8_t lanes[16], m = 255;
+	uint32_t sum = 0;
+	int i = 0, k;
+
+#if defined(__SSE2__)
+	__m128i vmin = _mm_set1_epi8( (char)0xff ), vsum = _mm_setzero_si128();
+
+	for( ; i + 16 <= n; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)(p + i) );
+
+		vmin = _mm_min_epu8( vmin, v );
+		vsum = _mm_add_epi64( vsum, _mm_sad_epu8( v, _mm_setzero_si128() ));
+	}
+	_mm_storeu_si128( (__m128i *)lanes, vmin );
+	sum = (uint32_t)_mm_cvtsi128_si32( vsum )
+		+ (uint32_t)_mm_cvtsi128_si32( _mm_srli_si128( vsum, 8 ));
+#else
+	uint8x16_t vmin = vdupq_n_u8( 255 );
+	uint32x4_t vsum = vdupq_n_u32( 0 );
+	uint32_t sums[4];
+
+	for( ; i + 16 <= n; i += 16 )
+	{
+		uint8x16_t v = vld1q_u8( p + i );
+
+		vmin = vminq_u8( vmin, v );
+		vsum = vpadalq_u16( vsum, vpaddlq_u8( v ));
+	}
+	vst1q_u8( lanes, vmin );
+	vst1q_u32( sums, vsum );
+	sum = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+
+	if( i > 0 )
+		for( k=0; k<16; k++ )
+			m = min( m, lanes[k] );
+
+	for( ; i<n; i++ )
+	{
+		m = min( m, p[i] );
+		sum += p[i];
+	}
+
+	*minp = m;
+	*sump = sum;
+}
+
+/***********************************************************************
+ * The mean of a plane as the portable code works it out. Adding up the
+ * pixels in a float is exact as long as the sum stays below 2^24, beyond
+ * that the same float additions are done again to round the same way.
+ ***********************************************************************/
+static float PlaneMean( const uint8_t *p, int n, uint32_t sum )
+{
+	float mean = 0;
+	int i;
+
+	if( sum < (1UL << 24) )
+		mean = sum;
+	else
+		for( i=0; i<n; i++ )
+			mean += p[i];
+
+	return mean;
 }
+#endif
 
 /***********************************************************************
  * Odd green rows and even green rows have a different histogram
  ***********************************************************************/
-int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b)
+static int ColourCorrectPlanes (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b, int vector)
 {
 	/* uint8_t *tmpRow; */
 	uint8_t gbMin, gbMax, grMin, grMax, rMin, rMax, bMin, bMax;
@@ -1155,7 +1247,24 @@ int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr,
  
 	gbMin = grMin = rMin = bMin = 255;
 	gbMax = grMax = rMax = bMax = 0;
-		
+
+#if PALMPIX_VECTOR
+	if( vector )
+	{
+		uint32_t rSum, grSum, gbSum, bSum;
+
+		PlaneStats( r, width * height, &rMin, &rSum );
+		PlaneStats( gr, width * height, &grMin, &grSum );
+		PlaneStats( gb, width * height, &gbMin, &gbSum );
+		PlaneStats( b, width * height, &bMin, &bSum );
+
+		rMean = PlaneMean( r, width * height, rSum );
+		grMean = PlaneMean( gr, width * height, grSum );
+		gbMean = PlaneMean( gb, width * height, gbSum );
+		bMean = PlaneMean( b, width * height, bSum );
+	}
+	else
+#endif
 	for( i=0; i<width*height; i ++ )
 	{
 		gbMin = min( gbMin, gb[i] );
@@ -1253,6 +1362,11 @@ int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr,
 	return( 1 );
 }
 
+int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b)
+{
+	return ColourCorrectPlanes( picHdr, r, gr, gb, b, PALMPIX_VECTOR );
+}
+
 int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b )
 {
 	/* uint8_t *tmpRow; */
@@ -1489,6 +1603,219 @@ static void Interpolate( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8
    
 }
 
+#if PALMPIX_VECTOR
+/*****************************************************************************
+ * The vector interpolation works on one output row at a time. It fills
+ * planar red, green and blue rows with the same sums as Interpolate, 8 raw
+ * pixels (16 output pixels) at a time in 16 bit lanes, and then interleaves
+ * them into the pixmap. Sums are shifted down exactly as in Interpolate, so
+ * the pixmaps are identical.
+ *****************************************************************************/
+#if defined(__SSE2__)
+typedef __m128i pixvec_t;
+# define PV_LOAD(p)	_mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(p) ), _mm_setzero_si128() )
+# define PV_ADD(a,b)	_mm_add_epi16( a, b )
+# define PV_SHR(a,n)	_mm_srli_epi16( a, n )
+# define PV_SHL(a,n)	_mm_slli_epi16( a, n )
+# define PV_STORE2(p,e,o) \
+	_mm_storeu_si128( (__m128i *)(p), _mm_packus_epi16( _mm_unpacklo_epi16( e, o ), _mm_unpackhi_epi16( e, o )))
+#else
+typedef uint16x8_t pixvec_t;
+# define PV_LOAD(p)	vmovl_u8( vld1_u8( p ))
+# define PV_ADD(a,b)	vaddq_u16( a, b )
+# define PV_SHR(a,n)	vshrq_n_u16( a, n )
+# define PV_SHL(a,n)	vshlq_n_u16( a, n )
+# define PV_STORE2(p,e,o) \
+	do { uint8x8x2_t eo_; eo_.val[0] = vmovn_u16( e ); eo_.val[1] = vmovn_u16( o ); vst2_u8( p, eo_ ); } while (0)
+#endif
+
+/* Interpolate raw pixels x0 up to x1 of one output row into the planar
+   rows. The channel pointers point at the raw row of the output row. */
+static void InterpolateRow( const uint8_t *red, const uint8_t *greenR, const uint8_t *greenB, const uint8_t *blue, int rawWidth, int odd, uint8_t *rp, uint8_t *gp, uint8_t *bp, int x0, int x1 )
+{
+   int x = x0, w = rawWidth;
+
+   if( odd )
+     {
+	for( ; x + 8 <= x1; x += 8 )
+	  {
+	     pixvec_t r0 = PV_LOAD( red + x ), rw0 = PV_LOAD( red + w + x );
+	     pixvec_t gr0 = PV_LOAD( greenR + x ), grw0 = PV_LOAD( greenR + w + x );
+	     pixvec_t gb0 = PV_LOAD( greenB + x ), b0 = PV_LOAD( blue + x );
+	     pixvec_t e, o;
+
+	     e = PV_SHR( PV_ADD( PV_ADD( PV_LOAD( red + x - 1 ), r0 ), PV_ADD( PV_LOAD( red + w + x - 1 ), rw0 )), 2 );
+	     o = PV_SHR( PV_ADD( r0, rw0 ), 1 );
+	     PV_STORE2( rp + 2 * x, e, o );
+
+	     e = PV_SHR( PV_ADD( PV_ADD( gr0, grw0 ), PV_ADD( PV_LOAD( greenB + x - 1 ), gb0 )), 2 );
+	     o = PV_SHR( PV_ADD( PV_ADD( PV_SHL( gb0, 2 ), PV_ADD( gr0, PV_LOAD( greenR + x + 1 ))),
+				 PV_ADD( grw0, PV_LOAD( greenR + w + x + 1 ))), 3 );
+	     PV_STORE2( gp + 2 * x, e, o );
+
+	     o = PV_SHR( PV_ADD( b0, PV_LOAD( blue + x + 1 )), 1 );
+	     PV_STORE2( bp + 2 * x, b0, o );
+	  }
+	for( ; x < x1; x++ )
+	  {
+	     rp[2*x] = (red[x-1] + red[x] + red[w+x-1] + red[w+x])>>2;
+	     gp[2*x] = (greenR[x] + greenR[x+w] + greenB[x-1] + greenB[x])>>2;
+	     bp[2*x] = blue[x];
+	     rp[2*x+1] = (red[x] + red[w+x])>>1;
+	     gp[2*x+1] = ((greenB[x] << 2) + greenR[x] + greenR[x+1] + greenR[x+w] + greenR[x+w+1])>>3;
+	     bp[2*x+1] = (blue[x] + blue[x+1])>>1;
+	  }
+     }
+   else
+     {
+	for( ; x + 8 <= x1; x += 8 )
+	  {
+	     pixvec_t r0 = PV_LOAD( red + x ), gr0 = PV_LOAD( greenR + x );
+	     pixvec_t gbu0 = PV_LOAD( greenB - w + x ), gb0 = PV_LOAD( greenB + x );
+	     pixvec_t bu0 = PV_LOAD( blue - w + x ), b0 = PV_LOAD( blue + x );
+	     pixvec_t e, o;
+
+	     e = PV_SHR( PV_ADD( PV_LOAD( red + x - 1 ), r0 ), 1 );
+	     PV_STORE2( rp + 2 * x, e, r0 );
+
+	     e = PV_SHR( PV_ADD( PV_ADD( PV_SHL( gr0, 2 ), PV_ADD( PV_LOAD( greenB - w + x - 1 ), gbu0 )),
+				 PV_ADD( PV_LOAD( greenB + x - 1 ), gb0 )), 3 );
+	     o = PV_SHR( PV_ADD( PV_ADD( gr0, PV_LOAD( greenR + x + 1 )), PV_ADD( gbu0, gb0 )), 2 );
+	     PV_STORE2( gp + 2 * x, e, o );
+
+	     e = PV_SHR( PV_ADD( bu0, b0 ), 1 );
+	     o = PV_SHR( PV_ADD( PV_ADD( bu0, PV_LOAD( blue - w + x - 1 )), PV_ADD( b0, PV_LOAD( blue + x + 1 ))), 2 );
+	     PV_STORE2( bp + 2 * x, e, o );
+	  }
+	for( ; x < x1; x++ )
+	  {
+	     rp[2*x] = (red[x-1] + red[x])>>1;
+	     gp[2*x] = ((greenR[x] << 2) + greenB[x-w-1] + greenB[x-w] + greenB[x-1] + greenB[x])>>3;
+	     bp[2*x] = (blue[x-w] + blue[x])>>1;
+	     rp[2*x+1] = red[x];
+	     gp[2*x+1] = (greenR[x] + greenR[x+1] + greenB[x-w] + greenB[x])>>2;
+	     bp[2*x+1] = (blue[x-w] + blue[x-w-1] + blue[x] + blue[x+1])>>2;
+	  }
+     }
+}
+
+/* Interleave n pixels of the planar rows into the pixmap. The planes are
+   put in pixmap order first, so the vector code only has one order to
+   handle. */
+static void InterleaveRow( const uint8_t *rp, const uint8_t *gp, const uint8_t *bp, int n, uint8_t *out, int offset_r, int offset_g, int offset_b )
+{
+   const uint8_t *plane[3] = { NULL, NULL, NULL };
+   const uint8_t *p0, *p1, *p2;
+   int x = 0;
+
+   if( offset_r < 0 || offset_r > 2 || offset_g < 0 || offset_g > 2
+       || offset_b < 0 || offset_b > 2 )
+     return;
+   plane[offset_r] = rp;
+   plane[offset_g] = gp;
+   plane[offset_b] = bp;
+   if( plane[0] == NULL || plane[1] == NULL || plane[2] == NULL )
+     {
+	/* Not a permutation, write the colours in the order Interpolate does */
+	for( ; x<n; x++, out += 3 )
+	  {
+	     out[offset_r] = rp[x];
+	     out[offset_g] = gp[x];
+	     out[offset_b] = bp[x];
+	  }
+	return;
+     }
+   p0 = plane[0];
+   p1 = plane[1];
+   p2 = plane[2];
+
+#if defined(__SSE2__)
+     {
+	/* Widen 16 pixels to 32 bits each, then squeeze out every fourth
+	   byte. Each 16 byte store writes 4 bytes beyond its 12 pixel
+	   bytes, which the next store or the last two pixels overwrite. */
+	const __m128i low3 = _mm_set_epi32( 0, 0xffffff, 0, 0xffffff );
+	const __m128i next3 = _mm_set_epi32( 0xffff, (int)0xff000000, 0xffff, (int)0xff000000 );
+	const __m128i low8 = _mm_set_epi32( 0, 0, -1, -1 );
+
+	for( ; x + 18 <= n; x += 16, out += 48 )
+	  {
+	     __m128i a = _mm_loadu_si128( (const __m128i *)(p0 + x) );
+	     __m128i b = _mm_loadu_si128( (const __m128i *)(p1 + x) );
+	     __m128i c = _mm_loadu_si128( (const __m128i *)(p2 + x) );
+	     __m128i ab, c0, q[4];
+	     int k;
+
+	     ab = _mm_unpacklo_epi8( a, b );
+	     c0 = _mm_unpacklo_epi8( c, _mm_setzero_si128() );
+	     q[0] = _mm_unpacklo_epi16( ab, c0 );
+	     q[1] = _mm_unpackhi_epi16( ab, c0 );
+	     ab = _mm_unpackhi_epi8( a, b );
+	     c0 = _mm_unpackhi_epi8( c, _mm_setzero_si128() );
+	     q[2] = _mm_unpacklo_epi16( ab, c0 );
+	     q[3] = _mm_unpackhi_epi16( ab, c0 );
+
+	     for( k=0; k<4; k++ )
+	       {
+		  __m128i v = q[k];
+
+		  v = _mm_or_si128( _mm_and_si128( v, low3 ),
+				    _mm_and_si128( _mm_srli_epi64( v, 8 ), next3 ));
+		  v = _mm_or_si128( _mm_and_si128( v, low8 ),
+				    _mm_srli_si128( _mm_andnot_si128( low8, v ), 2 ));
+		  _mm_storeu_si128( (__m128i *)(out + 12 * k), v );
+	       }
+	  }
+     }
+#else
+   for( ; x + 8 <= n; x += 8, out += 24 )
+     {
+	uint8x8x3_t v;
+
+	v.val[0] = vld1_u8( p0 + x );
+	v.val[1] = vld1_u8( p1 + x );
+	v.val[2] = vld1_u8( p2 + x );
+	vst3_u8( out, v );
+     }
+#endif
+
+   for( ; x<n; x++, out += 3 )
+     {
+	out[0] = p0[x];
+	out[1] = p1[x];
+	out[2] = p2[x];
+     }
+}
+
+static int InterpolateVector( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8_t *greenR, uint8_t *greenB, uint8_t *blue, uint8_t *pp, int offset_r, int offset_g, int offset_b )
+{
+   int rawWidth = pixHdr->w/2;
+   int y, offset;
+   uint8_t *planes, *rp, *gp, *bp;
+
+   planes = malloc( 3 * (size_t)pixHdr->w );
+   if( planes == NULL )
+     return 0;
+   rp = planes;
+   gp = rp + pixHdr->w;
+   bp = gp + pixHdr->w;
+
+   for( y=1; y<pixHdr->h-1; y++ )
+     {
+	offset = (y/2) * rawWidth;
+
+	InterpolateRow( red + offset, greenR + offset, greenB + offset, blue + offset,
+			rawWidth, y%2, rp, gp, bp, 1, rawWidth-1 );
+
+	InterleaveRow( rp + 2, gp + 2, bp + 2, 2*rawWidth-4,
+		       pp + 3 * (y * pixHdr->w + 2), offset_r, offset_g, offset_b );
+     }
+
+   free( planes );
+   return 1;
+}
+#endif
+
 void DecodeRow( uint8_t *compData, uint8_t *lastRow, uint8_t *unCompData, uint32_t *offset, int32_t *firstWord, uint16_t *PPLutsW, uint8_t *PPLuts, uint16_t halfWidth )
 {
    uint8_t *saveStartP, shiftOut;
@@ -1690,6 +2017,7 @@ int unpack_PalmPix (struct PalmPixState *s,
 	int chansize_max = 0;
 	int recno = header_recno;
 	int failed = 1;
+	int vector = PALMPIX_VECTOR && !(s->flags & PALMPIX_SCALAR);
 	int k;
 	
 	for (k = 0; k < 4; k++)
@@ -1714,7 +2042,8 @@ int unpack_PalmPix (struct PalmPixState *s,
 	if (raw == NULL)
 	  goto failed;
 	
-	s->pixmap = malloc ((size_t)(h->w * h->h * 3));
+	/* Cleared, as the outermost pixels are not interpolated */
+	s->pixmap = calloc ((size_t)(h->w * h->h), 3);
 	if (s->pixmap == NULL)
 	  goto failed;
 	
@@ -1761,8 +2090,8 @@ int unpack_PalmPix (struct PalmPixState *s,
 	  }
 
 	if( s->flags & PALMPIX_COLOUR_CORRECTION )
-		  ColourCorrect ( h, chan[pixChannelR], chan[pixChannelGR], 
-				  chan[pixChannelGB], chan[pixChannelB] ); 
+		  ColourCorrectPlanes ( h, chan[pixChannelR], chan[pixChannelGR], 
+				  chan[pixChannelGB], chan[pixChannelB], vector ); 
 
 	if( s->bias != 50 ) 
     {
@@ -1776,6 +2105,17 @@ int unpack_PalmPix (struct PalmPixState *s,
 		  Histogram ( h, chan[pixChannelR], chan[pixChannelGR], 
 				  chan[pixChannelGB], chan[pixChannelB] ); 
 
+#if PALMPIX_VECTOR
+	if (vector) 
+	  {
+	     if (!InterpolateVector (h,
+			  chan[pixChannelR], chan[pixChannelGR],
+			  chan[pixChannelGB], chan[pixChannelB],
+			  s->pixmap, s->offset_r, s->offset_g, s->offset_b))
+	       goto failed;
+	  }
+	else
+#endif
 	Interpolate (h,
 		     chan[pixChannelR], chan[pixChannelGR],
 		     chan[pixChannelGB], chan[pixChannelB],
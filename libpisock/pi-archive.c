@@ -0,0 +1,501 @@
+/*
+ * $Id$
+ *
+ * pi-archive.c:  Single-file container for a device backup set
+ *
+ * Copyright (c) 2026, pilot-link developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-archive.h"
+#include "pi-error.h"
+
+#define pi_mktag(c1,c2,c3,c4) (((c1)<<24)|((c2)<<16)|((c3)<<8)|(c4))
+
+#define PI_ARCHIVE_MAGIC	pi_mktag('P','L','A','R')
+#define PI_ARCHIVE_IDX_MAGIC	pi_mktag('P','L','I','X')
+#define PI_ARCHIVE_HDR_SIZE	8
+#define PI_ARCHIVE_ENT_SIZE	64
+#define PI_ARCHIVE_TRL_SIZE	16
+
+struct pi_archive {
+	FILE	*f;
+	char	*file_name;
+	int	for_writing;
+	int	dirty;			/* index must be rewritten on close */
+	int	num_entries;
+	int	num_entries_allocated;
+	unsigned long end;		/* where the next image will go */
+	pi_archive_entry_t *entries;	/* sorted by name */
+};
+
+/* Local prototypes */
+static int pi_archive_read_index(pi_archive_t *ar, long file_size);
+static int pi_archive_write_index(pi_archive_t *ar);
+static int pi_archive_lookup(const pi_archive_t *ar, const char *name,
+	int *position);
+static void pi_archive_free(pi_archive_t *ar);
+
+
+static pi_archive_t *
+pi_archive_new(const char *name, int for_writing)
+{
+	pi_archive_t *ar;
+
+	if ((ar = calloc(1, sizeof(pi_archive_t))) == NULL)
+		return NULL;
+
+	if ((ar->file_name = strdup(name)) == NULL) {
+		free(ar);
+		return NULL;
+	}
+	ar->for_writing = for_writing;
+
+	return ar;
+}
+
+static int
+pi_archive_write_header(pi_archive_t *ar)
+{
+	unsigned char buf[PI_ARCHIVE_HDR_SIZE];
+
+	set_long(buf, PI_ARCHIVE_MAGIC);
+	set_short(buf + 4, PI_ARCHIVE_VERSION);
+	set_short(buf + 6, 0);
+
+	if (fwrite(buf, PI_ARCHIVE_HDR_SIZE, 1, ar->f) != 1)
+		return PI_ERR_FILE_ERROR;
+
+	ar->end = PI_ARCHIVE_HDR_SIZE;
+	ar->dirty = 1;
+	return 0;
+}
+
+pi_archive_t *
+pi_archive_create(const char *name)
+{
+	pi_archive_t *ar;
+
+	if ((ar = pi_archive_new(name, 1)) == NULL)
+		return NULL;
+
+	if ((ar->f = fopen(name, "w+b")) == NULL
+	    || pi_archive_write_header(ar) < 0) {
+		pi_archive_free(ar);
+		return NULL;
+	}
+
+	return ar;
+}
+
+pi_archive_t *
+pi_archive_open(const char *name, int for_writing)
+{
+	long	file_size;
+	pi_archive_t *ar;
+
+	if ((ar = pi_archive_new(name, for_writing)) == NULL)
+		return NULL;
+
+	ar->f = fopen(name, for_writing ? "r+b" : "rb");
+	if (ar->f == NULL) {
+		pi_archive_free(ar);
+		if (for_writing && errno == ENOENT)
+			return pi_archive_create(name);
+		return NULL;
+	}
+
+	fseek(ar->f, 0, SEEK_END);
+	file_size = ftell(ar->f);
+
+	if (file_size == 0 && for_writing) {
+		if (pi_archive_write_header(ar) < 0)
+			goto bad;
+		return ar;
+	}
+
+	if (pi_archive_read_index(ar, file_size) < 0)
+		goto bad;
+
+	/* Never overwrite anything, not even the old index: if we get
+	   interrupted before the new index is written, the previous
+	   state of the archive can still be recovered */
+	ar->end = file_size;
+
+	return ar;
+
+bad:
+	LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+	    "ARCHIVE OPEN %s: not a valid archive\n", name));
+	pi_archive_free(ar);
+	return NULL;
+}
+
+int
+pi_archive_close(pi_archive_t *ar)
+{
+	int	result = 0;
+
+	if (ar == NULL)
+		return PI_ERR_FILE_INVALID;
+
+	if (ar->for_writing && ar->dirty)
+		result = pi_archive_write_index(ar);
+
+	if (ar->f != NULL && fclose(ar->f) != 0 && result == 0)
+		result = PI_ERR_FILE_ERROR;
+	ar->f = NULL;
+
+	pi_archive_free(ar);
+	return result;
+}
+
+int
+pi_archive_count(const pi_archive_t *ar)
+{
+	return ar->num_entries;
+}
+
+const pi_archive_entry_t *
+pi_archive_get_entry(const pi_archive_t *ar, int index)
+{
+	if (index < 0 || index >= ar->num_entries)
+		return NULL;
+	return &ar->entries[index];
+}
+
+const pi_archive_entry_t *
+pi_archive_find(const pi_archive_t *ar, const char *name)
+{
+	int	i;
+
+	if (!pi_archive_lookup(ar, name, &i))
+		return NULL;
+	return &ar->entries[i];
+}
+
+pi_file_t *
+pi_archive_open_file(pi_archive_t *ar, const char *name)
+{
+	const pi_archive_entry_t *entry;
+
+	if ((entry = pi_archive_find(ar, name)) == NULL)
+		return NULL;
+
+	/* the image may still sit in our stdio buffer */
+	if (ar->for_writing)
+		fflush(ar->f);
+
+	return pi_file_open_section(ar->file_name, (long) entry->offset,
+		(long) entry->size);
+}
+
+int
+pi_archive_close_file(pi_archive_t *ar, pi_file_t *pf)
+{
+	int	i,
+		result;
+	long	end;
+	size_t	len;
+	pi_archive_entry_t *entry;
+
+	if (!ar->for_writing || !pf->for_writing) {
+		result = PI_ERR_FILE_INVALID;
+		goto done;
+	}
+
+	if (fseek(ar->f, (long) ar->end, SEEK_SET) < 0) {
+		result = PI_ERR_FILE_ERROR;
+		goto done;
+	}
+
+	if ((result = pi_file_write_stream(pf, ar->f)) < 0)
+		goto done;
+
+	if ((end = ftell(ar->f)) < 0) {
+		result = PI_ERR_FILE_ERROR;
+		goto done;
+	}
+
+	if (!pi_archive_lookup(ar, pf->info.name, &i)) {
+		if (ar->num_entries >= ar->num_entries_allocated) {
+			int	count = ar->num_entries_allocated ?
+				ar->num_entries_allocated * 3 / 2 : 64;
+			pi_archive_entry_t *entries = realloc(ar->entries,
+				count * sizeof(pi_archive_entry_t));
+
+			if (entries == NULL) {
+				result = PI_ERR_GENERIC_MEMORY;
+				goto done;
+			}
+			ar->entries = entries;
+			ar->num_entries_allocated = count;
+		}
+		memmove(&ar->entries[i + 1], &ar->entries[i],
+			(ar->num_entries - i) * sizeof(pi_archive_entry_t));
+		ar->num_entries++;
+	}
+
+	entry = &ar->entries[i];
+	memset(entry, 0, sizeof(pi_archive_entry_t));
+	len = strlen(pf->info.name);
+	if (len > sizeof(entry->name) - 1)
+		len = sizeof(entry->name) - 1;
+	memcpy(entry->name, pf->info.name, len);
+	entry->name[len] = '\0';
+	entry->creator		= pf->info.creator;
+	entry->type		= pf->info.type;
+	entry->flags		= pf->info.flags;
+	entry->version		= pf->info.version;
+	entry->offset		= ar->end;
+	entry->size		= end - ar->end;
+	entry->modifyDate	= pf->info.modifyDate;
+	entry->modnum		= pf->info.modnum;
+
+	ar->end = end;
+	ar->dirty = 1;
+
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+	    "ARCHIVE STORE '%s' @%lu size %lu\n", entry->name,
+	    entry->offset, entry->size));
+
+done:
+	/* the image now lives in the archive, never on disk */
+	pi_file_discard(pf);
+	return result;
+}
+
+int
+pi_archive_remove(pi_archive_t *ar, const char *name)
+{
+	int	i;
+
+	if (!ar->for_writing)
+		return PI_ERR_FILE_INVALID;
+
+	if (!pi_archive_lookup(ar, name, &i))
+		return PI_ERR_FILE_NOT_FOUND;
+
+	memmove(&ar->entries[i], &ar->entries[i + 1],
+		(ar->num_entries - i - 1) * sizeof(pi_archive_entry_t));
+	ar->num_entries--;
+	ar->dirty = 1;
+
+	return 0;
+}
+
+/*********************************************************************************/
+/*                                                                               */
+/*              INTERNAL FUNCTIONS                                               */
+/*                                                                               */
+/*********************************************************************************/
+
+/***********************************************************************
+ *
+ * Function:    pi_archive_lookup
+ *
+ * Summary:     Binary search of the sorted index
+ *
+ * Parameters:  archive, database name, position (out)
+ *
+ * Returns:     1 if found (position is the entry index), 0 otherwise
+ *		(position is where the entry should be inserted)
+ *
+ ***********************************************************************/
+static int
+pi_archive_lookup(const pi_archive_t *ar, const char *name, int *position)
+{
+	int	lo = 0,
+		hi = ar->num_entries,
+		mid,
+		cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = strncmp(ar->entries[mid].name, name,
+			sizeof(ar->entries[mid].name));
+		if (cmp == 0) {
+			*position = mid;
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*position = lo;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_archive_read_index
+ *
+ * Summary:     Validate header and trailer and load the central index
+ *
+ * Parameters:  archive, total file size
+ *
+ * Returns:     0 for success, negative otherwise
+ *
+ ***********************************************************************/
+static int
+pi_archive_read_index(pi_archive_t *ar, long file_size)
+{
+	int	i;
+	unsigned long index_offset,
+		count;
+	unsigned char buf[PI_ARCHIVE_ENT_SIZE];
+	pi_archive_entry_t *entry;
+
+	if (file_size < PI_ARCHIVE_HDR_SIZE + PI_ARCHIVE_TRL_SIZE)
+		return PI_ERR_FILE_INVALID;
+
+	fseek(ar->f, 0, SEEK_SET);
+	if (fread(buf, PI_ARCHIVE_HDR_SIZE, 1, ar->f) != 1
+	    || get_long(buf) != PI_ARCHIVE_MAGIC
+	    || get_short(buf + 4) > PI_ARCHIVE_VERSION)
+		return PI_ERR_FILE_INVALID;
+
+	fseek(ar->f, file_size - PI_ARCHIVE_TRL_SIZE, SEEK_SET);
+	if (fread(buf, PI_ARCHIVE_TRL_SIZE, 1, ar->f) != 1
+	    || get_long(buf + 12) != PI_ARCHIVE_IDX_MAGIC)
+		return PI_ERR_FILE_INVALID;
+
+	index_offset	= get_long(buf);
+	count		= get_long(buf + 4);
+
+	if (index_offset < PI_ARCHIVE_HDR_SIZE
+	    || count > (unsigned long) file_size / PI_ARCHIVE_ENT_SIZE
+	    || index_offset + count * PI_ARCHIVE_ENT_SIZE
+	       + PI_ARCHIVE_TRL_SIZE != (unsigned long) file_size)
+		return PI_ERR_FILE_INVALID;
+
+	if (count) {
+		ar->entries = calloc(count, sizeof(pi_archive_entry_t));
+		if (ar->entries == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		ar->num_entries_allocated = count;
+	}
+
+	fseek(ar->f, (long) index_offset, SEEK_SET);
+	for (i = 0, entry = ar->entries; i < (int) count; i++, entry++) {
+		if (fread(buf, PI_ARCHIVE_ENT_SIZE, 1, ar->f) != 1)
+			return PI_ERR_FILE_ERROR;
+
+		memcpy(entry->name, buf, 32);
+		entry->name[31]		= '\0';
+		entry->creator		= get_long(buf + 32);
+		entry->type		= get_long(buf + 36);
+		entry->flags		= get_short(buf + 40);
+		entry->version		= get_short(buf + 42);
+		entry->offset		= get_long(buf + 44);
+		entry->size		= get_long(buf + 48);
+		entry->modifyDate	= pilot_time_to_unix_time(get_long(buf + 52));
+		entry->modnum		= get_long(buf + 56);
+
+		if (entry->offset < PI_ARCHIVE_HDR_SIZE
+		    || entry->offset + entry->size > index_offset) {
+			LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+			    "ARCHIVE OPEN entry %d '%s' corrupt\n",
+			    i, entry->name));
+			return PI_ERR_FILE_INVALID;
+		}
+
+		/* the index is written sorted, but don't trust it */
+		if (i > 0 && strncmp(entry[-1].name, entry->name, 32) >= 0)
+			return PI_ERR_FILE_INVALID;
+	}
+	ar->num_entries = count;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_archive_write_index
+ *
+ * Summary:     Append the central index and trailer after the last image
+ *
+ * Parameters:  archive
+ *
+ * Returns:     0 for success, negative otherwise
+ *
+ ***********************************************************************/
+static int
+pi_archive_write_index(pi_archive_t *ar)
+{
+	int	i;
+	unsigned char buf[PI_ARCHIVE_ENT_SIZE];
+	pi_archive_entry_t *entry;
+
+	if (fseek(ar->f, (long) ar->end, SEEK_SET) < 0)
+		return PI_ERR_FILE_ERROR;
+
+	for (i = 0, entry = ar->entries; i < ar->num_entries; i++, entry++) {
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, entry->name, 32);
+		set_long(buf + 32, entry->creator);
+		set_long(buf + 36, entry->type);
+		set_short(buf + 40, entry->flags);
+		set_short(buf + 42, entry->version);
+		set_long(buf + 44, entry->offset);
+		set_long(buf + 48, entry->size);
+		set_long(buf + 52, unix_time_to_pilot_time(entry->modifyDate));
+		set_long(buf + 56, entry->modnum);
+
+		if (fwrite(buf, PI_ARCHIVE_ENT_SIZE, 1, ar->f) != 1)
+			return PI_ERR_FILE_ERROR;
+	}
+
+	memset(buf, 0, PI_ARCHIVE_TRL_SIZE);
+	set_long(buf, ar->end);
+	set_long(buf + 4, ar->num_entries);
+	set_long(buf + 12, PI_ARCHIVE_IDX_MAGIC);
+	if (fwrite(buf, PI_ARCHIVE_TRL_SIZE, 1, ar->f) != 1)
+		return PI_ERR_FILE_ERROR;
+
+	if (fflush(ar->f) != 0 || ferror(ar->f))
+		return PI_ERR_FILE_ERROR;
+
+	ar->dirty = 0;
+	return 0;
+}
+
+static void
+pi_archive_free(pi_archive_t *ar)
+{
+	if (ar->f != NULL)
+		fclose(ar->f);
+	if (ar->entries != NULL)
+		free(ar->entries);
+	if (ar->file_name != NULL)
+		free(ar->file_name);
+	free(ar);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
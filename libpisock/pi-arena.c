@@ -0,0 +1,194 @@
+/*
+ * $Id$
+ *
+ * pi-arena.c:  region allocator for unpacked records
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-arena.h"
+
+#define ARENA_CHUNK_SIZE	8192
+
+/* Allocations are aligned for the most demanding of these */
+typedef union {
+	long	l;
+	double	d;
+	void	*p;
+} arena_align_t;
+
+#define ARENA_ALIGN		sizeof(arena_align_t)
+#define ARENA_ROUND(n)		(((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t	size;
+	arena_align_t data[1];
+} arena_chunk_t;
+
+#define CHUNK_HEADER		offsetof(arena_chunk_t, data)
+
+struct pi_arena {
+	arena_chunk_t *chunks;	/* Most recent first */
+	size_t	chunk_size,
+		used;		/* Bytes used in the most recent chunk */
+	int	borrow;		/* Strings are not copied */
+};
+
+pi_arena_t *
+pi_arena_new(size_t chunk_size)
+{
+	pi_arena_t *arena;
+
+	arena = (pi_arena_t *) malloc(sizeof(pi_arena_t));
+	if (arena == NULL)
+		return NULL;
+
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size ? ARENA_ROUND(chunk_size)
+		: ARENA_CHUNK_SIZE;
+	arena->used = 0;
+	arena->borrow = 0;
+
+	return arena;
+}
+
+pi_arena_t *
+pi_arena_new_borrowing(size_t chunk_size)
+{
+	pi_arena_t *arena = pi_arena_new(chunk_size);
+
+	if (arena != NULL)
+		arena->borrow = 1;
+
+	return arena;
+}
+
+void
+pi_arena_reset(pi_arena_t *arena)
+{
+	arena_chunk_t *chunk,
+		*next,
+		*keep = NULL;
+	size_t	total = 0;
+
+	if (arena->chunks == NULL)
+		return;
+
+	/* Keep one chunk as big as all of them together, so whatever was
+	   allocated since the last reset fits in it next time. Without the
+	   memory for it, keep the largest. */
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		total += chunk->size;
+		if (keep == NULL || chunk->size > keep->size)
+			keep = chunk;
+	}
+	if (total > keep->size) {
+		chunk = (arena_chunk_t *) malloc(CHUNK_HEADER + total);
+		if (chunk != NULL) {
+			chunk->size = total;
+			keep = chunk;
+		}
+	}
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		if (chunk != keep)
+			free(chunk);
+	}
+	keep->next = NULL;
+	arena->chunks = keep;
+	arena->used = 0;
+}
+
+void
+pi_arena_free(pi_arena_t *arena)
+{
+	arena_chunk_t *chunk,
+		*next;
+
+	if (arena == NULL)
+		return;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+void *
+pi_arena_alloc(pi_arena_t *arena, size_t size)
+{
+	void	*p;
+	size_t	chunk_size;
+	arena_chunk_t *chunk;
+
+	if (arena == NULL)
+		return malloc(size ? size : 1);
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - arena->used < size) {
+		chunk_size = size > arena->chunk_size ? size
+			: arena->chunk_size;
+		chunk = (arena_chunk_t *) malloc(CHUNK_HEADER + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = chunk_size;
+
+		if (arena->chunks != NULL
+		    && chunk_size - size < arena->chunks->size - arena->used) {
+			/* An oversized block: keep filling the current chunk */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+			return chunk->data;
+		}
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->used = 0;
+	}
+
+	p = (char *) chunk->data + arena->used;
+	arena->used += size;
+
+	return p;
+}
+
+void *
+pi_arena_memdup(pi_arena_t *arena, const void *data, size_t size)
+{
+	void	*p = pi_arena_alloc(arena, size);
+
+	if (p != NULL)
+		memcpy(p, data, size);
+
+	return p;
+}
+
+char *
+pi_arena_strdup(pi_arena_t *arena, const char *s)
+{
+	if (arena != NULL && arena->borrow)
+		return (char *) s;
+
+	return (char *) pi_arena_memdup(arena, s, strlen(s) + 1);
+}
@@ -0,0 +1,554 @@
+/*
+ * $Id$
+ *
+ * pi-diff.c:  Record and resource level comparison of databases
+ *
+ * Copyright (c) 2026, pilot-link developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-diff.h"
+#include "pi-util.h"
+#include "pi-error.h"
+
+#define PI_DIFF_MAGIC	"PILOT-DIFF"
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_key
+ *
+ * Summary:     Hash table key of a record (UID) or resource (type, ID)
+ *
+ * Parameters:  resource flag, item
+ *
+ * Returns:     Key hash
+ *
+ ***********************************************************************/
+static unsigned long
+pi_diff_key(int resource_flag, const pi_diff_item_t *item)
+{
+	unsigned long key;
+
+	if (resource_flag)
+		key = item->type ^ ((unsigned long) item->resource_id << 7);
+	else
+		key = item->uid;
+
+	/* Fibonacci hashing spreads the sequential UIDs Palm OS hands out */
+	return (key * 2654435761UL) & 0xffffffffUL;
+}
+
+static int
+pi_diff_same_key(int resource_flag, const pi_diff_item_t *a,
+	const pi_diff_item_t *b)
+{
+	if (resource_flag)
+		return a->type == b->type && a->resource_id == b->resource_id;
+	return a->uid == b->uid;
+}
+
+static pi_diff_t *
+pi_diff_new(int resource_flag)
+{
+	pi_diff_t *diff;
+
+	if ((diff = calloc(1, sizeof(pi_diff_t))) == NULL)
+		return NULL;
+	diff->resource_flag = resource_flag;
+	return diff;
+}
+
+static void
+pi_diff_set_name(pi_diff_t *diff, const char *name)
+{
+	size_t	len = strlen(name);
+
+	if (len > sizeof(diff->name) - 1)
+		len = sizeof(diff->name) - 1;
+	memcpy(diff->name, name, len);
+	diff->name[len] = '\0';
+}
+
+static pi_diff_entry_t *
+pi_diff_append(pi_diff_t *diff, int change)
+{
+	pi_diff_entry_t *entp;
+
+	if (diff->num_entries == diff->num_entries_allocated) {
+		int	count = diff->num_entries_allocated
+				? diff->num_entries_allocated * 2 : 64;
+
+		entp = realloc(diff->entries, count * sizeof(pi_diff_entry_t));
+		if (entp == NULL)
+			return NULL;
+		diff->entries = entp;
+		diff->num_entries_allocated = count;
+	}
+
+	entp = &diff->entries[diff->num_entries++];
+	memset(entp, 0, sizeof(pi_diff_entry_t));
+	entp->change = change;
+	entp->old_index = -1;
+	entp->new_index = -1;
+
+	switch (change) {
+	case PI_DIFF_ADDED:
+		diff->added++;
+		break;
+	case PI_DIFF_REMOVED:
+		diff->removed++;
+		break;
+	case PI_DIFF_MODIFIED:
+		diff->modified++;
+		break;
+	case PI_DIFF_ATTRIBUTES:
+		diff->attributes++;
+		break;
+	}
+
+	return entp;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_items
+ *
+ * Summary:     Compare two lists of record or resource summaries
+ *
+ * Parameters:  resource flag, old items and count, new items and count
+ *
+ * Returns:     New diff or NULL if out of memory
+ *
+ ***********************************************************************/
+pi_diff_t *
+pi_diff_items(int resource_flag, const pi_diff_item_t *from, int from_count,
+	const pi_diff_item_t *to, int to_count)
+{
+	int	i,
+		j,
+		*table = NULL;
+	unsigned long mask;
+	unsigned char *matched = NULL;
+	pi_diff_t *diff;
+	pi_diff_entry_t *entp;
+
+	if ((diff = pi_diff_new(resource_flag)) == NULL)
+		return NULL;
+
+	/* Open addressing table of the old items, at most half full. Slots
+	   hold the item index plus one, zero meaning empty. */
+	for (mask = 16; mask < (unsigned long) from_count * 2; mask <<= 1)
+		;
+	table = calloc(mask, sizeof(int));
+	matched = calloc((size_t) from_count + 1, 1);
+	if (table == NULL || matched == NULL)
+		goto fail;
+	mask--;
+
+	for (i = 0; i < from_count; i++) {
+		unsigned long slot = pi_diff_key(resource_flag, &from[i]) & mask;
+
+		while (table[slot])
+			slot = (slot + 1) & mask;
+		table[slot] = i + 1;
+	}
+
+	for (j = 0; j < to_count; j++) {
+		const pi_diff_item_t *old = NULL,
+			*new = &to[j];
+		unsigned long slot = pi_diff_key(resource_flag, new) & mask;
+
+		for (; table[slot]; slot = (slot + 1) & mask) {
+			i = table[slot] - 1;
+			if (!matched[i]
+			    && pi_diff_same_key(resource_flag, &from[i], new)) {
+				old = &from[i];
+				break;
+			}
+		}
+
+		if (old == NULL) {
+			if ((entp = pi_diff_append(diff, PI_DIFF_ADDED)) == NULL)
+				goto fail;
+		} else {
+			matched[i] = 1;
+			if (old->size != new->size || old->hash != new->hash)
+				entp = pi_diff_append(diff, PI_DIFF_MODIFIED);
+			else if (old->attrs != new->attrs)
+				entp = pi_diff_append(diff, PI_DIFF_ATTRIBUTES);
+			else
+				continue;
+			if (entp == NULL)
+				goto fail;
+
+			entp->old_index	= i;
+			entp->old_attrs	= old->attrs;
+			entp->old_size	= old->size;
+			entp->old_hash	= old->hash;
+		}
+
+		entp->uid		= new->uid;
+		entp->type		= new->type;
+		entp->resource_id	= new->resource_id;
+		entp->new_index		= j;
+		entp->new_attrs		= new->attrs;
+		entp->new_size		= new->size;
+		entp->new_hash		= new->hash;
+	}
+
+	for (i = 0; i < from_count; i++) {
+		if (matched[i])
+			continue;
+		if ((entp = pi_diff_append(diff, PI_DIFF_REMOVED)) == NULL)
+			goto fail;
+		entp->uid		= from[i].uid;
+		entp->type		= from[i].type;
+		entp->resource_id	= from[i].resource_id;
+		entp->old_index		= i;
+		entp->old_attrs		= from[i].attrs;
+		entp->old_size		= from[i].size;
+		entp->old_hash		= from[i].hash;
+	}
+
+	free(table);
+	free(matched);
+
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+	    "DIFF %d added, %d removed, %d modified, %d attributes\n",
+	    diff->added, diff->removed, diff->modified, diff->attributes));
+
+	return diff;
+
+fail:
+	free(table);
+	free(matched);
+	pi_diff_free(diff);
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_file_items
+ *
+ * Summary:     Summarize every record or resource of an open file
+ *
+ * Parameters:  file, receives items and count
+ *
+ * Returns:     Error code
+ *
+ ***********************************************************************/
+int
+pi_diff_file_items(pi_file_t *pf, pi_diff_item_t **items, int *count)
+{
+	int	i,
+		result,
+		attrs,
+		category,
+		entries;
+	void	*buf;
+	size_t	size;
+	pi_diff_item_t *list;
+
+	*items = NULL;
+	*count = 0;
+
+	pi_file_get_entries(pf, &entries);
+	if ((list = calloc((size_t) entries + 1, sizeof(pi_diff_item_t))) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	for (i = 0; i < entries; i++) {
+		if (pf->resource_flag) {
+			result = pi_file_read_resource(pf, i, &buf, &size,
+				&list[i].type, &list[i].resource_id);
+		} else {
+			result = pi_file_read_record(pf, i, &buf, &size,
+				&attrs, &category, &list[i].uid);
+			list[i].attrs = attrs | category;
+		}
+		if (result < 0) {
+			free(list);
+			return result;
+		}
+		list[i].size = size;
+		list[i].hash = pi_hash64(buf, size);
+	}
+
+	*items = list;
+	*count = entries;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_files
+ *
+ * Summary:     Compare two versions of a database
+ *
+ * Parameters:  old file, new file
+ *
+ * Returns:     New diff or NULL
+ *
+ ***********************************************************************/
+pi_diff_t *
+pi_diff_files(pi_file_t *from, pi_file_t *to)
+{
+	int	from_count,
+		to_count;
+	void	*from_block,
+		*to_block;
+	size_t	from_size,
+		to_size;
+	pi_diff_item_t *from_items = NULL,
+		*to_items = NULL;
+	pi_diff_t *diff = NULL;
+
+	if (from->resource_flag != to->resource_flag) {
+		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+		    "DIFF Can't compare a resource and a record database\n"));
+		return NULL;
+	}
+
+	if (pi_diff_file_items(from, &from_items, &from_count) < 0
+	    || pi_diff_file_items(to, &to_items, &to_count) < 0)
+		goto done;
+
+	diff = pi_diff_items(to->resource_flag, from_items, from_count,
+		to_items, to_count);
+	if (diff == NULL)
+		goto done;
+
+	pi_diff_set_name(diff, to->info.name);
+
+	pi_file_get_app_info(from, &from_block, &from_size);
+	pi_file_get_app_info(to, &to_block, &to_size);
+	diff->old_app_info_hash = pi_hash64(from_block, from_size);
+	diff->new_app_info_hash = pi_hash64(to_block, to_size);
+	diff->app_info_changed = from_size != to_size
+		|| diff->old_app_info_hash != diff->new_app_info_hash;
+
+	pi_file_get_sort_info(from, &from_block, &from_size);
+	pi_file_get_sort_info(to, &to_block, &to_size);
+	diff->old_sort_info_hash = pi_hash64(from_block, from_size);
+	diff->new_sort_info_hash = pi_hash64(to_block, to_size);
+	diff->sort_info_changed = from_size != to_size
+		|| diff->old_sort_info_hash != diff->new_sort_info_hash;
+
+done:
+	free(from_items);
+	free(to_items);
+	return diff;
+}
+
+void
+pi_diff_free(pi_diff_t *diff)
+{
+	if (diff == NULL)
+		return;
+	free(diff->entries);
+	free(diff);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_write
+ *
+ * Summary:     Write a diff as a text patch
+ *
+ * Parameters:  diff, stream
+ *
+ * Returns:     Error code
+ *
+ ***********************************************************************/
+int
+pi_diff_write(const pi_diff_t *diff, FILE *f)
+{
+	int	i;
+	char	key[32];
+	static const char ops[] = " +-MA";
+	const pi_diff_entry_t *entp;
+
+	fprintf(f, "%s %d\n", PI_DIFF_MAGIC, PI_DIFF_VERSION);
+	fprintf(f, "db\t%s\t%d\n", diff->name, diff->resource_flag ? 1 : 0);
+	fprintf(f, "appinfo\t%d\t%016llx\t%016llx\n",
+		diff->app_info_changed ? 1 : 0,
+		(unsigned long long) diff->old_app_info_hash,
+		(unsigned long long) diff->new_app_info_hash);
+	fprintf(f, "sortinfo\t%d\t%016llx\t%016llx\n",
+		diff->sort_info_changed ? 1 : 0,
+		(unsigned long long) diff->old_sort_info_hash,
+		(unsigned long long) diff->new_sort_info_hash);
+
+	for (i = 0; i < diff->num_entries; i++) {
+		entp = &diff->entries[i];
+
+		if (diff->resource_flag)
+			sprintf(key, "%08lx:%d", entp->type & 0xffffffffUL,
+				entp->resource_id);
+		else
+			sprintf(key, "%lu", (unsigned long) entp->uid);
+
+		fprintf(f, "%c\t%s\t%d\t%d\t%lu\t%lu\t%016llx\t%016llx\n",
+			ops[entp->change], key,
+			entp->old_attrs, entp->new_attrs,
+			(unsigned long) entp->old_size,
+			(unsigned long) entp->new_size,
+			(unsigned long long) entp->old_hash,
+			(unsigned long long) entp->new_hash);
+	}
+
+	fprintf(f, "end\t%d\n", diff->num_entries);
+
+	return ferror(f) ? PI_ERR_FILE_ERROR : 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_diff_read
+ *
+ * Summary:     Parse a text patch written by pi_diff_write()
+ *
+ * Parameters:  stream
+ *
+ * Returns:     New diff or NULL
+ *
+ ***********************************************************************/
+pi_diff_t *
+pi_diff_read(FILE *f)
+{
+	int	version,
+		count,
+		flag;
+	char	line[256],
+		*tab;
+	unsigned long long old_hash,
+		new_hash;
+	pi_diff_t *diff;
+	pi_diff_entry_t *entp;
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, PI_DIFF_MAGIC " %d", &version) != 1
+	    || version != PI_DIFF_VERSION)
+		return NULL;
+
+	/* the database name may contain anything but a tab */
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strncmp(line, "db\t", 3) != 0
+	    || (tab = strrchr(line, '\t')) == line + 2)
+		return NULL;
+	*tab++ = '\0';
+
+	if ((diff = pi_diff_new(atoi(tab))) == NULL)
+		return NULL;
+	pi_diff_set_name(diff, line + 3);
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, "appinfo\t%d\t%llx\t%llx", &flag,
+		    &old_hash, &new_hash) != 3)
+		goto fail;
+	diff->app_info_changed = flag;
+	diff->old_app_info_hash = old_hash;
+	diff->new_app_info_hash = new_hash;
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, "sortinfo\t%d\t%llx\t%llx", &flag,
+		    &old_hash, &new_hash) != 3)
+		goto fail;
+	diff->sort_info_changed = flag;
+	diff->old_sort_info_hash = old_hash;
+	diff->new_sort_info_hash = new_hash;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		int	change,
+			old_attrs,
+			new_attrs,
+			resource_id = 0;
+		char	key[32];
+		unsigned long type = 0,
+			old_size,
+			new_size;
+		recordid_t uid = 0;
+
+		if (sscanf(line, "end\t%d", &count) == 1) {
+			if (count != diff->num_entries)
+				goto fail;
+			return diff;
+		}
+
+		switch (line[0]) {
+		case '+':
+			change = PI_DIFF_ADDED;
+			break;
+		case '-':
+			change = PI_DIFF_REMOVED;
+			break;
+		case 'M':
+			change = PI_DIFF_MODIFIED;
+			break;
+		case 'A':
+			change = PI_DIFF_ATTRIBUTES;
+			break;
+		default:
+			goto fail;
+		}
+
+		if (sscanf(line + 1, "\t%31s\t%d\t%d\t%lu\t%lu\t%llx\t%llx",
+			   key, &old_attrs, &new_attrs, &old_size, &new_size,
+			   &old_hash, &new_hash) != 7)
+			goto fail;
+
+		if (diff->resource_flag) {
+			if (sscanf(key, "%lx:%d", &type, &resource_id) != 2)
+				goto fail;
+		} else {
+			uid = strtoul(key, NULL, 10);
+		}
+
+		if ((entp = pi_diff_append(diff, change)) == NULL)
+			goto fail;
+		entp->uid		= uid;
+		entp->type		= type;
+		entp->resource_id	= resource_id;
+		entp->old_attrs		= old_attrs;
+		entp->new_attrs		= new_attrs;
+		entp->old_size		= old_size;
+		entp->new_size		= new_size;
+		entp->old_hash		= old_hash;
+		entp->new_hash		= new_hash;
+	}
+
+	/* truncated patch */
+fail:
+	pi_diff_free(diff);
+	return NULL;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
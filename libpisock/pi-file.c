@@ -29,16 +29,25 @@
  * along with this library; if not, write to the Free Software Foundation,
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
 
 #include "pi-debug.h"
 #include "pi-source.h"
 #include "pi-file.h"
+#include "pi-diff.h"
+#include "pi-util.h"
 #include "pi-error.h"
 
 #undef FILEDEBUG
@@ -100,7 +109,16 @@ static int pi_file_close_for_write(pi_file_t *pf);
 static void pi_file_free(pi_file_t *pf);
 static int pi_file_find_resource_by_type_id(const pi_file_t *pf, unsigned long restype, int resid, int *resindex);
 static pi_file_entry_t *pi_file_append_entry(pi_file_t *pf);
+static int pi_file_find_uid(pi_file_t *pf, recordid_t uid);
+static void pi_file_add_uid(pi_file_t *pf, recordid_t uid);
 static int pi_file_set_rbuf_size(pi_file_t *pf, size_t size);
+static int pi_file_map(pi_file_t *pf);
+static int pi_file_device_ids(int socket, int db, recordid_t **uids,
+	int *count);
+static int pi_file_device_items(int socket, int db, pi_diff_item_t **items,
+	int *count);
+static int pi_file_diff_applies(int socket, int db, const pi_diff_t *diff,
+	int old_count);
 
 /* this seems to work, but what about leap years? */
 /*#define PILOT_TIME_DELTA (((unsigned)(1970 - 1904) * 365 * 24 * 60 * 60) + 1450800)*/
@@ -141,6 +159,28 @@ unix_time_to_pilot_time(time_t t)
 
 pi_file_t
 *pi_file_open(const char *name)
+{
+	return pi_file_open_section(name, 0, -1);
+}
+
+pi_file_t
+*pi_file_open_mapped(const char *name)
+{
+	pi_file_t *pf;
+
+	if ((pf = pi_file_open_section(name, 0, -1)) == NULL)
+		return NULL;
+
+	if (pi_file_map(pf) < 0) {
+		pi_file_close(pf);
+		return NULL;
+	}
+
+	return pf;
+}
+
+pi_file_t
+*pi_file_open_section(const char *name, long start, long length)
 {
 	int 	i,
 		file_size;
@@ -153,6 +193,9 @@ pi_file_t
 	unsigned char *p;
 	off_t offset, app_info_offset = 0, sort_info_offset = 0;
 
+	if (start < 0)
+		return NULL;
+
 	if ((pf = calloc(1, sizeof (pi_file_t))) == NULL)
 		return NULL;
 
@@ -161,7 +204,20 @@ pi_file_t
 
 	fseek(pf->f, 0, SEEK_END);
 	file_size = ftell(pf->f);
-	fseek(pf->f, 0, SEEK_SET);
+
+	/* All offsets stored in the image are relative to its first
+	   byte; a section is validated against its own length and the
+	   offsets are rebased once everything checks out. */
+	if (length < 0)
+		length = file_size - start;
+	if (start + length > file_size) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+		     "FILE OPEN %s: section @%ld+%ld past end of file\n",
+		     name, start, length));
+		goto bad;
+	}
+	file_size = length;
+	fseek(pf->f, start, SEEK_SET);
 
 	if (fread(buf, PI_HDR_SIZE, 1, pf->f) != (size_t) 1) {
 		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
@@ -308,13 +364,16 @@ pi_file_t
 		goto bad;
 	}
 
+	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++)
+		entp->offset += start;
+
 	if (pf->app_info_size == 0)
 		pf->app_info = NULL;
 	else {
 		if ((pf->app_info =
 			malloc((size_t) pf->app_info_size)) == NULL)
 			goto bad;
-		fseek(pf->f, (long)app_info_offset, SEEK_SET);
+		fseek(pf->f, (long)app_info_offset + start, SEEK_SET);
 		if (fread(pf->app_info, 1, (size_t) pf->app_info_size, pf->f)
 			 != (size_t) pf->app_info_size)
 			goto bad;
@@ -326,7 +385,7 @@ pi_file_t
 		if ((pf->sort_info = malloc((size_t)pf->sort_info_size))
 			 == NULL)
 			goto bad;
-		fseek(pf->f, (long)sort_info_offset, SEEK_SET);
+		fseek(pf->f, (long)sort_info_offset + start, SEEK_SET);
 		if (fread(pf->sort_info, 1, (size_t) pf->sort_info_size,
 			 pf->f) != (size_t) pf->sort_info_size)
 			goto bad;
@@ -357,6 +416,13 @@ pi_file_close(pi_file_t *pf)
 	return err;
 }
 
+void
+pi_file_discard(pi_file_t *pf)
+{
+	if (pf)
+		pi_file_free(pf);
+}
+
 void
 pi_file_get_info(const pi_file_t *pf, struct DBInfo *infop)
 {
@@ -415,7 +481,9 @@ pi_file_read_resource(pi_file_t *pf, int i,
 
 	entp = &pf->entries[i];
 
-	if (bufp) {
+	if (bufp && pf->map) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0)
 			return result;
 		fseek(pf->f, pf->entries[i].offset, SEEK_SET);
@@ -451,7 +519,9 @@ pi_file_read_record(pi_file_t *pf, int recindex,
 
 	entp = &pf->entries[recindex];
 
-	if (bufp) {
+	if (bufp && pf->map) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0) {
 			LOG((PI_DBG_API, PI_DBG_LVL_ERR,
 			    "FILE READ_RECORD Unable to set buffer size!\n"));
@@ -654,8 +724,14 @@ pi_file_append_record(pi_file_t *pf, void *data, size_t size,
 
 	if (!pf->for_writing || pf->resource_flag)
 		return PI_ERR_FILE_INVALID;
-	if (recuid && pi_file_id_used(pf, recuid))
-		return PI_ERR_FILE_ALREADY_EXISTS;
+	if (recuid) {
+		int used = pi_file_find_uid(pf, recuid);
+
+		if (used < 0)
+			return used;
+		if (used)
+			return PI_ERR_FILE_ALREADY_EXISTS;
+	}
 
 	entp = pi_file_append_entry(pf);
 	if (entp == NULL)
@@ -669,6 +745,8 @@ pi_file_append_record(pi_file_t *pf, void *data, size_t size,
 	entp->size 	= size;
 	entp->attrs 	= (recattrs & 0xf0) | (category & 0xf);
 	entp->uid 	= recuid;
+	if (recuid)
+		pi_file_add_uid(pf, recuid);
 
 	return size;
 }
@@ -1250,12 +1328,417 @@ fail:
 	return result;
 }
 
+int
+pi_file_install_delta(pi_file_t *pf, int socket, int cardno,
+	const pi_diff_t *diff, progress_func report_progress)
+{
+	int 	db = -1,
+		j,
+		reset 	= 0,
+		version,
+		result,
+		device_count = 0,
+		local_count = 0;
+	void 	*buffer;
+	size_t	size;
+	struct DBInfo device_info;
+	pi_buffer_t *appblock = NULL;
+	pi_diff_item_t *device_items = NULL,
+		*local_items = NULL;
+	pi_diff_t *computed = NULL;
+	pi_progress_t progress;
+
+	if (pf->info.flags & dlpDBFlagResource)
+		return pi_file_install(pf, socket, cardno, report_progress);
+
+	if (dlp_OpenDB(socket, cardno, dlpOpenReadWrite | dlpOpenSecret,
+			pf->info.name, &db) < 0)
+		return pi_file_install(pf, socket, cardno, report_progress);
+
+	/* A database of another application that happens to have the same
+	   name is replaced, not patched */
+	if (dlp_FindDBByOpenHandle(socket, db, NULL, NULL, &device_info,
+			NULL) < 0
+	    || (device_info.flags & dlpDBFlagResource)
+	    || device_info.creator != pf->info.creator
+	    || device_info.type != pf->info.type) {
+		dlp_CloseDB(socket, db);
+		return pi_file_install(pf, socket, cardno, report_progress);
+	}
+
+	version = pi_version(socket);
+
+	if (diff != NULL && diff->resource_flag) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_ARGUMENT);
+		goto fail;
+	}
+
+	/* A diff made against another state of the handheld database is
+	   no use: compare with what is there instead */
+	if (diff != NULL
+	    && (result = pi_file_diff_applies(socket, db, diff,
+			pf->num_entries - diff->added + diff->removed)) <= 0) {
+		if (result < 0)
+			goto read_failed;
+		LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+		    "FILE INSTALL_DELTA %s: diff doesn't match the handheld\n",
+		    pf->info.name));
+		diff = NULL;
+	}
+
+	/* Find out what differs between the handheld and the local file */
+	if (diff == NULL) {
+		if ((result = pi_file_device_items(socket, db, &device_items,
+				&device_count)) < 0)
+			goto read_failed;
+		if ((result = pi_diff_file_items(pf, &local_items,
+				&local_count)) < 0)
+			goto fail;
+		for (j = 0; j < local_count; j++)
+			local_items[j].attrs &= ~dlpRecAttrBusy;
+
+		computed = pi_diff_items(0, device_items, device_count,
+			local_items, local_count);
+		if (computed == NULL) {
+			result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+			goto fail;
+		}
+		diff = computed;
+	}
+
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+	    "FILE INSTALL_DELTA Name: %s %d added, %d removed, %d modified, "
+	    "%d attributes\n", pf->info.name, diff->added, diff->removed,
+	    diff->modified, diff->attributes));
+
+	memset(&progress, 0, sizeof(progress));
+	progress.type = PI_PROGRESS_SEND_DB;
+	progress.data.db.pf = pf;
+	progress.data.db.size.numRecords = diff->num_entries;
+	progress.data.db.size.appBlockSize = pf->app_info_size;
+	progress.data.db.size.maxRecSize = pi_maxrecsize(socket);
+
+	/* Upload the appInfo block only if it isn't what is already there.
+	   An empty local block removes the one on the handheld. */
+	pi_file_get_app_info(pf, &buffer, &size);
+	if ((appblock = pi_buffer_new(size + 1)) == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+	if (dlp_ReadAppBlock(socket, db, 0, -1, appblock) < 0)
+		pi_buffer_clear(appblock);
+	if (appblock->used != size
+	    || (size > 0 && memcmp(appblock->data, buffer, size) != 0)) {
+		if ((result = dlp_WriteAppBlock(socket, db, buffer, size)) < 0)
+			goto fail;
+		progress.transferred_bytes += size;
+	}
+
+	for (j = 0; j < diff->num_entries; j++) {
+		const pi_diff_entry_t *entp = &diff->entries[j];
+		int 	attr,
+			category;
+		recordid_t uid;
+
+		if (entp->change == PI_DIFF_REMOVED) {
+			result = dlp_DeleteRecord(socket, db, 0, entp->uid);
+			/* it may have been purged since it was listed */
+			if (result < 0 && (result != PI_ERR_DLP_PALMOS
+			    || pi_palmos_error(socket) != dlpErrNotFound))
+				goto fail;
+			continue;
+		}
+
+		if (entp->new_index >= 0)
+			result = pi_file_read_record(pf, entp->new_index,
+				&buffer, &size, &attr, &category, &uid);
+		else
+			result = pi_file_read_record_by_id(pf, entp->uid,
+				&buffer, &size, NULL, &attr, &category);
+		if (result < 0)
+			goto fail;
+
+		if (size > 65536 && version < 0x0104) {
+			LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+				"FILE INSTALL_DELTA Record over 64K!\n"));
+			result = pi_set_error(socket, PI_ERR_DLP_DATASIZE);
+			goto fail;
+		}
+
+		/* Old OS version cannot install deleted records, so
+		   don't even try */
+		if ((attr & (dlpRecAttrArchived | dlpRecAttrDeleted))
+		    && version < 0x0101)
+			continue;
+
+		if ((result = dlp_WriteRecord(socket, db, attr, entp->uid,
+				category, buffer, size, 0)) < 0)
+			goto fail;
+
+		progress.transferred_bytes += size;
+		progress.data.db.transferred_records++;
+
+		if (report_progress && report_progress(socket,
+				&progress) == PI_TRANSFER_STOP) {
+			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+			goto fail;
+		}
+	}
+
+	/* Give the database the header of the file, as pi_file_install()
+	   would. The modification number can't be set over DLP. */
+	result = dlp_SetDBInfo(socket, db,
+		pf->info.flags & ~(dlpDBFlagResource | dlpDBFlagOpen),
+		device_info.flags & ~pf->info.flags
+			& ~(dlpDBFlagResource | dlpDBFlagOpen),
+		pf->info.version, pf->info.createDate, pf->info.modifyDate,
+		pf->info.backupDate, pf->info.type, pf->info.creator);
+	if (result < 0 && result != PI_ERR_DLP_UNSUPPORTED)
+		goto fail;
+
+	if (pf->info.creator == pi_mktag('p', 't', 'c', 'h')
+	    || (pf->info.flags & dlpDBFlagReset))
+		reset = 1;
+
+	if (appblock)
+		pi_buffer_free(appblock);
+	pi_diff_free(computed);
+	free(device_items);
+	free(local_items);
+
+	if (reset)
+		dlp_ResetSystem(socket);
+
+	return dlp_CloseDB(socket, db);
+
+fail:
+	if (appblock)
+		pi_buffer_free(appblock);
+	pi_diff_free(computed);
+	free(device_items);
+	free(local_items);
+
+	if (pi_socket_connected(socket)) {
+		int err1 = pi_error(socket);
+		int err2 = pi_palmos_error(socket);
+
+		dlp_CloseDB(socket, db);
+
+		pi_set_error(socket, err1);
+		pi_set_palmos_error(socket, err2);
+	}
+	if (result >= 0)
+		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
+	return result;
+
+read_failed:
+	/* The handheld couldn't tell what it holds, but still answers:
+	   send the whole file instead */
+	if (!IS_DLP_ERR(result))
+		goto fail;
+	LOG((PI_DBG_API, PI_DBG_LVL_WARN,
+	    "FILE INSTALL_DELTA %s: can't read the handheld database, "
+	    "installing it whole\n", pf->info.name));
+	pi_diff_free(computed);
+	free(device_items);
+	dlp_CloseDB(socket, db);
+	return pi_file_install(pf, socket, cardno, report_progress);
+}
+
 /*********************************************************************************/
 /*                                                                               */
 /*              INTERNAL FUNCTIONS                                               */
 /*                                                                               */
 /*********************************************************************************/
 
+/***********************************************************************
+ *
+ * Function:    pi_file_device_ids
+ *
+ * Summary:     Get the unique IDs of every record of an open database
+ *		on the handheld
+ *
+ * Parameters:  socket, database handle, receives a malloc()'ed array
+ *		of IDs and their count
+ *
+ * Returns:     Error code
+ *
+ ***********************************************************************/
+static int
+pi_file_device_ids(int socket, int db, recordid_t **uids, int *count)
+{
+	int	i,
+		result,
+		numrecs,
+		chunk;
+	recordid_t *list;
+
+	*uids = NULL;
+	*count = 0;
+
+	if ((result = dlp_ReadOpenDBInfo(socket, db, &numrecs)) < 0)
+		return result;
+
+	list = malloc(((size_t) numrecs + 1) * sizeof(recordid_t));
+	if (list == NULL)
+		return pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+
+	/* the record ID list comes back in slices that fit in a packet */
+	for (i = 0; i < numrecs; i += chunk) {
+		if ((result = dlp_ReadRecordIDList(socket, db, 0, i,
+				numrecs - i > 500 ? 500 : numrecs - i,
+				list + i, &chunk)) < 0) {
+			free(list);
+			return result;
+		}
+		if (chunk == 0)
+			break;
+	}
+
+	*uids = list;
+	*count = i < numrecs ? i : numrecs;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_device_items
+ *
+ * Summary:     Summarize every record of an open database on the
+ *		handheld, for comparison with pi_diff_items(). Records
+ *		deleted but not purged yet, or gone since their ID was
+ *		listed, are summarized as deleted and empty, so a record
+ *		of the file with the same ID is written again and any
+ *		other is removed.
+ *
+ * Parameters:  socket, database handle, receives items and count
+ *
+ * Returns:     Error code
+ *
+ ***********************************************************************/
+static int
+pi_file_device_items(int socket, int db, pi_diff_item_t **items, int *count)
+{
+	int	i,
+		result,
+		numrecs,
+		attr,
+		category;
+	recordid_t *uids = NULL;
+	pi_buffer_t *buffer = NULL;
+	pi_diff_item_t *list = NULL;
+
+	*items = NULL;
+	*count = 0;
+
+	if ((result = pi_file_device_ids(socket, db, &uids, &numrecs)) < 0)
+		return result;
+
+	list = calloc((size_t) numrecs + 1, sizeof(pi_diff_item_t));
+	buffer = pi_buffer_new(0xffff);
+	if (list == NULL || buffer == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+
+	for (i = 0; i < numrecs; i++) {
+		list[i].uid = uids[i];
+
+		result = dlp_ReadRecordById(socket, db, uids[i], buffer,
+			NULL, &attr, &category);
+		if (result < 0) {
+			if (result != PI_ERR_DLP_PALMOS
+			    || (pi_palmos_error(socket) != dlpErrNotFound
+				&& pi_palmos_error(socket) != dlpErrDeleted))
+				goto fail;
+			attr = dlpRecAttrDeleted;
+		}
+
+		if (attr & dlpRecAttrDeleted) {
+			list[i].attrs = dlpRecAttrDeleted;
+			continue;
+		}
+		list[i].attrs = (attr & 0xf0 & ~dlpRecAttrBusy) | category;
+		list[i].size = buffer->used;
+		list[i].hash = pi_hash64(buffer->data, buffer->used);
+	}
+
+	free(uids);
+	pi_buffer_free(buffer);
+	*items = list;
+	*count = numrecs;
+	return 0;
+
+fail:
+	free(uids);
+	free(list);
+	if (buffer)
+		pi_buffer_free(buffer);
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_compare_ids
+ *
+ * Summary:     qsort() and bsearch() comparison of record IDs
+ *
+ * Parameters:  two record IDs
+ *
+ * Returns:     Negative, 0 or positive
+ *
+ ***********************************************************************/
+static int
+pi_file_compare_ids(const void *a, const void *b)
+{
+	recordid_t x = *(const recordid_t *) a,
+		y = *(const recordid_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_diff_applies
+ *
+ * Summary:     Check that the old side of a diff is what an open
+ *		database on the handheld holds: it must have as many
+ *		records, the records the diff adds must not be there
+ *		yet, and those it removes or changes must be
+ *
+ * Parameters:  socket, database handle, diff, number of records on
+ *		its old side
+ *
+ * Returns:     1 if the diff applies, 0 if not, negative on error
+ *
+ ***********************************************************************/
+static int
+pi_file_diff_applies(int socket, int db, const pi_diff_t *diff,
+	int old_count)
+{
+	int	i,
+		result,
+		count;
+	recordid_t *uids;
+
+	if ((result = pi_file_device_ids(socket, db, &uids, &count)) < 0)
+		return result;
+
+	qsort(uids, (size_t) count, sizeof(recordid_t), pi_file_compare_ids);
+
+	result = count == old_count;
+	for (i = 0; result && i < diff->num_entries; i++) {
+		const pi_diff_entry_t *entp = &diff->entries[i];
+		int 	present = bsearch(&entp->uid, uids, (size_t) count,
+			sizeof(recordid_t), pi_file_compare_ids) != NULL;
+
+		result = entp->change == PI_DIFF_ADDED ? !present : present;
+	}
+
+	free(uids);
+	return result;
+}
+
 /***********************************************************************
  *
  * Function:    pi_file_close_for_write 
@@ -1270,18 +1753,10 @@ fail:
 static int
 pi_file_close_for_write(pi_file_t *pf)
 {
-	int 	i,
-		offset;
+	int 	result;
 	FILE 	*f;
-	
-	struct 	DBInfo *ip;
-	struct 	pi_file_entry *entp;
 	struct	stat sbuf;
-		
-	unsigned char buf[512];
-	unsigned char *p;
 
-	ip = &pf->info;
 	if (pf->num_entries >= 64 * 1024) {
 		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
 			 "pi_file_close_for_write: too many entries "
@@ -1305,6 +1780,42 @@ pi_file_close_for_write(pi_file_t *pf)
 	if ((f = fopen(pf->file_name, "wb")) == NULL)
 		return PI_ERR_FILE_ERROR;
 
+	result = pi_file_write_stream(pf, f);
+	fclose(f);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_write_stream
+ *
+ * Summary:     Write the on-disk image of a file open for write to an
+ *		already open stream, starting at the current position
+ *
+ * Parameters:  file handle pi_file_t*, stream
+ *
+ * Returns:     0 for success, negative otherwise
+ *
+ ***********************************************************************/
+int
+pi_file_write_stream(pi_file_t *pf, FILE *f)
+{
+	int 	i,
+		offset;
+
+	struct 	DBInfo *ip;
+	struct 	pi_file_entry *entp;
+
+	unsigned char buf[512];
+	unsigned char *p;
+
+	if (!pf->for_writing)
+		return PI_ERR_FILE_INVALID;
+
+	if (pf->num_entries >= 64 * 1024)
+		return PI_ERR_FILE_INVALID;
+
 	ip = &pf->info;
 
 	offset = PI_HDR_SIZE + pf->num_entries * pf->ent_hdr_size + 2;
@@ -1364,17 +1875,17 @@ pi_file_close_for_write(pi_file_t *pf)
 		goto bad;
 
 
-	fwrite(pf->tmpbuf->data, pf->tmpbuf->used, 1, f);
+	if (pf->tmpbuf->used
+	    && fwrite(pf->tmpbuf->data, pf->tmpbuf->used, 1, f) != 1)
+		goto bad;
 	fflush(f);
 
-	if (ferror(f) || feof(f))
+	if (ferror(f))
 		goto bad;
 
-	fclose(f);
 	return 0;
 
 bad:
-	fclose(f);
 	return PI_ERR_FILE_ERROR;
 }
 
@@ -1396,6 +1907,15 @@ void pi_file_free(pi_file_t *pf)
 
 	if (pf->f != 0)
 		fclose(pf->f);
+
+	if (pf->map != NULL) {
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+		if (!pf->map_allocated)
+			munmap(pf->map, pf->map_size);
+		else
+#endif
+			free(pf->map);
+	}
 	
 	if (pf->app_info != NULL)
 		free(pf->app_info);
@@ -1415,12 +1935,95 @@ void pi_file_free(pi_file_t *pf)
 	if (pf->tmpbuf != NULL)
 		pi_buffer_free(pf->tmpbuf);
 
+	if (pf->uid_table != NULL)
+		free(pf->uid_table);
+
 	/* in case caller forgets the struct has been freed... */
 	memset(pf, 0, sizeof(pi_file_t));
 
 	free(pf);
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_find_uid
+ *
+ * Summary:	Look for the unique ID of a record about to be appended
+ *		to a file open for write, so that pi_file_append_record()
+ *		finds duplicate IDs in constant time instead of scanning
+ *		every entry. The table of IDs is kept at most half full,
+ *		counting the record about to be appended.
+ *
+ * Parameters:  file handle pi_file_t*, non-zero unique ID
+ *
+ * Returns:     1 if the ID is already used, 0 if not, negative on error
+ *
+ ***********************************************************************/
+static int
+pi_file_find_uid(pi_file_t *pf, recordid_t uid)
+{
+	size_t	i,
+		mask;
+
+	if ((size_t)pf->num_entries + 1 > pf->uid_table_size / 2) {
+		size_t	size = pf->uid_table_size ? pf->uid_table_size * 2 : 64;
+		recordid_t *table;
+		int	j;
+
+		while ((size_t)pf->num_entries + 1 > size / 2)
+			size *= 2;
+		if ((table = calloc(size, sizeof(recordid_t))) == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+
+		/* entries appended with no ID yet are skipped */
+		for (j = 0; j < pf->num_entries; j++) {
+			recordid_t id = pf->entries[j].uid;
+
+			if (id == 0)
+				continue;
+			for (i = (id * 2654435761UL) & (size - 1); table[i];
+			     i = (i + 1) & (size - 1))
+				;
+			table[i] = id;
+		}
+		free(pf->uid_table);
+		pf->uid_table 		= table;
+		pf->uid_table_size 	= size;
+	}
+
+	mask = pf->uid_table_size - 1;
+	for (i = (uid * 2654435761UL) & mask; pf->uid_table[i];
+	     i = (i + 1) & mask)
+		if (pf->uid_table[i] == uid)
+			return 1;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_add_uid
+ *
+ * Summary:	Remember the unique ID of a record once it was appended.
+ *		pi_file_find_uid() made room for it.
+ *
+ * Parameters:  file handle pi_file_t*, non-zero unique ID
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_file_add_uid(pi_file_t *pf, recordid_t uid)
+{
+	size_t	i,
+		mask = pf->uid_table_size - 1;
+
+	for (i = (uid * 2654435761UL) & mask; pf->uid_table[i];
+	     i = (i + 1) & mask)
+		;
+	pf->uid_table[i] = uid;
+}
+
 /***********************************************************************
  *
  * Function:    pi_file_set_rbuf_size
@@ -1457,6 +2060,68 @@ pi_file_set_rbuf_size(pi_file_t *pf, size_t size)
 	return 0;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_map
+ *
+ * Summary:	Bring the whole file of a database open for read into
+ *		memory, so records can be returned without copying.
+ *		mmap() is used where available, otherwise the file is
+ *		read into an allocated block. The stdio stream is
+ *		closed once this succeeds.
+ *
+ * Parameters:  file handle pi_file_t*
+ *
+ * Returns:     0 for success, negative otherwise
+ *
+ ***********************************************************************/
+static int
+pi_file_map(pi_file_t *pf)
+{
+	long	size;
+	void	*map;
+
+	if (pf->for_writing || pf->f == NULL)
+		return PI_ERR_FILE_INVALID;
+
+	fseek(pf->f, 0, SEEK_END);
+	if ((size = ftell(pf->f)) <= 0)
+		return PI_ERR_FILE_ERROR;
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+	map = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE,
+		fileno(pf->f), 0);
+	if (map != MAP_FAILED) {
+		pf->map = map;
+		pf->map_size = size;
+		pf->map_allocated = 0;
+		goto done;
+	}
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+	    "FILE MAP %s: mmap failed, reading file instead\n",
+	    pf->file_name ? pf->file_name : "<unnamed>"));
+#endif
+	if ((map = malloc((size_t) size)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	fseek(pf->f, 0, SEEK_SET);
+	if (fread(map, 1, (size_t) size, pf->f) != (size_t) size) {
+		free(map);
+		return PI_ERR_FILE_ERROR;
+	}
+	pf->map = map;
+	pf->map_size = size;
+	pf->map_allocated = 1;
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+done:
+#endif
+	fclose(pf->f);
+	pf->f = NULL;
+
+	return 0;
+}
+
 /***********************************************************************
  *
  * Function:    pi_file_append_entry
@@ -0,0 +1,1346 @@
+/*
+ * $Id$
+ *
+ * recurrence.c:  Expand repeating appointments, and index their
+ * occurrences
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+#include "pi-error.h"
+#include "pi-dlp.h"
+#include "pi-recurrence.h"
+
+#define MINUTES_PER_DAY		1440
+
+/* Latest day whose minutes still fit in a long, with a day to spare */
+#define LAST_DAY		(LONG_MAX / MINUTES_PER_DAY - 2)
+
+/* The Gregorian calendar repeats every 400 years. A rule stepping
+   through months visits every month it ever will within that many
+   steps. */
+#define MONTHS_PER_CYCLE	4800
+
+#define INDEX_BUCKETS		64
+
+typedef struct index_node {
+	struct index_node *left,
+		*right,
+		*chain;			/* next node in the same hash bucket */
+	recordid_t id;
+	unsigned int priority;
+	long 	begin,			/* start of the first occurrence */
+		end,			/* end of the last one, LONG_MAX if none */
+		max_end;		/* latest end in this subtree */
+	pi_recurrence_t rule;
+} index_node;
+
+struct pi_datebook_index {
+	index_node *root;		/* treap on (begin, id), heap on priority */
+	index_node **buckets;		/* by id */
+	unsigned int num_buckets;
+	int 	count;
+};
+
+
+/***********************************************************************
+ *
+ * Function:    floor_div, floor_mod
+ *
+ * Summary:     Division rounding towards minus infinity, and the
+ *		matching remainder, never negative
+ *
+ * Parameters:  Dividend, divisor (positive)
+ *
+ * Returns:     Quotient, remainder
+ *
+ ***********************************************************************/
+static long floor_div(long a, long b)
+{
+	return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+static long floor_mod(long a, long b)
+{
+	return a - floor_div(a, b) * b;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    days_from_civil
+ *
+ * Summary:     Day number of a date, counted from 1970-01-01
+ *
+ * Parameters:  Year, month (1-12), day of the month
+ *
+ * Returns:     Day number
+ *
+ ***********************************************************************/
+static long days_from_civil(long y, int m, int d)
+{
+	long 	era;
+	unsigned long yoe,
+		doy,
+		doe;
+
+	y -= m <= 2;
+	era = floor_div(y, 400);
+	yoe = (unsigned long) (y - era * 400);
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (long) doe - 719468;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    civil_from_days
+ *
+ * Summary:     Date of a day number
+ *
+ * Parameters:  Day number, year, month (1-12) and day returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void civil_from_days(long z, long *y, int *m, int *d)
+{
+	long 	era;
+	unsigned long doe,
+		yoe,
+		doy,
+		mp;
+
+	z += 719468;
+	era = floor_div(z, 146097);
+	doe = (unsigned long) (z - era * 146097);
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*d = (int) (doy - (153 * mp + 2) / 5 + 1);
+	*m = (int) (mp < 10 ? mp + 3 : mp - 9);
+	*y = (long) yoe + era * 400 + (*m <= 2);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    month_start
+ *
+ * Summary:     First day of a month, and its length
+ *
+ * Parameters:  Month counted from January of year 0, length returned
+ *
+ * Returns:     Day number
+ *
+ ***********************************************************************/
+static long month_start(long month, int *length)
+{
+	long 	y = floor_div(month, 12),
+		first;
+	int 	m = (int) floor_mod(month, 12) + 1;
+
+	first = days_from_civil(y, m, 1);
+	if (length)
+		*length = (int) (m == 12 ? 31
+			: days_from_civil(y, m + 1, 1) - first);
+	return first;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    weekday
+ *
+ * Summary:     Day of the week of a day number
+ *
+ * Parameters:  Day number
+ *
+ * Returns:     0 for Sunday to 6 for Saturday
+ *
+ ***********************************************************************/
+static int weekday(long day)
+{
+	/* 1970-01-01 was a Thursday */
+	return (int) floor_mod(day + 4, 7);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tm_day
+ *
+ * Summary:     Day number of the date in a struct tm, normalising
+ *		months out of range as mktime() would
+ *
+ * Parameters:  struct tm
+ *
+ * Returns:     Day number
+ *
+ ***********************************************************************/
+static long tm_day(const struct tm *t)
+{
+	long 	month = (t->tm_year + 1900L) * 12 + t->tm_mon;
+
+	return month_start(month, NULL) + t->tm_mday - 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    day_minutes
+ *
+ * Summary:     Minutes from 1970-01-01 00:00 to a time of a day,
+ *		saturating instead of overflowing
+ *
+ * Parameters:  Day number, minutes into the day
+ *
+ * Returns:     Minutes
+ *
+ ***********************************************************************/
+static long day_minutes(long day, long minutes)
+{
+	if (day > LAST_DAY)
+		return LONG_MAX;
+	if (day < -LAST_DAY)
+		return -LONG_MAX;
+	return day * MINUTES_PER_DAY + minutes;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tm_minutes
+ *
+ * Summary:     Minutes from 1970-01-01 00:00 to a struct tm
+ *
+ * Parameters:  struct tm
+ *
+ * Returns:     Minutes
+ *
+ ***********************************************************************/
+static long tm_minutes(const struct tm *t)
+{
+	return day_minutes(tm_day(t), t->tm_hour * 60L + t->tm_min);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    minutes_tm
+ *
+ * Summary:     Fill in a struct tm from minutes since 1970-01-01 00:00
+ *
+ * Parameters:  Minutes, struct tm returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void minutes_tm(long minutes, struct tm *t)
+{
+	long 	day = floor_div(minutes, MINUTES_PER_DAY),
+		y;
+	int 	m,
+		d,
+		rest = (int) (minutes - day * MINUTES_PER_DAY);
+
+	civil_from_days(day, &y, &m, &d);
+
+	memset(t, 0, sizeof(*t));
+	t->tm_year 	= (int) (y - 1900);
+	t->tm_mon 	= m - 1;
+	t->tm_mday 	= d;
+	t->tm_hour 	= rest / 60;
+	t->tm_min 	= rest % 60;
+	t->tm_wday 	= weekday(day);
+	t->tm_yday 	= (int) (day - days_from_civil(y, 1, 1));
+	t->tm_isdst 	= -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    compare_days
+ *
+ * Summary:     qsort() and bsearch() comparison of day numbers
+ *
+ * Parameters:  Two days
+ *
+ * Returns:     <0, 0 or >0
+ *
+ ***********************************************************************/
+static int compare_days(const void *a, const void *b)
+{
+	long 	x = *(const long *) a,
+		y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    compile_rule
+ *
+ * Summary:     Compile the repeat fields shared by appointments and
+ *		calendar events
+ *
+ * Parameters:  Rule to fill in, then the fields of the record
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+compile_rule(pi_recurrence_t *rule, int event, const struct tm *begin,
+	const struct tm *end, int type, int forever, const struct tm *repeat_end,
+	int frequency, int repeat_day, const int *repeat_days, int weekstart,
+	int exceptions, const struct tm *exception)
+{
+	int 	i,
+		n;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->type 	= type;
+	rule->frequency = frequency > 0 ? frequency : 1;
+	rule->first 	= tm_day(begin);
+	rule->event 	= event;
+
+	if (event) {
+		rule->start = 0;
+		rule->duration = MINUTES_PER_DAY;
+	} else {
+		rule->start = begin->tm_hour * 60 + begin->tm_min;
+		rule->duration = end->tm_hour * 60 + end->tm_min - rule->start;
+		if (rule->duration < 0)
+			rule->duration = 0;
+	}
+
+	if (type == repeatNone)
+		rule->last = rule->first;
+	else if (forever)
+		rule->last = PI_RECURRENCE_FOREVER;
+	else
+		rule->last = tm_day(repeat_end);
+
+	rule->weekstart = (int) floor_mod(weekstart, 7);
+	for (i = 0; i < 7; i++)
+		if (repeat_days[i])
+			rule->weekdays |= 1 << i;
+	if (rule->weekdays == 0)
+		rule->weekdays = 1 << weekday(rule->first);
+
+	civil_from_days(rule->first, &rule->first_month, &rule->month,
+		&rule->day);
+	rule->first_month = rule->first_month * 12 + rule->month - 1;
+	rule->month--;
+	rule->week = repeat_day / 7;
+	rule->weekday = repeat_day % 7;
+
+	if (type == repeatNone || exceptions <= 0)
+		return 0;
+
+	rule->exceptions = (long *) malloc(exceptions * sizeof(long));
+	if (rule->exceptions == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	for (i = 0; i < exceptions; i++)
+		rule->exceptions[i] = tm_day(&exception[i]);
+	qsort(rule->exceptions, exceptions, sizeof(long), compare_days);
+	for (i = n = 1; i < exceptions; i++)
+		if (rule->exceptions[i] != rule->exceptions[n - 1])
+			rule->exceptions[n++] = rule->exceptions[i];
+	rule->num_exceptions = n;
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_from_appointment
+ *
+ * Summary:     Compile the repeat rule of an appointment
+ *
+ * Parameters:  Rule to fill in, appointment
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+int
+pi_recurrence_from_appointment(pi_recurrence_t *rule,
+	const struct Appointment *a)
+{
+	return compile_rule(rule, a->event, &a->begin, &a->end,
+		a->repeatType, a->repeatForever, &a->repeatEnd,
+		a->repeatFrequency, a->repeatDay, a->repeatDays,
+		a->repeatWeekstart, a->exceptions, a->exception);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_from_calendar_event
+ *
+ * Summary:     Compile the repeat rule of a calendar event
+ *
+ * Parameters:  Rule to fill in, event
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+int
+pi_recurrence_from_calendar_event(pi_recurrence_t *rule,
+	const CalendarEvent_t *e)
+{
+	/* enum calendarRepeatType lists the same rules as enum repeatTypes,
+	   in the same order */
+	return compile_rule(rule, e->event, &e->begin, &e->end,
+		e->repeatType, e->repeatForever, &e->repeatEnd,
+		e->repeatFrequency, e->repeatDay, e->repeatDays,
+		e->repeatWeekstart, e->exceptions, e->exception);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_free
+ *
+ * Summary:     Release the exceptions of a rule
+ *
+ * Parameters:  Rule
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_recurrence_free(pi_recurrence_t *rule)
+{
+	free(rule->exceptions);
+	rule->exceptions = NULL;
+	rule->num_exceptions = 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    next_in_week
+ *
+ * Summary:     First day of a weekly rule on or after a day, in the
+ *		rule's weeks
+ *
+ * Parameters:  Rule, day (not before the first)
+ *
+ * Returns:     Day number
+ *
+ ***********************************************************************/
+static long next_in_week(const pi_recurrence_t *rule, long day)
+{
+	/* weeks start on the days whose weekday is weekstart */
+	long 	shift = rule->weekstart - 4,
+		week0 = floor_div(rule->first - shift, 7),
+		week = floor_div(day - shift, 7),
+		skip = floor_mod(week - week0, rule->frequency);
+	int 	mask,
+		from,
+		i;
+
+	/* bit i of mask is the i-th day of the week */
+	mask = ((rule->weekdays >> rule->weekstart)
+		| (rule->weekdays << (7 - rule->weekstart))) & 0x7f;
+
+	from = (int) (day - shift - week * 7);
+	if (skip) {
+		week += rule->frequency - skip;
+		from = 0;
+	}
+	for (;;) {
+		for (i = from; i < 7; i++)
+			if (mask & (1 << i))
+				return week * 7 + shift + i;
+		week += rule->frequency;
+		from = 0;
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    next_in_month
+ *
+ * Summary:     First day of a monthly or yearly rule on or after a
+ *		day, skipping months without the day of the month
+ *
+ * Parameters:  Rule, day (not before the first)
+ *
+ * Returns:     Day number, or -1 if there is none by the last day
+ *
+ ***********************************************************************/
+static long next_in_month(const pi_recurrence_t *rule, long day)
+{
+	long 	step = rule->frequency,
+		month,
+		y,
+		skip,
+		start,
+		d;
+	int 	m,
+		mday,
+		length,
+		n;
+
+	if (rule->type == repeatYearly)
+		step *= 12;
+
+	civil_from_days(day, &y, &m, &mday);
+	month = y * 12 + m - 1;
+	skip = floor_mod(month - rule->first_month, step);
+	if (skip)
+		month += step - skip;
+
+	for (n = 0; n <= MONTHS_PER_CYCLE; n++, month += step) {
+		start = month_start(month, &length);
+		if (start > rule->last)
+			break;
+
+		if (rule->type != repeatMonthlyByDay) {
+			if (rule->day > length)
+				continue;
+			d = start + rule->day - 1;
+		} else if (rule->week < 4) {
+			d = start + floor_mod(rule->weekday - weekday(start), 7)
+				+ 7 * rule->week;
+		} else {
+			d = start + length - 1;
+			d -= floor_mod(weekday(d) - rule->weekday, 7);
+		}
+		if (d >= day)
+			return d;
+	}
+
+	return -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_next_day
+ *
+ * Summary:     Find the first occurrence of a rule on or after a day
+ *
+ * Parameters:  Rule, day number
+ *
+ * Returns:     Day number of the occurrence, or -1 if there are no more
+ *
+ ***********************************************************************/
+long
+pi_recurrence_next_day(const pi_recurrence_t *rule, long day)
+{
+	long 	d;
+
+	if (day < rule->first)
+		day = rule->first;
+
+	while (day <= rule->last && day <= LAST_DAY) {
+		switch (rule->type) {
+		case repeatNone:
+			d = day == rule->first ? day : -1;
+			break;
+		case repeatDaily:
+			d = day - rule->first + rule->frequency - 1;
+			d = rule->first + d - d % rule->frequency;
+			break;
+		case repeatWeekly:
+			d = next_in_week(rule, day);
+			break;
+		case repeatMonthlyByDay:
+		case repeatMonthlyByDate:
+		case repeatYearly:
+			d = next_in_month(rule, day);
+			break;
+		default:
+			d = -1;
+			break;
+		}
+		if (d < 0 || d > rule->last)
+			return -1;
+
+		if (rule->num_exceptions == 0
+		    || bsearch(&d, rule->exceptions, rule->num_exceptions,
+			       sizeof(long), compare_days) == NULL)
+			return d;
+		day = d + 1;
+	}
+
+	return -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    span
+ *
+ * Summary:     Length of the occurrences of a rule for overlap tests:
+ *		an occurrence of no length still covers its minute
+ *
+ * Parameters:  Rule
+ *
+ * Returns:     Minutes
+ *
+ ***********************************************************************/
+static long span(const pi_recurrence_t *rule)
+{
+	return rule->duration > 0 ? rule->duration : 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    iter_start
+ *
+ * Summary:     Start iterating over the occurrences of a rule that
+ *		overlap a range given in minutes
+ *
+ * Parameters:  Iterator, rule, start and end of the range
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+iter_start(pi_recurrence_iter_t *it, const pi_recurrence_t *rule,
+	long from, long to)
+{
+	it->rule = rule;
+	it->until = to;
+
+	/* the first day whose occurrence ends after from */
+	if (from <= -LONG_MAX + 2 * MINUTES_PER_DAY)
+		it->day = rule->first;
+	else
+		it->day = floor_div(from - rule->start - span(rule),
+			MINUTES_PER_DAY) + 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    iter_next_minutes
+ *
+ * Summary:     Get the start of the next occurrence of an iterator
+ *
+ * Parameters:  Iterator, start returned in minutes
+ *
+ * Returns:     1 if there was one, 0 at the end of the range
+ *
+ ***********************************************************************/
+static int iter_next_minutes(pi_recurrence_iter_t *it, long *begin)
+{
+	long 	d;
+
+	if (it->rule == NULL)
+		return 0;
+
+	d = pi_recurrence_next_day(it->rule, it->day);
+	if (d < 0 || day_minutes(d, it->rule->start) >= it->until) {
+		it->rule = NULL;
+		return 0;
+	}
+
+	it->day = d + 1;
+	*begin = day_minutes(d, it->rule->start);
+	return 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_iter_init
+ *
+ * Summary:     Start iterating over the occurrences of a rule that
+ *		overlap a range
+ *
+ * Parameters:  Iterator, rule, start and end of the range
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_recurrence_iter_init(pi_recurrence_iter_t *it,
+	const pi_recurrence_t *rule, const struct tm *from,
+	const struct tm *to)
+{
+	iter_start(it, rule, tm_minutes(from), tm_minutes(to));
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_recurrence_iter_next
+ *
+ * Summary:     Get the next occurrence of an iterator
+ *
+ * Parameters:  Iterator, start and end of the occurrence returned
+ *
+ * Returns:     1 if there was one, 0 at the end of the range
+ *
+ ***********************************************************************/
+int
+pi_recurrence_iter_next(pi_recurrence_iter_t *it, struct tm *begin,
+	struct tm *end)
+{
+	long 	start,
+		duration;
+
+	if (it->rule == NULL)
+		return 0;
+	duration = it->rule->duration;
+
+	if (!iter_next_minutes(it, &start))
+		return 0;
+	minutes_tm(start, begin);
+	minutes_tm(start + duration, end);
+	return 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    node_priority
+ *
+ * Summary:     Treap priority of a record, a hash of its ID so the
+ *		tree is balanced whatever order records come in
+ *
+ * Parameters:  Record ID
+ *
+ * Returns:     Priority
+ *
+ ***********************************************************************/
+static unsigned int node_priority(recordid_t id)
+{
+	unsigned int x = (unsigned int) id;
+
+	x = ((x >> 16) ^ x) * 0x45d9f3bU;
+	x = ((x >> 16) ^ x) * 0x45d9f3bU;
+	return (x >> 16) ^ x;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    node_before
+ *
+ * Summary:     Tree order: by start of the first occurrence, then ID
+ *
+ * Parameters:  Two nodes
+ *
+ * Returns:     Non-zero if a comes before b
+ *
+ ***********************************************************************/
+static int node_before(const index_node *a, const index_node *b)
+{
+	return a->begin < b->begin || (a->begin == b->begin && a->id < b->id);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    node_update
+ *
+ * Summary:     Recompute the latest end below a node
+ *
+ * Parameters:  Node
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void node_update(index_node *n)
+{
+	n->max_end = n->end;
+	if (n->left && n->left->max_end > n->max_end)
+		n->max_end = n->left->max_end;
+	if (n->right && n->right->max_end > n->max_end)
+		n->max_end = n->right->max_end;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tree_split
+ *
+ * Summary:     Split a tree into the nodes before a key and the rest
+ *
+ * Parameters:  Tree, key, both trees returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+tree_split(index_node *t, const index_node *key, index_node **l,
+	index_node **r)
+{
+	if (t == NULL) {
+		*l = *r = NULL;
+		return;
+	}
+	if (node_before(t, key)) {
+		tree_split(t->right, key, &t->right, r);
+		*l = t;
+	} else {
+		tree_split(t->left, key, l, &t->left);
+		*r = t;
+	}
+	node_update(t);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tree_merge
+ *
+ * Summary:     Join two trees, all of the first coming before the second
+ *
+ * Parameters:  Both trees
+ *
+ * Returns:     Joined tree
+ *
+ ***********************************************************************/
+static index_node *tree_merge(index_node *l, index_node *r)
+{
+	if (l == NULL)
+		return r;
+	if (r == NULL)
+		return l;
+	if (l->priority > r->priority) {
+		l->right = tree_merge(l->right, r);
+		node_update(l);
+		return l;
+	}
+	r->left = tree_merge(l, r->left);
+	node_update(r);
+	return r;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tree_insert
+ *
+ * Summary:     Insert a node into a tree
+ *
+ * Parameters:  Tree, node
+ *
+ * Returns:     New tree
+ *
+ ***********************************************************************/
+static index_node *tree_insert(index_node *t, index_node *n)
+{
+	if (t == NULL || n->priority > t->priority) {
+		tree_split(t, n, &n->left, &n->right);
+		node_update(n);
+		return n;
+	}
+	if (node_before(n, t))
+		t->left = tree_insert(t->left, n);
+	else
+		t->right = tree_insert(t->right, n);
+	node_update(t);
+	return t;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tree_remove
+ *
+ * Summary:     Take a node out of the tree it is in
+ *
+ * Parameters:  Tree, node
+ *
+ * Returns:     New tree
+ *
+ ***********************************************************************/
+static index_node *tree_remove(index_node *t, const index_node *n)
+{
+	if (t == n)
+		return tree_merge(t->left, t->right);
+	if (node_before(n, t))
+		t->left = tree_remove(t->left, n);
+	else
+		t->right = tree_remove(t->right, n);
+	node_update(t);
+	return t;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_new
+ *
+ * Summary:     Create an empty occurrence index
+ *
+ * Parameters:  None
+ *
+ * Returns:     Index, or NULL if out of memory
+ *
+ ***********************************************************************/
+pi_datebook_index_t *
+pi_datebook_index_new(void)
+{
+	pi_datebook_index_t *idx;
+
+	idx = (pi_datebook_index_t *) calloc(1, sizeof(*idx));
+	if (idx == NULL)
+		return NULL;
+
+	idx->buckets = (index_node **) calloc(INDEX_BUCKETS,
+		sizeof(index_node *));
+	if (idx->buckets == NULL) {
+		free(idx);
+		return NULL;
+	}
+	idx->num_buckets = INDEX_BUCKETS;
+
+	return idx;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_free
+ *
+ * Summary:     Dispose of an index
+ *
+ * Parameters:  Index, may be NULL
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_datebook_index_free(pi_datebook_index_t *idx)
+{
+	index_node *n,
+		*next;
+	unsigned int i;
+
+	if (idx == NULL)
+		return;
+
+	for (i = 0; i < idx->num_buckets; i++) {
+		for (n = idx->buckets[i]; n; n = next) {
+			next = n->chain;
+			pi_recurrence_free(&n->rule);
+			free(n);
+		}
+	}
+	free(idx->buckets);
+	free(idx);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    find_bucket
+ *
+ * Summary:     Find the hash chain link that holds, or would hold, a
+ *		record
+ *
+ * Parameters:  Index, record ID
+ *
+ * Returns:     Link
+ *
+ ***********************************************************************/
+static index_node **find_bucket(const pi_datebook_index_t *idx,
+	recordid_t id)
+{
+	index_node **link;
+
+	link = &idx->buckets[node_priority(id) & (idx->num_buckets - 1)];
+	while (*link && (*link)->id != id)
+		link = &(*link)->chain;
+	return link;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    grow_buckets
+ *
+ * Summary:     Double the hash table once there are more records than
+ *		buckets
+ *
+ * Parameters:  Index
+ *
+ * Returns:     Nothing; the table stays as it is if out of memory
+ *
+ ***********************************************************************/
+static void grow_buckets(pi_datebook_index_t *idx)
+{
+	index_node **buckets,
+		*n,
+		*next;
+	unsigned int size = idx->num_buckets * 2,
+		i,
+		h;
+
+	buckets = (index_node **) calloc(size, sizeof(index_node *));
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < idx->num_buckets; i++) {
+		for (n = idx->buckets[i]; n; n = next) {
+			next = n->chain;
+			h = node_priority(n->id) & (size - 1);
+			n->chain = buckets[h];
+			buckets[h] = n;
+		}
+	}
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->num_buckets = size;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    index_set
+ *
+ * Summary:     Add a compiled rule to an index, or replace the one of
+ *		the same record
+ *
+ * Parameters:  Index, record ID, rule (taken over by the index)
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+index_set(pi_datebook_index_t *idx, recordid_t id, pi_recurrence_t *rule)
+{
+	index_node **link = find_bucket(idx, id),
+		*n = *link;
+	long 	last;
+
+	if (n) {
+		idx->root = tree_remove(idx->root, n);
+		pi_recurrence_free(&n->rule);
+	} else {
+		n = (index_node *) calloc(1, sizeof(index_node));
+		if (n == NULL) {
+			pi_recurrence_free(rule);
+			return PI_ERR_GENERIC_MEMORY;
+		}
+		n->id = id;
+		n->priority = node_priority(id);
+		*link = n;
+		idx->count++;
+	}
+
+	n->rule = *rule;
+	n->begin = day_minutes(rule->first, rule->start);
+	last = rule->last < LAST_DAY ? rule->last : LAST_DAY;
+	n->end = day_minutes(last, rule->start);
+	if (n->end < LONG_MAX - MINUTES_PER_DAY)
+		n->end += span(rule);
+	idx->root = tree_insert(idx->root, n);
+
+	if (idx->count > (int) idx->num_buckets)
+		grow_buckets(idx);
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_set_appointment
+ *
+ * Summary:     Add an appointment, or replace the record with its ID
+ *
+ * Parameters:  Index, record ID, appointment
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_set_appointment(pi_datebook_index_t *idx, recordid_t id,
+	const struct Appointment *a)
+{
+	pi_recurrence_t rule;
+
+	if (pi_recurrence_from_appointment(&rule, a) < 0)
+		return PI_ERR_GENERIC_MEMORY;
+	return index_set(idx, id, &rule);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_set_calendar_event
+ *
+ * Summary:     Add a calendar event, or replace the record with its ID
+ *
+ * Parameters:  Index, record ID, event
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_set_calendar_event(pi_datebook_index_t *idx,
+	recordid_t id, const CalendarEvent_t *e)
+{
+	pi_recurrence_t rule;
+
+	if (pi_recurrence_from_calendar_event(&rule, e) < 0)
+		return PI_ERR_GENERIC_MEMORY;
+	return index_set(idx, id, &rule);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_remove
+ *
+ * Summary:     Remove a record from an index
+ *
+ * Parameters:  Index, record ID
+ *
+ * Returns:     1 if it was there, 0 if not
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_remove(pi_datebook_index_t *idx, recordid_t id)
+{
+	index_node **link = find_bucket(idx, id),
+		*n = *link;
+
+	if (n == NULL)
+		return 0;
+
+	idx->root = tree_remove(idx->root, n);
+	*link = n->chain;
+	pi_recurrence_free(&n->rule);
+	free(n);
+	idx->count--;
+
+	return 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_count
+ *
+ * Summary:     Number of records in an index
+ *
+ * Parameters:  Index
+ *
+ * Returns:     Number of records
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_count(const pi_datebook_index_t *idx)
+{
+	return idx->count;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_read_file
+ *
+ * Summary:     Add every live record of a DatebookDB or
+ *		CalendarDB-PDat file to an index
+ *
+ * Parameters:  Index, open file
+ *
+ * Returns:     Number of records added, or a negative error code
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_read_file(pi_datebook_index_t *idx, pi_file_t *pf)
+{
+	struct DBInfo info;
+	pi_arena_t *arena;
+	int 	calendar,
+		entries,
+		attr,
+		added = 0,
+		result = 0,
+		i;
+
+	pi_file_get_info(pf, &info);
+	calendar = info.creator == makelong("PDat");
+	pi_file_get_entries(pf, &entries);
+
+	/* only the dates are kept, the strings need not be copied */
+	arena = pi_arena_new_borrowing(0);
+	if (arena == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	for (i = 0; i < entries && result >= 0; i++) {
+		pi_buffer_t record;
+		recordid_t uid;
+		void 	*data;
+		size_t 	size;
+
+		if (pi_file_read_record(pf, i, &data, &size, &attr, NULL,
+				&uid) < 0)
+			break;
+		if (attr & (dlpRecAttrDeleted | dlpRecAttrArchived))
+			continue;
+
+		record.data = (unsigned char *) data;
+		record.used = record.allocated = size;
+
+		pi_arena_reset(arena);
+		if (calendar) {
+			CalendarEvent_t e;
+
+			if (unpack_CalendarEvent_arena(&e, &record,
+					calendar_v1, arena) < 0)
+				continue;
+			result = pi_datebook_index_set_calendar_event(idx, uid,
+				&e);
+		} else {
+			struct Appointment a;
+
+			if (unpack_Appointment_arena(&a, &record, datebook_v1,
+					arena) < 0)
+				continue;
+			result = pi_datebook_index_set_appointment(idx, uid, &a);
+		}
+		if (result >= 0)
+			added++;
+	}
+	pi_arena_free(arena);
+
+	return result < 0 ? result : added;
+}
+
+
+typedef struct {
+	pi_occurrence_func func;
+	void 	*data;
+	long 	from,
+		to;
+	int 	found;
+} index_query;
+
+
+/***********************************************************************
+ *
+ * Function:    report_node
+ *
+ * Summary:     Report the occurrences of one record in the range
+ *
+ * Parameters:  Node, query
+ *
+ * Returns:     Non-zero if the callback asked to stop
+ *
+ ***********************************************************************/
+static int report_node(const index_node *n, index_query *q)
+{
+	pi_recurrence_iter_t it;
+	struct tm begin,
+		end;
+	long 	start;
+
+	iter_start(&it, &n->rule, q->from, q->to);
+	while (iter_next_minutes(&it, &start)) {
+		q->found++;
+		if (q->func == NULL)
+			continue;
+		minutes_tm(start, &begin);
+		minutes_tm(start + n->rule.duration, &end);
+		if (q->func(n->id, &begin, &end, q->data))
+			return 1;
+	}
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    tree_query
+ *
+ * Summary:     Report the occurrences of the records in a tree whose
+ *		span overlaps the range, skipping subtrees that end
+ *		before it or start after it
+ *
+ * Parameters:  Tree, query
+ *
+ * Returns:     Non-zero if the callback asked to stop
+ *
+ ***********************************************************************/
+static int tree_query(const index_node *t, index_query *q)
+{
+	while (t && t->max_end > q->from) {
+		if (tree_query(t->left, q))
+			return 1;
+		if (t->begin >= q->to)
+			return 0;
+		if (t->end > q->from && report_node(t, q))
+			return 1;
+		t = t->right;
+	}
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_datebook_index_query
+ *
+ * Summary:     Find the occurrences that overlap a range
+ *
+ * Parameters:  Index, start and end of the range, callback and its data
+ *
+ * Returns:     Number of occurrences found
+ *
+ ***********************************************************************/
+int
+pi_datebook_index_query(const pi_datebook_index_t *idx,
+	const struct tm *from, const struct tm *to,
+	pi_occurrence_func func, void *data)
+{
+	index_query q;
+
+	q.func = func;
+	q.data = data;
+	q.from = tm_minutes(from);
+	q.to = tm_minutes(to);
+	q.found = 0;
+
+	if (q.from < q.to)
+		tree_query(idx->root, &q);
+
+	return q.found;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
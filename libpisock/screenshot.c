@@ -0,0 +1,410 @@
+/*
+ * $Id$
+ *
+ * screenshot.c:  Translate ScreenShot database pictures
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "pi-screenshot.h"
+
+/* SSE2 is part of every x86-64 processor and NEON of every AArch64 one,
+   so the vector kernels are chosen when compiling. SCREENSHOT_SCALAR in
+   the flags selects the portable code at run time. */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define SCREENSHOT_VECTOR 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define SCREENSHOT_VECTOR 1
+#else
+# define SCREENSHOT_VECTOR 0
+#endif
+
+/* Screenshots with a header start with one of these, as a little endian
+   long */
+#define SCREENSHOT_MAGIC	0xBECEDEFEUL
+#define SCREENSHOT_MAGIC2	0xDEDEFEFEUL
+#define SCREENSHOT_HEADER_SIZE	10
+
+#define CLUT_SIZE		1024
+
+/***********************************************************************
+ *
+ * Function:    unpack_ScreenShotHeader
+ *
+ * Summary:     Recognise the first record of a screenshot
+ *
+ * Parameters:  Header returned, record, its size
+ *
+ * Returns:     1 if it starts a screenshot, 0 if not
+ *
+ ***********************************************************************/
+int
+unpack_ScreenShotHeader(struct ScreenShotHeader *h,
+	const unsigned char *record, size_t len)
+{
+	unsigned long magic = 0;
+
+	if (len >= SCREENSHOT_HEADER_SIZE)
+		magic = (unsigned long) record[0]
+			| (unsigned long) record[1] << 8
+			| (unsigned long) record[2] << 16
+			| (unsigned long) record[3] << 24;
+
+	if (magic == SCREENSHOT_MAGIC || magic == SCREENSHOT_MAGIC2) {
+		h->width 	= (record[4] << 8) + record[5];
+		h->height 	= (record[6] << 8) + record[7];
+		h->depth 	= record[8];
+		h->num_records 	= record[9] ? record[9] : 1;
+		h->offset 	= SCREENSHOT_HEADER_SIZE;
+		return 1;
+	}
+
+	/* No magic, must be a version 1 database of 160x160 screens */
+	h->width 	= 160;
+	h->height 	= 160;
+	h->num_records 	= 1;
+	h->offset 	= 0;
+	switch (len) {
+	case 3200:
+		h->depth = 1;
+		break;
+	case 6400:
+		h->depth = 2;
+		break;
+	case 12800:
+		h->depth = 4;
+		break;
+	case 26624:
+		h->depth = 8;
+		break;
+	case 51200:
+		h->depth = 16;
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    ScreenShot_data_size
+ *
+ * Summary:     Size of the pixel data of a screenshot
+ *
+ * Parameters:  Header
+ *
+ * Returns:     Bytes of pixels, and colour table at 8 bits per pixel
+ *
+ ***********************************************************************/
+size_t
+ScreenShot_data_size(const struct ScreenShotHeader *h)
+{
+	size_t 	size = ((size_t) h->width * h->height * h->depth + 7) / 8;
+
+	if (h->depth == 8)
+		size += CLUT_SIZE;
+	return size;
+}
+
+/***********************************************************************
+ *
+ * Grey kernels. Each byte holds 8 / depth pixels, the most significant
+ * first, 0 being white. A table gives the RGB pixels of every possible
+ * byte, so the conversion is one fixed size copy per byte. The macro
+ * makes one kernel for each depth, with the depth a constant.
+ *
+ ***********************************************************************/
+#define GREY_KERNEL(depth)						\
+static void								\
+Grey##depth(const unsigned char *in, size_t n, unsigned char *out)	\
+{									\
+	enum {								\
+		mask = (1 << depth) - 1,				\
+		per_byte = 8 / depth					\
+	};								\
+	unsigned char table[256][3 * per_byte];				\
+	int 	b,							\
+		k,							\
+		val;							\
+									\
+	for (b = 0; b < 256; b++) {					\
+		for (k = 0; k < per_byte; k++) {			\
+			val = mask - ((b >> ((per_byte - 1 - k) * depth))	\
+				& mask);				\
+			val *= 255 / mask;				\
+			table[b][3 * k] = val;				\
+			table[b][3 * k + 1] = val;			\
+			table[b][3 * k + 2] = val;			\
+		}							\
+	}								\
+									\
+	for (; n > 0; n--, in++, out += sizeof(table[0]))		\
+		memcpy(out, table[*in], sizeof(table[0]));		\
+}
+
+GREY_KERNEL(1)
+GREY_KERNEL(2)
+GREY_KERNEL(4)
+
+/***********************************************************************
+ *
+ * Function:    Clut8
+ *
+ * Summary:     Expand 8 bit pixels through the colour table. A table
+ *		lookup is a gather, which SSE2 and NEON can't do, so
+ *		instead each entry is made 4 bytes long and copied with
+ *		one store; the fourth byte is overwritten by the next
+ *		pixel.
+ *
+ * Parameters:  Pixels, number of pixels, colour table of 4 byte
+ *		entries with the red, green and blue in bytes 1 to 3,
+ *		RGB pixels returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+Clut8(const unsigned char *in, size_t n, const unsigned char *clut,
+	unsigned char *out)
+{
+	unsigned char table[256][4];
+	size_t 	i;
+
+	for (i = 0; i < 256; i++) {
+		table[i][0] = clut[4 * i + 1];
+		table[i][1] = clut[4 * i + 2];
+		table[i][2] = clut[4 * i + 3];
+		table[i][3] = 0;
+	}
+
+	for (i = 0; i + 1 < n; i++)
+		memcpy(out + 3 * i, table[in[i]], 4);
+	if (n > 0)
+		memcpy(out + 3 * i, table[in[i]], 3);
+}
+
+#if SCREENSHOT_VECTOR
+/***********************************************************************
+ *
+ * Function:    Rgb565Vector
+ *
+ * Summary:     Expand big endian RGB565 pixels to RGB, 16 at a time
+ *
+ * Parameters:  Pixels, number of pixels, RGB pixels returned
+ *
+ * Returns:     Number of pixels done, the rest is left to the portable
+ *		code
+ *
+ ***********************************************************************/
+static size_t
+Rgb565Vector(const unsigned char *in, size_t n, unsigned char *out)
+{
+	size_t 	x = 0;
+
+#if defined(__SSE2__)
+	/* Work out the colours in 16 bit lanes, pack them to bytes, then
+	   widen 16 pixels to 32 bits each and squeeze out every fourth
+	   byte. Each 16 byte store writes 4 bytes beyond its 12 pixel
+	   bytes, which the next store or the last two pixels overwrite. */
+	const __m128i f8 = _mm_set1_epi16(0xf8);
+	const __m128i fc = _mm_set1_epi16(0xfc);
+	const __m128i low3 = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+	const __m128i next3 = _mm_set_epi32(0xffff, (int) 0xff000000, 0xffff,
+		(int) 0xff000000);
+	const __m128i low8 = _mm_set_epi32(0, 0, -1, -1);
+
+	for (; x + 18 <= n; x += 16, out += 48) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (in + 2 * x));
+		__m128i b = _mm_loadu_si128((const __m128i *) (in + 2 * x + 16));
+		__m128i r, g, bl, rg, b0, q[4];
+		int 	k;
+
+		a = _mm_or_si128(_mm_srli_epi16(a, 8), _mm_slli_epi16(a, 8));
+		b = _mm_or_si128(_mm_srli_epi16(b, 8), _mm_slli_epi16(b, 8));
+		r = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(a, 8), f8),
+			_mm_and_si128(_mm_srli_epi16(b, 8), f8));
+		g = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(a, 3), fc),
+			_mm_and_si128(_mm_srli_epi16(b, 3), fc));
+		bl = _mm_packus_epi16(_mm_and_si128(_mm_slli_epi16(a, 3), f8),
+			_mm_and_si128(_mm_slli_epi16(b, 3), f8));
+
+		rg = _mm_unpacklo_epi8(r, g);
+		b0 = _mm_unpacklo_epi8(bl, _mm_setzero_si128());
+		q[0] = _mm_unpacklo_epi16(rg, b0);
+		q[1] = _mm_unpackhi_epi16(rg, b0);
+		rg = _mm_unpackhi_epi8(r, g);
+		b0 = _mm_unpackhi_epi8(bl, _mm_setzero_si128());
+		q[2] = _mm_unpacklo_epi16(rg, b0);
+		q[3] = _mm_unpackhi_epi16(rg, b0);
+
+		for (k = 0; k < 4; k++) {
+			__m128i v = q[k];
+
+			v = _mm_or_si128(_mm_and_si128(v, low3),
+				_mm_and_si128(_mm_srli_epi64(v, 8), next3));
+			v = _mm_or_si128(_mm_and_si128(v, low8),
+				_mm_srli_si128(_mm_andnot_si128(low8, v), 2));
+			_mm_storeu_si128((__m128i *) (out + 12 * k), v);
+		}
+	}
+#else
+	const uint8x16_t f8 = vdupq_n_u8(0xf8);
+	const uint8x16_t mask_1c = vdupq_n_u8(0x1c);
+
+	for (; x + 16 <= n; x += 16, out += 48) {
+		uint8x16x2_t v = vld2q_u8(in + 2 * x);
+		uint8x16x3_t o;
+
+		o.val[0] = vandq_u8(v.val[0], f8);
+		o.val[1] = vorrq_u8(vshlq_n_u8(v.val[0], 5),
+			vandq_u8(vshrq_n_u8(v.val[1], 3), mask_1c));
+		o.val[2] = vshlq_n_u8(v.val[1], 3);
+		vst3q_u8(out, o);
+	}
+#endif
+
+	return x;
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    Rgb565
+ *
+ * Summary:     Expand big endian RGB565 pixels to RGB
+ *
+ * Parameters:  Pixels, number of pixels, RGB pixels returned, whether
+ *		to use the vector kernel
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+Rgb565(const unsigned char *in, size_t n, unsigned char *out, int vector)
+{
+	size_t 	i = 0;
+
+#if SCREENSHOT_VECTOR
+	if (vector)
+		i = Rgb565Vector(in, n, out);
+#endif
+	for (; i < n; i++) {
+		out[i * 3] = in[i * 2] & 0xF8;
+		out[i * 3 + 1] = ((in[i * 2] & 0x07) << 5)
+			+ ((in[i * 2 + 1] & 0xE0) >> 3);
+		out[i * 3 + 2] = (in[i * 2 + 1] & 0x1F) << 3;
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_ScreenShot
+ *
+ * Summary:     Convert the pixel data of a screenshot to RGB
+ *
+ * Parameters:  Header, pixel data, its size, RGB pixels returned,
+ *		flags
+ *
+ * Returns:     1 on success, 0 on failure
+ *
+ ***********************************************************************/
+int
+unpack_ScreenShot(const struct ScreenShotHeader *h,
+	const unsigned char *data, size_t len, unsigned char *pixmap,
+	int flags)
+{
+	size_t 	pixels = (size_t) h->width * h->height,
+		i;
+	int 	vector = SCREENSHOT_VECTOR && !(flags & SCREENSHOT_SCALAR),
+		j,
+		k,
+		val,
+		mask = (1 << h->depth) - 1;
+
+	if (len < ScreenShot_data_size(h))
+		return 0;
+
+	switch (h->depth) {
+	case 1:
+	case 2:
+	case 4:
+		if (vector) {
+			if (h->depth == 1)
+				Grey1(data, pixels / 8, pixmap);
+			else if (h->depth == 2)
+				Grey2(data, pixels / 4, pixmap);
+			else
+				Grey4(data, pixels / 2, pixmap);
+			break;
+		}
+		for (i = 0; i < pixels / (8 / h->depth); i++) {
+			for (j = (8 / h->depth - 1), k = 0; j >= 0; j--, k++) {
+				/* get right bits */
+				val = ((data[i] >> (j * h->depth)) & mask);
+				/* invert */
+				val = mask - val;
+				/* stretch */
+				val *= (255 / mask);
+
+				pixmap[3 * (i * (8 / h->depth) + k)] = val;
+				pixmap[3 * (i * (8 / h->depth) + k) + 1] = val;
+				pixmap[3 * (i * (8 / h->depth) + k) + 2] = val;
+			}
+		}
+		break;
+
+	case 8:
+		/* The colour table is at the end of the data */
+		if (vector) {
+			Clut8(data, pixels, data + len - CLUT_SIZE, pixmap);
+			break;
+		}
+		for (i = 0; i < pixels; i++) {
+			const unsigned char *entry =
+				data + len - CLUT_SIZE + 4 * data[i];
+
+			pixmap[3 * i] = entry[1];
+			pixmap[3 * i + 1] = entry[2];
+			pixmap[3 * i + 2] = entry[3];
+		}
+		break;
+
+	case 16:
+		Rgb565(data, pixels, pixmap, vector);
+		break;
+
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
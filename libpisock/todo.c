@@ -84,6 +84,27 @@ free_ToDo(ToDo_t *todo)
  ***********************************************************************/
 int
 unpack_ToDo(ToDo_t *todo, const pi_buffer_t *buf, todoType type)
+{
+	return unpack_ToDo_arena(todo, buf, type, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_ToDo_arena
+ *
+ * Summary:     Unpack the ToDo structure from buffer, allocating the
+ *		strings from an arena
+ *
+ * Parameters:  ToDo_t*, pi_buffer_t * of buffer, todo type, arena (NULL to
+ *		allocate the strings with malloc)
+ *
+ * Returns:     -1 on fail, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_ToDo_arena(ToDo_t *todo, const pi_buffer_t *buf, todoType type,
+		  pi_arena_t *arena)
 {
 	unsigned long d;
 	int ofs;
@@ -136,16 +157,18 @@ unpack_ToDo(ToDo_t *todo, const pi_buffer_t *buf, todoType type)
 	if (buf->used - ofs < 1)
 		return -1;
 
-	todo->description = strdup((char *) buf->data + ofs);
+	todo->description = pi_arena_strdup(arena,
+		(char *) buf->data + ofs);
 
 	ofs += strlen(todo->description) + 1;
 
 	if (buf->used - ofs < 1) {
-		free(todo->description);
+		if (arena == NULL)
+			free(todo->description);
 		todo->description = 0;
 		return -1;
 	}
-	todo->note = strdup((char *) buf->data + ofs);
+	todo->note = pi_arena_strdup(arena, (char *) buf->data + ofs);
 
 	return 0;
 }
@@ -75,6 +75,72 @@ int crc16(unsigned char *ptr, int count)
 	return (crc & 0xFFFF);
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_hash64
+ *
+ * Summary:     MurmurHash64A by Austin Appleby (public domain), reading
+ *		the input as little-endian words so the result is the
+ *		same on every host
+ *
+ * Parameters:  data, length
+ *
+ * Returns:     64-bit hash
+ *
+ ***********************************************************************/
+#define PI_HASH_M	0xc6a4a7935bd1e995ULL
+#define PI_HASH_R	47
+#define PI_HASH_SEED	0x70696c6f742d6c6bULL	/* "pilot-lk" */
+
+uint64_t pi_hash64(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	const unsigned char *end = p + (len & ~(size_t) 7);
+	uint64_t h = PI_HASH_SEED ^ (len * PI_HASH_M),
+		k;
+
+	for (; p != end; p += 8) {
+		k = (uint64_t) p[0]
+		  | (uint64_t) p[1] << 8
+		  | (uint64_t) p[2] << 16
+		  | (uint64_t) p[3] << 24
+		  | (uint64_t) p[4] << 32
+		  | (uint64_t) p[5] << 40
+		  | (uint64_t) p[6] << 48
+		  | (uint64_t) p[7] << 56;
+
+		k *= PI_HASH_M;
+		k ^= k >> PI_HASH_R;
+		k *= PI_HASH_M;
+
+		h ^= k;
+		h *= PI_HASH_M;
+	}
+
+	switch (len & 7) {
+	case 7: h ^= (uint64_t) p[6] << 48;
+		/* FALLTHROUGH */
+	case 6: h ^= (uint64_t) p[5] << 40;
+		/* FALLTHROUGH */
+	case 5: h ^= (uint64_t) p[4] << 32;
+		/* FALLTHROUGH */
+	case 4: h ^= (uint64_t) p[3] << 24;
+		/* FALLTHROUGH */
+	case 3: h ^= (uint64_t) p[2] << 16;
+		/* FALLTHROUGH */
+	case 2: h ^= (uint64_t) p[1] << 8;
+		/* FALLTHROUGH */
+	case 1: h ^= (uint64_t) p[0];
+		h *= PI_HASH_M;
+	}
+
+	h ^= h >> PI_HASH_R;
+	h *= PI_HASH_M;
+	h ^= h >> PI_HASH_R;
+
+	return h;
+}
+
 void get_pilot_rate(int *establishrate, int *establishhighrate)
 {
 	/* Default PADP connection rate */
@@ -156,6 +156,511 @@ pack_VeoAppInfo(struct VeoAppInfo *appinfo, unsigned char *record, size_t len)
 	return (record - start);
 }
 
+/* Each data record holds four rows of the Bayer pattern */
+#define VEO_RECORD_ROWS	4
+
+/* A compressed pixel never takes more than 14 bits. Records are decoded
+   from a zero padded copy, so that a short or corrupt one can't make the
+   decoder read beyond it. */
+#define VEO_SCRATCH_SIZE(w)	((w) * VEO_RECORD_ROWS * 2 + 16)
+
+#define max(a,b) (( a > b ) ? a : b )
+#define min(a,b) (( a < b ) ? a : b )
+
+/* The raw Bayer pattern of a picture, split into its even and odd
+   columns so that every colour is a run of adjacent bytes:
+      even rows: G B G B ...   even columns green, odd columns blue
+      odd rows:  R G R G ...   even columns red, odd columns green */
+struct VeoPlanes {
+	int	width,		/* of each plane, half the picture width */
+		height;
+	unsigned char *even,
+		*odd;
+};
+
+/***********************************************************************
+ *
+ * Function:    DecodePixel
+ *
+ * Summary:     Decode the next pixel of a compressed record. A pixel is
+ *		one bit for a repeat of the previous value, or a 5 bit
+ *		difference to it, or a 5 bit zero followed by the full
+ *		8 bit value.
+ *
+ * Parameters:  Read position and bit within its byte, both updated,
+ *		and the previous value
+ *
+ * Returns:     The pixel
+ *
+ ***********************************************************************/
+static unsigned char
+DecodePixel(const unsigned char **inPP, int *shifterP, unsigned char prev)
+{
+	const unsigned char *inP = *inPP;
+	int 	shifter = *shifterP;
+	unsigned short tmp3, tmp4;
+	unsigned char value;
+
+	tmp3 = (1 << shifter) & *inP;
+	if (shifter == 0) {
+		shifter = 7;
+		inP++;
+	} else {
+		shifter--;
+	}
+
+	if (tmp3 != 0) {
+		value = prev;
+	} else {
+		tmp4 = (inP[0] << 8) | inP[1];
+		tmp4 = tmp4 << (7 - shifter);
+		if (shifter >= 5) {
+			shifter -= 5;
+		} else {
+			inP++;
+			shifter += 3;
+		}
+		tmp4 = tmp4 >> 11;
+
+		if (tmp4 == 0) {
+			tmp3 = (inP[0] << 8) | inP[1];
+			tmp3 = tmp3 << (7 - shifter);
+			inP++;
+			value = tmp3 >> 8;
+		} else if (tmp4 & 0x10) {
+			value = prev - (tmp4 & 0xf);
+		} else {
+			value = prev + (tmp4 & 0xf);
+		}
+	}
+
+	*inPP = inP;
+	*shifterP = shifter;
+	return value;
+}
+
+/***********************************************************************
+ *
+ * Function:    DecodeRecord
+ *
+ * Summary:     Decode one record of the picture, four rows of the Bayer
+ *		pattern. Each pair of rows is coded as the odd columns of
+ *		the first row, the even columns of the second, and then
+ *		the other two interleaved.
+ *
+ * Parameters:  Compressed record, zero padded, the four rows returned,
+ *		picture width
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+DecodeRecord(const unsigned char *inP, unsigned char *out, int w)
+{
+	int 	shifter = 7,
+		i,
+		j,
+		x;
+	unsigned char *outP;
+
+	for (j = 0; j < 2; j++, out += w * 2) {
+		for (i = 0; i < 2; i++) {
+			outP = i == 0 ? out + 1 : out + w;
+			if (shifter != 7) {
+				shifter = 7;
+				inP++;
+			}
+			outP[0] = *inP++;
+			for (x = 2; x < w; x += 2)
+				outP[x] = DecodePixel(&inP, &shifter,
+					outP[x - 2]);
+		}
+
+		if (shifter != 7) {
+			shifter = 7;
+			inP++;
+		}
+		out[0] = *inP++;
+		out[w + 1] = *inP++;
+		for (x = 2; x < w; x += 2) {
+			out[x] = DecodePixel(&inP, &shifter, out[x + w - 1]);
+			out[x + w + 1] = DecodePixel(&inP, &shifter, out[x]);
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    DecodePlanes
+ *
+ * Summary:     Decode all records of a picture into its planes
+ *
+ * Parameters:  State reading the records, planes
+ *
+ * Returns:     1 on success, 0 if a record can't be read
+ *
+ ***********************************************************************/
+static int
+DecodePlanes(VeoState_t *state, struct VeoPlanes *pl)
+{
+	int 	w = pl->width * 2,
+		rec,
+		row,
+		x;
+	unsigned char *scratch,
+		*rows;
+	void	*buffer;
+	size_t	bufsize,
+		scratch_size = VEO_SCRATCH_SIZE(w);
+
+	scratch = malloc(scratch_size + w * VEO_RECORD_ROWS);
+	if (scratch == NULL)
+		return 0;
+	rows = scratch + scratch_size;
+
+	for (rec = 0; rec * VEO_RECORD_ROWS < pl->height; rec++) {
+		if (state->getrecord(state, 1 + rec, &buffer, &bufsize) != 0) {
+			free(scratch);
+			return 0;
+		}
+		if (bufsize > scratch_size)
+			bufsize = scratch_size;
+		memcpy(scratch, buffer, bufsize);
+		memset(scratch + bufsize, 0, scratch_size - bufsize);
+
+		DecodeRecord(scratch, rows, w);
+
+		for (row = 0; row < VEO_RECORD_ROWS
+			     && rec * VEO_RECORD_ROWS + row < pl->height; row++) {
+			const unsigned char *src = rows + row * w;
+			size_t	offset = (size_t) (rec * VEO_RECORD_ROWS + row)
+				* pl->width;
+
+			for (x = 0; x < pl->width; x++) {
+				pl->even[offset + x] = src[2 * x];
+				pl->odd[offset + x] = src[2 * x + 1];
+			}
+		}
+	}
+
+	free(scratch);
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    SampleRows
+ *
+ * Summary:     Add the minimum and sum of each colour of two rows of the
+ *		Bayer pattern to the colour statistics
+ *
+ * Parameters:  Planes, even row number, minimums and sums of red, green
+ *		and blue
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+SampleRows(const struct VeoPlanes *pl, int row, unsigned char *mins,
+	   unsigned long *sums)
+{
+	const unsigned char *g0 = pl->even + row * pl->width,
+		*b0 = pl->odd + row * pl->width,
+		*r1 = pl->even + (row + 1) * pl->width,
+		*g1 = pl->odd + (row + 1) * pl->width;
+	int 	x;
+
+	for (x = 0; x < pl->width; x++) {
+		mins[0] = min(mins[0], r1[x]);
+		mins[1] = min(mins[1], g0[x]);
+		mins[1] = min(mins[1], g1[x]);
+		mins[2] = min(mins[2], b0[x]);
+		sums[0] += r1[x];
+		sums[1] += g0[x] + g1[x];
+		sums[2] += b0[x];
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    ColourCorrect
+ *
+ * Summary:     Work out the colour correction tables from the first
+ *		rows of the top, middle and bottom records of the picture
+ *
+ * Parameters:  Planes, red, green and blue tables returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+ColourCorrect(const struct VeoPlanes *pl, unsigned char *red,
+	      unsigned char *green, unsigned char *blue)
+{
+	unsigned char mins[3] = { 255, 255, 255 },
+		rMin, gMin, bMin;
+	unsigned long sums[3] = { 0, 0, 0 };
+	float 	gInc, rInc, bInc, gCur, rCur, bCur;
+	float 	rMean, gMean, bMean, maxMean;
+	float 	redCeiling = 254;
+	float 	greenCeiling = 252;
+	float 	blueCeiling = 255;
+	int 	height = pl->height,
+		rows[3],
+		i;
+
+	rows[0] = 0;
+	rows[1] = height / 2 / VEO_RECORD_ROWS * VEO_RECORD_ROWS;
+	rows[2] = (height - 1) / VEO_RECORD_ROWS * VEO_RECORD_ROWS;
+
+	for (i = 0; i < 3; i++) {
+		SampleRows(pl, rows[i], mins, sums);
+		if (pl->width * 2 == 640)
+			SampleRows(pl, rows[i] + 2, mins, sums);
+	}
+	rMin = mins[0];
+	gMin = mins[1];
+	bMin = mins[2];
+
+	/* The sums are small enough for a float to hold them exactly. The
+	   divisors assume a 640 pixel wide picture, as they always have. */
+	rMean = (float) sums[0] / (640 * 3);
+	gMean = (float) sums[1] / (640 * 6);
+	bMean = (float) sums[2] / (640 * 3);
+
+	maxMean = max(gMean - gMin, max(bMean - bMin, rMean - rMin));
+
+	rInc = maxMean / (rMean - rMin);
+	gInc = maxMean / (gMean - gMin);
+	bInc = maxMean / (bMean - bMin);
+
+	rCur = 0;
+	gCur = 0;
+	bCur = 0;
+
+	for (i = 0; i < 256; i++) {
+		if (i < rMin) {
+			red[i] = 0;
+		} else {
+			red[i] = rCur < redCeiling ? rCur : redCeiling;
+			rCur += rInc;
+		}
+
+		if (i < gMin) {
+			green[i] = 0;
+		} else {
+			green[i] = gCur < greenCeiling ? gCur : greenCeiling;
+			gCur += gInc;
+		}
+
+		if (i < bMin) {
+			blue[i] = 0;
+		} else {
+			blue[i] = bCur < blueCeiling ? bCur : blueCeiling;
+			bCur += bInc;
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    BiasTable
+ *
+ *		Bias is based on the Fast Alternative to Perlin's Bias
+ *		algorithm in Graphics Gems IV by
+ *		Christophe Schlick schlick@labri.u-bordeuax.fr
+ *
+ * Summary:     Pass a colour table through the bias curve
+ *
+ * Parameters:  Bias, 0..1, table
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+BiasTable(double bias, unsigned char *table)
+{
+	int 	i;
+	double 	num, denom, t;
+
+	for (i = 0; i < 256; i++) {
+		t = (double) table[i] / 256.0;
+		num = t;
+		denom = (1.0 / bias - 2) * (1.0 - t) + 1;
+		table[i] = num / denom * 256.0;
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    InterpolateRow
+ *
+ * Summary:     Interpolate one row of the picture from its row of the
+ *		Bayer pattern and the ones above and below, into the red,
+ *		green and blue of its even and odd pixels. Everything
+ *		but the first and last pixel pair is worked out with the
+ *		same arithmetic on adjacent bytes, which compilers turn
+ *		into vector code.
+ *
+ * Parameters:  Planes, row, six half rows returned: red, green and blue
+ *		of the even pixels, then of the odd pixels
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+InterpolateRow(const struct VeoPlanes *pl, int r, unsigned char **out)
+{
+	int 	n = pl->width,
+		last = n - 1,
+		i;
+	size_t 	a = (size_t) (r > 0 ? r - 1 : r) * n,
+		b = (size_t) r * n,
+		c = (size_t) (r < pl->height - 1 ? r + 1 : r) * n;
+	const unsigned char *AE = pl->even + a, *AO = pl->odd + a,
+		*BE = pl->even + b, *BO = pl->odd + b,
+		*CE = pl->even + c, *CO = pl->odd + c;
+	unsigned char *re = out[0], *ge = out[1], *be = out[2],
+		*ro = out[3], *go = out[4], *bo = out[5];
+
+	if (r % 2 == 0) {
+		/* green blue center */
+		for (i = 0; i < n; i++) {
+			re[i] = (AE[i] + CE[i]) >> 1;
+			ge[i] = BE[i];
+			bo[i] = BO[i];
+		}
+		be[0] = BO[0];
+		for (i = 1; i < n; i++)
+			be[i] = (BO[i - 1] + BO[i]) >> 1;
+
+		/* blue center */
+		for (i = 0; i < last; i++) {
+			ro[i] = (AE[i] + CE[i] + AE[i + 1] + CE[i + 1]) >> 2;
+			go[i] = (AO[i] + BE[i] + BE[i + 1] + CO[i]) >> 2;
+		}
+		ro[last] = (AE[last] + CE[last]) >> 1;
+		go[last] = (AO[last] + BE[last] + CO[last]) / 3;
+	} else {
+		/* red center */
+		re[0] = BE[0];
+		ge[0] = (AE[0] + BO[0] + CE[0]) / 3;
+		be[0] = (AO[0] + CO[0]) >> 1;
+		for (i = 1; i < n; i++) {
+			re[i] = BE[i];
+			ge[i] = (AE[i] + BO[i - 1] + BO[i] + CE[i]) >> 2;
+			be[i] = (AO[i - 1] + AO[i] + CO[i - 1] + CO[i]) >> 2;
+		}
+
+		/* green red center */
+		for (i = 0; i < last; i++)
+			ro[i] = (BE[i] + BE[i + 1]) >> 1;
+		ro[last] = BE[last];
+		for (i = 0; i < n; i++) {
+			go[i] = BO[i];
+			bo[i] = (AO[i] + CO[i]) >> 1;
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_VeoPicture
+ *
+ * Summary:     Decode a picture into an RGB pixmap. The records are
+ *		decoded once into the planes of the Bayer pattern, then
+ *		the picture is interpolated row by row, and the colour
+ *		correction and bias are applied through one table for
+ *		each colour.
+ *
+ * Parameters:  State reading the records, picture header
+ *
+ * Returns:     1 on success, 0 on failure
+ *
+ ***********************************************************************/
+int
+unpack_VeoPicture(VeoState_t *state, const Veo_t *v)
+{
+	struct VeoPlanes pl;
+	size_t 	plane_size;
+	unsigned char lut[3][256],
+		*half[6],
+		*pp;
+	int 	r,
+		i,
+		k;
+
+	state->pixmap = NULL;
+	if (!((v->width == 640 && v->height == 480)
+	      || (v->width == 320 && v->height == 240)))
+		return 0;
+
+	pl.width = v->width / 2;
+	pl.height = v->height;
+	plane_size = (size_t) pl.width * pl.height;
+	pl.even = malloc(plane_size * 2);
+	half[0] = malloc(pl.width * 6);
+	state->pixmap = malloc((size_t) v->width * v->height * 3);
+	if (pl.even == NULL || half[0] == NULL || state->pixmap == NULL)
+		goto fail;
+	pl.odd = pl.even + plane_size;
+	if (!DecodePlanes(state, &pl))
+		goto fail;
+	for (k = 1; k < 6; k++)
+		half[k] = half[0] + k * pl.width;
+
+	if (state->flags & VEO_COLOUR_CORRECT) {
+		ColourCorrect(&pl, lut[0], lut[1], lut[2]);
+	} else {
+		for (i = 0; i < 256; i++)
+			lut[0][i] = lut[1][i] = lut[2][i] = i;
+	}
+	if (state->flags & VEO_BIAS) {
+		for (k = 0; k < 3; k++)
+			BiasTable((double) state->bias / 100.0, lut[k]);
+	}
+
+	for (r = 0, pp = state->pixmap; r < v->height; r++) {
+		InterpolateRow(&pl, r, half);
+		for (i = 0; i < pl.width; i++, pp += 6) {
+			pp[0] = lut[0][half[0][i]];
+			pp[1] = lut[1][half[1][i]];
+			pp[2] = lut[2][half[2][i]];
+			pp[3] = lut[0][half[3][i]];
+			pp[4] = lut[1][half[4][i]];
+			pp[5] = lut[2][half[5][i]];
+		}
+	}
+
+	free(pl.even);
+	free(half[0]);
+	return 1;
+
+fail:
+	free(pl.even);
+	free(half[0]);
+	free_VeoPicture(state);
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    free_VeoPicture
+ *
+ * Summary:     Free the pixmap of a decoded picture
+ *
+ * Parameters:  State
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+free_VeoPicture(VeoState_t *state)
+{
+	free(state->pixmap);
+	state->pixmap = NULL;
+}
+
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* ex: set tabstop=4 expandtab: */
 /* Local Variables: */
@@ -0,0 +1,556 @@
+/*
+ * cache.c:  Content hashes of device records from the last sync
+ *
+ * A SyncCache remembers, for one database of one user, the hash,
+ * category and attributes of every device record as of the end of the
+ * last successful sync. During a slow sync the engine can then tell
+ * whether a device record changed since that sync from its hash alone,
+ * instead of asking the conduit to compare it with the desktop record.
+ *
+ * The cache can also keep the record bodies themselves, which three-way
+ * merges use as the common ancestor of a record changed on both sides.
+ *
+ * The cache file is a 12 byte header ('PSYC', version, number of
+ * entries) followed by one 16 byte entry per record: record ID, category,
+ * attributes, two bytes of padding and the 64-bit hash. In version 2 each
+ * entry is followed by the length of the body, 0 if not kept, and the
+ * body. All numbers are big-endian.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-dlp.h"
+#include "pi-util.h"
+#include "pi-sync.h"
+
+#define CACHE_VERSION		1
+#define CACHE_VERSION_BODIES	2
+#define CACHE_HEADER_SIZE	12
+#define CACHE_ENTRY_SIZE	16
+
+typedef struct _SyncCacheEntry {
+	recordid_t recID;
+	int 	catID,
+		attrs;
+	uint64_t hash;
+	unsigned char *body;	/* NULL if not kept */
+	size_t	len;
+} SyncCacheEntry;
+
+struct _SyncCache {
+	char 	*path;
+
+	/* Open addressing table, recID 0 marks a free slot */
+	SyncCacheEntry *table;
+	int 	size,
+		used;
+};
+
+/***********************************************************************
+ *
+ * Function:    cache_slot
+ *
+ * Summary:     Find the slot of a record ID, or the free slot where it
+ *		goes
+ *
+ * Parameters:  Cache, record ID
+ *
+ * Returns:     Slot number
+ *
+ ***********************************************************************/
+static int cache_slot(const SyncCache *cache, recordid_t id)
+{
+	unsigned long h = (unsigned long) id * 2654435761UL;
+	int 	slot = (int) ((h ^ (h >> 16)) & (cache->size - 1));
+
+	while (cache->table[slot].recID != 0
+	       && cache->table[slot].recID != id)
+		slot = (slot + 1) & (cache->size - 1);
+
+	return slot;
+}
+
+/***********************************************************************
+ *
+ * Function:    cache_grow
+ *
+ * Summary:     Make room for one more entry
+ *
+ * Parameters:  Cache
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+static int cache_grow(SyncCache *cache)
+{
+	int 	i,
+		old_size = cache->size;
+	SyncCacheEntry *old = cache->table;
+
+	if ((cache->used + 1) * 2 <= cache->size)
+		return 0;
+
+	cache->size = old_size ? old_size * 2 : 256;
+	cache->table = (SyncCacheEntry *) calloc(cache->size,
+		sizeof(SyncCacheEntry));
+	if (cache->table == NULL) {
+		cache->table = old;
+		cache->size = old_size;
+		return PI_ERR_GENERIC_MEMORY;
+	}
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].recID != 0)
+			cache->table[cache_slot(cache, old[i].recID)] = old[i];
+	free(old);
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    read_body
+ *
+ * Summary:     Read the body following an entry of a version 2 cache
+ *		file
+ *
+ * Parameters:  File, body and length (output); body is set to NULL if
+ *		the entry has none
+ *
+ * Returns:     0 on success, -1 if the file is truncated or out of
+ *		memory
+ *
+ ***********************************************************************/
+static int read_body(FILE *f, unsigned char **body, size_t *len)
+{
+	unsigned char size[4];
+
+	*body = NULL;
+	if (fread(size, 4, 1, f) != 1)
+		return -1;
+
+	*len = get_long(size);
+	if (*len == 0)
+		return 0;
+
+	*body = (unsigned char *) malloc(*len);
+	if (*body == NULL || fread(*body, *len, 1, f) != 1) {
+		free(*body);
+		*body = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_OpenCache
+ *
+ * Summary:     Load the hash cache of a database. A missing or damaged
+ *		cache file gives an empty cache, so the first sync simply
+ *		doesn't benefit from it.
+ *
+ * Parameters:  Directory of the cache files, user ID of the handheld,
+ *		database name
+ *
+ * Returns:     The cache, or NULL if out of memory
+ *
+ ***********************************************************************/
+SyncCache *sync_OpenCache(const char *dir, unsigned long user_id,
+			  const char *db_name)
+{
+	int 	i,
+		count,
+		bodies;
+	char 	*p;
+	unsigned char header[CACHE_HEADER_SIZE],
+		entry[CACHE_ENTRY_SIZE],
+		*body = NULL;
+	size_t	len;
+	SyncCache *cache;
+	FILE 	*f;
+
+	cache = (SyncCache *) malloc(sizeof(SyncCache));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(SyncCache));
+
+	cache->path = (char *) malloc(strlen(dir) + strlen(db_name) + 32);
+	if (cache->path == NULL) {
+		free(cache);
+		return NULL;
+	}
+	sprintf(cache->path, "%s/%lu-", dir, user_id);
+	p = cache->path + strlen(cache->path);
+	for (; *db_name; db_name++)
+		*p++ = (*db_name == '/') ? '_' : *db_name;
+	strcpy(p, ".hash");
+
+	f = fopen(cache->path, "rb");
+	if (f == NULL)
+		return cache;
+
+	if (fread(header, CACHE_HEADER_SIZE, 1, f) != 1
+	    || memcmp(header, "PSYC", 4) != 0
+	    || (get_long(header + 4) != CACHE_VERSION
+		&& get_long(header + 4) != CACHE_VERSION_BODIES)) {
+		fclose(f);
+		return cache;
+	}
+	bodies = get_long(header + 4) == CACHE_VERSION_BODIES;
+
+	count = (int) get_long(header + 8);
+	for (i = 0; i < count; i++) {
+		if (fread(entry, CACHE_ENTRY_SIZE, 1, f) != 1
+		    || (bodies && read_body(f, &body, &len) < 0)) {
+			/* Truncated, forget it all */
+			sync_CacheClear(cache);
+			break;
+		}
+		sync_CacheSet(cache, get_long(entry), get_byte(entry + 4),
+			      get_byte(entry + 5),
+			      ((uint64_t) get_long(entry + 8) << 32)
+			      | get_long(entry + 12));
+		if (body != NULL) {
+			SyncCacheEntry *e =
+				&cache->table[cache_slot(cache, get_long(entry))];
+
+			if (e->recID != 0) {
+				e->body = body;
+				e->len = len;
+			} else {
+				free(body);
+			}
+			body = NULL;
+		}
+	}
+	fclose(f);
+
+	return cache;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_SaveCache
+ *
+ * Summary:     Write a cache back to its file. The engine does this after
+ *		each successful sync of a handler with a cache.
+ *
+ * Parameters:  Cache
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_SYSTEM if the file can't be
+ *		written
+ *
+ ***********************************************************************/
+int sync_SaveCache(SyncCache *cache)
+{
+	int 	i,
+		count = 0,
+		bodies = 0,
+		ok;
+	char 	*tmp;
+	unsigned char header[CACHE_HEADER_SIZE],
+		entry[CACHE_ENTRY_SIZE + 4];
+	FILE 	*f;
+
+	tmp = (char *) malloc(strlen(cache->path) + 5);
+	if (tmp == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	sprintf(tmp, "%s.new", cache->path);
+
+	f = fopen(tmp, "wb");
+	if (f == NULL) {
+		free(tmp);
+		return PI_ERR_GENERIC_SYSTEM;
+	}
+
+	for (i = 0; i < cache->size; i++) {
+		if (cache->table[i].recID != 0)
+			count++;
+		if (cache->table[i].body != NULL)
+			bodies = 1;
+	}
+
+	memcpy(header, "PSYC", 4);
+	set_long(header + 4, bodies ? CACHE_VERSION_BODIES : CACHE_VERSION);
+	set_long(header + 8, count);
+	ok = fwrite(header, CACHE_HEADER_SIZE, 1, f) == 1;
+
+	for (i = 0; ok && i < cache->size; i++) {
+		const SyncCacheEntry *e = &cache->table[i];
+
+		if (e->recID == 0)
+			continue;
+		set_long(entry, e->recID);
+		set_byte(entry + 4, e->catID);
+		set_byte(entry + 5, e->attrs);
+		set_short(entry + 6, 0);
+		set_long(entry + 8, (unsigned long) (e->hash >> 32));
+		set_long(entry + 12, (unsigned long) (e->hash & 0xffffffffUL));
+		set_long(entry + CACHE_ENTRY_SIZE, e->body ? e->len : 0);
+		ok = fwrite(entry, CACHE_ENTRY_SIZE + (bodies ? 4 : 0), 1,
+			    f) == 1;
+		if (ok && e->body != NULL)
+			ok = fwrite(e->body, e->len, 1, f) == 1;
+	}
+
+	if (fclose(f) != 0)
+		ok = 0;
+	if (ok)
+		ok = rename(tmp, cache->path) == 0;
+	if (!ok)
+		remove(tmp);
+	free(tmp);
+
+	return ok ? 0 : PI_ERR_GENERIC_SYSTEM;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_FreeCache
+ *
+ * Summary:     Free a cache without saving it
+ *
+ * Parameters:  Cache
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_FreeCache(SyncCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	sync_CacheClear(cache);
+	free(cache->table);
+	free(cache->path);
+	free(cache);
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheLookup
+ *
+ * Summary:     Look up what a device record looked like at the end of
+ *		the last sync
+ *
+ * Parameters:  Cache, record ID, category, attributes and hash (each
+ *		may be NULL)
+ *
+ * Returns:     1 if the record is known, 0 otherwise
+ *
+ ***********************************************************************/
+int sync_CacheLookup(const SyncCache *cache, recordid_t id, int *catID,
+		     int *attrs, uint64_t *hash)
+{
+	const SyncCacheEntry *e;
+
+	if (cache->size == 0 || id == 0)
+		return 0;
+
+	e = &cache->table[cache_slot(cache, id)];
+	if (e->recID == 0)
+		return 0;
+
+	if (catID)
+		*catID = e->catID;
+	if (attrs)
+		*attrs = e->attrs;
+	if (hash)
+		*hash = e->hash;
+
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheSet
+ *
+ * Summary:     Record the current state of a device record
+ *
+ * Parameters:  Cache, record ID, category, attributes, hash of the data
+ *		(see pi_hash64())
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+int sync_CacheSet(SyncCache *cache, recordid_t id, int catID, int attrs,
+		  uint64_t hash)
+{
+	SyncCacheEntry *e;
+
+	if (id == 0)
+		return 0;
+
+	if (cache_grow(cache) < 0)
+		return PI_ERR_GENERIC_MEMORY;
+
+	e = &cache->table[cache_slot(cache, id)];
+	if (e->recID == 0) {
+		cache->used++;
+		e->body = NULL;
+	} else if (e->hash != hash) {
+		/* The body kept is from before the change */
+		free(e->body);
+		e->body = NULL;
+	}
+
+	e->recID = id;
+	e->catID = catID & 0xff;
+	e->attrs = attrs & 0xff;
+	e->hash  = hash;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheSetBody
+ *
+ * Summary:     Keep the body of a device record along with its hash, for
+ *		three-way merges
+ *
+ * Parameters:  Cache, record ID, data, length
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory,
+ *		PI_ERR_GENERIC_ARGUMENT if the record isn't in the cache
+ *
+ ***********************************************************************/
+int sync_CacheSetBody(SyncCache *cache, recordid_t id, const void *data,
+		      size_t len)
+{
+	unsigned char *body;
+	SyncCacheEntry *e;
+
+	if (cache->size == 0 || id == 0)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	e = &cache->table[cache_slot(cache, id)];
+	if (e->recID == 0)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	if (e->body != NULL && e->len == len
+	    && memcmp(e->body, data, len) == 0)
+		return 0;
+
+	body = (unsigned char *) malloc(len ? len : 1);
+	if (body == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	memcpy(body, data, len);
+
+	free(e->body);
+	e->body = body;
+	e->len = len;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheBody
+ *
+ * Summary:     Get the body a device record had at the end of the last
+ *		sync, if kept
+ *
+ * Parameters:  Cache, record ID, data and length (output). The data
+ *		stays valid until the record is changed in the cache.
+ *
+ * Returns:     1 if the body is known, 0 otherwise
+ *
+ ***********************************************************************/
+int sync_CacheBody(const SyncCache *cache, recordid_t id, const void **data,
+		   size_t *len)
+{
+	const SyncCacheEntry *e;
+
+	if (cache->size == 0 || id == 0)
+		return 0;
+
+	e = &cache->table[cache_slot(cache, id)];
+	if (e->recID == 0 || e->body == NULL)
+		return 0;
+
+	*data = e->body;
+	*len = e->len;
+
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheRemove
+ *
+ * Summary:     Forget a device record that was deleted
+ *
+ * Parameters:  Cache, record ID
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_CacheRemove(SyncCache *cache, recordid_t id)
+{
+	int 	slot,
+		next;
+
+	if (cache->size == 0 || id == 0)
+		return;
+
+	slot = cache_slot(cache, id);
+	if (cache->table[slot].recID == 0)
+		return;
+
+	/* Backward shift deletion keeps the probe sequences intact */
+	free(cache->table[slot].body);
+	cache->table[slot].body = NULL;
+	cache->table[slot].recID = 0;
+	cache->used--;
+	next = (slot + 1) & (cache->size - 1);
+	while (cache->table[next].recID != 0) {
+		SyncCacheEntry e = cache->table[next];
+
+		cache->table[next].recID = 0;
+		cache->table[next].body = NULL;
+		cache->table[cache_slot(cache, e.recID)] = e;
+		next = (next + 1) & (cache->size - 1);
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_CacheClear
+ *
+ * Summary:     Forget all records, e.g. after the database was emptied
+ *
+ * Parameters:  Cache
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_CacheClear(SyncCache *cache)
+{
+	int 	i;
+
+	for (i = 0; i < cache->size; i++)
+		if (cache->table[i].recID != 0)
+			free(cache->table[i].body);
+	if (cache->size > 0)
+		memset(cache->table, 0, cache->size * sizeof(SyncCacheEntry));
+	cache->used = 0;
+}
@@ -0,0 +1,593 @@
+/*
+ * index.c:  Hash indexed desktop records for SyncHandler conduits
+ *
+ * A conduit adds all its desktop records to a SyncIndex before the sync,
+ * and sync_UseIndex() installs Match, FreeMatch, ForEach and
+ * ForEachModified callbacks working on it. Matching a device record is
+ * then a single hash table lookup instead of a search of the desktop
+ * records, and ForEachModified only visits the records that were modified
+ * instead of all of them.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pi-dlp.h"
+#include "pi-sync.h"
+
+#define MODIFIED_FLAGS	(dlpRecAttrDirty | dlpRecAttrDeleted | dlpRecAttrArchived)
+
+/* Table slot of a record hashed under an ID it no longer has */
+#define TOMBSTONE	-1
+
+struct _SyncIndex {
+	/* Desktop records in the order they were added */
+	DesktopRecord **records;
+	unsigned char *dirty;
+	int 	count,
+		allocated;
+
+	/* ID each record is hashed under, 0 if none */
+	recordid_t *ids;
+
+	/* Open addressing table of record numbers + 1, keyed by recID.
+	   When a record's ID changes its old slot becomes a TOMBSTONE,
+	   which lookups skip and new entries reuse. table_used counts
+	   the tombstones too, so that probes always end. */
+	int 	*table;
+	int 	table_size,
+		table_used;
+
+	/* Open addressing table of record numbers + 1, keyed by the
+	   address of the record, to find a record being updated */
+	int 	*by_record;
+	int 	by_record_size;
+
+	/* Record numbers of the modified records */
+	int 	*modified;
+	int 	num_modified;
+
+	int 	each,
+		each_modified;
+};
+
+/***********************************************************************
+ *
+ * Function:    index_slot
+ *
+ * Summary:     First table slot for a record ID
+ *
+ * Parameters:  Index, record ID
+ *
+ * Returns:     Slot number
+ *
+ ***********************************************************************/
+static int index_slot(const SyncIndex *index, recordid_t id)
+{
+	unsigned long h = (unsigned long) id * 2654435761UL;
+
+	return (int) ((h ^ (h >> 16)) & (index->table_size - 1));
+}
+
+/***********************************************************************
+ *
+ * Function:    record_slot
+ *
+ * Summary:     First by_record slot for a desktop record
+ *
+ * Parameters:  Index, desktop record
+ *
+ * Returns:     Slot number
+ *
+ ***********************************************************************/
+static int record_slot(const SyncIndex *index, const DesktopRecord *drecord)
+{
+	unsigned long h = (unsigned long) ((uintptr_t) drecord >> 3)
+		* 2654435761UL;
+
+	return (int) ((h ^ (h >> 16)) & (index->by_record_size - 1));
+}
+
+/***********************************************************************
+ *
+ * Function:    index_hash
+ *
+ * Summary:     Enter a record in the hash table under its current ID,
+ *		growing the table as needed
+ *
+ * Parameters:  Index, record number
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+static int index_hash(SyncIndex *index, int n)
+{
+	int 	slot;
+	recordid_t id = index->records[n]->recID;
+
+	if ((index->table_used + 1) * 2 > index->table_size) {
+		int 	i,
+			live = 0,
+			*old = index->table,
+			old_size = index->table_size,
+			size = old_size ? old_size * 2 : 64,
+			*table;
+
+		/* Tombstones are dropped here, and if they were most of
+		   the table it is rebuilt at the same size */
+		for (i = 0; i < old_size; i++)
+			if (old[i] > 0)
+				live++;
+		if ((live + 1) * 4 <= old_size)
+			size = old_size;
+
+		table = (int *) calloc(size, sizeof(int));
+		if (table == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		index->table = table;
+		index->table_size = size;
+		index->table_used = 0;
+
+		for (i = 0; i < old_size; i++) {
+			if (old[i] <= 0)
+				continue;
+			slot = index_slot(index, index->ids[old[i] - 1]);
+			while (table[slot] != 0)
+				slot = (slot + 1) & (size - 1);
+			table[slot] = old[i];
+			index->table_used++;
+		}
+		free(old);
+	}
+
+	slot = index_slot(index, id);
+	while (index->table[slot] > 0)
+		slot = (slot + 1) & (index->table_size - 1);
+	if (index->table[slot] == 0)
+		index->table_used++;
+	index->table[slot] = n + 1;
+	index->ids[n] = id;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_unhash
+ *
+ * Summary:     Remove a record from the hash table, leaving a tombstone
+ *		in its slot
+ *
+ * Parameters:  Index, record number
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void index_unhash(SyncIndex *index, int n)
+{
+	int 	slot;
+
+	if (index->ids[n] == 0)
+		return;
+
+	slot = index_slot(index, index->ids[n]);
+	while (index->table[slot] != 0) {
+		if (index->table[slot] == n + 1) {
+			index->table[slot] = TOMBSTONE;
+			break;
+		}
+		slot = (slot + 1) & (index->table_size - 1);
+	}
+	index->ids[n] = 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_find
+ *
+ * Summary:     Look up the record with the given ID
+ *
+ * Parameters:  Index, record ID
+ *
+ * Returns:     Record number, or -1 if not found
+ *
+ ***********************************************************************/
+static int index_find(const SyncIndex *index, recordid_t id)
+{
+	int 	slot;
+
+	if (index->table_size == 0 || id == 0)
+		return -1;
+
+	slot = index_slot(index, id);
+	while (index->table[slot] != 0) {
+		int 	n = index->table[slot] - 1;
+
+		if (n >= 0 && index->ids[n] == id
+		    && index->records[n]->recID == id)
+			return n;
+		slot = (slot + 1) & (index->table_size - 1);
+	}
+
+	return -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_record
+ *
+ * Summary:     Find the number of a record in the index
+ *
+ * Parameters:  Index, desktop record
+ *
+ * Returns:     Record number, or -1 if the record was never added
+ *
+ ***********************************************************************/
+static int index_record(const SyncIndex *index, const DesktopRecord *drecord)
+{
+	int 	slot;
+
+	if (index->by_record_size == 0)
+		return -1;
+
+	slot = record_slot(index, drecord);
+	while (index->by_record[slot] != 0) {
+		int 	n = index->by_record[slot] - 1;
+
+		if (index->records[n] == drecord)
+			return n;
+		slot = (slot + 1) & (index->by_record_size - 1);
+	}
+
+	return -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_by_record
+ *
+ * Summary:     Enter a new record in the by_record table, growing it
+ *		along with the record array
+ *
+ * Parameters:  Index, record number
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+static int index_by_record(SyncIndex *index, int n)
+{
+	int 	i,
+		slot;
+
+	if ((n + 1) * 2 > index->by_record_size) {
+		int 	size = index->by_record_size
+			? index->by_record_size * 2 : 128,
+			*table;
+
+		table = (int *) calloc(size, sizeof(int));
+		if (table == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		free(index->by_record);
+		index->by_record = table;
+		index->by_record_size = size;
+
+		/* Records are never removed, so all of them are entered
+		   again */
+		for (i = 0; i < n; i++) {
+			slot = record_slot(index, index->records[i]);
+			while (table[slot] != 0)
+				slot = (slot + 1) & (size - 1);
+			table[slot] = i + 1;
+		}
+	}
+
+	slot = record_slot(index, index->records[n]);
+	while (index->by_record[slot] != 0)
+		slot = (slot + 1) & (index->by_record_size - 1);
+	index->by_record[slot] = n + 1;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_NewIndex
+ *
+ * Summary:     Create an empty index of desktop records
+ *
+ * Parameters:  None
+ *
+ * Returns:     The new index, or NULL if out of memory
+ *
+ ***********************************************************************/
+SyncIndex *sync_NewIndex(void)
+{
+	SyncIndex *index;
+
+	index = (SyncIndex *) malloc(sizeof(SyncIndex));
+	if (index != NULL)
+		memset(index, 0, sizeof(SyncIndex));
+
+	return index;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_FreeIndex
+ *
+ * Summary:     Free an index. The desktop records themselves belong to
+ *		the conduit and are not freed.
+ *
+ * Parameters:  The index
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_FreeIndex(SyncIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->records);
+	free(index->dirty);
+	free(index->ids);
+	free(index->table);
+	free(index->by_record);
+	free(index->modified);
+	free(index);
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_IndexAdd
+ *
+ * Summary:     Add a desktop record to an index. Records added with the
+ *		dirty, deleted or archived flag set are visited by
+ *		ForEachModified. A conduit's AddRecord callback should add
+ *		the records it creates.
+ *
+ * Parameters:  Index, desktop record, which must stay valid as long as
+ *		the index is used
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+int sync_IndexAdd(SyncIndex *index, DesktopRecord *drecord)
+{
+	int 	n;
+
+	if (index->count == index->allocated) {
+		int 	size = index->allocated ? index->allocated * 2 : 64;
+		DesktopRecord **records;
+		unsigned char *dirty;
+		recordid_t *ids;
+		int 	*modified;
+
+		records = (DesktopRecord **) realloc(index->records,
+			size * sizeof(DesktopRecord *));
+		if (records == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		index->records = records;
+
+		dirty = (unsigned char *) realloc(index->dirty, size);
+		if (dirty == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		index->dirty = dirty;
+
+		ids = (recordid_t *) realloc(index->ids,
+			size * sizeof(recordid_t));
+		if (ids == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		index->ids = ids;
+
+		modified = (int *) realloc(index->modified, size * sizeof(int));
+		if (modified == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		index->modified = modified;
+
+		index->allocated = size;
+	}
+
+	n = index->count;
+	index->records[n] = drecord;
+	index->dirty[n] = 0;
+	index->ids[n] = 0;
+
+	if (index_by_record(index, n) < 0
+	    || (drecord->recID != 0 && index_hash(index, n) < 0))
+		return PI_ERR_GENERIC_MEMORY;
+	index->count++;
+
+	if (drecord->flags & MODIFIED_FLAGS) {
+		index->dirty[n] = 1;
+		index->modified[index->num_modified++] = n;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_IndexUpdate
+ *
+ * Summary:     Tell an index that a desktop record changed: its recID was
+ *		changed (e.g. in SetPilotID) or it was modified and should
+ *		be visited by ForEachModified
+ *
+ * Parameters:  Index, desktop record previously added
+ *
+ * Returns:     0 on success, PI_ERR_GENERIC_MEMORY if out of memory,
+ *		PI_ERR_GENERIC_ARGUMENT if the record is not in the index
+ *
+ ***********************************************************************/
+int sync_IndexUpdate(SyncIndex *index, DesktopRecord *drecord)
+{
+	int 	n;
+
+	n = index_record(index, drecord);
+	if (n < 0)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	if (index->ids[n] != drecord->recID) {
+		index_unhash(index, n);
+		if (drecord->recID != 0 && index_hash(index, n) < 0)
+			return PI_ERR_GENERIC_MEMORY;
+	}
+
+	if ((drecord->flags & MODIFIED_FLAGS) && !index->dirty[n]) {
+		index->dirty[n] = 1;
+		index->modified[index->num_modified++] = n;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_IndexFind
+ *
+ * Summary:     Look up a desktop record by device record ID
+ *
+ * Parameters:  Index, record ID
+ *
+ * Returns:     The desktop record, or NULL if none has that ID
+ *
+ ***********************************************************************/
+DesktopRecord *sync_IndexFind(const SyncIndex *index, recordid_t id)
+{
+	int 	n = index_find(index, id);
+
+	return n < 0 ? NULL : index->records[n];
+}
+
+/***********************************************************************
+ *
+ * Function:    index_Match
+ *
+ * Summary:     Match callback: find the desktop record of a device
+ *		record
+ *
+ * Parameters:  None
+ *
+ * Returns:     0
+ *
+ ***********************************************************************/
+static int
+index_Match(SyncHandler *sh, PilotRecord *precord, DesktopRecord **drecord)
+{
+	*drecord = sync_IndexFind(sh->index, precord->recID);
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_FreeMatch
+ *
+ * Summary:     FreeMatch callback: matches are the conduit's own records,
+ *		nothing to free
+ *
+ * Parameters:  None
+ *
+ * Returns:     0
+ *
+ ***********************************************************************/
+static int index_FreeMatch(SyncHandler *sh, DesktopRecord *drecord)
+{
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_ForEach
+ *
+ * Summary:     ForEach callback: visit the records in the order they
+ *		were added
+ *
+ * Parameters:  None
+ *
+ * Returns:     0
+ *
+ ***********************************************************************/
+static int index_ForEach(SyncHandler *sh, DesktopRecord **drecord)
+{
+	SyncIndex *index = sh->index;
+
+	if (*drecord == NULL)
+		index->each = 0;
+
+	*drecord = index->each < index->count
+		? index->records[index->each++] : NULL;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    index_ForEachModified
+ *
+ * Summary:     ForEachModified callback: visit the records that were
+ *		added or updated modified and still are
+ *
+ * Parameters:  None
+ *
+ * Returns:     0
+ *
+ ***********************************************************************/
+static int index_ForEachModified(SyncHandler *sh, DesktopRecord **drecord)
+{
+	SyncIndex *index = sh->index;
+
+	if (*drecord == NULL)
+		index->each_modified = 0;
+
+	*drecord = NULL;
+	while (index->each_modified < index->num_modified) {
+		DesktopRecord *rec =
+			index->records[index->modified[index->each_modified++]];
+
+		if (rec->flags & MODIFIED_FLAGS) {
+			*drecord = rec;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_UseIndex
+ *
+ * Summary:     Make a handler find its desktop records through an index,
+ *		replacing its Match, FreeMatch, ForEach and ForEachModified
+ *		callbacks
+ *
+ * Parameters:  Handler, index
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_UseIndex(SyncHandler *sh, SyncIndex *index)
+{
+	sh->index 		= index;
+	sh->Match 		= index_Match;
+	sh->FreeMatch 		= index_FreeMatch;
+	sh->ForEach 		= index_ForEach;
+	sh->ForEachModified 	= index_ForEachModified;
+}
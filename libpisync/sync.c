@@ -23,10 +23,20 @@
  * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-debug.h"
 #include "pi-dlp.h"
+#include "pi-util.h"
 #include "pi-sync.h"
 
 typedef enum {
@@ -35,27 +45,119 @@ typedef enum {
 	BOTH
 } RecordModifier;
 
-typedef struct _RecordQueueList RecordQueueList;
+typedef struct _RecordQueueItem RecordQueueItem;
 typedef struct _RecordQueue RecordQueue;
 
-struct _RecordQueueList {
-	DesktopRecord *drecord;
-	PilotRecord *precord;
+/* Device changes are queued during a pass and flushed together at its
+   end, deletes first, with repeated writes to the same record dropped */
+typedef enum {
+	QUEUE_DELETE,		/* Delete recID */
+	QUEUE_STORE		/* Store drecord, prepared by the conduit */
+} RecordQueueOp;
+
+struct _RecordQueueItem {
+	RecordQueueOp op;
+	recordid_t recID;
+	int seq;
+	int dropped;
 
-	RecordQueueList *next;
+	DesktopRecord *drecord;
 };
 
 struct _RecordQueue {
-	int count;
+	int count;		/* Number of queued desktop records */
 
-	RecordQueueList *rql;
+	RecordQueueItem *items;
+	int num_items;
+	int allocated;
+
+#if HAVE_PTHREAD
+	/* Set while a pipelined pass runs: DLP calls must hold it */
+	pthread_mutex_t *link;
+#endif
 };
 
+/* A device record as of the end of the last sync, from the cache, for
+   three-way merges */
+typedef struct _RecordBase {
+	int 	known,
+		catID;
+	uint64_t hash;
+	PilotRecord *record;	/* NULL unless the cache keeps bodies */
+} RecordBase;
+
+/* How a record changed on both sides is resolved */
+typedef enum {
+	MERGE_CONFLICT,		/* Keep both versions */
+	MERGE_DEVICE,		/* Only the device changed it */
+	MERGE_DESKTOP		/* Only the desktop changed it, or merged */
+} MergeResult;
+
 
 #define PilotCheck(func)   if (rec_mod == PILOT || rec_mod == BOTH) if ((result = func) < 0) return result;
 #define DesktopCheck(func) if (rec_mod == DESKTOP || rec_mod == BOTH) if ((result = func) < 0) return result;
 #define ErrorCheck(func)   if ((result = func) < 0) return result;
 
+#if HAVE_PTHREAD
+#define LinkLock(rq)	if ((rq) != NULL && (rq)->link != NULL) pthread_mutex_lock((rq)->link);
+#define LinkUnlock(rq)	if ((rq) != NULL && (rq)->link != NULL) pthread_mutex_unlock((rq)->link);
+#else
+#define LinkLock(rq)
+#define LinkUnlock(rq)
+#endif
+
+/* Storage of device record data. The engine receives records straight
+   into it, so a record is never copied on its way from the link to the
+   conduit and its size is only limited by what the link can carry. */
+struct _PilotRecordData {
+	pi_buffer_t *buf;
+};
+
+/***********************************************************************
+ *
+ * Function:    record_data_new
+ *
+ * Summary:     Allocate record storage
+ *
+ * Parameters:  Initial size of the buffer
+ *
+ * Returns:     The new storage, or NULL if out of memory
+ *
+ ***********************************************************************/
+static PilotRecordData *record_data_new(size_t size)
+{
+	PilotRecordData *data;
+
+	data = (PilotRecordData *) malloc(sizeof(PilotRecordData));
+	if (data == NULL)
+		return NULL;
+
+	data->buf = pi_buffer_new(size);
+	if (data->buf == NULL) {
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/***********************************************************************
+ *
+ * Function:    record_data_free
+ *
+ * Summary:     Free record storage
+ *
+ * Parameters:  The storage
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void record_data_free(PilotRecordData *data)
+{
+	pi_buffer_free(data->buf);
+	free(data);
+}
+
 /***********************************************************************
  *
  * Function:    sync_NewPilotRecord
@@ -75,7 +177,9 @@ PilotRecord *sync_NewPilotRecord(int buf_size)
 	precord = (PilotRecord *) malloc(sizeof(PilotRecord));
 	memset(precord, 0, sizeof(PilotRecord));
 
-	precord->buffer = malloc(buf_size);
+	precord->data = record_data_new(buf_size > 0 ? buf_size : 0);
+	if (precord->data != NULL)
+		precord->buffer = precord->data->buf->data;
 
 	return precord;
 }
@@ -88,19 +192,24 @@ PilotRecord *sync_NewPilotRecord(int buf_size)
  *
  * Parameters:  None
  *
- * Returns:     The device record passed by sync_NewPilotRecord
+ * Returns:     The device record passed by sync_NewPilotRecord, with a
+ *		copy of the data sized to fit, so either record can be
+ *		changed without affecting the other
  *
  ***********************************************************************/
 PilotRecord *sync_CopyPilotRecord(const PilotRecord * precord)
 {
 	PilotRecord *new_record;
 
-	new_record = sync_NewPilotRecord(sizeof(precord->buffer));
+	new_record = sync_NewPilotRecord(precord->len);
 
 	new_record->recID 	= precord->recID;
 	new_record->catID 	= precord->catID;
 	new_record->flags 	= precord->flags;
-	memcpy(new_record->buffer, precord->buffer, precord->len);
+	if (precord->len > 0)
+		pi_buffer_append(new_record->data->buf, precord->buffer,
+				 precord->len);
+	new_record->buffer	= new_record->data->buf->data;
 	new_record->len 	= precord->len;
 
 	return new_record;
@@ -120,12 +229,56 @@ PilotRecord *sync_CopyPilotRecord(const PilotRecord * precord)
  ***********************************************************************/
 void sync_FreePilotRecord(PilotRecord * precord)
 {
-	if (precord->buffer)
+	if (precord->data)
+		record_data_free(precord->data);
+	else if (precord->buffer)
 		free(precord->buffer);
 
 	free(precord);
 }
 
+/***********************************************************************
+ *
+ * Function:    sync_PilotRecordBuffer
+ *
+ * Summary:     Get the buffer to receive new data for a device record
+ *		into, e.g. with dlp_ReadRecordByIndex()
+ *
+ * Parameters:  The device record
+ *
+ * Returns:     The record's buffer, or NULL if out of memory. Call
+ *		sync_PilotRecordReceived() once the buffer is filled.
+ *
+ ***********************************************************************/
+pi_buffer_t *sync_PilotRecordBuffer(PilotRecord * precord)
+{
+	if (precord->data == NULL) {
+		precord->data = record_data_new(0);
+		if (precord->data == NULL)
+			return NULL;
+	}
+
+	return precord->data->buf;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_PilotRecordReceived
+ *
+ * Summary:     Point a device record at the data received in the
+ *		buffer returned by sync_PilotRecordBuffer()
+ *
+ * Parameters:  The device record
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void sync_PilotRecordReceived(PilotRecord * precord)
+{
+	precord->buffer = precord->data->buf->data;
+	precord->len 	= precord->data->buf->used;
+}
+
 /***********************************************************************
  *
  * Function:    sync_NewDesktopRecord
@@ -184,12 +337,157 @@ void sync_FreeDesktopRecord(DesktopRecord * drecord)
 	free(drecord);
 }
 
+/***********************************************************************
+ *
+ * Function:    queue_item
+ *
+ * Summary:     Append an item to the queue
+ *
+ * Parameters:  None
+ *
+ * Returns:     The new item, or NULL if out of memory
+ *
+ ***********************************************************************/
+static RecordQueueItem *queue_item(RecordQueue * rq, RecordQueueOp op)
+{
+	RecordQueueItem *item;
+
+	if (rq->num_items == rq->allocated) {
+		int 	size = rq->allocated ? rq->allocated * 2 : 64;
+
+		item = (RecordQueueItem *) realloc(rq->items,
+			size * sizeof(RecordQueueItem));
+		if (item == NULL)
+			return NULL;
+		rq->items = item;
+		rq->allocated = size;
+	}
+
+	item = &rq->items[rq->num_items];
+	memset(item, 0, sizeof(RecordQueueItem));
+	item->op = op;
+	item->seq = rq->num_items++;
+
+	return item;
+}
+
 /***********************************************************************
  *
  * Function:    add_record_queue
  *
- * Summary:     Add records to process to the queue, until no more 
- *		records exist
+ * Summary:     Queue a desktop record to store on the Palm
+ *
+ * Parameters:  None
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+static int
+add_record_queue(RecordQueue * rq, DesktopRecord * drecord)
+{
+	RecordQueueItem *item;
+
+	item = queue_item(rq, QUEUE_STORE);
+	if (item == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	item->drecord = drecord;
+	item->recID = drecord->recID;
+	rq->count++;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    queue_pilot_delete
+ *
+ * Summary:     Queue the deletion of a record on the Palm
+ *
+ * Parameters:  None
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY if out of memory
+ *
+ ***********************************************************************/
+static int queue_pilot_delete(RecordQueue * rq, recordid_t id)
+{
+	RecordQueueItem *item;
+
+	item = queue_item(rq, QUEUE_DELETE);
+	if (item == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	item->recID = id;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    compare_queue_items
+ *
+ * Summary:     qsort() order of the queue: deletes, then stores, by
+ *		record ID, in the order they were queued
+ *
+ * Parameters:  None
+ *
+ * Returns:     <0, 0 or >0
+ *
+ ***********************************************************************/
+static int compare_queue_items(const void *a, const void *b)
+{
+	const RecordQueueItem *ia = (const RecordQueueItem *) a,
+		*ib = (const RecordQueueItem *) b;
+	int 	ca = ia->op == QUEUE_DELETE ? 0 : 1,
+		cb = ib->op == QUEUE_DELETE ? 0 : 1;
+
+	if (ca != cb)
+		return ca - cb;
+	if (ia->recID != ib->recID)
+		return ia->recID < ib->recID ? -1 : 1;
+
+	return ia->seq - ib->seq;
+}
+
+/***********************************************************************
+ *
+ * Function:    free_record_queue
+ *
+ * Summary:     Release the queued records and empty the queue
+ *
+ * Parameters:  None
+ *
+ * Returns:     0 on success, or the first error from FreeMatch
+ *
+ ***********************************************************************/
+static int free_record_queue(SyncHandler * sh, RecordQueue * rq)
+{
+	int 	i,
+		err,
+		result = 0;
+
+	for (i = 0; i < rq->num_items; i++) {
+		RecordQueueItem *item = &rq->items[i];
+
+		if (item->drecord) {
+			err = sh->FreeMatch(sh, item->drecord);
+			if (err < 0 && result == 0)
+				result = err;
+		}
+	}
+
+	free(rq->items);
+	rq->items = NULL;
+	rq->num_items = rq->allocated = rq->count = 0;
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    cache_record
+ *
+ * Summary:     Note the current state of a device record in the
+ *		handler's hash cache, if it has one
  *
  * Parameters:  None
  *
@@ -197,60 +495,191 @@ void sync_FreeDesktopRecord(DesktopRecord * drecord)
  *
  ***********************************************************************/
 static void
-add_record_queue(RecordQueue * rq, PilotRecord * precord,
-		 DesktopRecord * drecord)
+cache_record(SyncHandler * sh, recordid_t id, int flags, int catID,
+	     const void *buffer, size_t len)
 {
-	RecordQueueList *item;
+	if (sh->cache == NULL)
+		return;
+
+	/* Deleted and archived records go away when the database is
+	   cleaned up at the end of the sync */
+	if (flags & (dlpRecAttrDeleted | dlpRecAttrArchived)) {
+		sync_CacheRemove(sh->cache, id);
+		return;
+	}
 
-	item = malloc(sizeof(RecordQueueList));
+	sync_CacheSet(sh->cache, id, catID,
+		      flags & ~(dlpRecAttrDirty | dlpRecAttrBusy),
+		      pi_hash64(buffer, len));
+	if (sh->three_way && sh->Merge != NULL)
+		sync_CacheSetBody(sh->cache, id, buffer, len);
+}
 
-	if (drecord != NULL) {
-		item->drecord = drecord;
-		item->precord = NULL;
-	} else {
-		item->drecord = NULL;
-		item->precord = sync_CopyPilotRecord(precord);
+/***********************************************************************
+ *
+ * Function:    record_base
+ *
+ * Summary:     Get what a device record looked like after the last
+ *		sync, when its desktop record was modified and the handler
+ *		does three-way merges. Must be called before the cache is
+ *		updated with the record's current state.
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing, base->known tells whether the state was found
+ *
+ ***********************************************************************/
+static void
+record_base(SyncHandler * sh, DesktopRecord * drecord, recordid_t id,
+	    RecordBase * base)
+{
+	const void *body;
+	size_t	len;
+	pi_buffer_t *buf;
+
+	base->known = 0;
+	base->record = NULL;
+
+	if (!sh->three_way || sh->cache == NULL || drecord == NULL
+	    || !(drecord->flags & dlpRecAttrDirty))
+		return;
+
+	base->known = sync_CacheLookup(sh->cache, id, &base->catID, NULL,
+				       &base->hash);
+	if (!base->known || sh->Merge == NULL
+	    || !sync_CacheBody(sh->cache, id, &body, &len))
+		return;
+
+	/* Copied, the cache entry changes as soon as the record is seen */
+	base->record = sync_NewPilotRecord(0);
+	if (base->record == NULL)
+		return;
+	buf = sync_PilotRecordBuffer(base->record);
+	if (buf == NULL || pi_buffer_append(buf, body, len) == NULL) {
+		sync_FreePilotRecord(base->record);
+		base->record = NULL;
+		return;
 	}
+	sync_PilotRecordReceived(base->record);
+	base->record->recID = id;
+	base->record->catID = base->catID;
+}
 
-	if (rq) {
-		item->next = rq->rql;
-		rq->rql = item;
-	} else {
-		item->next = NULL;
-	}
+/***********************************************************************
+ *
+ * Function:    resolve_conflict
+ *
+ * Summary:     Decide what to do with a record changed on both sides,
+ *		given its state after the last sync
+ *
+ * Parameters:  None
+ *
+ * Returns:     A MergeResult, or a negative error from Merge
+ *
+ ***********************************************************************/
+static int
+resolve_conflict(SyncHandler * sh, const RecordBase * base,
+		 PilotRecord * precord, DesktopRecord * drecord)
+{
+	int 	result;
+	PilotRecord prepared;
 
-	rq->count++;
+	/* Marked dirty on the device, but the same as after the last sync */
+	if (precord->catID == base->catID
+	    && pi_hash64(precord->buffer, precord->len) == base->hash)
+		return MERGE_DESKTOP;
+
+	memset(&prepared, 0, sizeof(PilotRecord));
+	if (sh->Prepare(sh, drecord, &prepared) == 0
+	    && prepared.catID == base->catID
+	    && pi_hash64(prepared.buffer, prepared.len) == base->hash)
+		return MERGE_DEVICE;
+
+	if (sh->Merge == NULL || base->record == NULL)
+		return MERGE_CONFLICT;
+
+	result = sh->Merge(sh, base->record, precord, drecord);
+	if (result < 0)
+		return result;
+
+	LOG((PI_DBG_USER, PI_DBG_LVL_INFO,
+	     "SYNC Record 0x%08lx changed on both sides, %s\n",
+	     (unsigned long) precord->recID,
+	     result == 0 ? "merged" : "kept both versions"));
+
+	return result == 0 ? MERGE_DESKTOP : MERGE_CONFLICT;
 }
 
 /***********************************************************************
  *
- * Function:    free_record_queue_list
+ * Function:    delete_pilot_record
  *
- * Summary:     Free the list
+ * Summary:     Delete a record on the Palm
  *
  * Parameters:  None
  *
- * Returns:     Nothing
+ * Returns:     Same as dlp_DeleteRecord
  *
  ***********************************************************************/
-static int free_record_queue_list(SyncHandler * sh, RecordQueueList * rql)
+static int
+delete_pilot_record(SyncHandler * sh, RecordQueue * rq, int dbhandle,
+		    recordid_t id)
 {
-	int 	result = 0;
-	RecordQueueList *item;
+	int 	result;
 
-	while (rql != NULL) {
-		item = rql;
-		rql = rql->next;
+	LinkLock(rq);
+	result = dlp_DeleteRecord(sh->sd, dbhandle, 0, id);
+	LinkUnlock(rq);
+	if (result >= 0 && sh->cache)
+		sync_CacheRemove(sh->cache, id);
 
-		if (item->drecord)
-			ErrorCheck(sh->FreeMatch(sh, item->drecord));
-		if (item->precord)
-			sync_FreePilotRecord(item->precord);
+	return result;
+}
 
-		free(item);
-	}
+/***********************************************************************
+ *
+ * Function:    write_pilot_record
+ *
+ * Summary:     Write a record on the Palm
+ *
+ * Parameters:  None
+ *
+ * Returns:     Same as dlp_WriteRecord
+ *
+ ***********************************************************************/
+static int
+write_pilot_record(SyncHandler * sh, RecordQueue * rq, int dbhandle,
+		   int flags, recordid_t id, int catID, void *buffer,
+		   size_t len, recordid_t *newid)
+{
+	int 	result;
 
-	return 0;
+	LinkLock(rq);
+	result = dlp_WriteRecord(sh->sd, dbhandle, flags, id, catID,
+				 buffer, len, newid);
+	LinkUnlock(rq);
+	if (result >= 0)
+		cache_record(sh, newid ? *newid : id, flags, catID,
+			     buffer, len);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    save_cache
+ *
+ * Summary:     Save the handler's hash cache after a successful sync
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void save_cache(SyncHandler * sh, int result)
+{
+	if (sh->cache != NULL && result >= 0)
+		sync_SaveCache(sh->cache);
 }
 
 /***********************************************************************
@@ -267,7 +696,7 @@ static int free_record_queue_list(SyncHandler * sh, RecordQueueList * rql)
  ***********************************************************************/
 static int
 delete_both(SyncHandler * sh, int dbhandle, DesktopRecord * drecord,
-	    PilotRecord * precord, RecordModifier rec_mod)
+	    PilotRecord * precord, RecordQueue * rq, RecordModifier rec_mod)
 {
 	int result = 0;
 
@@ -275,8 +704,7 @@ delete_both(SyncHandler * sh, int dbhandle, DesktopRecord * drecord,
 		DesktopCheck(sh->DeleteRecord(sh, drecord));
 
 	if (precord != NULL)
-		PilotCheck(dlp_DeleteRecord
-			   (sh->sd, dbhandle, 0, precord->recID));
+		PilotCheck(queue_pilot_delete(rq, precord->recID));
 
 	return result;
 }
@@ -294,7 +722,8 @@ delete_both(SyncHandler * sh, int dbhandle, DesktopRecord * drecord,
  ***********************************************************************/
 static int
 store_record_on_pilot(SyncHandler * sh, int dbhandle,
-		      DesktopRecord * drecord, RecordModifier rec_mod)
+		      DesktopRecord * drecord, RecordQueue * rq,
+		      RecordModifier rec_mod)
 {
 	int 	result = 0;
 	PilotRecord precord;
@@ -306,9 +735,10 @@ store_record_on_pilot(SyncHandler * sh, int dbhandle,
 	if (result != 0)
 		return result;
 
-	PilotCheck(dlp_WriteRecord(sh->sd, dbhandle, precord.flags & dlpRecAttrSecret,
-				   precord.recID, precord.catID,
-				   precord.buffer, precord.len, &id_));
+	PilotCheck(write_pilot_record(sh, rq, dbhandle,
+				      precord.flags & dlpRecAttrSecret,
+				      precord.recID, precord.catID,
+				      precord.buffer, precord.len, &id_));
 
 	DesktopCheck(sh->SetPilotID(sh, drecord, id_));
 
@@ -363,7 +793,8 @@ static int close_db(SyncHandler * sh, int dbhandle)
  *
  * Summary:     Synchronize a record to the Palm
  *
- * Parameters:  None
+ * Parameters:  base is the device record after the last sync, for
+ *		three-way merges, or NULL
  *
  * Returns:     0 if success, otherwise return a negative number
  *
@@ -371,7 +802,8 @@ static int close_db(SyncHandler * sh, int dbhandle)
 static int
 sync_record(SyncHandler * sh, int dbhandle,
 	    DesktopRecord * drecord, PilotRecord * precord,
-	    RecordQueue * rq, RecordModifier rec_mod)
+	    const RecordBase * base, RecordQueue * rq,
+	    RecordModifier rec_mod)
 {
 	int 	parch 	= 0,
 		pdel 	= 0,
@@ -404,7 +836,7 @@ sync_record(SyncHandler * sh, int dbhandle,
 		DesktopCheck(sh->AddRecord(sh, precord));
 
 	} else if (precord == NULL && drecord != NULL) {
-		add_record_queue(rq, NULL, drecord);
+		ErrorCheck(add_record_queue(rq, drecord));
 
 	} else if (parch && ddel) {
 		DesktopCheck(sh->ReplaceRecord(sh, drecord, precord));
@@ -428,24 +860,22 @@ sync_record(SyncHandler * sh, int dbhandle,
 		comp = sh->Compare(sh, precord, drecord);
 		if (comp == 0) {
 			DesktopCheck(sh->ArchiveRecord(sh, drecord, 1));
-			PilotCheck(dlp_DeleteRecord
-				   (sh->sd, dbhandle, 0, precord->recID));
+			PilotCheck(queue_pilot_delete(rq, precord->recID));
 			DesktopCheck(sh->SetStatusCleared(sh, drecord));
 		} else {
-			PilotCheck(dlp_WriteRecord(sh->sd, dbhandle, 0, 0,
-						   precord->catID,
-						   precord->buffer,
-						   precord->len,
-						   &precord->recID));
+			PilotCheck(write_pilot_record(sh, rq, dbhandle, 0, 0,
+						      precord->catID,
+						      precord->buffer,
+						      precord->len,
+						      &precord->recID));
 			DesktopCheck(sh->AddRecord(sh, precord));
-			add_record_queue(rq, NULL, drecord);
+			ErrorCheck(add_record_queue(rq, drecord));
 			DesktopCheck(sh->SetStatusCleared(sh, drecord));
 		}
 
 	} else if (parch && !pchange && !darch && dchange) {
-		PilotCheck(dlp_DeleteRecord
-			   (sh->sd, dbhandle, 0, precord->recID));
-		add_record_queue(rq, NULL, drecord);
+		PilotCheck(queue_pilot_delete(rq, precord->recID));
+		ErrorCheck(add_record_queue(rq, drecord));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (pchange && darch && dchange) {
@@ -453,8 +883,7 @@ sync_record(SyncHandler * sh, int dbhandle,
 
 		comp = sh->Compare(sh, precord, drecord);
 		if (comp == 0) {
-			PilotCheck(dlp_DeleteRecord
-				   (sh->sd, dbhandle, 0, precord->recID));
+			PilotCheck(queue_pilot_delete(rq, precord->recID));
 		} else {
 			DesktopCheck(sh->ArchiveRecord(sh, drecord, 0));
 			DesktopCheck(sh->
@@ -468,13 +897,26 @@ sync_record(SyncHandler * sh, int dbhandle,
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (pchange && dchange) {
-		int comp;
+		int comp,
+			merge = MERGE_CONFLICT;
 
 		comp = sh->Compare(sh, precord, drecord);
-		if (comp != 0) {
+		if (comp != 0 && base != NULL) {
+			merge = resolve_conflict(sh, base, precord, drecord);
+			if (merge < 0)
+				return merge;
+		}
+
+		if (comp == 0) {
+			/* Same change on both sides */
+		} else if (merge == MERGE_DEVICE) {
+			DesktopCheck(sh->ReplaceRecord(sh, drecord, precord));
+		} else if (merge == MERGE_DESKTOP) {
+			ErrorCheck(add_record_queue(rq, drecord));
+		} else {
 			DesktopCheck(sh->AddRecord(sh, precord));
 			drecord->recID = 0;
-			add_record_queue(rq, NULL, drecord);
+			ErrorCheck(add_record_queue(rq, drecord));
 		}
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
@@ -487,28 +929,26 @@ sync_record(SyncHandler * sh, int dbhandle,
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (pdel && dchange) {
-		add_record_queue(rq, NULL, drecord);
+		ErrorCheck(add_record_queue(rq, drecord));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (pdel && !dchange) {
 		DesktopCheck(delete_both
-			     (sh, dbhandle, drecord, precord, rec_mod));
+			     (sh, dbhandle, drecord, precord, rq, rec_mod));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (!pchange && darch) {
-		PilotCheck(dlp_DeleteRecord
-			   (sh->sd, dbhandle, 0, precord->recID));
+		PilotCheck(queue_pilot_delete(rq, precord->recID));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (!pchange && dchange) {
-		PilotCheck(dlp_DeleteRecord
-			   (sh->sd, dbhandle, 0, precord->recID));
-		add_record_queue(rq, NULL, drecord);
+		PilotCheck(queue_pilot_delete(rq, precord->recID));
+		ErrorCheck(add_record_queue(rq, drecord));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	} else if (!pchange && ddel) {
 		DesktopCheck(delete_both
-			     (sh, dbhandle, drecord, precord, rec_mod));
+			     (sh, dbhandle, drecord, precord, rq, rec_mod));
 		DesktopCheck(sh->SetStatusCleared(sh, drecord));
 
 	}
@@ -545,16 +985,19 @@ int sync_CopyToPilot(SyncHandler * sh)
 	result = dlp_DeleteRecord(sh->sd, dbhandle, 1, 0);
 	if (result < 0)
 		goto cleanup;
+	if (sh->cache)
+		sync_CacheClear(sh->cache);
 
 
 	while (sh->ForEach(sh, &drecord) == 0 && drecord) {
 		result =
-		    store_record_on_pilot(sh, dbhandle, drecord, BOTH);
+		    store_record_on_pilot(sh, dbhandle, drecord, NULL, BOTH);
 		if (result < 0)
 			goto cleanup;
 	}
 
 	result = sh->Post(sh, dbhandle);
+	save_cache(sh, result);
 
       cleanup:
 	close_db(sh, dbhandle);
@@ -582,7 +1025,7 @@ int sync_CopyFromPilot(SyncHandler * sh)
 	pi_buffer_t *recbuf;
 
 	DesktopRecord *drecord = NULL;
-	PilotRecord *precord = sync_NewPilotRecord(DLP_BUF_SIZE);
+	PilotRecord *precord = sync_NewPilotRecord(0);
 
 	result = open_db(sh, &dbhandle);
 	if (result < 0)
@@ -599,24 +1042,21 @@ int sync_CopyFromPilot(SyncHandler * sh)
 	}
 
 	i = 0;
-	recbuf = pi_buffer_new(DLP_BUF_SIZE);
-	while (dlp_ReadRecordByIndex(sh->sd, dbhandle, i, recbuf, &precord->recID,
-		   &precord->flags, &precord->catID) > 0) {
-		precord->len = recbuf->used;
-		if (precord->len > DLP_BUF_SIZE)
-			precord->len = DLP_BUF_SIZE;
-		memcpy(precord->buffer, recbuf->data, precord->len);
+	while ((recbuf = sync_PilotRecordBuffer(precord)) != NULL
+	       && dlp_ReadRecordByIndex(sh->sd, dbhandle, i, recbuf,
+			&precord->recID, &precord->flags, &precord->catID) > 0) {
+		sync_PilotRecordReceived(precord);
+		cache_record(sh, precord->recID, precord->flags,
+			     precord->catID, precord->buffer, precord->len);
 		result = sh->AddRecord(sh, precord);
-		if (result < 0) {
-			pi_buffer_free(recbuf);
+		if (result < 0)
 			goto cleanup;
-		}
 
 		i++;
 	}
-	pi_buffer_free (recbuf);
 
 	result = sh->Post(sh, dbhandle);
+	save_cache(sh, result);
 
 cleanup:
 	close_db(sh, dbhandle);
@@ -628,36 +1068,515 @@ cleanup:
  *
  * Function:    sync_MergeFromPilot_process
  *
- * Summary:     Try to be intelligent about merging data in a record
+ * Summary:     Apply the device changes queued during a pass: deletes
+ *		first, then the records to store, skipping repeated
+ *		changes to the same record
  *
  * Parameters:  None
  *
- * Returns:     Nothing
+ * Returns:     0 on success, otherwise the first error. All changes are
+ *		attempted even if some fail.
  *
  ***********************************************************************/
 static int
 sync_MergeFromPilot_process(SyncHandler * sh, int dbhandle,
 			    RecordQueue * rq, RecordModifier rec_mod)
 {
-	int 	result = 0;
-	RecordQueueList *item;
+	int 	i,
+		err,
+		saved = 0,
+		result = 0;
+	RecordQueueItem *item;
+
+	if (rq->num_items == 0)
+		return 0;
+
+	qsort(rq->items, rq->num_items, sizeof(RecordQueueItem),
+	      compare_queue_items);
+
+	/* Only the last of repeated changes to a record needs to be sent.
+	   New records (ID 0) are all different. */
+	for (i = 0; i + 1 < rq->num_items; i++) {
+		item = &rq->items[i];
+		if (item->recID != 0 && item->recID == item[1].recID
+		    && item->op == item[1].op) {
+			item->dropped = 1;
+			saved++;
+		}
+	}
+
+	for (i = 0; i < rq->num_items; i++) {
+		item = &rq->items[i];
+		if (item->dropped)
+			continue;
+
+		err = 0;
+		switch (item->op) {
+		case QUEUE_DELETE:
+			err = delete_pilot_record(sh, rq, dbhandle,
+						  item->recID);
+			break;
+		case QUEUE_STORE:
+			err = store_record_on_pilot(sh, dbhandle,
+						    item->drecord, rq, rec_mod);
+			break;
+		}
+
+		if (err < 0) {
+			LOG((PI_DBG_USER, PI_DBG_LVL_ERR,
+			     "SYNC %s of record 0x%08lx failed (%d)\n",
+			     item->op == QUEUE_DELETE ? "Delete" : "Write",
+			     (unsigned long) item->recID, err));
+			if (result == 0)
+				result = err;
+		}
+	}
+
+	LOG((PI_DBG_USER, PI_DBG_LVL_INFO,
+	     "SYNC Flushed %d device changes, %d round trips saved\n",
+	     rq->num_items - saved, saved));
+
+	err = free_record_queue(sh, rq);
+
+	return result < 0 ? result : err;
+}
+
+/***********************************************************************
+ *
+ * Function:    merge_pilot_record
+ *
+ * Summary:     Merge one record received from the Palm, once matched
+ *		with its desktop record
+ *
+ * Parameters:  slow is non-zero during a slow sync, where the flags of
+ *		the record must be calculated. compare is the result of
+ *		sh->Compare() for the record if already known, or NULL.
+ *
+ * Returns:     0 if success, nonzero otherwise
+ *
+ ***********************************************************************/
+static int
+merge_pilot_record(SyncHandler * sh, int dbhandle, PilotRecord * precord,
+		   DesktopRecord * drecord, int slow, const int *compare,
+		   RecordQueue * rq, RecordModifier rec_mod)
+{
+	int 	count = rq->count,
+		parch,
+		psecret,
+		cached = 0,
+		cached_cat,
+		result = 0;
+	uint64_t cached_hash;
+	RecordBase base;
+
+	record_base(sh, drecord, precord->recID, &base);
+
+	if (!slow) {
+		cache_record(sh, precord->recID, precord->flags,
+			     precord->catID, precord->buffer, precord->len);
+		goto sync;
+	}
+
+	/* Since this is a slow sync, we must calculate the flags */
+	parch = precord->flags & dlpRecAttrArchived;
+	psecret = precord->flags & dlpRecAttrSecret;
+
+	/* What the record looked like after the last sync tells whether
+	   it changed, without asking the conduit */
+	if (compare == NULL && sh->cache != NULL)
+		cached = sync_CacheLookup(sh->cache, precord->recID,
+					  &cached_cat, NULL, &cached_hash);
+	cache_record(sh, precord->recID, precord->flags,
+		     precord->catID, precord->buffer, precord->len);
+
+	precord->flags = 0;
+	if (drecord == NULL) {
+		precord->flags = precord->flags | dlpRecAttrDirty;
+	} else if (cached) {
+		if (cached_cat != precord->catID
+		    || cached_hash != pi_hash64(precord->buffer, precord->len))
+			precord->flags = precord->flags | dlpRecAttrDirty;
+	} else {
+		int comp;
+
+		comp = compare ? *compare : sh->Compare(sh, precord, drecord);
+		if (comp != 0) {
+			precord->flags =
+			    precord->flags | dlpRecAttrDirty;
+		}
+	}
+	if (parch)
+		precord->flags =
+		    precord->flags | dlpRecAttrArchived;
+	if (psecret)
+		precord->flags = precord->flags | dlpRecAttrSecret;
+
+      sync:
+	result = sync_record(sh, dbhandle, drecord, precord,
+			     base.known ? &base : NULL, rq, rec_mod);
+	if (base.record != NULL)
+		sync_FreePilotRecord(base.record);
+	if (result < 0)
+		return result;
+
+	if (drecord && rq->count == count)
+		ErrorCheck(sh->FreeMatch(sh, drecord));
+
+	return result;
+}
+
+#if HAVE_PTHREAD
+/* The pipelined engine overlaps the DLP round trips with the conduit's
+   work. A reader thread receives device records into a ring of
+   sh->pipeline records, optional workers run Match (and, in slow syncs
+   without a cache, Compare) on them, and the calling thread merges them
+   in the order they were read, exactly like the sequential engine does.
+   DLP calls made while merging hold the link lock so they don't mix with
+   the reader's. */
+
+#define PIPELINE_FALLBACK	1	/* Pipeline unavailable, go sequential */
+#define PIPELINE_MAX_WORKERS	16
+
+typedef struct _PipelineItem {
+	PilotRecord *precord;
+	DesktopRecord *drecord;
+	int 	matched,
+		match_result,
+		compared,
+		compare;
+} PipelineItem;
+
+typedef struct _Pipeline {
+	SyncHandler *sh;
+	int 	dbhandle,
+		slow;
+
+	/* For slow syncs, the records present when the sync started */
+	recordid_t *ids;
+	int 	num_ids;
+
+	pthread_mutex_t link;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	/* Protected by lock */
+	PipelineItem *ring;
+	int 	depth;
+	long 	read,
+		taken,
+		done;
+	int 	eof,
+		stop;
+} Pipeline;
+
+/***********************************************************************
+ *
+ * Function:    pipeline_reader
+ *
+ * Summary:     Thread receiving device records ahead of the engine
+ *
+ * Parameters:  The pipeline
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *pipeline_reader(void *arg)
+{
+	Pipeline *p = (Pipeline *) arg;
+	SyncHandler *sh = p->sh;
+
+	for (;;) {
+		int 	result;
+		PipelineItem *item;
+		pi_buffer_t *recbuf;
+
+		pthread_mutex_lock(&p->lock);
+		while (!p->stop && p->read - p->done >= p->depth)
+			pthread_cond_wait(&p->changed, &p->lock);
+		if (p->stop) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		item = &p->ring[p->read % p->depth];
+		pthread_mutex_unlock(&p->lock);
+
+		recbuf = sync_PilotRecordBuffer(item->precord);
+
+		pthread_mutex_lock(&p->link);
+		if (recbuf == NULL) {
+			result = PI_ERR_GENERIC_MEMORY;
+		} else if (p->slow) {
+			if (p->read < p->num_ids) {
+				item->precord->recID = p->ids[p->read];
+				result = dlp_ReadRecordById(sh->sd,
+					p->dbhandle, item->precord->recID,
+					recbuf, NULL, &item->precord->flags,
+					&item->precord->catID);
+			} else {
+				result = -1;	/* all read */
+			}
+		} else {
+			result = dlp_ReadNextModifiedRec(sh->sd, p->dbhandle,
+				recbuf, &item->precord->recID, NULL,
+				&item->precord->flags, &item->precord->catID);
+		}
+		pthread_mutex_unlock(&p->link);
+
+		pthread_mutex_lock(&p->lock);
+		if (result < 0) {
+			p->eof = 1;
+		} else {
+			sync_PilotRecordReceived(item->precord);
+			item->matched = 0;
+			item->compared = 0;
+			p->read++;
+		}
+		pthread_cond_broadcast(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+
+		if (result < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    pipeline_matcher
+ *
+ * Summary:     Worker thread matching received records with desktop
+ *		records ahead of the engine
+ *
+ * Parameters:  The pipeline
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *pipeline_matcher(void *arg)
+{
+	Pipeline *p = (Pipeline *) arg;
+	SyncHandler *sh = p->sh;
+
+	for (;;) {
+		int 	result,
+			compared = 0,
+			compare = 0;
+		PipelineItem *item;
+		DesktopRecord *drecord = NULL;
+
+		pthread_mutex_lock(&p->lock);
+		while (!p->stop && p->taken == p->read && !p->eof)
+			pthread_cond_wait(&p->changed, &p->lock);
+		if (p->stop || p->taken == p->read) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		item = &p->ring[p->taken++ % p->depth];
+		pthread_mutex_unlock(&p->lock);
+
+		result = sh->Match(sh, item->precord, &drecord);
+		if (result >= 0 && p->slow && drecord != NULL
+		    && sh->cache == NULL) {
+			compare = sh->Compare(sh, item->precord, drecord);
+			compared = 1;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		item->drecord = drecord;
+		item->match_result = result;
+		item->compared = compared;
+		item->compare = compare;
+		item->matched = 1;
+		pthread_cond_broadcast(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    pipeline_record_ids
+ *
+ * Summary:     Get the IDs of all records of a database, which a slow
+ *		pipelined sync reads one by one: unlike indexes, they
+ *		don't move when records are added or deleted while the
+ *		reader is ahead
+ *
+ * Parameters:  None
+ *
+ * Returns:     0 on success, negative number on error
+ *
+ ***********************************************************************/
+static int pipeline_record_ids(Pipeline * p)
+{
+	int 	i,
+		numrecs,
+		chunk = 0,
+		result;
+
+	result = dlp_ReadOpenDBInfo(p->sh->sd, p->dbhandle, &numrecs);
+	if (result < 0)
+		return result;
+
+	p->ids = (recordid_t *) malloc((numrecs + 1) * sizeof(recordid_t));
+	if (p->ids == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	/* the list comes back in slices that fit in a packet */
+	for (i = 0; i < numrecs; i += chunk) {
+		result = dlp_ReadRecordIDList(p->sh->sd, p->dbhandle, 0, i,
+			numrecs - i > 500 ? 500 : numrecs - i,
+			p->ids + i, &chunk);
+		if (result < 0)
+			return result;
+		if (chunk == 0)
+			break;
+	}
+	p->num_ids = i < numrecs ? i : numrecs;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    sync_MergeFromPilot_pipelined
+ *
+ * Summary:     Merge from Palm to desktop, reading ahead
+ *
+ * Parameters:  slow is non-zero for a slow sync
+ *
+ * Returns:     0 if success, negative number on error,
+ *		PIPELINE_FALLBACK if the sequential engine must be used
+ *
+ ***********************************************************************/
+static int
+sync_MergeFromPilot_pipelined(SyncHandler * sh, int dbhandle, int slow,
+			      RecordModifier rec_mod)
+{
+	int 	i,
+		workers = 0,
+		result = 0;
+	long 	n;
+	Pipeline p;
+	RecordQueue rq;
+	pthread_t reader,
+		matchers[PIPELINE_MAX_WORKERS];
+
+	memset(&p, 0, sizeof(p));
+	memset(&rq, 0, sizeof(rq));
+	p.sh 		= sh;
+	p.dbhandle 	= dbhandle;
+	p.slow 		= slow;
+	p.depth 	= sh->pipeline;
+
+	if (slow && pipeline_record_ids(&p) < 0) {
+		free(p.ids);
+		return PIPELINE_FALLBACK;
+	}
+
+	p.ring = (PipelineItem *) calloc(p.depth, sizeof(PipelineItem));
+	if (p.ring == NULL) {
+		free(p.ids);
+		return PIPELINE_FALLBACK;
+	}
+	for (i = 0; i < p.depth; i++)
+		p.ring[i].precord = sync_NewPilotRecord(0);
 
-	for (item = rq->rql; item != NULL; item = item->next) {
-		if (item->drecord != NULL) {
-			store_record_on_pilot(sh, dbhandle, item->drecord,
-					      rec_mod);
+	pthread_mutex_init(&p.link, NULL);
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.changed, NULL);
+	rq.link = &p.link;
+
+	if (pthread_create(&reader, NULL, pipeline_reader, &p) != 0) {
+		result = PIPELINE_FALLBACK;
+		goto cleanup;
+	}
+	while (workers < sh->match_workers && workers < PIPELINE_MAX_WORKERS
+	       && pthread_create(&matchers[workers], NULL, pipeline_matcher,
+				 &p) == 0)
+		workers++;
+
+	for (;;) {
+		int 	end = 0;
+		PipelineItem *item;
+		DesktopRecord *drecord = NULL;
+
+		pthread_mutex_lock(&p.lock);
+		for (;;) {
+			item = &p.ring[p.done % p.depth];
+			if (p.done < p.read && (workers == 0 || item->matched))
+				break;
+			if (p.eof && p.done == p.read) {
+				end = 1;
+				break;
+			}
+			pthread_cond_wait(&p.changed, &p.lock);
+		}
+		pthread_mutex_unlock(&p.lock);
+		if (end)
+			break;
+
+		if (workers == 0) {
+			result = sh->Match(sh, item->precord, &drecord);
 		} else {
-			PilotCheck(dlp_WriteRecord(sh->sd, dbhandle, 0, 0,
-						   item->precord->catID,
-						   item->precord->buffer,
-						   item->precord->len,
-						   &item->precord->recID));
+			result = item->match_result;
+			drecord = item->drecord;
 		}
+		if (result < 0)
+			break;
+
+		result = merge_pilot_record(sh, dbhandle, item->precord,
+			drecord, slow, item->compared ? &item->compare : NULL,
+			&rq, rec_mod);
+		if (result < 0)
+			break;
+
+		pthread_mutex_lock(&p.lock);
+		p.done++;
+		pthread_cond_broadcast(&p.changed);
+		pthread_mutex_unlock(&p.lock);
 	}
-	free_record_queue_list(sh, rq->rql);
+
+	pthread_mutex_lock(&p.lock);
+	p.stop = 1;
+	pthread_cond_broadcast(&p.changed);
+	pthread_mutex_unlock(&p.lock);
+
+	pthread_join(reader, NULL);
+	for (i = 0; i < workers; i++)
+		pthread_join(matchers[i], NULL);
+
+	rq.link = NULL;
+	if (result >= 0) {
+		result = sync_MergeFromPilot_process(sh, dbhandle, &rq,
+						     rec_mod);
+	} else {
+		/* The matchers may have got ahead of the record that
+		   failed; nothing else will free their matches */
+		for (n = p.done + 1; n < p.taken; n++) {
+			PipelineItem *item = &p.ring[n % p.depth];
+
+			if (item->matched && item->match_result >= 0
+			    && item->drecord != NULL)
+				sh->FreeMatch(sh, item->drecord);
+		}
+		free_record_queue(sh, &rq);
+	}
+
+      cleanup:
+	pthread_cond_destroy(&p.changed);
+	pthread_mutex_destroy(&p.lock);
+	pthread_mutex_destroy(&p.link);
+	for (i = 0; i < p.depth; i++)
+		sync_FreePilotRecord(p.ring[i].precord);
+	free(p.ring);
+	free(p.ids);
 
 	return result;
 }
+#endif
 
 /***********************************************************************
  *
@@ -675,29 +1594,40 @@ sync_MergeFromPilot_fast(SyncHandler * sh, int dbhandle,
 			 RecordModifier rec_mod)
 {
 	int 	result = 0;
-	PilotRecord *precord 	= sync_NewPilotRecord(DLP_BUF_SIZE);
+	PilotRecord *precord;
 	DesktopRecord *drecord 	= NULL;
-	RecordQueue rq 		= { 0, NULL };
-	pi_buffer_t *recbuf = pi_buffer_new(DLP_BUF_SIZE);
-	
-	while (dlp_ReadNextModifiedRec(sh->sd, dbhandle, recbuf,
+	RecordQueue rq;
+	pi_buffer_t *recbuf;
+
+	memset(&rq, 0, sizeof(rq));
+
+#if HAVE_PTHREAD
+	if (sh->pipeline > 0) {
+		result = sync_MergeFromPilot_pipelined(sh, dbhandle, 0,
+						       rec_mod);
+		if (result != PIPELINE_FALLBACK)
+			return result;
+		result = 0;
+	}
+#endif
+
+	precord = sync_NewPilotRecord(0);
+	while ((recbuf = sync_PilotRecordBuffer(precord)) != NULL
+	       && dlp_ReadNextModifiedRec(sh->sd, dbhandle, recbuf,
 				       &precord->recID, NULL,
 				       &precord->flags,
 				       &precord->catID) >= 0) {
-		int count = rq.count;
-		precord->len = recbuf->used;
-		if (precord->len > DLP_BUF_SIZE)
-			precord->len = DLP_BUF_SIZE;
-		memcpy(precord->buffer, recbuf->data, precord->len);
-		ErrorCheck(sh->Match(sh, precord, &drecord));
-		ErrorCheck(sync_record
-			   (sh, dbhandle, drecord, precord, &rq, rec_mod));
-
-		if (drecord && rq.count == count)
-			ErrorCheck(sh->FreeMatch(sh, drecord));
+		sync_PilotRecordReceived(precord);
+		if ((result = sh->Match(sh, precord, &drecord)) < 0
+		    || (result = merge_pilot_record(sh, dbhandle, precord,
+				drecord, 0, NULL, &rq, rec_mod)) < 0)
+			break;
 	}
-	pi_buffer_free(recbuf);
 	sync_FreePilotRecord(precord);
+	if (result < 0) {
+		free_record_queue(sh, &rq);
+		return result;
+	}
 
 	result = sync_MergeFromPilot_process(sh, dbhandle, &rq, rec_mod);
 
@@ -720,62 +1650,46 @@ sync_MergeFromPilot_slow(SyncHandler * sh, int dbhandle,
 			 RecordModifier rec_mod)
 {
 	int 	i,
-		parch, 
-		psecret,
 		result = 0;
 	pi_buffer_t *recbuf;
 
-	PilotRecord *precord 	= sync_NewPilotRecord(DLP_BUF_SIZE);
+	PilotRecord *precord;
 	DesktopRecord *drecord 	= NULL;
-	RecordQueue rq 		= { 0, NULL };
+	RecordQueue rq;
+
+	memset(&rq, 0, sizeof(rq));
 
+#if HAVE_PTHREAD
+	if (sh->pipeline > 0) {
+		result = sync_MergeFromPilot_pipelined(sh, dbhandle, 1,
+						       rec_mod);
+		if (result != PIPELINE_FALLBACK)
+			return result;
+		result = 0;
+	}
+#endif
+
+	precord = sync_NewPilotRecord(0);
 	i = 0;
-	recbuf = pi_buffer_new(DLP_BUF_SIZE);
-	while (dlp_ReadRecordByIndex
+	while ((recbuf = sync_PilotRecordBuffer(precord)) != NULL
+	       && dlp_ReadRecordByIndex
 	       (sh->sd, dbhandle, i, recbuf, &precord->recID,
 			&precord->flags, &precord->catID) > 0) {
-		int 	count = rq.count;
+		sync_PilotRecordReceived(precord);
 
-		precord->len = recbuf->used;
-		if (precord->len > DLP_BUF_SIZE)
-			precord->len = DLP_BUF_SIZE;
-		memcpy(precord->buffer, recbuf->data, precord->len);
-		
-		ErrorCheck(sh->Match(sh, precord, &drecord));
-
-		/* Since this is a slow sync, we must calculate the flags */
-		parch = precord->flags & dlpRecAttrArchived;
-		psecret = precord->flags & dlpRecAttrSecret;
-
-		precord->flags = 0;
-		if (drecord == NULL) {
-			precord->flags = precord->flags | dlpRecAttrDirty;
-		} else {
-			int comp;
-
-			comp = sh->Compare(sh, precord, drecord);
-			if (comp != 0) {
-				precord->flags =
-				    precord->flags | dlpRecAttrDirty;
-			}
-		}
-		if (parch)
-			precord->flags =
-			    precord->flags | dlpRecAttrArchived;
-		if (psecret)
-			precord->flags = precord->flags | dlpRecAttrSecret;
-
-		ErrorCheck(sync_record
-			   (sh, dbhandle, drecord, precord, &rq, rec_mod));
-
-		if (drecord && rq.count == count)
-			ErrorCheck(sh->FreeMatch(sh, drecord));
+		if ((result = sh->Match(sh, precord, &drecord)) < 0
+		    || (result = merge_pilot_record(sh, dbhandle, precord,
+				drecord, 1, NULL, &rq, rec_mod)) < 0)
+			break;
 
 		i++;
 	}
-	pi_buffer_free(recbuf);
 
 	sync_FreePilotRecord(precord);
+	if (result < 0) {
+		free_record_queue(sh, &rq);
+		return result;
+	}
 
 	result = sync_MergeFromPilot_process(sh, dbhandle, &rq, rec_mod);
 
@@ -819,6 +1733,7 @@ int sync_MergeFromPilot(SyncHandler * sh)
 	}
 
 	result = sh->Post(sh, dbhandle);
+	save_cache(sh, result);
 
       cleanup:
 	close_db(sh, dbhandle);
@@ -844,33 +1759,52 @@ sync_MergeToPilot_fast(SyncHandler * sh, int dbhandle,
 	int 	result 		= 0;
 	PilotRecord *precord 	= NULL;
 	DesktopRecord *drecord 	= NULL;
-	RecordQueue rq 		= { 0, NULL };
-	pi_buffer_t *recbuf = pi_buffer_new(DLP_BUF_SIZE);
+	RecordQueue rq;
+	PilotRecord *device	= sync_NewPilotRecord(0);
+	pi_buffer_t *recbuf;
+	RecordBase base 	= { 0, 0, 0, NULL };
 
+	memset(&rq, 0, sizeof(rq));
 	while (sh->ForEachModified(sh, &drecord) == 0 && drecord) {
 		if (drecord->recID != 0) {
-			precord = sync_NewPilotRecord(DLP_BUF_SIZE);
+			precord = device;
 			precord->recID = drecord->recID;
-			PilotCheck(dlp_ReadRecordById(sh->sd, dbhandle,
+			recbuf = sync_PilotRecordBuffer(precord);
+			if (recbuf == NULL) {
+				result = PI_ERR_GENERIC_MEMORY;
+				break;
+			}
+			if ((rec_mod == PILOT || rec_mod == BOTH)
+			    && (result = dlp_ReadRecordById(sh->sd, dbhandle,
 						      precord->recID,
 						      recbuf,
 						      NULL,
 						      &precord->flags,
-						      &precord->catID));
-			precord->len = recbuf->used;
-			if (precord->len > DLP_BUF_SIZE)
-				precord->len = DLP_BUF_SIZE;
-			memcpy(precord->buffer, recbuf->data, precord->len);
+						      &precord->catID)) < 0)
+				break;
+			sync_PilotRecordReceived(precord);
+			record_base(sh, drecord, precord->recID, &base);
+			cache_record(sh, precord->recID, precord->flags,
+				     precord->catID, precord->buffer,
+				     precord->len);
 		}
 
-		ErrorCheck(sync_record
-			   (sh, dbhandle, drecord, precord, &rq, rec_mod));
+		result = sync_record(sh, dbhandle, drecord, precord,
+				     base.known ? &base : NULL, &rq, rec_mod);
+		if (base.record != NULL)
+			sync_FreePilotRecord(base.record);
+		if (result < 0)
+			break;
 
-		if (precord)
-			sync_FreePilotRecord (precord);
 		precord = NULL;
+		base.known = 0;
+		base.record = NULL;
+	}
+	sync_FreePilotRecord(device);
+	if (result < 0) {
+		free_record_queue(sh, &rq);
+		return result;
 	}
-	pi_buffer_free(recbuf);
 
 	result = sync_MergeFromPilot_process(sh, dbhandle, &rq, rec_mod);
 
@@ -897,23 +1831,34 @@ sync_MergeToPilot_slow(SyncHandler * sh, int dbhandle,
 		result 		= 0;
 	PilotRecord *precord 	= NULL;
 	DesktopRecord *drecord 	= NULL;
-	RecordQueue rq 		= { 0, NULL };
-	pi_buffer_t *recbuf = pi_buffer_new(DLP_BUF_SIZE);
+	RecordQueue rq;
+	PilotRecord *device	= sync_NewPilotRecord(0);
+	pi_buffer_t *recbuf;
+	RecordBase base 	= { 0, 0, 0, NULL };
 
+	memset(&rq, 0, sizeof(rq));
 	while (sh->ForEach(sh, &drecord) == 0 && drecord) {
 		if (drecord->recID != 0) {
-			precord = sync_NewPilotRecord(DLP_BUF_SIZE);
+			precord = device;
 			precord->recID = drecord->recID;
-			PilotCheck(dlp_ReadRecordById(sh->sd, dbhandle,
+			recbuf = sync_PilotRecordBuffer(precord);
+			if (recbuf == NULL) {
+				result = PI_ERR_GENERIC_MEMORY;
+				break;
+			}
+			if ((rec_mod == PILOT || rec_mod == BOTH)
+			    && (result = dlp_ReadRecordById(sh->sd, dbhandle,
 						      precord->recID,
 						      recbuf,
 						      NULL,
 						      &precord->flags,
-						      &precord->catID));
-			precord->len = recbuf->used;
-			if (precord->len > DLP_BUF_SIZE)
-				precord->len = DLP_BUF_SIZE;
-			memcpy(precord->buffer, recbuf->data, precord->len);
+						      &precord->catID)) < 0)
+				break;
+			sync_PilotRecordReceived(precord);
+			record_base(sh, drecord, precord->recID, &base);
+			cache_record(sh, precord->recID, precord->flags,
+				     precord->catID, precord->buffer,
+				     precord->len);
 		}
 
 		/* Since this is a slow sync, we must calculate the flags */
@@ -938,14 +1883,22 @@ sync_MergeToPilot_slow(SyncHandler * sh, int dbhandle,
 		if (dsecret)
 			drecord->flags = drecord->flags | dlpRecAttrSecret;
 
-		ErrorCheck(sync_record
-			   (sh, dbhandle, drecord, precord, &rq, rec_mod));
+		result = sync_record(sh, dbhandle, drecord, precord,
+				     base.known ? &base : NULL, &rq, rec_mod);
+		if (base.record != NULL)
+			sync_FreePilotRecord(base.record);
+		if (result < 0)
+			break;
 
-		if (precord)
-			sync_FreePilotRecord (precord);
 		precord = NULL;
+		base.known = 0;
+		base.record = NULL;
+	}
+	sync_FreePilotRecord(device);
+	if (result < 0) {
+		free_record_queue(sh, &rq);
+		return result;
 	}
-	pi_buffer_free(recbuf);
 
 	result = sync_MergeFromPilot_process(sh, dbhandle, &rq, rec_mod);
 
@@ -989,6 +1942,7 @@ int sync_MergeToPilot(SyncHandler * sh)
 	}
 
 	result = sh->Post(sh, dbhandle);
+	save_cache(sh, result);
 
       cleanup:
 	close_db(sh, dbhandle);
@@ -1040,6 +1994,7 @@ int sync_Synchronize(SyncHandler * sh)
 	}
 
 	result = sh->Post(sh, dbhandle);
+	save_cache(sh, result);
 
       cleanup:
 	close_db(sh, dbhandle);
@@ -24,16 +24,596 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include "pi-buffer.h"
 #include "pi-util.h"
 
 #ifdef HAVE_ICONV
 #include <iconv.h>
 #endif
 
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #define PILOT_CHARSET "CP1252" 
 
+/* Charsets converted without iconv */
+enum {
+	CHARSET_OTHER,
+	CHARSET_UTF8,
+	CHARSET_CP1252
+};
+
+/* Unicode code points of CP1252 0x80 to 0x9F, 0 where undefined. The
+   other bytes stand for the code point of the same value. */
+static const unsigned short cp1252_high[32] = {
+	0x20AC, 0,      0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017D, 0,
+	0,      0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0,      0x017E, 0x0178
+};
+
+/* UTF-8 encoding of CP1252 0x80 to 0x9F: length, then the bytes. Length
+   0 marks bytes that don't stand for a character. */
+static const unsigned char cp1252_utf8_high[32][4] = {
+	{ 3, 0xE2, 0x82, 0xAC },	/* 0x80 */
+	{ 0 },				/* 0x81 */
+	{ 3, 0xE2, 0x80, 0x9A },	/* 0x82 */
+	{ 2, 0xC6, 0x92 },		/* 0x83 */
+	{ 3, 0xE2, 0x80, 0x9E },	/* 0x84 */
+	{ 3, 0xE2, 0x80, 0xA6 },	/* 0x85 */
+	{ 3, 0xE2, 0x80, 0xA0 },	/* 0x86 */
+	{ 3, 0xE2, 0x80, 0xA1 },	/* 0x87 */
+	{ 2, 0xCB, 0x86 },		/* 0x88 */
+	{ 3, 0xE2, 0x80, 0xB0 },	/* 0x89 */
+	{ 2, 0xC5, 0xA0 },		/* 0x8A */
+	{ 3, 0xE2, 0x80, 0xB9 },	/* 0x8B */
+	{ 2, 0xC5, 0x92 },		/* 0x8C */
+	{ 0 },				/* 0x8D */
+	{ 2, 0xC5, 0xBD },		/* 0x8E */
+	{ 0 },				/* 0x8F */
+	{ 0 },				/* 0x90 */
+	{ 3, 0xE2, 0x80, 0x98 },	/* 0x91 */
+	{ 3, 0xE2, 0x80, 0x99 },	/* 0x92 */
+	{ 3, 0xE2, 0x80, 0x9C },	/* 0x93 */
+	{ 3, 0xE2, 0x80, 0x9D },	/* 0x94 */
+	{ 3, 0xE2, 0x80, 0xA2 },	/* 0x95 */
+	{ 3, 0xE2, 0x80, 0x93 },	/* 0x96 */
+	{ 3, 0xE2, 0x80, 0x94 },	/* 0x97 */
+	{ 2, 0xCB, 0x9C },		/* 0x98 */
+	{ 3, 0xE2, 0x84, 0xA2 },	/* 0x99 */
+	{ 2, 0xC5, 0xA1 },		/* 0x9A */
+	{ 3, 0xE2, 0x80, 0xBA },	/* 0x9B */
+	{ 2, 0xC5, 0x93 },		/* 0x9C */
+	{ 0 },				/* 0x9D */
+	{ 2, 0xC5, 0xBE },		/* 0x9E */
+	{ 2, 0xC5, 0xB8 },		/* 0x9F */
+};
+
+/* U+FFFD REPLACEMENT CHARACTER, in the same form */
+static const unsigned char replacement_utf8[4] = { 3, 0xEF, 0xBF, 0xBD };
+
+#ifdef HAVE_ICONV
+/* Converters are expensive to open, so each thread keeps the last few */
+#define CONVERTER_CACHE_SIZE	8
+#define CHARSET_NAME_SIZE	32
+
+typedef struct converter {
+	char 	from[CHARSET_NAME_SIZE],
+		to[CHARSET_NAME_SIZE];
+	iconv_t cd;
+} converter_t;
+
+typedef struct converter_cache {
+	converter_t entries[CONVERTER_CACHE_SIZE];
+	int 	used,
+		next;
+} converter_cache_t;
+
+#if HAVE_PTHREAD
+static pthread_key_t converter_key;
+static pthread_once_t converter_once = PTHREAD_ONCE_INIT;
+#else
+static converter_cache_t converter_static_cache;
+#endif
+#endif
+
+/***********************************************************************
+ *
+ * Function:    charset_kind
+ *
+ * Summary:     Tell whether a charset name is one converted by the
+ *		built-in tables
+ *
+ * Parameters:  charset		iconv charset name
+ *
+ * Returns:     CHARSET_UTF8, CHARSET_CP1252 or CHARSET_OTHER
+ *
+ ***********************************************************************/
+static int charset_kind(const char *charset)
+{
+	char	name[16];
+	int 	n = 0;
+
+	for (; *charset; charset++) {
+		char 	c = *charset;
+
+		if (c == '-' || c == '_')
+			continue;
+		if (n == sizeof(name) - 1)
+			return CHARSET_OTHER;
+		name[n++] = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+	}
+	name[n] = '\0';
+
+	if (strcmp(name, "UTF8") == 0)
+		return CHARSET_UTF8;
+	if (strcmp(name, "CP1252") == 0 || strcmp(name, "WINDOWS1252") == 0)
+		return CHARSET_CP1252;
+
+	return CHARSET_OTHER;
+}
+
+/***********************************************************************
+ *
+ * Function:    ascii_prefix
+ *
+ * Summary:     Find how many leading bytes are plain ASCII, eight at a
+ *		time
+ *
+ * Parameters:  text, bytes
+ *
+ * Returns:     Number of leading bytes below 0x80
+ *
+ ***********************************************************************/
+static size_t ascii_prefix(const char *text, size_t bytes)
+{
+	size_t	i = 0;
+	uint64_t word;
+
+	for (; i + 8 <= bytes; i += 8) {
+		memcpy(&word, text + i, 8);
+		if (word & 0x8080808080808080ULL)
+			break;
+	}
+	while (i < bytes && !(text[i] & 0x80))
+		i++;
+
+	return i;
+}
+
+/***********************************************************************
+ *
+ * Function:    cp1252_to_utf8
+ *
+ * Summary:     Append CP1252 text converted to UTF-8 to a buffer
+ *
+ * Parameters:  text, bytes, out,
+ *		replace		non-zero to write U+FFFD for undefined bytes
+ *				instead of failing
+ *
+ * Returns:     0 on success, -1 if the text holds an undefined byte or
+ *		out of memory
+ *
+ ***********************************************************************/
+static int
+cp1252_to_utf8(const char *text, size_t bytes, pi_buffer_t *out,
+	       int replace)
+{
+	size_t	i,
+		ascii;
+	unsigned char *o;
+
+	ascii = ascii_prefix(text, bytes);
+	if (pi_buffer_expect(out, ascii + (bytes - ascii) * 3) == NULL)
+		return -1;
+	o = out->data + out->used;
+	memcpy(o, text, ascii);
+	o += ascii;
+
+	for (i = ascii; i < bytes; i++) {
+		unsigned char c = text[i];
+		const unsigned char *e;
+
+		if (c < 0x80) {
+			*o++ = c;
+		} else if (c >= 0xA0) {
+			*o++ = 0xC0 | (c >> 6);
+			*o++ = 0x80 | (c & 0x3F);
+		} else {
+			e = cp1252_utf8_high[c - 0x80];
+			if (e[0] == 0) {
+				if (!replace)
+					return -1;
+				e = replacement_utf8;
+			}
+			memcpy(o, e + 1, e[0]);
+			o += e[0];
+		}
+	}
+	out->used = o - out->data;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    utf8_to_cp1252
+ *
+ * Summary:     Append UTF-8 text converted to CP1252 to a buffer
+ *
+ * Parameters:  text, bytes, out,
+ *		replace		non-zero to write '?' for invalid sequences
+ *				and characters CP1252 lacks instead of
+ *				failing
+ *
+ * Returns:     0 on success, -1 if the text isn't valid UTF-8, holds a
+ *		character CP1252 lacks, or out of memory
+ *
+ ***********************************************************************/
+static int
+utf8_to_cp1252(const char *text, size_t bytes, pi_buffer_t *out,
+	       int replace)
+{
+	size_t	i,
+		ascii;
+	unsigned char *o;
+	const unsigned char *t = (const unsigned char *) text;
+
+	ascii = ascii_prefix(text, bytes);
+	if (pi_buffer_expect(out, bytes) == NULL)
+		return -1;
+	o = out->data + out->used;
+	memcpy(o, text, ascii);
+	o += ascii;
+
+	for (i = ascii; i < bytes;) {
+		unsigned int u;
+		int 	n,
+			j;
+		size_t	next = i + 1;
+
+		if (t[i] < 0x80) {
+			*o++ = t[i++];
+			continue;
+		} else if ((t[i] & 0xE0) == 0xC0) {
+			u = t[i] & 0x1F;
+			n = 1;
+		} else if ((t[i] & 0xF0) == 0xE0) {
+			u = t[i] & 0x0F;
+			n = 2;
+		} else {
+			/* Beyond the BMP or invalid: not in CP1252 anyway */
+			goto bad;
+		}
+		if (i + n >= bytes)
+			goto bad;
+		for (j = 1; j <= n; j++) {
+			if ((t[i + j] & 0xC0) != 0x80)
+				goto bad;
+			u = (u << 6) | (t[i + j] & 0x3F);
+		}
+		next = i + n + 1;
+
+		if (u < (n == 1 ? 0x80U : 0x800U))
+			goto bad;	/* overlong encoding */
+		if (u >= 0xA0 && u <= 0xFF) {
+			*o++ = u;
+		} else {
+			for (j = 0; j < 32; j++)
+				if (cp1252_high[j] == u && u != 0)
+					break;
+			if (j == 32)
+				goto bad;
+			*o++ = 0x80 + j;
+		}
+		i = next;
+		continue;
+
+	bad:
+		/* A broken sequence is replaced a byte at a time, a
+		   character CP1252 lacks all at once */
+		if (!replace)
+			return -1;
+		*o++ = '?';
+		i = next;
+	}
+	out->used = o - out->data;
+
+	return 0;
+}
+
+#ifdef HAVE_ICONV
+/***********************************************************************
+ *
+ * Function:    converter_cache_free
+ *
+ * Summary:     Close the converters of a thread when it exits
+ *
+ * Parameters:  cache
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void converter_cache_free(void *data)
+{
+	int 	i;
+	converter_cache_t *cache = (converter_cache_t *) data;
+
+	for (i = 0; i < cache->used; i++)
+		iconv_close(cache->entries[i].cd);
+	free(cache);
+}
+
+#if HAVE_PTHREAD
+static void converter_key_init(void)
+{
+	pthread_key_create(&converter_key, converter_cache_free);
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    converter_get
+ *
+ * Summary:     Get a converter from the calling thread's cache, opening
+ *		it if needed
+ *
+ * Parameters:  to, from	iconv charset names
+ *		cached (output)	set to 0 if the converter isn't cached
+ *				and must be closed after use
+ *
+ * Returns:     The converter, or (iconv_t) -1 on failure
+ *
+ ***********************************************************************/
+static iconv_t converter_get(const char *to, const char *from, int *cached)
+{
+	int 	i;
+	iconv_t cd;
+	converter_t *c;
+	converter_cache_t *cache;
+
+#if HAVE_PTHREAD
+	pthread_once(&converter_once, converter_key_init);
+	cache = (converter_cache_t *) pthread_getspecific(converter_key);
+	if (cache == NULL) {
+		cache = (converter_cache_t *) calloc(1,
+			sizeof(converter_cache_t));
+		if (cache != NULL
+		    && pthread_setspecific(converter_key, cache) != 0) {
+			free(cache);
+			cache = NULL;
+		}
+	}
+#else
+	cache = &converter_static_cache;
+#endif
+
+	*cached = 0;
+	if (cache == NULL || strlen(to) >= CHARSET_NAME_SIZE
+	    || strlen(from) >= CHARSET_NAME_SIZE)
+		return iconv_open(to, from);
+
+	for (i = 0; i < cache->used; i++) {
+		c = &cache->entries[i];
+		if (strcmp(c->to, to) == 0 && strcmp(c->from, from) == 0) {
+			/* back to the initial shift state */
+			iconv(c->cd, NULL, NULL, NULL, NULL);
+			*cached = 1;
+			return c->cd;
+		}
+	}
+
+	cd = iconv_open(to, from);
+	if (cd == (iconv_t) -1)
+		return cd;
+
+	if (cache->used < CONVERTER_CACHE_SIZE) {
+		c = &cache->entries[cache->used++];
+	} else {
+		c = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % CONVERTER_CACHE_SIZE;
+		iconv_close(c->cd);
+	}
+	strcpy(c->to, to);
+	strcpy(c->from, from);
+	c->cd = cd;
+	*cached = 1;
+
+	return cd;
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    convert_append
+ *
+ * Summary:     Append text converted from one charset to another to a
+ *		buffer, followed by a null byte
+ *
+ * Parameters:  to, from	iconv charset names
+ *		text, bytes	text to convert
+ *		out		buffer to append to; on failure, its used
+ *				size is left unchanged
+ *		replace		non-zero to replace what can't be converted
+ *				by U+FFFD, or '?' if 'to' isn't UTF-8,
+ *				instead of failing
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+static int
+convert_append(const char *to, const char *from, const char *text,
+	       size_t bytes, pi_buffer_t *out, int replace)
+{
+	int 	result = -1,
+		to_kind = charset_kind(to),
+		from_kind = charset_kind(from);
+	size_t	start = out->used;
+
+	if (from_kind == CHARSET_CP1252 && to_kind == CHARSET_UTF8) {
+		result = cp1252_to_utf8(text, bytes, out, replace);
+	} else if (from_kind == CHARSET_UTF8 && to_kind == CHARSET_CP1252) {
+		result = utf8_to_cp1252(text, bytes, out, replace);
+	} else {
+#ifdef HAVE_ICONV
+		int 	cached;
+		char	*in = (char *) text,
+			*o;
+		size_t	ibl = bytes,
+			obl;
+		iconv_t cd;
+
+		cd = converter_get(to, from, &cached);
+		if (cd == (iconv_t) -1)
+			return -1;
+
+		result = 0;
+		while (result == 0) {
+			if (pi_buffer_expect(out, ibl * 2 + 16) == NULL) {
+				result = -1;
+				break;
+			}
+			o = (char *) out->data + out->used;
+			obl = out->allocated - out->used;
+			if (iconv(cd, &in, &ibl, &o, &obl) != (size_t) -1) {
+				/* flush any pending shift sequence */
+				if (iconv(cd, NULL, NULL, &o, &obl)
+				    == (size_t) -1)
+					result = -1;
+				out->used = o - (char *) out->data;
+				break;
+			}
+			out->used = o - (char *) out->data;
+			if (errno == E2BIG)
+				continue;
+
+			/* Skip a byte that can't be converted */
+			if (!replace || ibl == 0 || pi_buffer_append(out,
+				    to_kind == CHARSET_UTF8
+				    ? "\xEF\xBF\xBD" : "?",
+				    to_kind == CHARSET_UTF8 ? 3 : 1) == NULL) {
+				result = -1;
+				break;
+			}
+			in++;
+			ibl--;
+		}
+
+		if (!cached)
+			iconv_close(cd);
+#endif
+	}
+
+	if (result == 0 && pi_buffer_append(out, "", 1) == NULL)
+		result = -1;
+	if (result < 0)
+		out->used = start;
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    convert_string
+ *
+ * Summary:     Convert one string into a newly allocated one
+ *
+ * Parameters:  to, from, text, bytes, result (output)
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+static int
+convert_string(const char *to, const char *from, const char *text,
+	       int bytes, char **result)
+{
+	pi_buffer_t buf;
+
+	*result = NULL;
+	if (bytes < 0)
+		return -1;
+
+	buf.data = (unsigned char *) malloc(bytes + 1);
+	buf.allocated = bytes + 1;
+	buf.used = 0;
+	if (buf.data == NULL)
+		return -1;
+
+	if (convert_append(to, from, text, bytes, &buf, 0) < 0) {
+		free(buf.data);
+		return -1;
+	}
+
+	*result = (char *) buf.data;
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    convert_batch
+ *
+ * Summary:     Convert many strings into a single allocation
+ *
+ * Parameters:  to, from, count, texts, bytes, results, arena (output)
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+static int
+convert_batch(const char *to, const char *from, int count,
+	      const char *const *texts, const int *bytes, char **results,
+	      char **arena)
+{
+	int 	i;
+	size_t	total = 0,
+		*offsets;
+	pi_buffer_t buf;
+
+	*arena = NULL;
+	for (i = 0; i < count; i++) {
+		results[i] = NULL;
+		if (texts[i] != NULL && bytes[i] > 0)
+			total += bytes[i];
+	}
+
+	offsets = (size_t *) malloc((count + 1) * sizeof(size_t));
+	buf.allocated = total + count + 1;
+	buf.data = (unsigned char *) malloc(buf.allocated);
+	buf.used = 0;
+	if (offsets == NULL || buf.data == NULL)
+		goto fail;
+
+	for (i = 0; i < count; i++) {
+		offsets[i] = buf.used;
+		if (texts[i] == NULL)
+			continue;
+		if (bytes[i] < 0
+		    || convert_append(to, from, texts[i], bytes[i], &buf, 0) < 0)
+			goto fail;
+	}
+
+	/* The arena only stops moving once all strings are in */
+	for (i = 0; i < count; i++)
+		if (texts[i] != NULL)
+			results[i] = (char *) buf.data + offsets[i];
+	*arena = (char *) buf.data;
+	free(offsets);
+
+	return 0;
+
+fail:
+	free(offsets);
+	free(buf.data);
+
+	return -1;
+}
+
 /***********************************************************************
  *
  * Function:    convert_ToPilotChar
@@ -63,16 +643,12 @@ int
 convert_ToPilotChar(const char *charset, const char *text,
 		    int bytes, char **ptext)
 {
-#ifdef HAVE_ICONV
 	char*   pcharset;
 
 	if ((pcharset = getenv("PILOT_CHARSET")) == NULL)
 		pcharset = PILOT_CHARSET;
 	return convert_ToPilotChar_WithCharset(charset, text, bytes,
 	    ptext, pcharset);
-#else
-	return -1;
-#endif
 }
 
 
@@ -103,33 +679,11 @@ int
 convert_ToPilotChar_WithCharset(const char *charset, const char *text,
 		    int bytes, char **ptext, const char * pi_charset)
 {
-#ifdef HAVE_ICONV
-	char*	ob;
-	iconv_t cd;
-	size_t 	ibl, obl;
-
 	if(NULL==pi_charset){
 		pi_charset = PILOT_CHARSET;
 	}
 
-	cd = iconv_open(pi_charset, charset);
-	if (cd==(iconv_t)-1)
-		return -1;
-
-	ibl 	= bytes;
-	obl 	= bytes * 4 + 1;
-	*ptext 	= ob = malloc(obl);
-	
-	if (iconv(cd, &text, &ibl, &ob, &obl) == (size_t)-1)
-		return -1;
-	*ob = '\0';
-
-	iconv_close(cd);
-
-	return 0;
-#else
-	return -1;
-#endif
+	return convert_string(pi_charset, charset, text, bytes, ptext);
 }
 
 /***********************************************************************
@@ -158,16 +712,12 @@ int
 convert_FromPilotChar(const char *charset, const char *ptext,
 		      int bytes, char **text)
 {
-#ifdef HAVE_ICONV
 	char*   pcharset;
 
 	if ((pcharset = getenv("PILOT_CHARSET")) == NULL)
 		pcharset = PILOT_CHARSET;
 	return convert_FromPilotChar_WithCharset(charset, ptext, bytes,
 	    text, pcharset);
-#else
-	return -1;
-#endif
 }
 
 
@@ -194,33 +744,121 @@ int
 convert_FromPilotChar_WithCharset(const char *charset, const char *ptext,
 		      int bytes, char **text, const char * pi_charset)
 {
-#ifdef HAVE_ICONV
-	char*	ob;
-	iconv_t cd;
-	size_t 	ibl, obl;
-
 	if(NULL==pi_charset){
 		pi_charset = PILOT_CHARSET;
 	}
 
-	cd = iconv_open(charset, pi_charset);
-	if (cd==(iconv_t)-1)
-		return -1;
+	return convert_string(charset, pi_charset, ptext, bytes, text);
+}
 
-	ibl 	= bytes;
-	obl 	= bytes * 4 + 1;
-	*text 	= ob = malloc(obl);
-	
-	if (iconv(cd, &ptext, &ibl, &ob, &obl) == (size_t)-1)
-		return -1;
-	*ob = '\0';
 
-	iconv_close(cd);
+/***********************************************************************
+ *
+ * Function:    convert_ToPilotChar_Batch
+ *
+ * Summary:     Convert many strings from a desktop text encoding to a
+ *		Palm supported encoding at once, into one allocation
+ *
+ * Parameters:
+ *		charset		iconv-recognised source charset
+ *		pi_charset	iconv-recognised pilot-charset identifier, or
+ *				NULL for the PILOT_CHARSET environment
+ *				variable or CP1252
+ *		count		number of strings
+ *		texts		strings to convert; NULL entries are skipped
+ *				and give NULL results
+ *		bytes		number of bytes of each string to convert
+ *		ptexts (output)	converted null-terminated strings, all
+ *				pointing into 'arena'
+ *		arena (output)	the single allocation holding the results,
+ *				to be freed by the caller
+ *
+ * Returns:     0 on success, -1 if any string fails to convert, in which
+ *		case nothing needs to be freed
+ *
+ ***********************************************************************/
+int
+convert_ToPilotChar_Batch(const char *charset, const char *pi_charset,
+			  int count, const char *const *texts,
+			  const int *bytes, char **ptexts, char **arena)
+{
+	if (pi_charset == NULL && (pi_charset = getenv("PILOT_CHARSET")) == NULL)
+		pi_charset = PILOT_CHARSET;
+
+	return convert_batch(pi_charset, charset, count, texts, bytes,
+		ptexts, arena);
+}
 
-	return 0;
-#else
-	return -1;
-#endif
+
+/***********************************************************************
+ *
+ * Function:    convert_FromPilotChar_Batch
+ *
+ * Summary:     Convert many strings from a Palm supported encoding to a
+ *		desktop text encoding at once, into one allocation
+ *
+ * Parameters:
+ *		charset		iconv-recognised destination charset
+ *		pi_charset	iconv-recognised pilot-charset identifier, or
+ *				NULL for the PILOT_CHARSET environment
+ *				variable or CP1252
+ *		count		number of strings
+ *		ptexts		strings to convert; NULL entries are skipped
+ *				and give NULL results
+ *		bytes		number of bytes of each string to convert
+ *		texts (output)	converted null-terminated strings, all
+ *				pointing into 'arena'
+ *		arena (output)	the single allocation holding the results,
+ *				to be freed by the caller
+ *
+ * Returns:     0 on success, -1 if any string fails to convert, in which
+ *		case nothing needs to be freed
+ *
+ ***********************************************************************/
+int
+convert_FromPilotChar_Batch(const char *charset, const char *pi_charset,
+			    int count, const char *const *ptexts,
+			    const int *bytes, char **texts, char **arena)
+{
+	if (pi_charset == NULL && (pi_charset = getenv("PILOT_CHARSET")) == NULL)
+		pi_charset = PILOT_CHARSET;
+
+	return convert_batch(charset, pi_charset, count, ptexts, bytes,
+		texts, arena);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    convert_FromPilotChar_Append
+ *
+ * Summary:     Append text converted from a Palm supported encoding to
+ *		a buffer, replacing what can't be converted
+ *
+ * Parameters:
+ *		charset		iconv-recognised destination charset
+ *		pi_charset	iconv-recognised pilot-charset identifier, or
+ *				NULL for the PILOT_CHARSET environment
+ *				variable or CP1252
+ *		ptext		multibyte sequence in pilot's charset
+ *		bytes		number of bytes from ptext to convert
+ *		out		buffer to append the converted text and a
+ *				null byte to
+ *
+ * Returns:     0 on success, -1 if out of memory or the charsets can't
+ *		be converted, in which case 'out' is left unchanged
+ *
+ ***********************************************************************/
+int
+convert_FromPilotChar_Append(const char *charset, const char *pi_charset,
+			     const char *ptext, int bytes, pi_buffer_t *out)
+{
+	if (pi_charset == NULL && (pi_charset = getenv("PILOT_CHARSET")) == NULL)
+		pi_charset = PILOT_CHARSET;
+	if (bytes < 0)
+		return -1;
+
+	return convert_append(charset, pi_charset, ptext, bytes, out, 1);
 }
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* Local Variables: */
@@ -28,6 +28,7 @@
 #include "pi-socket.h"
 #include "pi-dlp.h"
 #include "pi-address.h"
+#include "pi-csv.h"
 #include "pi-header.h"
 #include "pi-userland.h"
 
@@ -40,12 +41,15 @@ char 	tabledelims[4] = { '\n', ',', ';', '\t' };
 
 
 
+/* Fields are quoted, and control characters written as backslash
+   escapes, so that every record is on one line */
+#define CSV_FLAGS	(PI_CSV_BACKSLASH | PI_CSV_TRIM)
+
+/* The progress count is only updated this often */
+#define PROGRESS_EVERY	256
+
 /* Define prototypes */
-int inchar(FILE * in);
-int read_field(char *dest, FILE * in, size_t length);
-void outchar(char c, FILE * out);
-int write_field(FILE * out, const char *source, enum terminators more);
-int match_phone(char *buf, struct AddressAppInfo *aai);
+int match_phone(const char *buf, const pi_csv_labels_t *phones);
 int read_file(FILE * in, int sd, int db, struct AddressAppInfo *aai);
 int write_file(FILE * out, int sd, int db, struct AddressAppInfo *aai, int human /* human-readable or CSV */);
 
@@ -85,236 +89,39 @@ int
 
 /***********************************************************************
  *
- * Function:    inchar
- *
- * Summary:     Turn the protected name back into the "original"
- *		characters
- *
- * Parameters:
- *
- * Returns:     Modified character, 'c'
- *
- ***********************************************************************/
-int inchar(FILE * in) {
-	int 	c;	/* switch */
-
-	c = getc(in);
-	if (c == '\\') {
-		c = getc(in);
-		switch (c) {
-		case 'b':
-			c = '\b';
-			break;
-		case 'f':
-			c = '\f';
-			break;
-		case 'n':
-			c = '\n';
-			break;
-		case 't':
-			c = '\t';
-			break;
-		case 'r':
-			c = '\r';
-			break;
-		case 'v':
-			c = '\v';
-			break;
-		case '\\':
-			c = '\\';
-			break;
-		default:
-			ungetc(c, in);
-			c = '\\';
-			break;
-		}
-	}
-	return c;
-}
-
-
-/***********************************************************************
- *
- * Function:    read_field
- *
- * Summary:     Reach each field of the CSV during read_file
- *
- * Parameters:  dest    <-> Buffer for storing field contents
- *              in      --> Inbound filehandle
- *              length  --> Size of buffer
- *
- * Returns:     0 for end of line
- *              1 for , termination
- *              2 for ; termination
- *              3 for \t termination
- *             -1 on end of file
- *
- *              Note that these correspond to indexes in the tabledelims
- *              array, and should be preserved.
- *
- ***********************************************************************/
-int read_field(char *dest, FILE *in, size_t length) {
-	int 	c;
-
-	if (length<=1) return -1;
-	/* reserve space for trailing NUL */
-	length--;
-
-	do {	/* Absorb whitespace */
-		c = getc(in);
-		if(c == '\n') {
-			*dest = 0;
-			return term_newline;
-		}
-
-	} while ((c != EOF) && ((c == ' ') || (c == '\t') || (c == '\r')));
-
-	if (c == '"') {
-		c = inchar(in);
-
-		while (c != EOF) {
-			if (c == '"') {
-				c = inchar(in);
-				if (c != '"')
-					break;
-			}
-			*dest++ = c;
-			if (!(--length))
-				break;
-			c = inchar(in);
-		}
-	} else {
-		while (c != EOF) {
-			if ((c == '\n') || (c == tabledelims[tabledelim])) {
-				break;
-			}
-			*dest++ = c;
-			if (!(--length))
-				break;
-			c = inchar(in);
-		}
-	}
-	*dest++ = '\0';
-
-	/* Absorb whitespace */
-	while ((c != EOF) && ((c == ' ') || (c == '\t')))
-		c = getc(in);
-
-	if (c == ',')
-		return term_comma;
-
-	else if (c == ';')
-		return term_semi;
-
-	else if (c == '\t')
-		return term_tab;
-
-	else if (c == EOF)
-		return -1;	/* No more */
-	else
-		return term_newline;
-}
-
-
-/***********************************************************************
- *
- * Function:    outchar
- *
- * Summary:     Protect each of the 'illegal' characters in the output
- *
- * Parameters:  filehandle
- *
- * Returns:     Nothing
- *
- ***********************************************************************/
-void outchar(char c, FILE * out) {
-		switch (c) {
-		case '"':
-			putc('"', out);
-			putc('"', out);
-			break;
-		case '\b':
-			putc('\\', out);
-			putc('b', out);
-			break;
-		case '\f':
-			putc('\\', out);
-			putc('f', out);
-			break;
-		case '\n':
-			putc('\\', out);
-			putc('n', out);
-			break;
-		case '\t':
-			putc('\\', out);
-			putc('t', out);
-			break;
-		case '\r':
-			putc('\\', out);
-			putc('r', out);
-			break;
-		case '\v':
-			putc('\\', out);
-			putc('v', out);
-			break;
-		case '\\':
-			putc('\\', out);
-			putc('\\', out);
-			break;
-		default:
-			putc(c, out);
-			break;
-		}
-}
-
-
-/***********************************************************************
- *
- * Function:    write_field
+ * Function:    match_phone
  *
- * Summary:     Write out each field in the CSV
+ * Summary:     Find the phone label named in 'buf'
  *
- * Parameters:  out    --> output file handle
- *              source --> NUL-terminated data to output
- *              more   --> delimiter number
+ * Parameters:  label name, table of the phone labels
  *
- * Returns:
+ * Returns:     Index of the label, or the number in 'buf' if no
+ *		label matches
  *
  ***********************************************************************/
-int write_field(FILE * out, const char *source, enum terminators more) {
-	putc('"', out);
+int match_phone(const char *buf, const pi_csv_labels_t *phones) {
+	int 	i = pi_csv_labels_find(phones, buf);
 
-	while (*source) {
-		outchar(*source, out);
-		source++;
-	}
-	putc('"', out);
-
-	putc(tabledelims[more], out);
-	return 0;
+	return i >= 0 ? i : atoi(buf);	/* 0 is default */
 }
 
 
-
-
 /***********************************************************************
  *
- * Function:    match_phone
+ * Function:    match_category
  *
- * Summary:     Find and match the 'phone' entries in 'buf'
+ * Summary:     Find the category named in 'buf', as plu_findcategory()
+ *		with PLU_CAT_CASE_INSENSITIVE | PLU_CAT_DEFAULT_UNFILED
  *
- * Parameters:
+ * Parameters:  category name, table of the category names
  *
- * Returns:
+ * Returns:     Index of the category, 0 (Unfiled) if there is none
  *
  ***********************************************************************/
-int match_phone(char *buf, struct AddressAppInfo *aai) {
-	int 	i;
+static int match_category(const char *buf, const pi_csv_labels_t *categories) {
+	int 	i = pi_csv_labels_find(categories, buf);
 
-	for (i = 0; i < 8; i++)
-		if (strncasecmp(buf, aai->phoneLabels[i], sizeof(aai->phoneLabels[0])) == 0)
-			return i;
-	return atoi(buf);	/* 0 is default */
+	return i >= 0 ? i : 0;
 }
 
 
@@ -330,14 +137,20 @@ int match_phone(char *buf, struct AddressAppInfo *aai) {
  *
  ***********************************************************************/
 int read_file(FILE *f, int sd, int db, struct AddressAppInfo *aai) {
-	int 	i	= -1,
+	int 	i,
+		k,
 		l,
+		n,
 		attribute,
 		category;
-	char 	buf[0xffff];
 	int showPhone = -1;
+	char 	separators[2] = { ';', '\0' };
 
 	pi_buffer_t *record;
+	pi_csv_reader_t *csv;
+	pi_csv_field_t *field;
+	pi_csv_labels_t phones,
+		categories;
 
 	struct 	Address addr;
 
@@ -345,95 +158,78 @@ int read_file(FILE *f, int sd, int db, struct AddressAppInfo *aai) {
 	int count = 0; /* Number of entries read */
 	const char *progress = "   Reading CSV entries, writing to Palm Address Book... ";
 
+	csv = pi_csv_reader_new(f, tabledelims[tabledelim],
+		CSV_FLAGS | PI_CSV_COMMENTS);
+	record = pi_buffer_new(0);
+	if (csv == NULL || record == NULL) {
+		fprintf(stderr, "   ERROR: Out of memory\n");
+		pi_csv_reader_free(csv);
+		pi_buffer_free(record);
+		return -1;
+	}
+
+	/* Fields ending with ';' mark augmented entries */
+	if (tabledelim != term_semi)
+		csv->separators = separators;
+
+	pi_csv_labels_init(&phones, aai->phoneLabels[0], 8,
+		sizeof(aai->phoneLabels[0]));
+	pi_csv_labels_init(&categories, aai->category.name[0], 16,
+		sizeof(aai->category.name[0]));
+
 	if (!plu_quiet) {
 		printf("%s",progress);
 		fflush(stdout);
 	}
 
-	while (!feof(f)) {
+	while ((n = pi_csv_read_record(csv)) > 0) {
+		field = csv->fields;
 		fields = 0;
-		l = getc(f);
-		if (feof(f) || (l<0)) {
-			break;
-		}
-		if ('#' == l) {
-			/* skip remainder of line */
-			while (!feof(f) && (l!='\n') && (l>=0)) {
-				l = getc(f);
-			}
-			continue;
-		} else {
-			ungetc(l,f);
-		}
-		i = read_field(buf, f, sizeof(buf));
-		/* fprintf(stderr,"* Field=%s\n",buf); */
+		k = 0;
 
 		memset(&addr, 0, sizeof(addr));
 		addr.showPhone = 0;
 		showPhone = -1; /* None specified this record */
 
-		if ((i == term_semi) && (tabledelim != term_semi)) {
+		if ((field[k].term == ';') && (tabledelim != term_semi)) {
 			/* This is an augmented entry */
-			category = plu_findcategory(&aai->category,buf,
-				PLU_CAT_CASE_INSENSITIVE | PLU_CAT_DEFAULT_UNFILED);
-			i = read_field(buf, f, sizeof(buf));
-			if (i == term_semi) {
-				showPhone = match_phone(buf, aai);
-				i = read_field(buf, f, sizeof(buf));
-			}
+			category = match_category(field[k++].data, &categories);
+			if (k < n && field[k].term == ';')
+				showPhone = match_phone(field[k++].data, &phones);
 		} else {
 			category = defaultcategory;
 		}
 
-		if (i < 0)
-			break;
-
 		attribute = 0;
 
-		for (l = 0; (i >= 0) && (l < 21); l++) {
+		/* The fields are packed where they lie, not copied */
+		for (l = 0; (k < n) && (l < 21); l++, k++) {
 			int l2 = realentry[l];
 
 			if ((l2 >= 3) && (l2 <= 7)) {
-				if ((i != term_semi) || (tabledelim == term_semi)) {
+				if ((field[k].term != ';') || (tabledelim == term_semi)) {
 					addr.phoneLabel[l2 - 3] = l2 - 3;
 				}
 				else {
-					addr.phoneLabel[l2 - 3] = match_phone(buf, aai);
-					i = read_field(buf, f, sizeof(buf));
+					addr.phoneLabel[l2 - 3] = match_phone(field[k].data, &phones);
+					if (++k == n)
+						break;
 				}
-				if (buf[0]) {
-					addr.entry[l2] = strdup(buf);
+				if (field[k].data[0]) {
+					addr.entry[l2] = field[k].data;
 					++fields;
-				} else {
-					addr.entry[l2] = NULL;
 				}
 			} else if (19 <= l2) {
 				if (19 == l2) {
-					attribute = (atoi(buf) ? dlpRecAttrSecret : 0);
+					attribute = (atoi(field[k].data) ? dlpRecAttrSecret : 0);
 				}
 				if (20 == l2) {
-					category = plu_findcategory(&aai->category,buf,
-						PLU_CAT_CASE_INSENSITIVE | PLU_CAT_DEFAULT_UNFILED);
+					category = match_category(field[k].data, &categories);
 				}
-			} else {
-				if (buf[0]) {
-					addr.entry[l2] = strdup(buf);
-					++fields;
-				} else {
-					addr.entry[l2] = NULL;
-				}
-
+			} else if (field[k].data[0]) {
+				addr.entry[l2] = field[k].data;
+				++fields;
 			}
-
-			if (i == 0)
-				break;
-
-			i = read_field(buf, f, sizeof(buf));
-		}
-
-
-		while (i > 0) {	/* Too many fields in record */
-			i = read_field(buf, f, sizeof(buf));
 		}
 
 		if (showPhone >= 0) {
@@ -448,27 +244,30 @@ int read_file(FILE *f, int sd, int db, struct AddressAppInfo *aai) {
 		}
 
 		if (fields>0) {
-		        record = pi_buffer_new(0);
 			pack_Address(&addr, record, address_v1);
 			dlp_WriteRecord(sd, db, attribute, 0, category,
 					(unsigned char *) record->data, record->used, 0);
-			pi_buffer_free(record);
 			++count;
-		}
-		free_Address(&addr);
 
-		if (!plu_quiet) {
-			printf("\r%s%d",progress,count);
-			fflush(stdout);
+			if (!plu_quiet && count % PROGRESS_EVERY == 0) {
+				printf("\r%s%d",progress,count);
+				fflush(stdout);
+			}
 		}
-
 	}
 
+	if (n < 0)
+		fprintf(stderr, "\n   ERROR: Could not read the CSV file (%s)\n",
+			strerror(errno));
+
+	pi_buffer_free(record);
+	pi_csv_reader_free(csv);
+
 	if (!plu_quiet) {
 		printf("\r%s%d\n   Done.\n",progress,count);
 		fflush(stdout);
 	}
-	return 0;
+	return n < 0 ? -1 : 0;
 }
 
 
@@ -484,42 +283,39 @@ int read_file(FILE *f, int sd, int db, struct AddressAppInfo *aai) {
  *
  ***********************************************************************/
 
-void write_record_CSV(FILE *out, const struct AddressAppInfo *aai, 
+void write_record_CSV(pi_csv_writer_t *out, const struct AddressAppInfo *aai, 
         const struct Address *addr, const int attribute, 
         const int category) {
         
 	int j;
-	char buffer[16];
 
 	if (augment && (category || addr->showPhone)) {
-		write_field(out,
+		pi_csv_write_field(out,
 				aai->category.name[category],
-				term_semi);
-		write_field(out,
+				';');
+		pi_csv_write_field(out,
 				aai->phoneLabels[addr->phoneLabel[addr->showPhone]],
-				term_semi);
+				';');
 	}
 
 	for (j = 0; j < 19; j++) {
 		if (addr->entry[realentry[j]]) {
 			if (augment && (j >= 4) && (j <= 8)) {
-				write_field(out,
+				pi_csv_write_field(out,
 						aai->phoneLabels[addr->phoneLabel
-								[j - 4]], term_semi);
+								[j - 4]], ';');
 			}
-			write_field(out, addr->entry[realentry[j]],
-					tabledelim);
+			pi_csv_write_field(out, addr->entry[realentry[j]], 0);
 		} else {
-			write_field(out, "", tabledelim);
+			pi_csv_write_field(out, NULL, 0);
 		}
 	}
 
-	snprintf(buffer, sizeof(buffer), "%d", (attribute & dlpRecAttrSecret) ? 1 : 0);
-	write_field(out, buffer, tabledelim);
+	pi_csv_write_field(out, (attribute & dlpRecAttrSecret) ? "1" : "0", 0);
 
-	write_field(out,
+	pi_csv_write_field(out,
 		aai->category.name[category],
-		term_newline);
+		'\n');
 }
 
 void write_record_human(struct AddressAppInfo *aai, struct Address *addr, const int category) {
@@ -551,18 +347,23 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 		category;
 	struct 	Address addr;
 	pi_buffer_t *buf;
+	pi_arena_t *arena;
+	pi_csv_writer_t csv;
 
 	int count = 0;
 	const char *progress = "   Writing Palm Address Book entries to file... ";
 
+	pi_csv_writer_init(&csv, out, tabledelims[tabledelim],
+		CSV_FLAGS | PI_CSV_QUOTE_ALL);
+
 	if (!human) {
 		/* Print out the header and fields with fields intact. Note we
 		'ignore' the last field (Private flag) and print our own here, so
 		we don't have to chop off the trailing comma at the end. Hacky. */
 		fprintf(out, "# ");
 		for (j = 0; j < 21; j++) {
-			write_field(out, tableheads[j],
-				j<20 ? tabledelim : term_newline);
+			pi_csv_write_field(&csv, tableheads[j],
+				j<20 ? 0 : '\n');
 		}
 		if (augment) {
 			fprintf(out,"### This in an augmented (non-standard) CSV file.\n");
@@ -574,7 +375,10 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 		fflush(stdout);
 	}
 
+	/* The fields are only printed, so they are left in the record
+	   buffer instead of being copied */
 	buf = pi_buffer_new (0xffff);
+	arena = pi_arena_new_borrowing(0);
 	for (i = 0;
 	     (j =
 	      dlp_ReadRecordByIndex(sd, db, i, buf, 0,
@@ -584,21 +388,23 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 
 		if (attribute & dlpRecAttrDeleted)
 			continue;
-		unpack_Address(&addr, buf, address_v1);
+		pi_arena_reset(arena);
+		unpack_Address_arena(&addr, buf, address_v1, arena);
 
 		if (!human) {
-			write_record_CSV(out,aai,&addr,attribute,category);
+			write_record_CSV(&csv,aai,&addr,attribute,category);
 		} else {
 			write_record_human(aai,&addr,category);
 		}
 
 
 		++count;
-		if (!plu_quiet) {
+		if (!plu_quiet && count % PROGRESS_EVERY == 0) {
 			printf("\r%s%d",progress,count);
 			fflush(stdout);
 		}
 	}
+	pi_arena_free (arena);
 	pi_buffer_free (buf);
 
 	if (!plu_quiet) {
@@ -720,9 +526,9 @@ int main(int argc, const char *argv[]) {
 
 	/* The first implies that -t was given; the second that it wasn't,
 	   so use default, and the third if handles weird values. */
-	if ((tabledelim < 0) || (tabledelim > sizeof(tabledelim))) {
+	if ((tabledelim < 0) || (tabledelim >= (int) sizeof(tabledelims))) {
 		fprintf(stderr,"   ERROR: Invalid delimiter number %d (use 0-%d).\n",
-			tabledelim,(int)(sizeof(tabledelim)));
+			tabledelim,(int)(sizeof(tabledelims)) - 1);
 		return 1;
 	}
 
@@ -1,5 +1,5 @@
 /*
- * $Id$ 
+ * $Id$
  *
  * pilot-dedupe.c:  Palm utility to remove duplicate records
  *
@@ -19,212 +19,561 @@
  *
  */
 
+/* Records are read one at a time and looked up in a hash table by
+   category, length and pi_hash64() of their data. Only records that
+   match on all three are compared byte by byte, so a database is scanned
+   in linear time and only the data of records that turn out to have a
+   duplicate is kept in memory. The duplicates found are deleted once
+   the scan is complete. */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "pi-header.h"
 #include "pi-source.h"
 #include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-util.h"
 #include "pi-userland.h"
 
+/* Where records come from: a local file or an open database on the Palm */
+struct source {
+	pi_file_t *pf;
+	int	sd;
+	int	db;
+};
+
 struct record {
-	struct record *next;
-	unsigned long id_;
-	char *data;
-	int cat;
-	int index;
-	int len;
+	uint64_t hash;
+	recordid_t id_;
+	int	index;
+	int	cat;
+	size_t	len;
+	int	original;	/* record this one duplicates, or -1 */
+	int	dupes;		/* duplicates of this record found so far */
+	void	*data;		/* only read once another record matches */
 };
 
+struct dedupe {
+	struct source *src;
+	struct record *records;
+	int	count,
+		allocated;
+	int	*table;		/* indices in records, -1 for empty slots */
+	size_t	table_size;	/* a power of two */
+	int	dupes;
+};
+
+static int dry_run = 0;
+
+
 /***********************************************************************
  *
- * Function:    compare_r
+ * Function:    read_record
  *
- * Summary:     Compare records
+ * Summary:     Read a record from a file or the Palm. Records of
+ *		mapped files are returned where they lie, not copied.
  *
- * Parameters:  None
+ * Parameters:  source, index, buffer, unique ID, attributes and
+ *		category returned
  *
- * Returns:     Nothing
+ * Returns:     0 on success, negative at the end or on error
  *
  ***********************************************************************/
-static int compare_r(const void *av, const void *bv)
+static int read_record(struct source *src, int i, pi_buffer_t *buf,
+	recordid_t *id_, int *attr, int *cat)
 {
-	int 	i,
-		o;
-	struct record *a = *(struct record **) av;
-	struct record *b = *(struct record **) bv;
-
-	if (a->cat < b->cat)
-		o = -1;
-	else if (a->cat > b->cat)
-		o = 1;
-	else if (a->len < b->len)
-		o = -1;
-	else if (a->len > b->len)
-		o = 1;
-	else if ((i = memcmp(a->data, b->data, a->len)))
-		o = i;
-	else if (a->index < b->index)
-		o = -1;
-	else if (a->index > b->index)
-		o = 1;
-	else
-		o = 0;
-
-	return o;
+	void 	*data;
+	size_t 	size;
+
+	if (src->pf == NULL)
+		return dlp_ReadRecordByIndex(src->sd, src->db, i, buf, id_,
+			attr, cat);
+
+	if (pi_file_read_record(src->pf, i, &data, &size, attr, cat,
+			id_) < 0)
+		return -1;
+
+	buf->data = data;
+	buf->used = buf->allocated = size;
+	return 0;
 }
 
-static int DeDupe (int sd, const char *dbname)
+
+/***********************************************************************
+ *
+ * Function:    record_data
+ *
+ * Summary:     Get the data of a record seen earlier in the scan,
+ *		reading it again the first time it is needed. Records
+ *		read from the Palm are copied, file records point into
+ *		the mapped file.
+ *
+ * Parameters:  dedupe state, record
+ *
+ * Returns:     The data, or NULL on error
+ *
+ ***********************************************************************/
+static void *record_data(struct dedupe *d, struct record *r)
 {
-	int 	c,
-		db,
-		dupe 	= 0,
-		j,
-		k,
-		l;
-	struct record *r,
-		      **sortidx,
-		      *records = NULL;
 	pi_buffer_t *buffer;
-	char buf[200];
+	pi_buffer_t view;
+	recordid_t id_;
+	int 	attr,
+		cat;
+
+	if (r->data != NULL || r->len == 0)
+		return r->data;
+
+	if (d->src->pf != NULL) {
+		if (read_record(d->src, r->index, &view, &id_, &attr,
+				&cat) < 0)
+			return NULL;
+		r->data = view.data;
+		return r->data;
+	}
 
-	/* Open the database, store access handle in db */
-	printf("Opening %s\n", dbname);
-	if (dlp_OpenDB(sd, 0, dlpOpenReadWrite, dbname, &db) < 0) {
-		printf("Unable to open %s\n", dbname);
+	buffer = pi_buffer_new(r->len);
+	if (buffer == NULL)
+		return NULL;
+	if (read_record(d->src, r->index, buffer, &id_, &attr, &cat) >= 0
+	    && buffer->used == r->len) {
+		r->data 	= buffer->data;
+		buffer->data 	= NULL;
+	}
+	pi_buffer_free(buffer);
+
+	return r->data;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    grow_table
+ *
+ * Summary:     Double the hash table and insert the records that are
+ *		not duplicates again
+ *
+ * Parameters:  dedupe state
+ *
+ * Returns:     0 on success, -1 when out of memory
+ *
+ ***********************************************************************/
+static int grow_table(struct dedupe *d)
+{
+	size_t	size 	= d->table_size ? d->table_size * 2 : 1024,
+		i;
+	int 	*table,
+		k;
+
+	table = malloc(size * sizeof(int));
+	if (table == NULL)
 		return -1;
+	for (i = 0; i < size; i++)
+		table[i] = -1;
+
+	for (k = 0; k < d->count; k++) {
+		if (d->records[k].original >= 0)
+			continue;
+		for (i = d->records[k].hash & (size - 1); table[i] >= 0;
+		     i = (i + 1) & (size - 1))
+			;
+		table[i] = k;
+	}
+
+	free(d->table);
+	d->table 	= table;
+	d->table_size 	= size;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    add_record
+ *
+ * Summary:     Look up a record read from the source, and either mark
+ *		it as a duplicate of an earlier record or remember it
+ *
+ * Parameters:  dedupe state, index, unique ID, category, data
+ *
+ * Returns:     Index of the record it duplicates, -1 if it is new,
+ *		-2 on error
+ *
+ ***********************************************************************/
+static int add_record(struct dedupe *d, int index, recordid_t id_, int cat,
+	const pi_buffer_t *buf)
+{
+	struct 	record *r;
+	uint64_t hash 	= pi_hash64(buf->data, buf->used);
+	size_t 	i;
+	int 	k;
+
+	if ((size_t)d->count + 1 > d->table_size / 2 && grow_table(d) < 0)
+		return -2;
+
+	for (i = hash & (d->table_size - 1); (k = d->table[i]) >= 0;
+	     i = (i + 1) & (d->table_size - 1)) {
+		void 	*data;
+
+		r = &d->records[k];
+		if (r->hash != hash || r->cat != cat || r->len != buf->used)
+			continue;
+
+		/* Same hash: make sure the data is really the same */
+		data = record_data(d, r);
+		if (r->len && data == NULL)
+			return -2;
+		if (r->len == 0 || memcmp(data, buf->data, r->len) == 0)
+			break;
 	}
 
-	printf("Reading records...\n");
+	if (d->count == d->allocated) {
+		int 	n = d->allocated ? d->allocated * 2 : 256;
+		struct record *records;
 
-	l 	= 0;
-	c 	= 0;
-	buffer = pi_buffer_new (0xffff);
-	for (;;) {
+		records = realloc(d->records, n * sizeof(struct record));
+		if (records == NULL)
+			return -2;
+		d->records 	= records;
+		d->allocated 	= n;
+	}
+
+	r = &d->records[d->count];
+	r->hash 	= hash;
+	r->id_ 		= id_;
+	r->index 	= index;
+	r->cat 		= cat;
+	r->len 		= buf->used;
+	r->original 	= k;
+	r->dupes 	= 0;
+	r->data 	= NULL;
+
+	if (k < 0)
+		d->table[i] = d->count;
+	d->count++;
+
+	return k;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    scan
+ *
+ * Summary:     Read every record of the source and report the
+ *		duplicates. Deleted and archived records are skipped.
+ *
+ * Parameters:  dedupe state
+ *
+ * Returns:     Number of duplicates, or -1 on error
+ *
+ ***********************************************************************/
+static int scan(struct dedupe *d)
+{
+	int 	l,
+		k;
+	pi_buffer_t view,
+		*buffer = &view;
+
+	/* file records are only ever pointed to, not copied */
+	if (d->src->pf == NULL && (buffer = pi_buffer_new(0xffff)) == NULL)
+		return -1;
+
+	for (l = 0; ; l++) {
 		int 	attr,
 			cat;
 		recordid_t id_;
-		int len =
-			dlp_ReadRecordByIndex(sd, db, l,
-					      buffer,
-					      &id_,
-					      &attr, &cat);
-
-		l++;
 
-		if (len < 0)
+		if (read_record(d->src, l, buffer, &id_, &attr, &cat) < 0)
 			break;
 
-		/* Skip deleted records */
-		if ((attr & dlpRecAttrDeleted)
-		    || (attr & dlpRecAttrArchived))
+		if (attr & (dlpRecAttrDeleted | dlpRecAttrArchived))
 			continue;
 
-		c++;
+		k = add_record(d, l, id_, cat, buffer);
+		if (k == -2) {
+			fprintf(stderr, "   ERROR: out of memory\n");
+			l = -1;
+			break;
+		}
+		if (k >= 0) {
+			printf("%s record %d, duplicate #%d of record %d\n",
+				dry_run ? "Would delete" : "Found",
+				l + 1, ++d->records[k].dupes,
+				d->records[k].index + 1);
+			d->dupes++;
+		}
+	}
 
-		r = (struct record *)
-			malloc(sizeof(struct record));
+	if (buffer != &view)
+		pi_buffer_free(buffer);
 
-		r->data 	= (char *) malloc(buffer->used);
-		memcpy(r->data, buffer->data, buffer->used);
-		r->len 		= len;
-		r->cat 		= cat;
-		r->id_ 		= id_;
-		r->index 	= l;
+	return l < 0 ? -1 : d->dupes;
+}
 
-		r->next 	= records;
-		records 	= r;
 
-	}
+/***********************************************************************
+ *
+ * Function:    delete_from_palm
+ *
+ * Summary:     Delete the duplicates found by the scan. Every
+ *		duplicate is tried even if one fails.
+ *
+ * Parameters:  dedupe state
+ *
+ * Returns:     Number of records deleted
+ *
+ ***********************************************************************/
+static int delete_from_palm(struct dedupe *d)
+{
+	int 	k,
+		deleted = 0;
 
-	pi_buffer_free (buffer);
+	for (k = 0; k < d->count; k++) {
+		struct record *r = &d->records[k];
 
-	sortidx = malloc(sizeof(struct record *) * c);
+		if (r->original < 0)
+			continue;
+		if (dlp_DeleteRecord(d->src->sd, d->src->db, 0, r->id_) < 0) {
+			fprintf(stderr, "   ERROR: could not delete record %d "
+				"(ID 0x%08lx)\n", r->index + 1, r->id_);
+			continue;
+		}
+		deleted++;
+	}
 
-	r = records;
-	for (k = 0; r && (k < c); k++, r = r->next)
-		sortidx[k] = r;
+	return deleted;
+}
 
-	qsort(sortidx, c, sizeof(struct record *), compare_r);
 
-	printf("Scanning for duplicates...\n");
+/***********************************************************************
+ *
+ * Function:    rewrite_file
+ *
+ * Summary:     Write a copy of a file without the duplicates found by
+ *		the scan next to it, then move it in place
+ *
+ * Parameters:  dedupe state, file name
+ *
+ * Returns:     Number of records deleted, or -1 on error
+ *
+ ***********************************************************************/
+static int rewrite_file(struct dedupe *d, const char *name)
+{
+	int 	i,
+		k,
+		entries;
+	char 	*tmpname;
+	void 	*data;
+	size_t 	size;
+	pi_file_t *in 	= d->src->pf,
+		*out;
+	struct 	DBInfo info;
+
+	tmpname = malloc(strlen(name) + 5);
+	if (tmpname == NULL)
+		return -1;
+	sprintf(tmpname, "%s.tmp", name);
 
-	for (k = 0; k < c; k++) {
-		struct 	record *r2;
-		int 	d = 0;
+	pi_file_get_info(in, &info);
+	info.modifyDate = time(NULL);
+	out = pi_file_create(tmpname, &info);
+	if (out == NULL) {
+		free(tmpname);
+		return -1;
+	}
+	out->unique_id_seed = in->unique_id_seed;
+
+	pi_file_get_app_info(in, &data, &size);
+	if (size)
+		pi_file_set_app_info(out, data, size);
+	pi_file_get_sort_info(in, &data, &size);
+	if (size)
+		pi_file_set_sort_info(out, data, size);
+
+	/* records and d->records are both in file order */
+	pi_file_get_entries(in, &entries);
+	for (i = 0, k = 0; i < entries; i++) {
+		int 	attr,
+			cat;
+		recordid_t id_;
 
-		r = sortidx[k];
+		if (pi_file_read_record(in, i, &data, &size, &attr, &cat,
+				&id_) < 0)
+			goto fail;
 
-		if (r->len < 0)
+		while (k < d->count && d->records[k].index < i)
+			k++;
+		if (k < d->count && d->records[k].index == i
+		    && d->records[k].original >= 0)
 			continue;
 
-		for (j = k + 1; j < c; j++) {
-			r2 = sortidx[j];
+		if (pi_file_append_record(out, data, size, attr, cat,
+				id_) < 0)
+			goto fail;
+	}
+
+	if (pi_file_close(out) < 0) {
+		unlink(tmpname);
+		free(tmpname);
+		return -1;
+	}
+	if (rename(tmpname, name) < 0) {
+		unlink(tmpname);
+		free(tmpname);
+		return -1;
+	}
+
+	free(tmpname);
+	return d->dupes;
 
-			if (r2->len < 0)
-				continue;
+ fail:
+	pi_file_discard(out);
+	free(tmpname);
+	return -1;
+}
 
-			if ((r->len != r2->len)
-			    || memcmp(r->data, r2->data, r->len))
-				break;
 
-			printf
-				("Deleting record %d, duplicate #%d of record %d\n",
-				 r2->index, ++d, r->index);
-			dupe++;
-			dlp_DeleteRecord(sd, db, 0, r2->id_);
+/***********************************************************************
+ *
+ * Function:    DeDupe
+ *
+ * Summary:     Remove the duplicate records of a database on the Palm,
+ *		or of a local file if the name ends in .pdb
+ *
+ * Parameters:  socket (unused for files), database or file name
+ *
+ * Returns:     0 on success, -1 on error
+ *
+ ***********************************************************************/
+static int DeDupe (int sd, const char *dbname)
+{
+	int 	i,
+		found,
+		removed = 0;
+	struct 	source src;
+	struct 	dedupe d;
+	char 	buf[200];
 
-			r2->len = -1;
-			r2->id_ = 0;
+	memset(&src, 0, sizeof(src));
+	memset(&d, 0, sizeof(d));
+	src.sd 	= sd;
+	d.src 	= &src;
 
+	/* Open the database, store access handle in db */
+	printf("Opening %s\n", dbname);
+	if (sd < 0) {
+		src.pf = pi_file_open_mapped(dbname);
+		if (src.pf == NULL) {
+			printf("Unable to open %s\n", dbname);
+			return -1;
+		}
+		if (src.pf->info.flags & dlpDBFlagResource) {
+			printf("%s is a resource database\n", dbname);
+			pi_file_close(src.pf);
+			return -1;
 		}
-		k = j - 1;
+	} else if (dlp_OpenDB(sd, 0,
+			dry_run ? dlpOpenRead : dlpOpenReadWrite,
+			dbname, &src.db) < 0) {
+		printf("Unable to open %s\n", dbname);
+		return -1;
+	}
 
+	printf("Scanning for duplicates...\n");
+	found = scan(&d);
+
+	if (found > 0 && !dry_run) {
+		printf("Deleting %d records...\n", found);
+		if (src.pf != NULL)
+			removed = rewrite_file(&d, dbname);
+		else
+			removed = delete_from_palm(&d);
+		if (removed < 0)
+			printf("Unable to write %s: %s\n", dbname,
+				strerror(errno));
 	}
 
-	free(sortidx);
+	if (src.pf == NULL) {
+		for (i = 0; i < d.count; i++)
+			free(d.records[i].data);
+		dlp_CloseDB(sd, src.db);
+	} else {
+		pi_file_close(src.pf);
+	}
+	free(d.records);
+	free(d.table);
+
+	if (found < 0 || removed < 0)
+		return -1;
 
-	while (records) {
-		if (records->data)
-			free(records->data);
-		r 	= records;
-		records = records->next;
-		free(r);
+	if (dry_run) {
+		printf("Found %d duplicates in %s, nothing deleted\n",
+			found, dbname);
+		return 0;
 	}
 
-	/* Close the database */
-	dlp_CloseDB(sd, db);
-	sprintf(buf, "Removed %d duplicates from %s\n", dupe,
+	sprintf(buf, "Removed %d duplicates from %s\n", removed,
 		dbname);
 	printf("%s", buf);
-	dlp_AddSyncLogEntry(sd, buf);
+	if (src.pf == NULL)
+		dlp_AddSyncLogEntry(sd, buf);
 
-	return 0;
+	return removed == found ? 0 : -1;
 }
 
 
+/***********************************************************************
+ *
+ * Function:    is_file
+ *
+ * Summary:     Tell local files from databases on the Palm
+ *
+ * Parameters:  name
+ *
+ * Returns:     Non-zero if the name ends in .pdb
+ *
+ ***********************************************************************/
+static int is_file(const char *name)
+{
+	size_t 	len = strlen(name);
+
+	return len > 4 && strcasecmp(name + len - 4, ".pdb") == 0;
+}
+
 
 int main(int argc, const char *argv[])
 {
 	int     c,		/* switch */
-		sd		= -1;
+		sd		= -1,
+		failed		= 0;
 
 	const char
-                *db		= NULL;
+                *db		= NULL,
+		**args;
 
 	poptContext pc;
 
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
+		{"dry-run", 'n', POPT_ARG_NONE, &dry_run, 0,
+		 "Only report the duplicates, don't delete them", NULL},
 		POPT_TABLEEND
 	};
 
 	pc = poptGetContext("pilot-dedupe", argc, argv, options, 0);
-	poptSetOtherOptionHelp(pc,"<database> ...\n\n"
-	"   Removes duplicate records from any Palm database\n\n"
+	poptSetOtherOptionHelp(pc,"<database>|<file.pdb> ...\n\n"
+	"   Removes duplicate records from any Palm database\n"
+	"   Names ending in .pdb are local files, which are rewritten\n"
+	"   without connecting to the Palm\n\n"
 	"   Example arguments:\n"
-	"      -p /dev/pilot AddressDB ToDoDB\n\n");
+	"      -p /dev/pilot AddressDB ToDoDB\n"
+	"      -n MemoDB.pdb\n\n");
 
 	if (argc < 2) {
 		poptPrintUsage(pc,stderr,0);
@@ -239,25 +588,37 @@ int main(int argc, const char *argv[])
 		plu_badoption(pc,c);
 	}
 
-	if(poptPeekArg(pc) == NULL) {
+	args = poptGetArgs(pc);
+	if (args == NULL) {
 		fprintf(stderr, "   ERROR: You must specify at least one database\n");
 		return -1;
 	}
 
-	sd = plu_connect ();
-	if (sd < 0)
-		goto error;
+	for (c = 0; args[c] != NULL; c++)
+		if (!is_file(args[c]))
+			break;
 
-	while((db = poptGetArg(pc)) != NULL)
-		DeDupe(sd, db);
+	/* Only connect if there is a database on the Palm to work on */
+	if (args[c] != NULL) {
+		sd = plu_connect ();
+		if (sd < 0)
+			goto error;
+	}
+
+	while((db = *args++) != NULL)
+		if (DeDupe(is_file(db) ? -1 : sd, db) < 0)
+			failed = 1;
 
-	if (dlp_ResetLastSyncPC(sd) < 0)
+	if (sd < 0)
+		return failed;
+
+	if (!dry_run && dlp_ResetLastSyncPC(sd) < 0)
 		goto error_close;
 
 	if (pi_close(sd) < 0)
 		goto error;
 
-	return 0;
+	return failed;
 
  error_close:
 	pi_close(sd);
@@ -0,0 +1,1363 @@
+/*
+ * $Id$
+ *
+ * pilot-export.c:  Bulk export of Palm databases for analytics
+ *
+ * Copyright (c) 2026, pilot-link developers.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/* Two output formats are supported:
+
+   JSON lines: one object per record, with the database name, the kind
+   of data, the record UID, category name and attributes, followed by
+   one member per field of the unpacked record.
+
+   Columnar: a binary stream made of a header, then for each database
+   a table descriptor followed by row groups of up to ROWS_PER_GROUP
+   records, each holding its columns one after the other, then an end
+   marker. All numbers are big-endian.
+
+     header:     'PLCO' 2 version 2 reserved
+     table:      'TABL' string database, string kind, 2 column count,
+                 per column: 1 type (0 integer, 1 string), string name
+     row group:  'ROWS' 4 row count, per column: 4 byte length, null
+                 bitmap (1 bit per row, set when null), then 4 bytes
+                 per row for integers, or 4 byte end offsets per row
+                 followed by the concatenated UTF-8 data for strings
+     end:        'END ' 4 total row count
+
+   where a string is 2 bytes length followed by the UTF-8 data.
+
+   Memory use only depends on the size of a row group, never on the
+   size of the database. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-header.h"
+#include "pi-userland.h"
+#include "pi-util.h"
+
+#include "pi-address.h"
+#include "pi-datebook.h"
+#include "pi-calendar.h"
+#include "pi-contact.h"
+#include "pi-todo.h"
+#include "pi-memo.h"
+#include "pi-expense.h"
+#include "pi-mail.h"
+
+#define COLUMNAR_VERSION	1
+#define ROWS_PER_GROUP		1024
+#define MAX_COLUMNS		64
+
+enum { format_json, format_columnar };
+enum { COL_INT, COL_STRING };
+
+struct column {
+	const char *name;
+	int	type;
+};
+
+struct export;
+
+/* One kind of database we know how to unpack */
+struct kind {
+	const char *name;
+	unsigned long creator;
+	const struct column *columns;
+	int	(*appinfo)(struct export *x, pi_buffer_t *buf);
+	int	(*record)(struct export *x, pi_buffer_t *buf);
+};
+
+/* State of the export of one database */
+struct export {
+	const char *dbname;
+	const struct kind *kind;
+	int	format;
+	int	ncolumns;
+	const struct column *columns[MAX_COLUMNS];
+	int	column;			/* next column of the current row */
+
+	FILE	*out;
+#if HAVE_PTHREAD
+	pthread_mutex_t *lock;		/* held while writing to a shared stream */
+#endif
+
+	/* JSON lines */
+	pi_buffer_t *line;
+
+	/* columnar */
+	int	rows;
+	unsigned long total_rows;
+	pi_buffer_t *nulls[MAX_COLUMNS];
+	pi_buffer_t *data[MAX_COLUMNS];		/* integers or string end offsets */
+	pi_buffer_t *strings[MAX_COLUMNS];
+
+	/* from the appInfo block */
+	struct CategoryAppInfo category;
+	char	phone_labels[8][16];
+	contactsType contact_type;
+
+	/* common fields of the current record */
+	recordid_t uid;
+	int	attrs;
+	int	cat;
+};
+
+static const struct column common_columns[] = {
+	{ "uid",	COL_INT },
+	{ "category",	COL_STRING },
+	{ "attrs",	COL_INT },
+	{ NULL,		0 }
+};
+
+
+/***********************************************************************
+ *
+ * Function:    json_escape
+ *
+ * Summary:     Escape a byte of UTF-8 text for a JSON string
+ *
+ * Parameters:  byte, buffer of at least 7 bytes for the result
+ *
+ * Returns:     Length of the result, 1 if the byte needs no escaping
+ *
+ ***********************************************************************/
+static size_t json_escape(unsigned int c, unsigned char *out)
+{
+	if (c == '"' || c == '\\') {
+		out[0] = '\\';
+		out[1] = c;
+		return 2;
+	} else if (c >= 0x20) {
+		out[0] = c;
+		return 1;
+	}
+
+	switch (c) {
+	case '\n':
+		memcpy(out, "\\n", 2);
+		return 2;
+	case '\r':
+		memcpy(out, "\\r", 2);
+		return 2;
+	case '\t':
+		memcpy(out, "\\t", 2);
+		return 2;
+	default:
+		return sprintf((char *) out, "\\u%04x", c);
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    put_utf8
+ *
+ * Summary:     Append Palm text to a buffer as UTF-8, optionally
+ *		escaped for a JSON string
+ *
+ * Parameters:  buffer, text, non-zero to escape
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void put_utf8(pi_buffer_t *buf, const char *text, int json)
+{
+	unsigned char out[8];
+	size_t	start = buf->used,
+		end,
+		extra = 0,
+		i,
+		j,
+		n;
+
+	/* Bytes the Palm charset leaves undefined come out as U+FFFD */
+	if (convert_FromPilotChar_Append("UTF-8", NULL, text, strlen(text),
+			buf) < 0
+	    && pi_buffer_append(buf, text, strlen(text) + 1) == NULL)
+		return;
+	end = --buf->used;
+	if (!json)
+		return;
+
+	/* Escape in place, from the end, once the final size is known */
+	for (i = start; i < end; i++)
+		extra += json_escape(buf->data[i], out) - 1;
+	if (extra == 0 || pi_buffer_expect(buf, extra) == NULL)
+		return;
+	buf->used = end + extra;
+	for (i = end, j = buf->used; i > start; ) {
+		n = json_escape(buf->data[--i], out);
+		j -= n;
+		memcpy(buf->data + j, out, n);
+	}
+}
+
+static void put_text(pi_buffer_t *buf, const char *text)
+{
+	pi_buffer_append(buf, text, strlen(text));
+}
+
+static void put_long(pi_buffer_t *buf, unsigned long value)
+{
+	unsigned char b[4];
+
+	set_long(b, value);
+	pi_buffer_append(buf, b, 4);
+}
+
+static void put_short(pi_buffer_t *buf, unsigned int value)
+{
+	unsigned char b[2];
+
+	set_short(b, value);
+	pi_buffer_append(buf, b, 2);
+}
+
+static void put_string(pi_buffer_t *buf, const char *text)
+{
+	size_t	start = buf->used;
+
+	put_short(buf, 0);
+	put_utf8(buf, text, 0);
+	set_short(buf->data + start, buf->used - start - 2);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    flush_output
+ *
+ * Summary:     Write a buffer to the output stream, in one piece
+ *		when the stream is shared with other threads
+ *
+ * Parameters:  export, buffer
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void flush_output(struct export *x, pi_buffer_t *buf)
+{
+#if HAVE_PTHREAD
+	if (x->lock)
+		pthread_mutex_lock(x->lock);
+#endif
+	fwrite(buf->data, 1, buf->used, x->out);
+#if HAVE_PTHREAD
+	if (x->lock)
+		pthread_mutex_unlock(x->lock);
+#endif
+	pi_buffer_clear(buf);
+}
+
+static void flush_rows(struct export *x)
+{
+	int 	i;
+
+	if (x->rows == 0)
+		return;
+
+	pi_buffer_clear(x->line);
+	put_text(x->line, "ROWS");
+	put_long(x->line, x->rows);
+	for (i = 0; i < x->ncolumns; i++) {
+		put_long(x->line, x->nulls[i]->used + x->data[i]->used
+			+ x->strings[i]->used);
+		pi_buffer_append_buffer(x->line, x->nulls[i]);
+		pi_buffer_append_buffer(x->line, x->data[i]);
+		pi_buffer_append_buffer(x->line, x->strings[i]);
+		pi_buffer_clear(x->nulls[i]);
+		pi_buffer_clear(x->data[i]);
+		pi_buffer_clear(x->strings[i]);
+	}
+	flush_output(x, x->line);
+
+	x->total_rows += x->rows;
+	x->rows = 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    begin_row, end_row, value_*
+ *
+ * Summary:     Emit the fields of a record, in the order of the
+ *		columns of its kind
+ *
+ ***********************************************************************/
+static void value(struct export *x, int type, const char *s, long i);
+
+static void begin_row(struct export *x)
+{
+	int 	i;
+
+	x->column = 0;
+
+	if (x->format == format_json) {
+		pi_buffer_clear(x->line);
+		put_text(x->line, "{\"db\":\"");
+		put_utf8(x->line, x->dbname, 1);
+		put_text(x->line, "\",\"kind\":\"");
+		put_text(x->line, x->kind->name);
+		put_text(x->line, "\"");
+	} else {
+		/* grow the null bitmaps a byte every eight rows */
+		if (x->rows % 8 == 0) {
+			for (i = 0; i < x->ncolumns; i++)
+				pi_buffer_append(x->nulls[i], "", 1);
+		}
+	}
+
+	value(x, COL_INT, NULL, (long) x->uid);
+	value(x, COL_STRING, x->category.name[x->cat & 0x0f], 0);
+	value(x, COL_INT, NULL, x->attrs);
+}
+
+static void end_row(struct export *x)
+{
+	if (x->format == format_json) {
+		put_text(x->line, "}\n");
+		flush_output(x, x->line);
+		x->total_rows++;
+	} else if (++x->rows == ROWS_PER_GROUP) {
+		flush_rows(x);
+	}
+}
+
+/* A null is passed as a NULL string, whatever the column type */
+static void value(struct export *x, int type, const char *s, long i)
+{
+	const struct column *col = x->columns[x->column];
+	int 	null = (type == COL_STRING && s == NULL);
+	char 	num[24];
+
+	if (x->format == format_json) {
+		put_text(x->line, ",\"");
+		put_text(x->line, col->name);
+		put_text(x->line, "\":");
+		if (null) {
+			put_text(x->line, "null");
+		} else if (col->type == COL_INT) {
+			sprintf(num, "%ld", i);
+			put_text(x->line, num);
+		} else {
+			put_text(x->line, "\"");
+			put_utf8(x->line, s, 1);
+			put_text(x->line, "\"");
+		}
+	} else {
+		pi_buffer_t *data = x->data[x->column];
+
+		if (null)
+			x->nulls[x->column]->data[x->rows / 8] |=
+				1 << (x->rows % 8);
+		if (col->type == COL_INT) {
+			put_long(data, null ? 0 : (unsigned long) i);
+		} else {
+			pi_buffer_t *strings = x->strings[x->column];
+
+			if (!null)
+				put_utf8(strings, s, 0);
+			put_long(data, strings->used);
+		}
+	}
+
+	x->column++;
+}
+
+static void value_string(struct export *x, const char *s)
+{
+	value(x, COL_STRING, s, 0);
+}
+
+static void value_int(struct export *x, long i)
+{
+	value(x, COL_INT, NULL, i);
+}
+
+static void value_null(struct export *x)
+{
+	value(x, COL_STRING, NULL, 0);
+}
+
+static void value_time(struct export *x, const struct tm *tm, int with_time)
+{
+	char 	buf[80];
+
+	if (with_time)
+		sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d",
+			tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+			tm->tm_hour, tm->tm_min, tm->tm_sec);
+	else
+		sprintf(buf, "%04d-%02d-%02d",
+			tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+	value_string(x, buf);
+}
+
+
+/***********************************************************************
+ *
+ * Kinds of databases. Each record function unpacks a record and emits
+ * one value per column, in the order of its column table.
+ *
+ ***********************************************************************/
+static const struct column address_columns[] = {
+	{ "lastname", COL_STRING },	{ "firstname", COL_STRING },
+	{ "company", COL_STRING },	{ "phone1", COL_STRING },
+	{ "phone2", COL_STRING },	{ "phone3", COL_STRING },
+	{ "phone4", COL_STRING },	{ "phone5", COL_STRING },
+	{ "address", COL_STRING },	{ "city", COL_STRING },
+	{ "state", COL_STRING },	{ "zip", COL_STRING },
+	{ "country", COL_STRING },	{ "title", COL_STRING },
+	{ "custom1", COL_STRING },	{ "custom2", COL_STRING },
+	{ "custom3", COL_STRING },	{ "custom4", COL_STRING },
+	{ "note", COL_STRING },
+	{ "phone1_label", COL_STRING },	{ "phone2_label", COL_STRING },
+	{ "phone3_label", COL_STRING },	{ "phone4_label", COL_STRING },
+	{ "phone5_label", COL_STRING },	{ "show_phone", COL_INT },
+	{ NULL, 0 }
+};
+
+static int address_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct AddressAppInfo ai;
+
+	if (unpack_AddressAppInfo(&ai, buf->data, buf->used) < 0)
+		return -1;
+	x->category = ai.category;
+	memcpy(x->phone_labels, ai.phoneLabels, sizeof(x->phone_labels));
+	return 0;
+}
+
+static int address_record(struct export *x, pi_buffer_t *buf)
+{
+	int 	i;
+	struct Address a;
+
+	memset(&a, 0, sizeof(a));
+	if (unpack_Address(&a, buf, address_v1) < 0) {
+		free_Address(&a);
+		return -1;
+	}
+
+	begin_row(x);
+	for (i = 0; i < 19; i++)
+		value_string(x, a.entry[i]);
+	for (i = 0; i < 5; i++)
+		value_string(x, x->phone_labels[a.phoneLabel[i] & 7]);
+	value_int(x, a.showPhone);
+	end_row(x);
+
+	free_Address(&a);
+	return 0;
+}
+
+static const struct column appointment_columns[] = {
+	{ "description", COL_STRING },	{ "note", COL_STRING },
+	{ "location", COL_STRING },	{ "untimed", COL_INT },
+	{ "begin", COL_STRING },	{ "end", COL_STRING },
+	{ "alarm", COL_INT },		{ "advance", COL_INT },
+	{ "advance_units", COL_INT },	{ "repeat", COL_STRING },
+	{ "repeat_frequency", COL_INT },{ "repeat_end", COL_STRING },
+	{ "repeat_days", COL_STRING },	{ "exceptions", COL_INT },
+	{ NULL, 0 }
+};
+
+static int datebook_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct AppointmentAppInfo ai;
+
+	if (unpack_AppointmentAppInfo(&ai, buf->data, buf->used) < 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+/* Appointments and calendar events share everything but the location */
+static void event_values(struct export *x, const char *description,
+	const char *note, const char *location, int untimed,
+	const struct tm *begin, const struct tm *end, int alarm,
+	int advance, int advance_units, int repeat, int repeat_forever,
+	int repeat_frequency, const struct tm *repeat_end,
+	const int *repeat_days, int exceptions)
+{
+	int 	i;
+	char 	days[8];
+
+	begin_row(x);
+	value_string(x, description);
+	value_string(x, note);
+	value_string(x, location);
+	value_int(x, untimed);
+	value_time(x, begin, !untimed);
+	value_time(x, end, !untimed);
+	value_int(x, alarm);
+	if (alarm) {
+		value_int(x, advance);
+		value_int(x, advance_units);
+	} else {
+		value_null(x);
+		value_null(x);
+	}
+	if (repeat == repeatNone) {
+		value_null(x);
+		value_null(x);
+		value_null(x);
+		value_null(x);
+	} else {
+		value_string(x, DatebookRepeatTypeNames[repeat]);
+		value_int(x, repeat_frequency);
+		if (repeat_forever)
+			value_null(x);
+		else
+			value_time(x, repeat_end, 0);
+		for (i = 0; i < 7; i++)
+			days[i] = repeat_days[i] ? '1' : '0';
+		days[7] = '\0';
+		value_string(x, repeat == repeatWeekly ? days : NULL);
+	}
+	value_int(x, exceptions);
+	end_row(x);
+}
+
+static int datebook_record(struct export *x, pi_buffer_t *buf)
+{
+	struct Appointment a;
+
+	memset(&a, 0, sizeof(a));
+	if (unpack_Appointment(&a, buf, datebook_v1) < 0) {
+		free_Appointment(&a);
+		return -1;
+	}
+
+	event_values(x, a.description, a.note, NULL, a.event, &a.begin,
+		&a.end, a.alarm, a.advance, a.advanceUnits, a.repeatType,
+		a.repeatForever, a.repeatFrequency, &a.repeatEnd,
+		a.repeatDays, a.exceptions);
+
+	free_Appointment(&a);
+	return 0;
+}
+
+static int calendar_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct CalendarAppInfo ai;
+
+	if (unpack_CalendarAppInfo(&ai, buf) <= 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+static int calendar_record(struct export *x, pi_buffer_t *buf)
+{
+	CalendarEvent_t e;
+
+	new_CalendarEvent(&e);
+	if (unpack_CalendarEvent(&e, buf, calendar_v1) < 0) {
+		free_CalendarEvent(&e);
+		return -1;
+	}
+
+	event_values(x, e.description, e.note, e.location, e.event,
+		&e.begin, &e.end, e.alarm, e.advance, e.advanceUnits,
+		e.repeatType, e.repeatForever, e.repeatFrequency,
+		&e.repeatEnd, e.repeatDays, e.exceptions);
+
+	free_CalendarEvent(&e);
+	return 0;
+}
+
+static const struct column contact_columns[] = {
+	{ "lastname", COL_STRING },	{ "firstname", COL_STRING },
+	{ "company", COL_STRING },	{ "title", COL_STRING },
+	{ "phone1", COL_STRING },	{ "phone2", COL_STRING },
+	{ "phone3", COL_STRING },	{ "phone4", COL_STRING },
+	{ "phone5", COL_STRING },	{ "phone6", COL_STRING },
+	{ "phone7", COL_STRING },	{ "im1", COL_STRING },
+	{ "im2", COL_STRING },		{ "website", COL_STRING },
+	{ "custom1", COL_STRING },	{ "custom2", COL_STRING },
+	{ "custom3", COL_STRING },	{ "custom4", COL_STRING },
+	{ "custom5", COL_STRING },	{ "custom6", COL_STRING },
+	{ "custom7", COL_STRING },	{ "custom8", COL_STRING },
+	{ "custom9", COL_STRING },	{ "address1", COL_STRING },
+	{ "city1", COL_STRING },	{ "state1", COL_STRING },
+	{ "zip1", COL_STRING },		{ "country1", COL_STRING },
+	{ "address2", COL_STRING },	{ "city2", COL_STRING },
+	{ "state2", COL_STRING },	{ "zip2", COL_STRING },
+	{ "country2", COL_STRING },	{ "address3", COL_STRING },
+	{ "city3", COL_STRING },	{ "state3", COL_STRING },
+	{ "zip3", COL_STRING },		{ "country3", COL_STRING },
+	{ "note", COL_STRING },		{ "birthday", COL_STRING },
+	{ "anniversary", COL_STRING },	{ "picture_size", COL_INT },
+	{ NULL, 0 }
+};
+
+static int contact_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct ContactAppInfo ai;
+
+	if (unpack_ContactAppInfo(&ai, buf) < 0)
+		return -1;
+	x->category = ai.category;
+	x->contact_type = ai.type;
+	free_ContactAppInfo(&ai);
+	return 0;
+}
+
+static int contact_record(struct export *x, pi_buffer_t *buf)
+{
+	int 	i;
+	struct Contact c;
+
+	memset(&c, 0, sizeof(c));
+	if (unpack_Contact(&c, buf, x->contact_type) < 0) {
+		free_Contact(&c);
+		return -1;
+	}
+
+	begin_row(x);
+	for (i = 0; i < NUM_CONTACT_ENTRIES; i++)
+		value_string(x, c.entry[i]);
+	if (c.birthdayFlag)
+		value_time(x, &c.birthday, 0);
+	else
+		value_null(x);
+	if (c.anniversaryFlag)
+		value_time(x, &c.anniversary, 0);
+	else
+		value_null(x);
+	value_int(x, c.picture ? (long) c.picture->length : 0);
+	end_row(x);
+
+	free_Contact(&c);
+	return 0;
+}
+
+static const struct column todo_columns[] = {
+	{ "description", COL_STRING },	{ "note", COL_STRING },
+	{ "priority", COL_INT },	{ "complete", COL_INT },
+	{ "due", COL_STRING },
+	{ NULL, 0 }
+};
+
+static int todo_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct ToDoAppInfo ai;
+
+	if (unpack_ToDoAppInfo(&ai, buf->data, buf->used) < 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+static int todo_record(struct export *x, pi_buffer_t *buf)
+{
+	struct ToDo t;
+
+	memset(&t, 0, sizeof(t));
+	if (unpack_ToDo(&t, buf, todo_v1) < 0) {
+		free_ToDo(&t);
+		return -1;
+	}
+
+	begin_row(x);
+	value_string(x, t.description);
+	value_string(x, t.note);
+	value_int(x, t.priority);
+	value_int(x, t.complete);
+	if (t.indefinite)
+		value_null(x);
+	else
+		value_time(x, &t.due, 0);
+	end_row(x);
+
+	free_ToDo(&t);
+	return 0;
+}
+
+static const struct column memo_columns[] = {
+	{ "text", COL_STRING },
+	{ NULL, 0 }
+};
+
+static int memo_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct MemoAppInfo ai;
+
+	if (unpack_MemoAppInfo(&ai, buf->data, buf->used) < 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+static int memo_record(struct export *x, pi_buffer_t *buf)
+{
+	struct Memo m;
+
+	memset(&m, 0, sizeof(m));
+	if (unpack_Memo(&m, buf, memo_v1) < 0) {
+		free_Memo(&m);
+		return -1;
+	}
+
+	begin_row(x);
+	value_string(x, m.text);
+	end_row(x);
+
+	free_Memo(&m);
+	return 0;
+}
+
+static const struct column expense_columns[] = {
+	{ "date", COL_STRING },		{ "type", COL_STRING },
+	{ "payment", COL_STRING },	{ "currency", COL_INT },
+	{ "amount", COL_STRING },	{ "vendor", COL_STRING },
+	{ "city", COL_STRING },		{ "attendees", COL_STRING },
+	{ "note", COL_STRING },
+	{ NULL, 0 }
+};
+
+static int expense_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct ExpenseAppInfo ai;
+
+	if (unpack_ExpenseAppInfo(&ai, buf->data, buf->used) <= 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+static int expense_record(struct export *x, pi_buffer_t *buf)
+{
+	struct Expense e;
+
+	memset(&e, 0, sizeof(e));
+	if (unpack_Expense(&e, buf->data, buf->used) <= 0) {
+		free_Expense(&e);
+		return -1;
+	}
+
+	begin_row(x);
+	value_time(x, &e.date, 0);
+	value_string(x, (unsigned) e.type <= etTrain
+		? ExpenseTypeNames[e.type] : NULL);
+	value_string(x, (unsigned) e.payment <= epUnfiled
+		? ExpensePaymentNames[e.payment] : NULL);
+	value_int(x, e.currency);
+	value_string(x, e.amount);
+	value_string(x, e.vendor);
+	value_string(x, e.city);
+	value_string(x, e.attendees);
+	value_string(x, e.note);
+	end_row(x);
+
+	free_Expense(&e);
+	return 0;
+}
+
+static const struct column mail_columns[] = {
+	{ "subject", COL_STRING },	{ "from", COL_STRING },
+	{ "to", COL_STRING },		{ "cc", COL_STRING },
+	{ "bcc", COL_STRING },		{ "reply_to", COL_STRING },
+	{ "sent_to", COL_STRING },	{ "body", COL_STRING },
+	{ "date", COL_STRING },		{ "read", COL_INT },
+	{ "priority", COL_INT },
+	{ NULL, 0 }
+};
+
+static int mail_appinfo(struct export *x, pi_buffer_t *buf)
+{
+	struct MailAppInfo ai;
+
+	if (unpack_MailAppInfo(&ai, buf->data, buf->used) <= 0)
+		return -1;
+	x->category = ai.category;
+	return 0;
+}
+
+static int mail_record(struct export *x, pi_buffer_t *buf)
+{
+	struct Mail m;
+
+	memset(&m, 0, sizeof(m));
+	if (unpack_Mail(&m, buf->data, buf->used) <= 0) {
+		free_Mail(&m);
+		return -1;
+	}
+
+	begin_row(x);
+	value_string(x, m.subject);
+	value_string(x, m.from);
+	value_string(x, m.to);
+	value_string(x, m.cc);
+	value_string(x, m.bcc);
+	value_string(x, m.replyTo);
+	value_string(x, m.sentTo);
+	value_string(x, m.body);
+	if (m.dated)
+		value_time(x, &m.date, 1);
+	else
+		value_null(x);
+	value_int(x, m.read);
+	value_int(x, m.priority);
+	end_row(x);
+
+	free_Mail(&m);
+	return 0;
+}
+
+static const struct kind kinds[] = {
+	{ "address",	pi_mktag('a','d','d','r'), address_columns,
+	  address_appinfo, address_record },
+	{ "appointment", pi_mktag('d','a','t','e'), appointment_columns,
+	  datebook_appinfo, datebook_record },
+	{ "appointment", pi_mktag('P','D','a','t'), appointment_columns,
+	  calendar_appinfo, calendar_record },
+	{ "contact",	pi_mktag('P','A','d','d'), contact_columns,
+	  contact_appinfo, contact_record },
+	{ "todo",	pi_mktag('t','o','d','o'), todo_columns,
+	  todo_appinfo, todo_record },
+	{ "memo",	pi_mktag('m','e','m','o'), memo_columns,
+	  memo_appinfo, memo_record },
+	{ "memo",	pi_mktag('P','M','e','m'), memo_columns,
+	  memo_appinfo, memo_record },
+	{ "expense",	pi_mktag('e','x','p','s'), expense_columns,
+	  expense_appinfo, expense_record },
+	{ "mail",	pi_mktag('m','a','i','l'), mail_columns,
+	  mail_appinfo, mail_record },
+	{ NULL,		0, NULL, NULL, NULL }
+};
+
+
+/* Where records come from: a local file or an open database on the Palm */
+struct source {
+	pi_file_t *pf;
+	int	sd;
+	int	db;
+};
+
+static int read_record(struct source *src, int i, pi_buffer_t *buf,
+	recordid_t *uid, int *attrs, int *cat)
+{
+	void 	*data;
+	size_t 	size;
+
+	if (src->pf == NULL)
+		return dlp_ReadRecordByIndex(src->sd, src->db, i, buf, uid,
+			attrs, cat);
+
+	if (pi_file_read_record(src->pf, i, &data, &size, attrs, cat,
+			uid) < 0)
+		return -1;
+
+	/* the file is mapped: unpack straight from it */
+	buf->data = data;
+	buf->used = buf->allocated = size;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    export_db
+ *
+ * Summary:     Export every record of one database
+ *
+ * Parameters:  source, database name, creator, format, output
+ *		stream, lock if the stream is shared
+ *
+ * Returns:     Number of records exported, or -1 if the database
+ *		isn't of a supported kind
+ *
+ ***********************************************************************/
+static long export_db(struct source *src, const char *dbname,
+	unsigned long creator, int format, FILE *out, void *lock)
+{
+	int 	i,
+		errors 	= 0;
+	void 	*data;
+	size_t 	size;
+	struct export x;
+	pi_buffer_t *appinfo,
+		*record = NULL,
+		view;
+	const struct kind *kind;
+	const struct column *col;
+
+	for (kind = kinds; kind->name; kind++)
+		if (kind->creator == creator)
+			break;
+	if (kind->name == NULL) {
+		fprintf(stderr, "   WARNING: %s: unsupported database, skipped\n",
+			dbname);
+		return -1;
+	}
+
+	memset(&x, 0, sizeof(x));
+	x.dbname = dbname;
+	x.kind 	= kind;
+	x.format = format;
+	x.out 	= out;
+#if HAVE_PTHREAD
+	x.lock 	= lock;
+#endif
+	x.line 	= pi_buffer_new(1024);
+	for (col = common_columns; col->name; col++)
+		x.columns[x.ncolumns++] = col;
+	for (col = kind->columns; col->name; col++)
+		x.columns[x.ncolumns++] = col;
+
+	if (format == format_columnar) {
+		for (i = 0; i < x.ncolumns; i++) {
+			x.nulls[i] = pi_buffer_new(ROWS_PER_GROUP / 8);
+			x.data[i] = pi_buffer_new(ROWS_PER_GROUP * 4);
+			x.strings[i] = pi_buffer_new(1024);
+		}
+
+		put_text(x.line, "TABL");
+		put_string(x.line, dbname);
+		put_string(x.line, kind->name);
+		put_short(x.line, x.ncolumns);
+		for (i = 0; i < x.ncolumns; i++) {
+			pi_buffer_append(x.line,
+				x.columns[i]->type == COL_INT ? "\0" : "\1", 1);
+			put_string(x.line, x.columns[i]->name);
+		}
+		flush_output(&x, x.line);
+	}
+
+	appinfo = pi_buffer_new(0xffff);
+	if (src->pf) {
+		pi_file_get_app_info(src->pf, &data, &size);
+		pi_buffer_append(appinfo, data, size);
+	} else {
+		dlp_ReadAppBlock(src->sd, src->db, 0, -1, appinfo);
+	}
+	if (kind->appinfo(&x, appinfo) < 0)
+		fprintf(stderr, "   WARNING: %s: bad AppInfo block, "
+			"category names unavailable\n", dbname);
+	pi_buffer_free(appinfo);
+
+	if (src->pf == NULL)
+		record = pi_buffer_new(0xffff);
+
+	for (i = 0;; i++) {
+		pi_buffer_t *buf = record ? record : &view;
+
+		if (read_record(src, i, buf, &x.uid, &x.attrs, &x.cat) < 0)
+			break;
+
+		if (x.attrs & dlpRecAttrDeleted)
+			continue;
+		if (kind->record(&x, buf) < 0)
+			errors++;
+	}
+
+	if (errors)
+		fprintf(stderr, "   WARNING: %s: %d record(s) could not be "
+			"unpacked\n", dbname, errors);
+
+	if (format == format_columnar) {
+		flush_rows(&x);
+		put_text(x.line, "END ");
+		put_long(x.line, x.total_rows);
+		flush_output(&x, x.line);
+
+		for (i = 0; i < x.ncolumns; i++) {
+			pi_buffer_free(x.nulls[i]);
+			pi_buffer_free(x.data[i]);
+			pi_buffer_free(x.strings[i]);
+		}
+	}
+
+	if (record)
+		pi_buffer_free(record);
+	pi_buffer_free(x.line);
+
+	return (long) x.total_rows;
+}
+
+static void write_header(FILE *out, int format)
+{
+	unsigned char buf[8];
+
+	if (format != format_columnar)
+		return;
+	memcpy(buf, "PLCO", 4);
+	set_short(buf + 4, COLUMNAR_VERSION);
+	set_short(buf + 6, 0);
+	fwrite(buf, 1, sizeof(buf), out);
+}
+
+
+/* Local files to export, shared by the worker threads */
+struct work {
+	const char **files;
+	int	count;
+	int	next;
+	int	format;
+	const char *outdir;
+	long	records;
+	int	failed;
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;		/* protects next, records, failed */
+	pthread_mutex_t out_lock;	/* serializes writes to stdout */
+#endif
+};
+
+
+/***********************************************************************
+ *
+ * Function:    open_output
+ *
+ * Summary:     Open the file a database is exported to in the
+ *		output directory: its name, without extension, with
+ *		.jsonl or .plc appended
+ *
+ ***********************************************************************/
+static FILE *open_output(const char *outdir, const char *name, int format)
+{
+	const char *base = strrchr(name, '/');
+	char 	*path,
+		*p;
+	FILE 	*f;
+
+	base = base ? base + 1 : name;
+	path = malloc(strlen(outdir) + strlen(base) + 8);
+	if (path == NULL)
+		return NULL;
+	sprintf(path, "%s/%s", outdir, base);
+
+	p = path + strlen(outdir) + 1;
+	if (strchr(p, '.') && strchr(p, '.') != p)
+		*strrchr(p, '.') = '\0';
+	for (; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	strcat(path, format == format_json ? ".jsonl" : ".plc");
+
+	if ((f = fopen(path, "wb")) == NULL)
+		fprintf(stderr, "   ERROR: Can't create '%s': %s\n", path,
+			strerror(errno));
+	free(path);
+	return f;
+}
+
+static void *export_worker(void *arg)
+{
+	struct work *w = arg;
+	int 	i,
+		ok;
+	long 	n;
+	FILE 	*out;
+	void 	*lock;
+	struct source src;
+	struct DBInfo info;
+
+	for (;;) {
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&w->lock);
+#endif
+		i = w->next++;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if (i >= w->count)
+			break;
+
+		memset(&src, 0, sizeof(src));
+		if ((src.pf = pi_file_open_mapped(w->files[i])) == NULL) {
+			fprintf(stderr, "   ERROR: Can't open '%s'\n",
+				w->files[i]);
+			n = -1;
+		} else {
+			pi_file_get_info(src.pf, &info);
+
+			lock = NULL;
+			out = stdout;
+			if (w->outdir) {
+				out = open_output(w->outdir, w->files[i],
+					w->format);
+			} else {
+#if HAVE_PTHREAD
+				lock = &w->out_lock;
+#endif
+			}
+
+			n = -1;
+			if (out) {
+				if (w->outdir)
+					write_header(out, w->format);
+				n = export_db(&src, info.name, info.creator,
+					w->format, out, lock);
+				if (w->outdir)
+					fclose(out);
+			}
+			pi_file_close(src.pf);
+		}
+
+		ok = n >= 0;
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&w->lock);
+#endif
+		if (ok)
+			w->records += n;
+		else
+			w->failed++;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&w->lock);
+#endif
+	}
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    export_files
+ *
+ * Summary:     Export local databases, several at a time
+ *
+ * Parameters:  file names, format, output directory or NULL for
+ *		stdout, number of threads
+ *
+ * Returns:     Number of files that could not be exported
+ *
+ ***********************************************************************/
+static int export_files(const char **files, int format, const char *outdir,
+	int jobs)
+{
+	int 	i;
+	struct work w;
+#if HAVE_PTHREAD
+	pthread_t *threads;
+#endif
+
+	memset(&w, 0, sizeof(w));
+	w.files = files;
+	while (files[w.count])
+		w.count++;
+	w.format = format;
+	w.outdir = outdir;
+
+	if (outdir == NULL)
+		write_header(stdout, format);
+
+#if HAVE_PTHREAD
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	/* row groups of different tables can't be interleaved */
+	if (outdir == NULL && format == format_columnar)
+		jobs = 1;
+	if (jobs > w.count)
+		jobs = w.count;
+
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_mutex_init(&w.out_lock, NULL);
+	threads = calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, export_worker, &w))
+			break;
+	}
+	jobs = i;
+	if (jobs == 0)
+		export_worker(&w);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&w.lock);
+	pthread_mutex_destroy(&w.out_lock);
+#else
+	export_worker(&w);
+#endif
+
+	fflush(stdout);
+	if (!plu_quiet)
+		fprintf(stderr, "   Exported %ld record(s) from %d database(s)\n",
+			w.records, w.count - w.failed);
+
+	return w.failed;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    export_palm
+ *
+ * Summary:     Export databases straight from the Palm
+ *
+ * Parameters:  database names, format, output directory or NULL
+ *
+ * Returns:     Number of databases that could not be exported
+ *
+ ***********************************************************************/
+static int export_palm(const char **names, int format, const char *outdir)
+{
+	int 	failed 	= 0;
+	long 	n,
+		records = 0;
+	FILE 	*out;
+	struct source src;
+	struct DBInfo info;
+
+	memset(&src, 0, sizeof(src));
+	if ((src.sd = plu_connect()) < 0)
+		return -1;
+
+	if (outdir == NULL)
+		write_header(stdout, format);
+
+	for (; *names; names++) {
+		if (dlp_OpenDB(src.sd, 0, dlpOpenRead, *names, &src.db) < 0
+		    || dlp_FindDBByOpenHandle(src.sd, src.db, NULL, NULL,
+			    &info, NULL) < 0) {
+			fprintf(stderr, "   ERROR: Can't open '%s' on the Palm\n",
+				*names);
+			failed++;
+			continue;
+		}
+
+		out = outdir ? open_output(outdir, *names, format) : stdout;
+		n = -1;
+		if (out) {
+			if (outdir)
+				write_header(out, format);
+			n = export_db(&src, *names, info.creator, format, out,
+				NULL);
+			if (outdir)
+				fclose(out);
+		}
+		dlp_CloseDB(src.sd, src.db);
+
+		if (n < 0)
+			failed++;
+		else
+			records += n;
+	}
+
+	dlp_AddSyncLogEntry(src.sd, "Databases exported by pilot-export.\n"
+		"Thank you for using pilot-link.");
+	dlp_EndOfSync(src.sd, 0);
+	pi_close(src.sd);
+
+	fflush(stdout);
+	if (!plu_quiet)
+		fprintf(stderr, "   Exported %ld record(s)\n", records);
+
+	return failed;
+}
+
+
+int main(int argc, const char **argv)
+{
+	int 	c,		/* switch */
+		format 		= format_json,
+		jobs		= 0;
+
+	char 	*format_name 	= NULL,
+		*outdir 	= NULL;
+
+	const char **args = NULL;
+
+	poptContext po;
+
+	struct poptOption options[] = {
+		USERLAND_RESERVED_OPTIONS
+		{"format",	'F', POPT_ARG_STRING, &format_name, 0, "Output format: json (default) or columnar", "format"},
+		{"output",	'o', POPT_ARG_STRING, &outdir, 0, "Write one file per database in <dir> instead of stdout", "dir"},
+		{"jobs",	'j', POPT_ARG_INT, &jobs, 0, "Number of files exported in parallel (default: one per CPU)", "jobs"},
+		POPT_TABLEEND
+	};
+
+	po = poptGetContext("pilot-export", argc, argv, options, 0);
+	poptSetOtherOptionHelp(po, "<file> ... | -p <port> <database> ...\n\n"
+	"   Export the records of address, datebook, calendar, contacts, todo,\n"
+	"   memo, expense and mail databases as JSON lines or in a columnar\n"
+	"   binary format, from local files or straight from your Palm.\n\n"
+	"   Example arguments:\n"
+	"      Backup/*.pdb > records.jsonl\n"
+	"      -F columnar -o Export/ Backup/*.pdb\n"
+	"      -p /dev/pilot AddressDB ToDoDB\n\n");
+
+	if (argc < 2) {
+		poptPrintUsage(po, stderr, 0);
+		return 1;
+	}
+
+	while ((c = poptGetNextOpt(po)) >= 0) {
+		fprintf(stderr, "   ERROR: Unhandled option %d.\n", c);
+		return 1;
+	}
+
+	if (c < -1) {
+		plu_badoption(po, c);
+	}
+
+	if (format_name) {
+		if (!strcasecmp(format_name, "json")) {
+			format = format_json;
+		} else if (!strcasecmp(format_name, "columnar")) {
+			format = format_columnar;
+		} else {
+			fprintf(stderr, "   ERROR: Unknown format '%s'.\n",
+				format_name);
+			return 1;
+		}
+	}
+
+	args = poptGetArgs(po);
+	if (!args || !args[0]) {
+		fprintf(stderr, "   ERROR: Must provide one or more %s.\n",
+			plu_port ? "database names" : "filenames");
+		return 1;
+	}
+
+	if (plu_port)
+		c = export_palm(args, format, outdir);
+	else
+		c = export_files(args, format, outdir, jobs);
+
+	poptFreeContext(po);
+	return c ? 1 : 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -22,16 +22,51 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "pi-header.h"
 #include "pi-source.h"
 #include "pi-file.h"
+#include "pi-diff.h"
+#include "pi-util.h"
 #include "pi-userland.h"
 
+#define PDB_ENTRY_TABLE_OFFSET	78
+
+/* One database found by the backup tree scanner */
+struct check {
+	char	*path;
+	int	ok;
+	int	entries;
+	size_t	size;
+	unsigned long long hash;
+	char	reason[80];
+};
+
+struct check_list {
+	struct check *files;
+	int	count;
+	int	allocated;
+	int	next;			/* next file for a worker to take */
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
 /***********************************************************************
  *
  * Function:    iso_time_str
@@ -363,6 +398,375 @@ static void dump_record(struct pi_file *pf, struct DBInfo *ip, char *rkey, int f
 
 
 
+/***********************************************************************
+ *
+ * Function:    diff_files
+ *
+ * Summary:     Compare two versions of a database and print the
+ *		differences as a patch
+ *
+ * Parameters:  old and new file names
+ *
+ * Returns:     0 if identical, 1 if different, 2 on error
+ *
+ ***********************************************************************/
+static int diff_files(const char *oldname, const char *newname)
+{
+	int 	result = 2;
+	pi_file_t *from = NULL,
+		*to = NULL;
+	pi_diff_t *diff;
+
+	if ((from = pi_file_open_mapped(oldname)) == NULL) {
+		fprintf(stderr, "   ERROR: Can't open '%s'\n", oldname);
+		goto done;
+	}
+	if ((to = pi_file_open_mapped(newname)) == NULL) {
+		fprintf(stderr, "   ERROR: Can't open '%s'\n", newname);
+		goto done;
+	}
+
+	if ((diff = pi_diff_files(from, to)) == NULL) {
+		fprintf(stderr, "   ERROR: Can't compare '%s' and '%s'. "
+			"Are both record or both resource databases?\n",
+			oldname, newname);
+		goto done;
+	}
+
+	if (pi_diff_write(diff, stdout) < 0) {
+		fprintf(stderr, "   ERROR: Can't write the differences\n");
+	} else {
+		result = (diff->num_entries || diff->app_info_changed
+			  || diff->sort_info_changed) ? 1 : 0;
+	}
+	pi_diff_free(diff);
+
+done:
+	if (from)
+		pi_file_close(from);
+	if (to)
+		pi_file_close(to);
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    compare_keys
+ *
+ * Summary:     qsort() callback ordering record UIDs or resource
+ *		type/ID pairs, packed in an unsigned long long
+ *
+ ***********************************************************************/
+static int compare_keys(const void *a, const void *b)
+{
+	unsigned long long ka = *(const unsigned long long *) a,
+		kb = *(const unsigned long long *) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(((const struct check *) a)->path,
+		((const struct check *) b)->path);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    check_file
+ *
+ * Summary:     Validate one database: everything pi_file_open()
+ *		enforces, plus the layout of the header, entry table
+ *		and data, and unique record or resource keys. The
+ *		contents are hashed on the way.
+ *
+ * Parameters:  check structure, filled in with the results
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void check_file(struct check *c)
+{
+	int 	i;
+	unsigned long first,
+		app_info_offset,
+		sort_info_offset,
+		table_end;
+	unsigned char *map;
+	unsigned long long *keys = NULL;
+	pi_file_t *pf;
+
+	c->ok = 0;
+
+	if ((pf = pi_file_open_mapped(c->path)) == NULL) {
+		strcpy(c->reason, "unreadable or damaged header/entry table");
+		return;
+	}
+
+	map = pf->map;
+	c->entries = pf->num_entries;
+	c->size = pf->map_size;
+	c->hash = pi_hash64(map, pf->map_size);
+
+	if (memchr(map, 0, 32) == NULL) {
+		strcpy(c->reason, "database name not terminated");
+		goto done;
+	}
+
+	/* Data must not overlap the header or the entry table, and
+	   appInfo and sortInfo come before the first entry */
+	table_end = PDB_ENTRY_TABLE_OFFSET
+		+ (unsigned long) pf->num_entries * pf->ent_hdr_size;
+	app_info_offset = get_long(map + 52);
+	sort_info_offset = get_long(map + 56);
+	first = pf->num_entries ? (unsigned long) pf->entries[0].offset
+		: pf->map_size;
+
+	if ((app_info_offset && app_info_offset < table_end)
+	    || (sort_info_offset && sort_info_offset < table_end)
+	    || first < table_end) {
+		strcpy(c->reason, "data overlaps the entry table");
+		goto done;
+	}
+	if ((app_info_offset && app_info_offset > first)
+	    || (sort_info_offset && sort_info_offset > first)
+	    || (app_info_offset && sort_info_offset
+		&& app_info_offset > sort_info_offset)) {
+		strcpy(c->reason, "appInfo/sortInfo out of order");
+		goto done;
+	}
+
+	if (pf->num_entries > 1) {
+		if ((keys = malloc(pf->num_entries * sizeof(*keys))) == NULL) {
+			strcpy(c->reason, "out of memory");
+			goto done;
+		}
+		for (i = 0; i < pf->num_entries; i++) {
+			pi_file_entry_t *entp = &pf->entries[i];
+
+			keys[i] = pf->resource_flag
+				? ((unsigned long long) entp->type << 16)
+					| (entp->resource_id & 0xffff)
+				: entp->uid;
+		}
+		qsort(keys, (size_t) pf->num_entries, sizeof(*keys),
+			compare_keys);
+		/* desktop tools often leave every record UID at 0 */
+		for (i = 1; i < pf->num_entries; i++) {
+			if (keys[i] != keys[i - 1]
+			    || (!pf->resource_flag && keys[i] == 0))
+				continue;
+			if (pf->resource_flag) {
+				/* printlong() isn't reentrant */
+				char 	type[5];
+				unsigned long tag =
+					(unsigned long) (keys[i] >> 16);
+
+				pi_untag(type, tag);
+				sprintf(c->reason, "duplicate resource %s #%d",
+					type, (int) (short) (keys[i] & 0xffff));
+			} else
+				sprintf(c->reason, "duplicate record UID 0x%06lx",
+					(unsigned long) keys[i]);
+			goto done;
+		}
+	}
+
+	c->ok = 1;
+
+done:
+	free(keys);
+	pi_file_close(pf);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    check_worker
+ *
+ * Summary:     Thread body: validate files until there are none left
+ *
+ ***********************************************************************/
+static void *check_worker(void *arg)
+{
+	struct check_list *list = arg;
+	int 	i;
+
+	for (;;) {
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&list->lock);
+#endif
+		i = list->next++;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&list->lock);
+#endif
+		if (i >= list->count)
+			break;
+		check_file(&list->files[i]);
+	}
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    collect_files
+ *
+ * Summary:     Add a database, or every PDB/PRC/PQA file below a
+ *		directory, to the list of files to check
+ *
+ * Parameters:  list, path, non-zero if named on the command line
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void collect_files(struct check_list *list, const char *path,
+	int explicit)
+{
+	struct stat sbuf;
+
+	/* Don't follow symbolic links to directories found while walking a
+	   tree, they may lead back up and loop forever */
+	if ((explicit ? stat(path, &sbuf) : lstat(path, &sbuf)) < 0) {
+		fprintf(stderr, "   ERROR: Can't access '%s'\n", path);
+		return;
+	}
+	if (S_ISLNK(sbuf.st_mode)
+	    && (stat(path, &sbuf) < 0 || S_ISDIR(sbuf.st_mode)))
+		return;
+
+	if (S_ISDIR(sbuf.st_mode)) {
+		DIR 	*dir;
+		struct dirent *dirent;
+		char 	*sub;
+
+		if ((dir = opendir(path)) == NULL) {
+			fprintf(stderr, "   ERROR: Can't open directory '%s'\n",
+				path);
+			return;
+		}
+		while ((dirent = readdir(dir)) != NULL) {
+			if (dirent->d_name[0] == '.')
+				continue;
+			sub = malloc(strlen(path) + strlen(dirent->d_name) + 2);
+			if (sub == NULL)
+				break;
+			sprintf(sub, "%s/%s", path, dirent->d_name);
+			collect_files(list, sub, 0);
+			free(sub);
+		}
+		closedir(dir);
+		return;
+	}
+
+	/* Inside directories, only look at what is named like a database */
+	if (!explicit) {
+		const char *ext = strrchr(path, '.');
+
+		if (ext == NULL || (strcasecmp(ext, ".pdb")
+				    && strcasecmp(ext, ".prc")
+				    && strcasecmp(ext, ".pqa")))
+			return;
+	}
+
+	if (list->count == list->allocated) {
+		int 	allocated = list->allocated ? list->allocated * 2 : 256;
+		struct check *files;
+
+		files = realloc(list->files, allocated * sizeof(struct check));
+		if (files == NULL)
+			return;
+		list->files = files;
+		list->allocated = allocated;
+	}
+	memset(&list->files[list->count], 0, sizeof(struct check));
+	list->files[list->count++].path = strdup(path);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    check_tree
+ *
+ * Summary:     Validate every database in the given files and
+ *		directories with a pool of worker threads, then print a
+ *		line per database and a summary
+ *
+ * Parameters:  file and directory names, number of threads
+ *
+ * Returns:     0 if every database is valid, 1 otherwise
+ *
+ ***********************************************************************/
+static int check_tree(const char **paths, int jobs)
+{
+	int 	i,
+		bad 	= 0;
+	unsigned long entries = 0;
+	double 	bytes 	= 0;
+	struct check_list list;
+#if HAVE_PTHREAD
+	pthread_t *threads;
+#endif
+
+	memset(&list, 0, sizeof(list));
+	while (*paths)
+		collect_files(&list, *paths++, 1);
+	if (list.count > 1)
+		qsort(list.files, (size_t) list.count, sizeof(struct check),
+			compare_paths);
+
+#if HAVE_PTHREAD
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > list.count)
+		jobs = list.count;
+
+	pthread_mutex_init(&list.lock, NULL);
+	threads = calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, check_worker, &list))
+			break;
+	}
+	jobs = i;
+
+	/* if no thread could be started, do the work ourselves */
+	if (jobs == 0)
+		check_worker(&list);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&list.lock);
+#else
+	check_worker(&list);
+#endif
+
+	for (i = 0; i < list.count; i++) {
+		struct check *c = &list.files[i];
+
+		if (c->ok) {
+			printf("OK\t%016llx\t%s\n", c->hash, c->path);
+			entries += c->entries;
+			bytes += c->size;
+		} else {
+			printf("BAD\t%s\t%s\n", c->reason, c->path);
+			bad++;
+		}
+		free(c->path);
+	}
+
+	printf("\n   Checked %d database(s): %d OK, %d damaged, "
+		"%lu records/resources, %.0f bytes\n",
+		list.count, list.count - bad, bad, entries, bytes);
+
+	free(list.files);
+	return bad ? 1 : 0;
+}
+
+
 int main(int argc, const char **argv)
 {
 	int 	c,		/* switch */
@@ -372,6 +776,9 @@ int main(int argc, const char **argv)
 		dflag 		= 0,
 		lflag 		= 0,
 		rflag 		= 0,
+		diffflag	= 0,
+		checkflag	= 0,
+		jobs		= 0,
 		filedump 	= 0;
 
 	char *rkey           = NULL;
@@ -392,6 +799,9 @@ int main(int argc, const char **argv)
         	{"record",	'r', POPT_ARG_STRING, &rkey,  0, "Dump a record by index ('code0') or uid ('1234')"},
 	        {"to-file",	'f', POPT_ARG_NONE, &filedump,  0, "Same as above but also dump records to files"},
         	{"dump",	'd', POPT_ARG_NONE, &dflag, 0, "Dump all data and all records, very verbose"},
+	        {"diff",	 0 , POPT_ARG_NONE, &diffflag, 0, "Print the changes between two versions of a database"},
+	        {"check",	 0 , POPT_ARG_NONE, &checkflag, 0, "Validate databases and whole backup directories, recursively"},
+	        {"jobs",	'j', POPT_ARG_INT, &jobs, 0, "Number of files checked in parallel (default: one per CPU)", "jobs"},
         	  POPT_TABLEEND
 	};
 
@@ -400,7 +810,9 @@ int main(int argc, const char **argv)
 	"   Dump application and header information from your local PRC/PDB files\n\n"
 	"   Example arguments:\n"
 	"      -l Foo.prc\n"
-	"      -H -a Bar.pdb\n\n");
+	"      -H -a Bar.pdb\n"
+	"      --diff Old/Bar.pdb New/Bar.pdb\n"
+	"      --check -j 8 Backups/\n\n");
 
 	plu_popt_alias(po,"dump-rec",0,"--bad-option --to-file --record");
 	plu_popt_alias(po,NULL,'R',"--bad-option --to-file --record");
@@ -431,6 +843,17 @@ int main(int argc, const char **argv)
 		return 1;
 	}
 
+	if (checkflag)
+		return check_tree(rargv, jobs);
+
+	if (diffflag) {
+		if (!rargv[1] || rargv[2]) {
+			fprintf(stderr,"   ERROR: --diff takes exactly two filenames.\n");
+			return 2;
+		}
+		return diff_files(rargv[0], rargv[1]);
+	}
+
 	while (*rargv) {
 		const char *name = *rargv++;
 
@@ -24,6 +24,10 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "popt.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,13 +38,19 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <netinet/in.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "pi-header.h"
 #include "pi-source.h"
+#include "pi-socket.h"
 #include "pi-syspkt.h"
 #include "pi-dlp.h"
-#include "pi-header.h"
+#include "pi-util.h"
 #include "pi-userland.h"
 
 #ifndef DEFAULT_MODE
@@ -83,58 +93,349 @@ static int check_romversion(int sd, plu_romversion_t *version)
 	return 0;
 }
 
-int do_get_rom(int sd,const char *filename)
+/* Memory is read with the MemMove trap through RPC, in chunks of at most
+   CHUNK_MAX bytes. The size of an RPC parameter is a single byte, so this
+   is as large as a chunk can get whatever the link's MTU; 256 wraps to 0,
+   which the handhelds have always accepted. After a failed read the chunk
+   is halved down to CHUNK_MIN and the same bytes are read again; it
+   doubles back after CHUNK_GROW reads in a row succeed. */
+#define CHUNK_MAX	256
+#define CHUNK_MIN	32
+#define CHUNK_GROW	16
+#define MAX_FAILURES	8
+
+/* The image is written and checksummed in blocks. Once a block is on
+   disk its offset and hash are appended to the checkpoint file, next to
+   the image, so that an interrupted dump resumes after the last block
+   whose data still matches its hash. The checkpoint is removed once the
+   image is complete. */
+#define BLOCK_SIZE	65536
+#define CHECKPOINT_MAGIC "pilot-getrom checkpoint 1"
+
+struct dump {
+	int	file;
+	FILE	*checkpoint;
+	char	checkpoint_name[280];
+	unsigned long length;
+	int	error;			/* errno of a failed write */
+
+	/* Blocks are filled in turn; the other one is being written */
+	unsigned char *block[2];
+	unsigned long block_offset[2];
+	size_t	block_len[2];
+#if HAVE_PTHREAD
+	int	threaded;
+	pthread_t thread;
+	pthread_mutex_t lock;		/* protects full, done */
+	pthread_cond_t cond;
+	int	full[2];		/* the block waits to be written */
+	int	done;			/* no more blocks will come */
+#endif
+};
+
+
+/* Write bytes from..to of a block, keeping the errno of a failure */
+static int write_range(struct dump *d, int slot, size_t from, size_t to)
 {
-	int	i,
-		file = -1,
-		timespent = 0;
+	ssize_t	n;
+
+	while (from < to) {
+		n = pwrite(d->file, d->block[slot] + from, to - from,
+			(off_t) (d->block_offset[slot] + from));
+		if (n <= 0) {
+			d->error = n < 0 ? errno : EIO;
+			return -1;
+		}
+		from += n;
+	}
+	return 0;
+}
 
-	struct 	RPC_params p;
-	plu_romversion_t version;
+/***********************************************************************
+ *
+ * Function:    write_block
+ *
+ * Summary:     Write a block of the image, leaving holes for runs of
+ *		zeros, and record it in the checkpoint once it is on
+ *		disk
+ *
+ * Parameters:  dump, block slot
+ *
+ * Returns:     Nothing; a failure is kept in dump->error
+ *
+ ***********************************************************************/
+static void write_block(struct dump *d, int slot)
+{
+	unsigned char *data = d->block[slot];
+	size_t	len = d->block_len[slot],
+		pos,
+		from,
+		run,
+		i;
+	uint64_t hash;
+
+	if (d->error)
+		return;
+
+	/* Skip 256 byte runs of zeros, so that the file will be holey */
+	for (pos = from = 0; pos < len; pos += run) {
+		run = len - pos < 256 ? len - pos : 256;
+		for (i = 0; i < run && !data[pos + i]; i++)
+			;
+		if (i < run)
+			continue;
+		if (pos > from && write_range(d, slot, from, pos) < 0)
+			return;
+		from = pos + run;
+	}
+	if (len > from && write_range(d, slot, from, len) < 0)
+		return;
 
-	unsigned long ROMstart;
-	unsigned long ROMlength;
-	unsigned long offset;
-	unsigned long left;
+	if (fsync(d->file) < 0 && errno != EINVAL) {
+		d->error = errno;
+		return;
+	}
 
-	char 	name[256],
-		print[256];
+	hash = pi_hash64(data, len);
+	fprintf(d->checkpoint, "%lu %08lx%08lx\n", d->block_offset[slot],
+		(unsigned long) (hash >> 32),
+		(unsigned long) (hash & 0xffffffffUL));
+	if (fflush(d->checkpoint) != 0)
+		d->error = errno;
+}
 
-	time_t 	start = time(NULL), end;
+#if HAVE_PTHREAD
+static void *dump_writer(void *arg)
+{
+	struct dump *d = arg;
+	int 	slot = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&d->lock);
+		while (!d->full[slot] && !d->done)
+			pthread_cond_wait(&d->cond, &d->lock);
+		if (!d->full[slot]) {
+			pthread_mutex_unlock(&d->lock);
+			break;
+		}
+		pthread_mutex_unlock(&d->lock);
 
-	/* Tell user (via Palm) that we are starting things up */
-	dlp_OpenConduit(sd);
+		write_block(d, slot);
 
-	if (check_romversion(sd,&version) < 0) {
-		return -1;
+		pthread_mutex_lock(&d->lock);
+		d->full[slot] = 0;
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+		slot ^= 1;
 	}
+	return NULL;
+}
+#endif
 
-	PackRPC(&p, 0xA23E, RPC_IntReply, RPC_Long(0xFFFFFFFF), RPC_End);
-	/* err = */ dlp_RPC(sd, &p, &ROMstart);
-	PackRPC(&p, 0xA23E, RPC_IntReply, RPC_Long(ROMstart), RPC_End);
-	/* err = */ dlp_RPC(sd, &p, &ROMlength);
+
+/***********************************************************************
+ *
+ * Function:    submit_block
+ *
+ * Summary:     Hand a filled block to the writer and wait until the
+ *		other one is free to be filled
+ *
+ * Parameters:  dump, slot of the filled block
+ *
+ * Returns:     Slot to fill next, or -1 if writing an earlier block
+ *		failed
+ *
+ ***********************************************************************/
+static int submit_block(struct dump *d, int slot)
+{
+#if HAVE_PTHREAD
+	if (d->threaded) {
+		pthread_mutex_lock(&d->lock);
+		d->full[slot] = 1;
+		pthread_cond_broadcast(&d->cond);
+		while (d->full[slot ^ 1])
+			pthread_cond_wait(&d->cond, &d->lock);
+		slot = d->error ? -1 : slot ^ 1;
+		pthread_mutex_unlock(&d->lock);
+		return slot;
+	}
+#endif
+	write_block(d, slot);
+	return d->error ? -1 : slot;
+}
 
 
-	/* As Steve said, "Bummer." */
-	if ((version.major == 3) && (version.minor == 0)
-	    && (ROMlength == 0x100000)) {
-		ROMlength = 0x200000;
+/***********************************************************************
+ *
+ * Function:    resume_offset
+ *
+ * Summary:     Check the blocks listed in an existing checkpoint
+ *		against the image, and start a new checkpoint holding
+ *		those that still match
+ *
+ * Parameters:  dump, image start address
+ *
+ * Returns:     Offset the dump resumes at, 0 if there is nothing to
+ *		resume from
+ *
+ ***********************************************************************/
+static unsigned long resume_offset(struct dump *d, unsigned long start)
+{
+	FILE 	*old;
+	char 	line[128];
+	unsigned long offset = 0,
+		block,
+		hi,
+		lo,
+		saved_start,
+		saved_length;
+	unsigned long *hashes = NULL,
+		*more;
+	size_t	count = 0,
+		allocated = 0,
+		len,
+		i;
+	uint64_t hash;
+
+	old = fopen(d->checkpoint_name, "r");
+	if (old == NULL)
+		return 0;
+
+	if (fgets(line, sizeof(line), old) == NULL
+	    || strncmp(line, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) != 0
+	    || fscanf(old, "%lx %lu\n", &saved_start, &saved_length) != 2
+	    || saved_start != start || saved_length != d->length) {
+		fclose(old);
+		return 0;
 	}
 
-	snprintf(name, sizeof(name),"%s%s.rom",
-		(filename ? filename : "pilot-"),
-		version.name);
+	while (fgets(line, sizeof(line), old) != NULL
+	       && sscanf(line, "%lu %8lx%8lx", &block, &hi, &lo) == 3
+	       && block == offset && offset < d->length) {
+		len = d->length - offset < BLOCK_SIZE
+			? d->length - offset : BLOCK_SIZE;
 
+		/* Holes and a short file read as zeros */
+		memset(d->block[0], 0, len);
+		if (pread(d->file, d->block[0], len, (off_t) offset) < 0)
+			break;
+		hash = pi_hash64(d->block[0], len);
+		if ((unsigned long) (hash >> 32) != hi
+		    || (unsigned long) (hash & 0xffffffffUL) != lo)
+			break;
 
-	if (!plu_quiet) {
-		printf("   Generating %s\n", name);
+		if (count == allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			more = realloc(hashes,
+				allocated * 2 * sizeof(unsigned long));
+			if (more == NULL)
+				break;
+			hashes = more;
+		}
+		hashes[count * 2] = hi;
+		hashes[count * 2 + 1] = lo;
+		count++;
+		offset += len;
+	}
+	fclose(old);
+
+	if (hashes == NULL)
+		return 0;
+
+	/* Keep only the blocks just verified */
+	d->checkpoint = fopen(d->checkpoint_name, "w");
+	if (d->checkpoint != NULL) {
+		fprintf(d->checkpoint, "%s\n%lx %lu\n", CHECKPOINT_MAGIC,
+			start, d->length);
+		for (i = 0; i < count; i++)
+			fprintf(d->checkpoint, "%lu %08lx%08lx\n",
+				(unsigned long) i * BLOCK_SIZE,
+				hashes[i * 2], hashes[i * 2 + 1]);
+		fflush(d->checkpoint);
+	} else {
+		offset = 0;
+	}
+	free(hashes);
+	return offset;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    fetch_memory
+ *
+ * Summary:     Dump a range of the handheld's memory to a file,
+ *		resuming an earlier dump of the same range
+ *
+ * Parameters:  socket, file name, start address, length, "ROM" or
+ *		"RAM"
+ *
+ * Returns:     0 if the image is complete, -1 otherwise
+ *
+ ***********************************************************************/
+static int fetch_memory(int sd, const char *name, unsigned long start,
+	unsigned long length, const char *what)
+{
+	struct 	RPC_params p;
+	struct 	dump d;
+	unsigned long offset,
+		block_start;
+	size_t	chunk 		= CHUNK_MAX,
+		len,
+		pos		= 0;
+	int	slot		= 0,
+		good		= 0,
+		failures	= 0,
+		err,
+		result		= -1;
+	char 	print[256];
+	time_t 	begin 		= time(NULL),
+		last		= 0,
+		now;
+
+	memset(&d, 0, sizeof(d));
+	d.length = length;
+	snprintf(d.checkpoint_name, sizeof(d.checkpoint_name),
+		"%s.checkpoint", name);
+
+	d.block[0] = malloc(BLOCK_SIZE);
+	d.block[1] = malloc(BLOCK_SIZE);
+	d.file = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (d.block[0] == NULL || d.block[1] == NULL || d.file < 0) {
+		fprintf(stderr, "   ERROR: Unable to create %s: %s\n", name,
+			strerror(errno));
+		goto cleanup;
 	}
 
-	file = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	offset = resume_offset(&d, start);
+	if (d.checkpoint == NULL) {
+		offset = 0;
+		d.checkpoint = fopen(d.checkpoint_name, "w");
+		if (d.checkpoint == NULL || ftruncate(d.file, 0) < 0) {
+			fprintf(stderr, "   ERROR: Unable to create %s: %s\n",
+				d.checkpoint_name, strerror(errno));
+			goto cleanup;
+		}
+		fprintf(d.checkpoint, "%s\n%lx %lu\n", CHECKPOINT_MAGIC,
+			start, length);
+		fflush(d.checkpoint);
+	} else {
+		/* Drop whatever the interrupted dump left past the blocks
+		   that were verified */
+		if (ftruncate(d.file, offset) < 0) {
+			fprintf(stderr, "   ERROR: Unable to resume %s: %s\n",
+				name, strerror(errno));
+			goto cleanup;
+		}
+		if (!plu_quiet)
+			printf("   Resuming at byte %lu\n", offset);
+	}
 
-	offset = lseek(file, 0, SEEK_END);
-	offset &= ~255;
-	lseek(file, offset, SEEK_SET);
+#if HAVE_PTHREAD
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.cond, NULL);
+	d.threaded = pthread_create(&d.thread, NULL, dump_writer, &d) == 0;
+#endif
 
 	PackRPC(&p, 0xA164, RPC_IntReply, RPC_Byte(1), RPC_End);
 	/* err = */ dlp_RPC(sd, &p, 0);
@@ -146,46 +447,60 @@ int do_get_rom(int sd,const char *filename)
 	/* err = */ dlp_RPC(sd, &p, 0);
 
 	signal(SIGINT, sighandler);
-	left = ROMlength - offset;
-	i = offset;
-	while (left > 0) {
-		int 	len = left,
-			j;
-		char 	buffer[256];
-		double 	perc = ((double) offset / ROMlength) * 100.0;
-
-		if (len > 256)
-			len = 256;
-
-		if (!plu_quiet) {
-			printf("\r   %ld of %ld bytes (%.2f%%)", offset, ROMlength, perc);
+	block_start = offset;
+	while (offset < length) {
+		len = length - offset;
+		if (len > chunk)
+			len = chunk;
+		if (len > BLOCK_SIZE - pos)
+			len = BLOCK_SIZE - pos;
+
+		PackRPC(&p, 0xA026, RPC_IntReply,
+			RPC_Ptr(d.block[slot] + pos, len),
+			RPC_Long(offset + start), RPC_Long(len), RPC_End);
+		err = dlp_RPC(sd, &p, 0);
+		if (err < 0) {
+			if (!pi_socket_connected(sd)
+			    || ++failures > MAX_FAILURES) {
+				printf("\n   Reading byte %lu failed (%d)\n",
+					offset, err);
+				goto interrupted;
+			}
+			chunk = chunk / 2 < CHUNK_MIN ? CHUNK_MIN : chunk / 2;
+			good = 0;
+			continue;
+		}
+		failures = 0;
+		if (++good >= CHUNK_GROW && chunk < CHUNK_MAX) {
+			chunk *= 2;
+			good = 0;
 		}
 
-		fflush(stdout);
-		PackRPC(&p, 0xA026, RPC_IntReply, RPC_Ptr(buffer, len),
-			RPC_Long(offset + ROMstart), RPC_Long(len),
-			RPC_End);
-		/* err = */ dlp_RPC(sd, &p, 0);
-		left -= len;
-
-		/* If the buffer only contains zeros, skip instead of
-		   writing, so that the file will be holey. */
-		for (j = 0; j < len; j++)
-			if (buffer[j])
-				break;
-		if (j == len)
-			lseek(file, len, SEEK_CUR);
-		else
-			write(file, buffer, len);
+		pos += len;
 		offset += len;
-		if (cancel || !(i++ % 8))
-			if (cancel || (dlp_OpenConduit(sd) < 0)) {
-				printf("\n   Operation cancelled!\n");
-				dlp_AddSyncLogEntry(sd, "\npilot-getrom ended unexpectedly.\n"
-							"Entire ROM was not fetched.\n");
-				goto cancel;
+		if (pos == BLOCK_SIZE || offset == length) {
+			d.block_offset[slot] = block_start;
+			d.block_len[slot] = pos;
+			slot = submit_block(&d, slot);
+			if (slot < 0)
+				goto interrupted;
+			block_start = offset;
+			pos = 0;
+		}
+
+		/* Check for a cancel on the handheld once a second rather
+		   than every few reads, each check costs a round trip */
+		now = time(NULL);
+		if (cancel || now != last) {
+			last = now;
+			if (!plu_quiet) {
+				printf("\r   %ld of %ld bytes (%.2f%%)", offset,
+					length, (double) offset / length * 100.0);
+				fflush(stdout);
 			}
-		if (!(i % 16)) {
+			if (cancel || (dlp_OpenConduit(sd) < 0))
+				goto interrupted;
+
 			sprintf(print, "%ld", offset);
 			PackRPC(&p, 0xA220, RPC_IntReply,
 				RPC_Ptr(print, strlen(print)),
@@ -194,38 +509,109 @@ int do_get_rom(int sd,const char *filename)
 			/* err = */ dlp_RPC(sd, &p, 0);
 		}
 	}
+	result = 0;
+
+interrupted:
+#if HAVE_PTHREAD
+	if (d.threaded) {
+		pthread_mutex_lock(&d.lock);
+		d.done = 1;
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.lock);
+		pthread_join(d.thread, NULL);
+	}
+	pthread_mutex_destroy(&d.lock);
+	pthread_cond_destroy(&d.cond);
+#endif
 
-	end = time(NULL);
-	timespent = (end-start);
-	if (!plu_quiet) {
-		printf("\n   ROM fetch complete\n");
-		printf("   ROM fetched in: %d:%02d:%02d\n",timespent/3600, (timespent/60)%60, timespent%60);
+	if (result == 0 && d.error == 0 && ftruncate(d.file, length) < 0)
+		d.error = errno;
+	if (d.error) {
+		fprintf(stderr, "\n   ERROR: Writing %s failed: %s\n", name,
+			strerror(d.error));
+		result = -1;
 	}
 
-cancel:
-	if (file>=0) {
-		close(file);
+	if (result == 0) {
+		now = time(NULL) - begin;
+		if (!plu_quiet) {
+			printf("\n   %s fetch complete\n", what);
+			printf("   %s fetched in: %d:%02d:%02d\n", what,
+				(int) now / 3600, (int) (now / 60) % 60,
+				(int) now % 60);
+		}
+	} else {
+		printf("\n   Operation cancelled!\n"
+			"   Run the same command again to resume the download.\n");
+		sprintf(print, "\npilot-getrom ended unexpectedly.\n"
+			"Entire %s was not fetched.\n", what);
+		dlp_AddSyncLogEntry(sd, print);
 	}
-	return 0;
+
+cleanup:
+	if (d.checkpoint != NULL) {
+		fclose(d.checkpoint);
+		if (result == 0)
+			unlink(d.checkpoint_name);
+	}
+	if (d.file >= 0)
+		close(d.file);
+	free(d.block[0]);
+	free(d.block[1]);
+	return result;
+}
+
+int do_get_rom(int sd,const char *filename)
+{
+	struct 	RPC_params p;
+	plu_romversion_t version;
+
+	unsigned long ROMstart;
+	unsigned long ROMlength;
+
+	char 	name[256];
+
+	/* Tell user (via Palm) that we are starting things up */
+	dlp_OpenConduit(sd);
+
+	if (check_romversion(sd,&version) < 0) {
+		return -1;
+	}
+
+	PackRPC(&p, 0xA23E, RPC_IntReply, RPC_Long(0xFFFFFFFF), RPC_End);
+	/* err = */ dlp_RPC(sd, &p, &ROMstart);
+	PackRPC(&p, 0xA23E, RPC_IntReply, RPC_Long(ROMstart), RPC_End);
+	/* err = */ dlp_RPC(sd, &p, &ROMlength);
+
+
+	/* As Steve said, "Bummer." */
+	if ((version.major == 3) && (version.minor == 0)
+	    && (ROMlength == 0x100000)) {
+		ROMlength = 0x200000;
+	}
+
+	snprintf(name, sizeof(name),"%s%s.rom",
+		(filename ? filename : "pilot-"),
+		version.name);
+
+
+	if (!plu_quiet) {
+		printf("   Generating %s\n", name);
+	}
+
+	return fetch_memory(sd, name, ROMstart, ROMlength, "ROM");
 }
 
 
 
 int do_get_ram(int sd, const char *filename)
 {
-	char 	name[256],
-		print[256];
-	time_t  start = time(NULL), end;
+	char 	name[256];
 
 	struct 	RPC_params p;
 	plu_romversion_t version;
 
-	unsigned long SRAMstart, SRAMlength, offset, left;
-
-	int	i,
-		file = -1,
-		j,
-		timespent	= 0;
+	unsigned long SRAMstart, SRAMlength;
 
 	/* Tell user (via Palm) that we are starting things up */
 	dlp_OpenConduit(sd);
@@ -247,21 +633,6 @@ int do_get_ram(int sd, const char *filename)
 		printf("   Generating %s\n", name);
 	}
 
-	file = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-
-	offset = lseek(file, 0, SEEK_END);
-	offset &= ~255;
-	lseek(file, offset, SEEK_SET);
-
-	PackRPC(&p, 0xA164, RPC_IntReply, RPC_Byte(1), RPC_End);
-	/* err = */ dlp_RPC(sd, &p, 0);
-
-	sprintf(print, "Downloading byte %ld", offset);
-	PackRPC(&p, 0xA220, RPC_IntReply, RPC_Ptr(print, strlen(print)),
-		RPC_Short(strlen(print)), RPC_Short(0), RPC_Short(28),
-		RPC_End);
-	/* err = */ dlp_RPC(sd, &p, 0);
-
 #if 0
 	PackRPC(&p, 0xA026, RPC_IntReply, RPC_LongPtr(&penPtr),
 		RPC_Long(364), RPC_Long(4), RPC_End);
@@ -275,67 +646,7 @@ int do_get_ram(int sd, const char *filename)
 	pi_dumpdata(print, 8);
 #endif
 
-	signal(SIGINT, sighandler);
-	left 	= SRAMlength - offset;
-	i 	= offset;
-	while (left > 0) {
-		int 	len 	= left;
-		char 	buffer[256];
-		double 	perc 	= ((double) offset / SRAMlength) * 100.0;
-
-		if (len > 256)
-			len = 256;
-
-		if (!plu_quiet) {
-                	printf("\r   %ld of %ld bytes (%.2f%%)", offset, SRAMlength, perc);
-		}
-		fflush(stdout);
-		PackRPC(&p, 0xA026, RPC_IntReply, RPC_Ptr(buffer, len),
-			RPC_Long(offset + SRAMstart), RPC_Long(len),
-			RPC_End);
-		/* err = */ dlp_RPC(sd, &p, 0);
-		left -= len;
-
-		/* If the buffer only contains zeros, skip instead of
-		   writing, so that the file will be holey. */
-		for (j = 0; j < len; j++)
-			if (buffer[j])
-				break;
-		if (j == len)
-			lseek(file, len, SEEK_CUR);
-		else
-			write(file, buffer, len);
-
-		offset += len;
-		if (cancel || !(i++ % 4))
-			if (cancel || (dlp_OpenConduit(sd) < 0)) {
-				printf("\n   Operation cancelled!\n");
-				dlp_AddSyncLogEntry(sd, "\npilot-getrom ended unexpectedly.\n"
-							"Entire RAM was not fetched.\n");
-				goto cancel;
-			}
-		if (!(i % 8)) {
-			sprintf(print, "%ld", offset);
-			PackRPC(&p, 0xA220, RPC_IntReply,
-				RPC_Ptr(print, strlen(print)),
-				RPC_Short(strlen(print)), RPC_Short(92),
-				RPC_Short(28), RPC_End);
-			/* err = */ dlp_RPC(sd, &p, 0);
-		}
-	}
-
-	end = time(NULL);
-        timespent = (end-start);
-	if (!plu_quiet) {
-		printf("   RAM fetch complete\n");
-		printf("   RAM fetched in: %d:%02d:%02d\n",timespent/3600, (timespent/60)%60, timespent%60);
-	}
-
-cancel:
-	if (file >=0) {
-		close(file);
-	}
-	return 0;
+	return fetch_memory(sd, name, SRAMstart, SRAMlength, "RAM");
 }
 
 
@@ -31,16 +31,55 @@
 #include "pi-source.h"
 #include "pi-dlp.h"
 #include "pi-datebook.h"
+#include "pi-installer.h"
 #include "pi-userland.h"
 
 extern time_t parsedate(char *p);
 
+/* Pack an appointment, called by the installer */
+static int pack_appointment(void *ctx, void *item, pi_buffer_t *buf)
+{
+	return pack_Appointment((struct Appointment *) item, buf, datebook_v1);
+}
+
+/* Tell how the install of an appointment went, called by the installer */
+static void report_appointment(void *ctx, int index, void *item, int result,
+	recordid_t id)
+{
+	struct 	Appointment *appointment = item;
+
+	if (result == PI_INSTALL_DUPLICATE) {
+		printf("Already on the Palm: %s\n", appointment->description);
+		return;
+	}
+	if (result < 0) {
+		fprintf(stderr, "   ERROR: Unable to install '%s' (%d, PalmOS 0x%04x)\n",
+			appointment->description, result,
+			pi_palmos_error(*(int *) ctx));
+		return;
+	}
+
+	printf("Description: %s, %s\n",
+		appointment->description, appointment->note);
+
+	printf("date: %d/%d/%d %d:%02d\n",
+		appointment->begin.tm_mon + 1,
+		appointment->begin.tm_mday,
+		appointment->begin.tm_year + 1900,
+		appointment->begin.tm_hour,
+		appointment->begin.tm_min);
+}
+
 int main(int argc, const char *argv[])
 {
 	int 	c,		/* switch */
 		db,
 		fieldno,
 		filelen,
+		i,
+		count		= 0,
+		install_flags	= 0,
+		failed		= 0,
 		sd		= -1;
 
 	char
@@ -49,19 +88,21 @@ int main(int argc, const char *argv[])
 		*file_text	= NULL,
 		*fields[4];
 	
-	pi_buffer_t *Appointment_buf;
-	Appointment_buf 	= pi_buffer_new (0xffff);
-
 	FILE 	*f = NULL;
 
+	pi_installer_t *inst = NULL;
+	pi_installer_stats_t stats;
+
 	struct 	PilotUser User;
-	struct 	Appointment appointment;
+	struct 	Appointment appointment,
+		*appointments	= NULL;
 
 	poptContext pc;
 
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
 		{"read", 'r', POPT_ARG_STRING, &filename, 0, "Read entries from <file>", "file"},
+		{"skip-duplicates", 0, POPT_ARG_VAL, &install_flags, PI_INSTALL_SKIP_DUPLICATES, "Don't install entries that are already in the datebook"},
 		POPT_TABLEEND
 	};
 
@@ -110,6 +151,19 @@ int main(int argc, const char *argv[])
 	fclose(f);
 	f = NULL;
 
+	/* At most one appointment per line */
+	for (i = 0; i < filelen; i++)
+		if (file_text[i] == '\n')
+			count++;
+	appointments = (struct Appointment *) malloc((count + 1) *
+		sizeof(struct Appointment));
+	if (appointments == NULL) {
+		perror("malloc()");
+		free(file_text);
+		return 1;
+	}
+	count = 0;
+
 	sd = plu_connect();
 	if (sd < 0)
 		goto error;
@@ -127,7 +181,12 @@ int main(int argc, const char *argv[])
 		goto error_close;
 	}
 
-
+	inst = pi_installer_new(sd, db, install_flags,
+		pack_appointment, report_appointment, &sd);
+	if (inst == NULL) {
+		fprintf(stderr,"   ERROR: Unable to allocate memory\n");
+		goto error_close;
+	}
 
 	file_text[filelen] 	= '\0';
 	cPtr 			= file_text;
@@ -221,50 +280,60 @@ int main(int argc, const char *argv[])
 			appointment.description 	= fields[3];
 			appointment.note 		= NULL;
 
-			pack_Appointment(&appointment, Appointment_buf, datebook_v1);
-
-			printf("Description: %s, %s\n",
-				appointment.description, appointment.note);
-
-			printf("date: %d/%d/%d %d:%02d\n",
-				appointment.begin.tm_mon + 1,
-				appointment.begin.tm_mday,
-				appointment.begin.tm_year + 1900,
-				appointment.begin.tm_hour,
-				appointment.begin.tm_min);
-
-			dlp_WriteRecord(sd, db, 0, 0, 0,
-					Appointment_buf->data,
-					Appointment_buf->used, 0);
+			appointments[count] = appointment;
+			if (pi_installer_add(inst, &appointments[count], 0) < 0) {
+				fprintf(stderr,"   ERROR: Unable to allocate memory\n");
+				goto error_close;
+			}
+			count++;
 			fields[fieldno++] = cPtr;
 		} else {
 			cPtr++;
 		}
 	}
 
+	/* Each failed appointment was reported on the way */
+	if (pi_installer_run(inst, &stats) < 0 || stats.failed > 0) {
+		fprintf(stderr, "   ERROR: %d of %d appointments could not be "
+			"installed\n", stats.failed, count);
+		failed = 1;
+	}
+
 	/* Close the database */
 	dlp_CloseDB(sd, db);
 
-	/* Tell the user who it is, with a different PC id. */
+	/* Tell the user who it is, with a different PC id. The sync only
+	   counts as successful if every appointment made it. */
 	User.lastSyncPC 	= 0x00010000;
-	User.successfulSyncDate = time(NULL);
-	User.lastSyncDate 	= User.successfulSyncDate;
+	User.lastSyncDate 	= time(NULL);
+	if (!failed)
+		User.successfulSyncDate = User.lastSyncDate;
 	dlp_WriteUserInfo(sd, &User);
 
-	if (dlp_AddSyncLogEntry(sd, "Successfully wrote Appointment to Palm.\n"
-				"Thank you for using pilot-link.\n") < 0);
+	if (dlp_AddSyncLogEntry(sd, failed ?
+			"Unable to write all Appointments to Palm.\n" :
+			"Successfully wrote Appointment to Palm.\n"
+			"Thank you for using pilot-link.\n") < 0)
 		goto error_close;
 
-	if(dlp_EndOfSync(sd, 0) < 0);
+	if (dlp_EndOfSync(sd, 0) < 0)
 		goto error_close;
 
-	if(pi_close(sd) < 0)
+	if (pi_close(sd) < 0 || failed)
 		goto error;
 
+	pi_installer_free(inst);
+	free(appointments);
+	free(file_text);
+	return 0;
+
 error_close:
 	pi_close(sd);
 
 error:
+	pi_installer_free(inst);
+	free(appointments);
+	free(file_text);
 	return -1;
 }
 
@@ -26,8 +26,51 @@
 #include "pi-source.h"
 #include "pi-dlp.h"
 #include "pi-expense.h"
+#include "pi-installer.h"
 #include "pi-userland.h"
 
+/* Pack an expense, called by the installer */
+static int pack_expense(void *ctx, void *item, pi_buffer_t *buf)
+{
+	struct 	Expense *e = item;
+	unsigned char head[6];
+	const char *strings[5];
+	int 	i;
+
+	/* Date */
+	head[0] = 0xc3;
+	head[1] = 0x45;
+
+	head[2] = e->type;
+	head[3] = e->payment;
+	head[4] = e->currency;
+	head[5] = 0x00;
+	pi_buffer_append(buf, head, sizeof(head));
+
+	strings[0] = e->amount;
+	strings[1] = e->vendor;
+	strings[2] = e->city;
+	strings[3] = e->attendees;
+	strings[4] = e->note;
+	for (i = 0; i < 5; i++)
+		if (pi_buffer_append(buf, strings[i], strlen(strings[i]) + 1)
+		    == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+
+	return 0;
+}
+
+/* Tell how the install of the expense went, called by the installer */
+static void report_expense(void *ctx, int index, void *item, int result,
+	recordid_t id)
+{
+	if (result == PI_INSTALL_DUPLICATE)
+		fprintf(stderr,"   This expense is already on the Palm.\n");
+	else if (result < 0)
+		fprintf(stderr,"   ERROR: Unable to install the expense (%d, PalmOS 0x%04x)\n",
+			result, pi_palmos_error(*(int *) ctx));
+}
+
 int main(int argc, const char *argv[])
 {
 	int 	db,
@@ -36,18 +79,18 @@ int main(int argc, const char *argv[])
 		l,
 		category,
 		po_err		= -1,
-		replace_category = 0;
+		written,
+		replace_category = 0,
+		install_flags	= 0;
 
 	char
 		*category_name 	= NULL,
 		*expenseType	= NULL,
 		*paymentType	= NULL;
-	size_t size;
 	int found;
 
-	unsigned char buf[0xffff];
-	unsigned char *b;
 	pi_buffer_t *appblock;
+	pi_installer_t *inst;
 
 	struct 	PilotUser User;
 	struct 	ExpenseAppInfo eai;
@@ -66,6 +109,7 @@ int main(int argc, const char *argv[])
 	        {"note", 	'n', POPT_ARG_STRING, &theExpense.note, 0, "Notes for this expense entry"},
         	{"category", 	'c', POPT_ARG_STRING, &category_name, 0, "Install entry into this category", "CATEGORY" },
                 {"replace", 	0, POPT_ARG_VAL, &replace_category, 1, "Replace all entries in category by this one"},
+                {"skip-duplicates", 0, POPT_ARG_VAL, &install_flags, PI_INSTALL_SKIP_DUPLICATES, "Don't install the entry if it is already in the category"},
         	POPT_TABLEEND
 	};
 
@@ -187,35 +231,13 @@ int main(int argc, const char *argv[])
 			theExpense.note = "";
 		}
 
-		b = buf;
-
-		/* Date */
-		*(b++) 	= 0xc3;
-		*(b++) 	= 0x45;
-
-		*(b++) 	= theExpense.type;
-		*(b++) 	= theExpense.payment;
-		*(b++) 	= theExpense.currency;
-		*(b++) 	= 0x00;
-
-		strcpy(b, theExpense.amount);
-		b += strlen(theExpense.amount) + 1;
-
-		strcpy(b, theExpense.vendor);
-		b += strlen(theExpense.vendor) + 1;
-
-		strcpy(b, theExpense.city);
-		b += strlen(theExpense.city) + 1;
-
-		strcpy(b, theExpense.attendees);
-		b += strlen(theExpense.attendees) + 1;
-
-		strcpy(b, theExpense.note);
-		b += strlen(theExpense.note) + 1;
-
-		size = b - buf;
-		dlp_WriteRecord(sd, (unsigned char)db, 0, 0, category,
-				(unsigned char *)buf, size, 0);
+		inst = pi_installer_new(sd, db, install_flags,
+			pack_expense, report_expense, &sd);
+		if (inst == NULL)
+			goto error_close;
+		pi_installer_add(inst, &theExpense, category);
+		written = pi_installer_run(inst, NULL);
+		pi_installer_free(inst);
 
 	/* Close the database */
 	dlp_CloseDB(sd, db);
@@ -226,7 +248,8 @@ int main(int argc, const char *argv[])
 	User.lastSyncDate 	= User.successfulSyncDate;
 	dlp_WriteUserInfo(sd, &User);
 
-	dlp_AddSyncLogEntry(sd, "Wrote expense entry to Palm.\n");
+	if (written > 0)
+		dlp_AddSyncLogEntry(sd, "Wrote expense entry to Palm.\n");
 	dlp_EndOfSync(sd, 0);
 	pi_close(sd);
 	poptFreeContext(po);
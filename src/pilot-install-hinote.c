@@ -27,37 +27,99 @@
 #include "pi-dlp.h"
 #include "pi-hinote.h"
 #include "pi-header.h"
+#include "pi-installer.h"
 #include "pi-userland.h"
 
 /* Size of maximum buffer, containing 28k of note + a filename + \n + NUL at
    the end. */
 #define HINOTE_BUFFER_SIZE (28 * 1024 + FILENAME_MAX + 2)
 
+struct hinote_file {
+	const char *name;
+	int	size;
+};
+
+struct hinote_install {
+	int	sd;
+	char	*file_text;	/* only used by pack_hinote() */
+};
+
+/* Pack a note from its file, called by the installer */
+static int pack_hinote(void *ctx, void *item, pi_buffer_t *buf)
+{
+	struct 	hinote_install *hi = ctx;
+	struct 	hinote_file *file = item;
+	struct 	HiNoteNote note;
+	int 	filenamelen = strlen(file->name),
+		note_size;
+	FILE 	*f;
+
+	f = fopen(file->name, "r");
+	if (f == NULL)
+		return PI_ERR_GENERIC_SYSTEM;
+
+	memset(hi->file_text, 0, HINOTE_BUFFER_SIZE);
+	strcpy(hi->file_text, file->name);
+	hi->file_text[filenamelen] = '\n';
+
+	fread(hi->file_text + filenamelen + 1, file->size, 1, f);
+	hi->file_text[filenamelen + 1 + file->size] = '\0';
+	fclose(f);
+
+	note.text = hi->file_text;
+	note.flags = 0x40;
+	note.level = 0;
+	note_size = pack_HiNoteNote(&note, NULL, 0);
+	if (pi_buffer_expect(buf, note_size) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	buf->used = pack_HiNoteNote(&note, buf->data, note_size);
+	return 0;
+}
+
+/* Tell how the install of a note went, called by the installer */
+static void report_hinote(void *ctx, int index, void *item, int result,
+	recordid_t id)
+{
+	struct 	hinote_install *hi = ctx;
+	struct 	hinote_file *file = item;
+
+	if (result == PI_INSTALL_WRITTEN) {
+		if (!plu_quiet) {
+			fprintf(stdout, "   Installed %s to Hi-Note application\n", file->name);
+		}
+	} else if (result == PI_INSTALL_DUPLICATE) {
+		fprintf(stderr, "   WARNING: '%s' is already in the Hi-Note database\n",
+			file->name);
+	} else {
+		fprintf(stderr, "   WARNING: Installing '%s' failed (%d, PalmOS 0x%04x)\n",
+			file->name, result, pi_palmos_error(hi->sd));
+	}
+}
+
 int main(int argc, const char *argv[])
 {
 	int 	db,
 		sd	= -1,
 		c,		/* switch */
 		j,
-		filenamelen,
 		filelen,
 		err,
+		count		= 0,
 		category 	= 0,
-		note_size;
+		install_flags	= 0;
 
 	const char
                 *file_arg;
 
-	char    *file_text,
-		*cat 		= NULL;
+	char    *cat 		= NULL;
 	pi_buffer_t *appblock;
+	pi_installer_t *inst;
 
-	unsigned char note_buf[0x8000];
-	FILE 	*f;
 	struct 	PilotUser User;
 	struct 	stat info;
 	struct 	HiNoteAppInfo mai;
-	struct 	HiNoteNote note;
+	struct 	hinote_file *files;
+	struct 	hinote_install hi;
 
 	poptContext pc;
 
@@ -65,6 +127,7 @@ int main(int argc, const char *argv[])
 		USERLAND_RESERVED_OPTIONS
 		{"category", 'c', POPT_ARG_STRING, &cat, 0, "Write files to <category> in the Hi-NOte application",
 		 "category"},
+		{"skip-duplicates", 0, POPT_ARG_VAL, &install_flags, PI_INSTALL_SKIP_DUPLICATES, "Don't install files that are already notes in the category"},
 		POPT_TABLEEND
 	};
 
@@ -95,8 +158,9 @@ int main(int argc, const char *argv[])
 	}
 
 	/* Allocate buffer for biggest possible file */
-	file_text = (char *) malloc(HINOTE_BUFFER_SIZE);
-	if (file_text == NULL) {
+	hi.file_text = (char *) malloc(HINOTE_BUFFER_SIZE);
+	files = (struct hinote_file *) calloc(argc, sizeof(struct hinote_file));
+	if (hi.file_text == NULL || files == NULL) {
 		fprintf(stderr,"   ERROR: Cannot allocate memory for files.\n");
 		return 1;
 	}
@@ -128,6 +192,14 @@ int main(int argc, const char *argv[])
 			PLU_CAT_DEFAULT_UNFILED);
 	}
 
+	hi.sd = sd;
+	inst = pi_installer_new(sd, db, install_flags,
+		pack_hinote, report_hinote, &hi);
+	if (inst == NULL) {
+		fprintf(stderr,"   ERROR: Cannot allocate memory for files.\n");
+		goto error_close;
+	}
+
 	while((file_arg = poptGetArg(pc)) != NULL) {
 
 		/* Attempt to check the file size, stat() returns nonzero on
@@ -148,39 +220,18 @@ int main(int argc, const char *argv[])
 				filelen);
 
 			continue;
-		} else {
-			f = fopen(file_arg, "r");
-		}
-
-		if (f == NULL) {
-			fprintf(stderr,"   WARNING: Opening file '%s': %s\n",file_arg,strerror(errno));
-			continue;
 		}
 
-		filenamelen = strlen(file_arg);
-
-
-		memset(file_text,0,HINOTE_BUFFER_SIZE);
-		strcpy(file_text, file_arg);
-		file_text[filenamelen] = '\n';
-
-		fread(file_text + filenamelen + 1, filelen, 1, f);
-		file_text[filenamelen + 1 + filelen] = '\0';
-
-
-		note.text = file_text;
-		note.flags = 0x40;
-		note.level = 0;
-		note_size = pack_HiNoteNote(&note, note_buf, sizeof(note_buf));
-
-		/* dlp_exec(sd, 0x26, 0x20, &db, 1, NULL, 0); */
-		if (!plu_quiet) {
-			fprintf(stdout, "   Installing %s to Hi-Note application...\n", file_arg);
-		}
-		dlp_WriteRecord(sd, db, 0, 0, category, note_buf,
-				note_size, 0);
+		files[count].name = file_arg;
+		files[count].size = filelen;
+		pi_installer_add(inst, &files[count], category);
+		count++;
 	}
-	free(file_text);
+
+	pi_installer_run(inst, NULL);
+	pi_installer_free(inst);
+	free(files);
+	free(hi.file_text);
 
 	/* Close the database */
 	dlp_CloseDB(sd, db);
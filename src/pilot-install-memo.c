@@ -25,6 +25,7 @@
 
 #include "pi-dlp.h"
 #include "pi-memo.h"
+#include "pi-installer.h"
 #include "pi-header.h"
 #include "pi-userland.h"
 
@@ -85,63 +86,72 @@ void append_filenames(filename_array *m, const char **names)
 	}
 }
 
-int install_memo(int sd, int db, int category, int add_title, char *filename)
+struct memo_file {
+	char	*filename;
+	int	size;
+};
+
+struct memo_install {
+	int	sd;
+	int	add_title;
+	unsigned int count;
+};
+
+/* Pack a memo from its file, called by the installer */
+int pack_memo(void *ctx, void *item, pi_buffer_t *buf)
 {
-	struct  stat sbuf;
+	struct memo_install *mi = ctx;
+	struct memo_file *m = item;
 	FILE *f = NULL;
-	char *tmp = NULL;
-	char *memo_buf = NULL;
-	int memo_size, preamble;
-
-	/* Check the file still exists and its size. */
-	if (stat(filename, &sbuf) <0) {
-		fprintf(stderr,"   ERROR: Unable to open %s (%s)\n\n",
-			filename, strerror(errno));
-		return 1;
-	}
+	size_t len;
 
-	memo_size = sbuf.st_size;
-	preamble = add_title ? strlen(filename) + 1 : 0;
-	memo_buf = calloc(1, memo_size + preamble + 16);
-	if (!memo_buf) {
-		fprintf(stderr,"   ERROR: cannot allocate memory for memo (%s)\n",
-			strerror(errno));
-		return 1;
-	}
+	if (pi_buffer_expect(buf, m->size + strlen(m->filename) + 2) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
 
-	if (memo_size + preamble > 65490) {
-		fprintf(stderr, "   WARNING: `%s'\n",filename);
-		fprintf(stderr, "   File is larger than the allowed size for Palm memo size. Please\n");
-		fprintf(stderr, "   decrease the file size to less than 65,490 bytes and try again.\n\n");
-		return 1;
+	if (mi->add_title) {
+		pi_buffer_append(buf, m->filename, strlen(m->filename));
+		pi_buffer_append(buf, "\n", 1);
 	}
 
-	if (preamble)
-		sprintf(memo_buf, "%s\n", filename);
-
-	f = fopen(filename, "rb");
-	if (f == NULL) {
-		fprintf(stderr,"   ERROR: Unable to open %s (%s)\n\n",
-			filename, strerror(errno));
-		return 1;
-	}
-	fread(memo_buf + preamble, memo_size, 1, f);
+	f = fopen(m->filename, "rb");
+	if (f == NULL)
+		return PI_ERR_GENERIC_SYSTEM;
+	len = fread(buf->data + buf->used, 1, m->size, f);
 	fclose(f);
+	buf->data[buf->used + len] = '\0';
 
-	dlp_WriteRecord(sd, db, 0, 0, category, memo_buf, -1, 0);
-	free(memo_buf);
+	/* The memo ends at the first NUL, as a text record does */
+	buf->used = strlen((char *) buf->data) + 1;
+	return 0;
+}
+
+/* Tell how the install of a memo went, called by the installer */
+void report_memo(void *ctx, int index, void *item, int result, recordid_t id)
+{
+	struct memo_install *mi = ctx;
+	struct memo_file *m = item;
 
-	if ((memo_size < 65490) && (memo_size > 4096)) {
-		fprintf(stderr, "   WARNING: `%s'\n", filename);
+	if (result == PI_INSTALL_DUPLICATE) {
+		fprintf(stderr, "   File '%s' is already on your Palm device, skipped\n\n",
+			m->filename);
+		return;
+	}
+	if (result < 0) {
+		fprintf(stderr, "   ERROR: Unable to install %s (%d, PalmOS 0x%04x)\n\n",
+			m->filename, result, pi_palmos_error(mi->sd));
+		return;
+	}
+
+	mi->count++;
+	if ((m->size < 65490) && (m->size > 4096)) {
+		fprintf(stderr, "   WARNING: `%s'\n", m->filename);
 		fprintf(stderr, "   This file was synchonized successfully, but will remain uneditable,\n");
 		fprintf(stderr, "   because it is larger than the Palm limitation of 4,096 bytes in\n");
 		fprintf(stderr, "   size.\n\n");
 
-	} else if (memo_size < 4096) {
-		fprintf(stderr, "   File '%s' was synchronized to your Palm device\n\n", filename);
+	} else if (m->size < 4096) {
+		fprintf(stderr, "   File '%s' was synchronized to your Palm device\n\n", m->filename);
 	}
-
-	return 0;
 }
 
 
@@ -152,8 +162,10 @@ int main(int argc, char *argv[])
 		add_title	= 0,
 		category	= -1,
 		replace		= 0,
+		install_flags	= 0,
 		db,
-		ReadAppBlock;
+		ReadAppBlock,
+		preamble;
 	unsigned int i;
 	unsigned int count = 0;
 
@@ -166,6 +178,10 @@ int main(int argc, char *argv[])
         struct 	MemoAppInfo mai;
 
 	pi_buffer_t *appblock;
+	pi_installer_t *inst;
+	struct memo_file *files;
+	struct memo_install mi;
+	struct stat sbuf;
 
         const struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
@@ -173,6 +189,7 @@ int main(int argc, char *argv[])
                 { "replace",  'r', POPT_ARG_NONE,   &replace, 0, "Replace all memos in specified category"},
                 { "title",    't', POPT_ARG_NONE,   &add_title, 0, "Use the filename as the title of the Memo entry"},
 		{ "file",     'f', POPT_ARG_STRING, &filename, 'f', "File containing the target memo entry"},
+		{ "skip-duplicates", 0, POPT_ARG_VAL, &install_flags, PI_INSTALL_SKIP_DUPLICATES, "Don't install files that are already memos in the category"},
                 POPT_TABLEEND
         };
 
@@ -255,10 +272,45 @@ int main(int argc, char *argv[])
 		category = 0;	/* Unfiled */
 	}
 
+	mi.sd = sd;
+	mi.add_title = add_title;
+	mi.count = 0;
+	files = calloc(memos.filenames_used, sizeof(struct memo_file));
+	inst = pi_installer_new(sd, db, install_flags,
+		pack_memo, report_memo, &mi);
+	if (files == NULL || inst == NULL) {
+		fprintf(stderr,"   ERROR: cannot allocate memory for memos\n");
+		goto error_close;
+	}
+
 	for (i=0; i<memos.filenames_used; i++) {
-		if (!install_memo(sd, db, category, add_title, memos.filenames[i])) count++;
+		if (!memos.filenames[i])
+			continue;
+
+		/* Check the file still exists and its size. */
+		if (stat(memos.filenames[i], &sbuf) <0) {
+			fprintf(stderr,"   ERROR: Unable to open %s (%s)\n\n",
+				memos.filenames[i], strerror(errno));
+			continue;
+		}
+
+		preamble = add_title ? strlen(memos.filenames[i]) + 1 : 0;
+		if (sbuf.st_size + preamble > 65490) {
+			fprintf(stderr, "   WARNING: `%s'\n",memos.filenames[i]);
+			fprintf(stderr, "   File is larger than the allowed size for Palm memo size. Please\n");
+			fprintf(stderr, "   decrease the file size to less than 65,490 bytes and try again.\n\n");
+			continue;
+		}
+
+		files[i].filename = memos.filenames[i];
+		files[i].size = sbuf.st_size;
+		pi_installer_add(inst, &files[i], category);
 	}
 
+	pi_installer_run(inst, NULL);
+	pi_installer_free(inst);
+	free(files);
+	count = mi.count;
 
 	/* Close the database */
 	dlp_CloseDB(sd, db);
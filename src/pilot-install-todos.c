@@ -30,21 +30,42 @@
 #include "pi-todo.h"
 #include "pi-header.h"
 #include "pi-buffer.h"
+#include "pi-installer.h"
 
-void install_ToDos(int sd, int db, char *filename)
+/* Pack a ToDo, called by the installer */
+int pack_todo(void *ctx, void *item, pi_buffer_t *buf)
 {
-	int 	cLen		= 0,
-		i		= 0,
+	return pack_ToDo((struct ToDo *) item, buf, todo_v1);
+}
+
+/* Tell how the install of a ToDo went, called by the installer */
+void report_todo(void *ctx, int index, void *item, int result, recordid_t id)
+{
+	struct 	ToDo *todo = item;
+
+	if (result == PI_INSTALL_WRITTEN)
+		printf("Description: %s\n", todo->description);
+	else if (result == PI_INSTALL_DUPLICATE)
+		printf("Already on the Palm: %s\n", todo->description);
+	else
+		fprintf(stderr, "   ERROR: Unable to install '%s' (%d, PalmOS 0x%04x)\n",
+			todo->description, result, pi_palmos_error(*(int *) ctx));
+}
+
+void install_ToDos(int sd, int db, char *filename, int flags)
+{
+	int 	i		= 0,
+		count		= 0,
 		filelen;
 
         char 	*file_text 	= NULL,
-		*cPtr 		= file_text,
-		*begPtr 	= cPtr,
+		*cPtr,
+		*begPtr,
 		note_text[] 	= "";
 
-        pi_buffer_t *ToDo_buf;
+        pi_installer_t *inst;
 
-        struct 	ToDo todo;
+        struct 	ToDo *todos;
         FILE 	*f;
 
 	f = fopen(filename, "r");
@@ -64,41 +85,50 @@ void install_ToDos(int sd, int db, char *filename)
 	}
 
 	fread(file_text, filelen, 1, f);
+	fclose(f);
+
+	/* One ToDo per line */
+	for (i = 0; i < filelen; i++)
+		if (file_text[i] == '\n')
+			count++;
+	todos = (struct ToDo *) calloc(count + 1, sizeof(struct ToDo));
+	inst = pi_installer_new(sd, db, flags,
+		pack_todo, report_todo, &sd);
+	if (todos == NULL || inst == NULL) {
+		perror("malloc()");
+		exit(EXIT_FAILURE);
+	}
+
+	count = 0;
+	i = 0;
 
         cPtr = file_text;
         begPtr = cPtr;
-        cLen = 0;
-        i = 0;
 	while (i < filelen) {
 		i++;
-		/* printf("c:%c.\n",*cPtr); */
 		if (*cPtr == '\n') {
-			todo.description = begPtr;
 			/* replace CR with terminator */
 			*cPtr = '\0';
 
-			todo.priority 	= 4;
-			todo.complete 	= 0;
-			todo.indefinite = 1;
-			/* now = time(0);
-			   todo.due = *localtime(&now); */
-			todo.note = note_text;
-			ToDo_buf = pi_buffer_new(0);
-			pack_ToDo(&todo, ToDo_buf, todo_v1);
-			printf("Description: %s\n", todo.description);
-
-			/* printf("todobuf: %s\n",ToDo_buf->data);       */
-			dlp_WriteRecord(sd, db, 0, 0, 0, ToDo_buf->data,
-					ToDo_buf->used, 0);
-			pi_buffer_free(ToDo_buf);
+			todos[count].description = begPtr;
+			todos[count].priority 	= 4;
+			todos[count].complete 	= 0;
+			todos[count].indefinite = 1;
+			todos[count].note 	= note_text;
+			pi_installer_add(inst, &todos[count], 0);
+			count++;
+
 			cPtr++;
 			begPtr = cPtr;
-			cLen = 0;
 		} else {
-			cLen++;
 			cPtr++;
 		}
 	}
+
+	pi_installer_run(inst, NULL);
+	pi_installer_free(inst);
+	free(todos);
+	free(file_text);
 	return;
 }
 
@@ -106,7 +136,8 @@ int main(int argc, const char *argv[])
 {
 	int 	c,		/* switch */
 		db,
-		sd 		= -1;
+		sd 		= -1,
+		install_flags	= 0;
 
         const char
                 *progname 	= argv[0];
@@ -118,6 +149,7 @@ int main(int argc, const char *argv[])
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
 	        {"filename",	'f', POPT_ARG_STRING, &filename, 0, "A local file with formatted ToDo entries"},
+	        {"skip-duplicates", 0, POPT_ARG_VAL, &install_flags, PI_INSTALL_SKIP_DUPLICATES, "Don't install tasks that are already on the Palm"},
 		POPT_TABLEEND
 	};
 
@@ -174,7 +206,7 @@ int main(int argc, const char *argv[])
 		}
 
 		/* Actually do the install here, passed a filename */
-		install_ToDos(sd, db, filename);
+		install_ToDos(sd, db, filename, install_flags);
 
 		/* Close the database */
 		dlp_CloseDB(sd, db);
@@ -188,6 +188,7 @@ int main(int argc, const char *argv[])
 
 	pi_buffer_t	*buffer,
 		*appblock;
+	pi_arena_t	*arena;
 
 	const char
                 *progname 	= argv[0];
@@ -311,7 +312,10 @@ int main(int argc, const char *argv[])
 		};
 	}
 
+	/* Memos are only written out, so their text is left in the record
+	   buffer instead of being copied */
 	buffer = pi_buffer_new (0xffff);
+	arena = pi_arena_new_borrowing(0);
 
 	for (idx = 0;; idx++) {
 
@@ -352,7 +356,8 @@ int main(int argc, const char *argv[])
 				continue;
 		}
 
-		unpack_Memo(&m, buffer, memo_v1);
+		pi_arena_reset(arena);
+		unpack_Memo_arena(&m, buffer, memo_v1, arena);
 
 		/* Skip memos whose title does not match with the query */
 		if (title_matching) {
@@ -378,6 +383,7 @@ int main(int argc, const char *argv[])
 		}
 	}
 
+	pi_arena_free (arena);
 	pi_buffer_free (buffer);
 
 	if (delete && !filename) {
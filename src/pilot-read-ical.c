@@ -1,8 +1,8 @@
 /*
  * $Id$ 
  *
- * pilot-read-ical.c:  Translate Palm ToDo and Datebook databases into ical
- *                     2.0 format
+ * pilot-read-ical.c:  Translate Palm ToDo and Datebook databases into
+ *                     iCalendar (RFC 5545)
  *
  * Copyright (c) 1996, Kenneth Albanowski
  *
@@ -30,373 +30,498 @@
 #include "pi-source.h"
 #include "pi-todo.h"
 #include "pi-datebook.h"
+#include "pi-calendar.h"
 #include "pi-dlp.h"
+#include "pi-file.h"
 #include "pi-header.h"
+#include "pi-ical.h"
+#include "pi-util.h"
 #include "pi-userland.h"
 
-char *tclquote(char *in)
+#define PRODID	"-//pilot-link//pilot-read-ical//EN"
+
+/* Where records come from: a local file or an open database on the Palm */
+struct source {
+	pi_file_t *pf;
+	int	sd;
+	int	db;
+};
+
+static char *pubtext = NULL;
+
+
+/***********************************************************************
+ *
+ * Function:    read_record
+ *
+ * Summary:     Read a record from a file or the Palm. Records of
+ *		mapped files are unpacked where they lie, not copied.
+ *
+ * Parameters:  source, index, buffer, unique ID, attributes and
+ *		category returned
+ *
+ * Returns:     0 on success, negative at the end or on error
+ *
+ ***********************************************************************/
+static int read_record(struct source *src, int i, pi_buffer_t *buf,
+	recordid_t *uid, int *attrs, int *cat)
 {
-	int 	len;
-	char 	*out,
-		*pos;
-	static char *buffer = 0;
+	void 	*data;
+	size_t 	size;
 
-	if (in == NULL) {
-		return buffer;
-	}
+	if (src->pf == NULL)
+		return dlp_ReadRecordByIndex(src->sd, src->db, i, buf, uid,
+			attrs, cat);
+
+	if (pi_file_read_record(src->pf, i, &data, &size, attrs, cat,
+			uid) < 0)
+		return -1;
+
+	buf->data = data;
+	buf->used = buf->allocated = size;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    read_appinfo
+ *
+ * Summary:     Read the application info block of a file or database
+ *
+ * Parameters:  source, buffer
+ *
+ * Returns:     0 on success, negative on error
+ *
+ ***********************************************************************/
+static int read_appinfo(struct source *src, pi_buffer_t *buf)
+{
+	void 	*data;
+	size_t 	size;
 
-	/* Skip leading bullet (and any whitespace after) */
-	if (in[0] == '\x95') {
-		++in;
-		while (in[0] == ' ' || in[0] == '\t') {
-			++in;
+	if (src->pf == NULL)
+		return dlp_ReadAppBlock(src->sd, src->db, 0, 0xffff, buf);
+
+	pi_file_get_app_info(src->pf, &data, &size);
+	buf->used = 0;
+	return pi_buffer_append(buf, data, size) == NULL ? -1 : 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    to_host
+ *
+ * Summary:     Convert the strings of a record to UTF-8, replacing the
+ *		text of records that don't start with a bullet by the
+ *		public text if there is one, and removing the bullet
+ *		otherwise
+ *
+ * Parameters:  strings to convert in place (NULL entries are left
+ *		alone), number of them, allocation to free() returned
+ *
+ * Returns:     Nothing; bytes the handheld's charset leaves undefined
+ *		come out as U+FFFD, and if out of memory the strings are
+ *		left as they are
+ *
+ ***********************************************************************/
+static void to_host(char **texts, int count, char **block)
+{
+	size_t	offsets[4];
+	int 	i;
+	pi_buffer_t buf;
+
+	*block = NULL;
+
+	/* '\x95' is the "bullet" character */
+	if (texts[0]) {
+		if (pubtext && texts[0][0] != '\x95') {
+			texts[0] = NULL;
+		} else if (texts[0][0] == '\x95') {
+			++texts[0];
+			while (texts[0][0] == ' ' || texts[0][0] == '\t')
+				++texts[0];
 		}
 	}
 
-	len = 3;
-	pos = in;
-	while (*pos) {
-		if ((*pos == '\\') || (*pos == '"') || (*pos == '[')
-		    || (*pos == '{')
-		    || (*pos == '$'))
-			len++;
-		len++;
-		pos++;
+	/* Each field on its own, so one odd byte only costs that byte */
+	buf.data = NULL;
+	buf.allocated = 0;
+	buf.used = 0;
+	for (i = 0; i < count; i++) {
+		offsets[i] = buf.used;
+		if (texts[i] && convert_FromPilotChar_Append("UTF-8", NULL,
+				texts[i], strlen(texts[i]), &buf) < 0)
+			break;
 	}
-
-	if (buffer)
-		free(buffer);
-	buffer = (char *) malloc(len);
-	out = buffer;
-
-	pos = in;
-	*out++ = '"';
-	while (*pos) {
-		if ((*pos == '\\') || (*pos == '"') || (*pos == '[')
-		    || (*pos == '{')
-		    || (*pos == '$'))
-			*out++ = '\\';
-		*out++ = *pos++;
+	if (i < count) {
+		free(buf.data);
+	} else {
+		for (i = 0; i < count; i++)
+			if (texts[i])
+				texts[i] = (char *) buf.data + offsets[i];
+		*block = (char *) buf.data;
 	}
-	*out++ = '"';
-	*out++ = '\0';
 
-	return buffer;
+	if (texts[0] == NULL)
+		texts[0] = pubtext;
 }
 
 
-int main(int argc, const char *argv[])
+/***********************************************************************
+ *
+ * Function:    export_todos
+ *
+ * Summary:     Write every live record of a ToDo database as a VTODO
+ *
+ * Parameters:  writer, source
+ *
+ * Returns:     Number of records written, or -1 on error
+ *
+ ***********************************************************************/
+static int export_todos(pi_ical_t *ical, struct source *src)
 {
-	int 	c,		/* switch */
-		db,
-		sd 		= -1,
-		i,
-		read_todos 	= -1;
-	FILE 	*ical = NULL;
-	char 	cmd[255],
-		*ptext 		= NULL,
-		*icalfile 	= NULL,
-		*pubtext 	= NULL;
+	int 	i,
+		attr,
+		category,
+		written = 0;
+	char 	*block;
+	recordid_t id;
+	struct ToDo t;
 	struct ToDoAppInfo tai;
-	pi_buffer_t *recbuf,
-	    *appblock;
+	pi_buffer_t *buf,
+		record;
+	pi_arena_t *arena;
+
+	memset(&tai, 0, sizeof(tai));
+	buf = pi_buffer_new(0xffff);
+	arena = pi_arena_new_borrowing(0);
+	if (buf == NULL || arena == NULL) {
+		pi_buffer_free(buf);
+		pi_arena_free(arena);
+		return -1;
+	}
+	if (read_appinfo(src, buf) >= 0)
+		unpack_ToDoAppInfo(&tai, buf->data, buf->used);
 
-	poptContext pc;
+	/* records of files are read into their own buffer, pointing into the
+	   file */
+	for (i = 0;; i++) {
+		pi_buffer_t *rb = src->pf ? &record : buf;
+		char 	*texts[2];
+		const char *cat;
 
-	struct poptOption options[] = {
-		USERLAND_RESERVED_OPTIONS
-		{"datebook", 'd', POPT_ARG_VAL, &read_todos, 0,
-		 "Datebook only, no ToDos", NULL},
-		{"pubtext", 't', POPT_ARG_STRING, &ptext, 0,
-		 "Replace text of items not started with a bullet with <pubtext>",
-		 "pubtext"},
-		{"file", 'f', POPT_ARG_STRING, &icalfile, 0,
-		 "Write the ical formatted data to <file> (overwrites existing <file>)",
-		 "file"},
-		POPT_TABLEEND
-	};
+		if (read_record(src, i, rb, &id, &attr, &category) < 0)
+			break;
 
-	pc = poptGetContext("read-ical", argc, argv, options, 0);
-	poptSetOtherOptionHelp(pc,"\n\n"
-		"   Dumps the DatebookDB and/or ToDo applications to ical format.\n"
-		"   Requires the program 'ical'.\n\n");
+		/* Skip deleted records */
+		if ((attr & dlpRecAttrDeleted)
+		    || (attr & dlpRecAttrArchived))
+			continue;
 
-	if (argc < 2) {
-		poptPrintUsage(pc,stderr,0);
-		return 1;
-	}
+		pi_arena_reset(arena);
+		if (unpack_ToDo_arena(&t, rb, todo_v1, arena) < 0)
+			continue;
 
-	while ((c = poptGetNextOpt(pc)) >= 0) {
-		fprintf(stderr,"   ERROR: Unhandled option %d.\n",c);
-		return 1;
-	}
+		texts[0] = t.description;
+		texts[1] = t.note;
+		to_host(texts, 2, &block);
+		t.description = texts[0];
+		t.note = texts[1];
 
-	if (c < -1) {
-		plu_badoption(pc,c);
-		return 1;
+		cat = category > 0 && category < 16
+			&& tai.category.name[category][0]
+			? tai.category.name[category] : NULL;
+
+		if (pi_ical_write_todo(ical, id, attr, cat, &t) < 0) {
+			free(block);
+			written = -1;
+			break;
+		}
+		free(block);
+		written++;
 	}
 
+	pi_buffer_free(buf);
+	pi_arena_free(arena);
+	return written;
+}
 
-	if (icalfile == NULL) {
-		fprintf(stderr, "   ERROR: ical filename not specified. Please use the -f option.\n");
-		return 1;
-	}
 
-        sd = plu_connect();
-        if (sd < 0)
-                goto error;
-
-	unlink(icalfile);
-	sprintf(cmd, "ical -list -f - -calendar %s", icalfile);
-	ical = popen(cmd, "w");
-	if (ical == NULL) {
-		int e = errno;
-		fprintf(stderr,"   ERROR: cannot start communication with ical.\n"
-			"          %s\n",strerror(e));
-		return 1;
+/***********************************************************************
+ *
+ * Function:    export_appointments
+ *
+ * Summary:     Write every live record of a Datebook or Calendar
+ *		database as a VEVENT
+ *
+ * Parameters:  writer, source, non-zero for a CalendarDB-PDat database
+ *
+ * Returns:     Number of records written, or -1 on error
+ *
+ ***********************************************************************/
+static int export_appointments(pi_ical_t *ical, struct source *src,
+	int calendar)
+{
+	int 	i,
+		attr,
+		result,
+		written = 0;
+	char 	*block;
+	recordid_t id;
+	pi_buffer_t *buf,
+		record;
+	pi_arena_t *arena;
+
+	buf = src->pf ? NULL : pi_buffer_new(0xffff);
+	arena = pi_arena_new_borrowing(0);
+	if ((src->pf == NULL && buf == NULL) || arena == NULL) {
+		pi_buffer_free(buf);
+		pi_arena_free(arena);
+		return -1;
 	}
-	fprintf(ical, "calendar cal $ical(calendar)\n");
 
-        if (dlp_OpenConduit(sd) < 0)
-                goto error_close;
+	for (i = 0;; i++) {
+		pi_buffer_t *rb = src->pf ? &record : buf;
+		char 	*texts[3];
 
+		if (read_record(src, i, rb, &id, &attr, NULL) < 0)
+			break;
 
-	if (read_todos) {
-		/* Open the ToDo database, store access handle in db */
-		if (dlp_OpenDB
-		    (sd, 0, 0x80 | 0x40, "ToDoDB", &db) < 0) {
-			fprintf(stderr,"   ERROR: Unable to open ToDoDB on Palm.\n");
-			dlp_AddSyncLogEntry(sd, "Unable to open ToDoDB.\n");
-			goto error_close;
+		/* Skip deleted records */
+		if ((attr & dlpRecAttrDeleted)
+		    || (attr & dlpRecAttrArchived))
+			continue;
+
+		pi_arena_reset(arena);
+		if (calendar) {
+			CalendarEvent_t e;
+
+			if (unpack_CalendarEvent_arena(&e, rb, calendar_v1,
+					arena) < 0)
+				continue;
+			texts[0] = e.description;
+			texts[1] = e.note;
+			texts[2] = e.location;
+			to_host(texts, 3, &block);
+			e.description = texts[0];
+			e.note = texts[1];
+			e.location = texts[2];
+			result = pi_ical_write_calendar_event(ical, id, attr,
+				&e);
+		} else {
+			struct Appointment a;
+
+			if (unpack_Appointment_arena(&a, rb, datebook_v1,
+					arena) < 0)
+				continue;
+			texts[0] = a.description;
+			texts[1] = a.note;
+			to_host(texts, 2, &block);
+			a.description = texts[0];
+			a.note = texts[1];
+			result = pi_ical_write_appointment(ical, id, attr, &a);
 		}
+		free(block);
 
-		appblock = pi_buffer_new(0xffff);
-		dlp_ReadAppBlock(sd, db, 0, 0xffff, appblock);
-		unpack_ToDoAppInfo(&tai, appblock->data, appblock->used);
-		pi_buffer_free(appblock);
+		if (result < 0) {
+			written = -1;
+			break;
+		}
+		written++;
+	}
 
-		recbuf = pi_buffer_new (0xffff);
+	if (buf)
+		pi_buffer_free(buf);
+	pi_arena_free(arena);
+	return written;
+}
 
-		for (i = 0;; i++) {
-			int 	attr,
-				category;
-			char 	id_buf[255];
-			struct 	ToDo t;
-			recordid_t id_;
 
-			int len = dlp_ReadRecordByIndex(sd, db, i, recbuf, &id_, &attr, &category);
+/***********************************************************************
+ *
+ * Function:    export_file
+ *
+ * Summary:     Write the records of a local ToDoDB, DatebookDB or
+ *		CalendarDB-PDat file
+ *
+ * Parameters:  writer, file name
+ *
+ * Returns:     Number of records written, or -1 on error
+ *
+ ***********************************************************************/
+static int export_file(pi_ical_t *ical, const char *name)
+{
+	struct source src;
+	struct DBInfo info;
+	int 	n;
+
+	memset(&src, 0, sizeof(src));
+	if ((src.pf = pi_file_open_mapped(name)) == NULL) {
+		fprintf(stderr, "   ERROR: Can't open '%s'\n", name);
+		return -1;
+	}
+	pi_file_get_info(src.pf, &info);
+
+	if (info.creator == pi_mktag('t','o','d','o')) {
+		n = export_todos(ical, &src);
+	} else if (info.creator == pi_mktag('d','a','t','e')) {
+		n = export_appointments(ical, &src, 0);
+	} else if (info.creator == pi_mktag('P','D','a','t')) {
+		n = export_appointments(ical, &src, 1);
+	} else {
+		fprintf(stderr, "   ERROR: '%s' is not a ToDo, Datebook or "
+			"Calendar database\n", name);
+		n = -1;
+	}
 
-			if (len < 0)
-				break;
+	pi_file_close(src.pf);
+	return n;
+}
 
-			/* Skip deleted records */
-			if ((attr & dlpRecAttrDeleted)
-			    || (attr & dlpRecAttrArchived))
-				continue;
 
-			unpack_ToDo(&t, recbuf, todo_v1);
+/***********************************************************************
+ *
+ * Function:    export_palm
+ *
+ * Summary:     Write the ToDo and Datebook databases of the Palm
+ *
+ * Parameters:  writer, non-zero to write the todos too
+ *
+ * Returns:     0 on success, -1 on error
+ *
+ ***********************************************************************/
+static int export_palm(pi_ical_t *ical, int read_todos)
+{
+	struct source src;
+	int 	n;
 
-			fprintf(ical, "set n [notice]\n");
+	memset(&src, 0, sizeof(src));
+	src.sd = plu_connect();
+	if (src.sd < 0)
+		return -1;
 
-			/* '\x95' is the "bullet" chcter */
-			fprintf(ical, "$n text %s\n", tclquote((pubtext && t.description[0] != '\x95') ? pubtext : t.description));
-			fprintf(ical, "$n date [date today]\n");
-			fprintf(ical, "$n todo 1\n");
-			fprintf(ical, "$n option Priority %d\n", t.priority);
-			sprintf(id_buf, "%lx", id_);
-			fprintf(ical, "$n option PilotRecordId %s\n", id_buf);
-			fprintf(ical, "$n done %d\n", t.complete ? 1 : 0);
-			fprintf(ical, "cal add $n\n");
+	if (dlp_OpenConduit(src.sd) < 0)
+		goto error_close;
 
-			free_ToDo(&t);
+	if (read_todos) {
+		/* Open the ToDo database, store access handle in db */
+		if (dlp_OpenDB(src.sd, 0, 0x80 | 0x40, "ToDoDB",
+				&src.db) < 0) {
+			fprintf(stderr,"   ERROR: Unable to open ToDoDB on Palm.\n");
+			dlp_AddSyncLogEntry(src.sd, "Unable to open ToDoDB.\n");
+			goto error_close;
 		}
-		pi_buffer_free(recbuf);
+
+		n = export_todos(ical, &src);
 
 		/* Close the database */
-		dlp_CloseDB(sd, db);
+		dlp_CloseDB(src.sd, src.db);
+		if (n < 0)
+			goto error_close;
 
-		dlp_AddSyncLogEntry(sd, "Successfully read todos from Palm.\nThank you for using pilot-link.\n");
+		dlp_AddSyncLogEntry(src.sd, "Successfully read todos from Palm.\nThank you for using pilot-link.\n");
 	}
 
 	/* Open the Datebook's database, store access handle in db */
-	if (dlp_OpenDB
-	    (sd, 0, 0x80 | 0x40, "DatebookDB", &db) < 0) {
+	if (dlp_OpenDB(src.sd, 0, 0x80 | 0x40, "DatebookDB", &src.db) < 0) {
 		fprintf(stderr,"   ERROR: Unable to open DatebookDB on Palm.\n");
-		dlp_AddSyncLogEntry(sd, "Unable to open DatebookDB.\n");
+		dlp_AddSyncLogEntry(src.sd, "Unable to open DatebookDB.\n");
 		goto error_close;
 	}
 
-	recbuf = pi_buffer_new (0xffff);
+	n = export_appointments(ical, &src, 0);
 
-	for (i = 0;; i++) {
-		int 	j,
-			attr;
-		char 	id_buf[255];
-		struct 	Appointment a;
-		recordid_t id_;
+	/* Close the database */
+	dlp_CloseDB(src.sd, src.db);
+	if (n < 0)
+		goto error_close;
 
-		int len =
-		    dlp_ReadRecordByIndex(sd, db, i, recbuf, &id_, &attr, 0);
+	dlp_AddSyncLogEntry(src.sd, "read-ical successfully read Datebook from Palm.\n"
+				"Thank you for using pilot-link.\n");
+	dlp_EndOfSync(src.sd, 0);
+	pi_close(src.sd);
+	return 0;
 
-		if (len < 0)
-			break;
+error_close:
+	pi_close(src.sd);
+	return -1;
+}
 
-		/* Skip deleted records */
-		if ((attr & dlpRecAttrDeleted)
-		    || (attr & dlpRecAttrArchived))
-			continue;
 
-		unpack_Appointment(&a, recbuf, datebook_v1);
+int main(int argc, const char *argv[])
+{
+	int 	c,		/* switch */
+		read_todos 	= -1,
+		failed 		= 0;
+	FILE 	*out;
+	char 	*icalfile 	= NULL;
+	const char **files;
+	pi_ical_t ical;
 
-		if (a.event) {
-			fprintf(ical, "set i [notice]\n");
+	poptContext pc;
 
-		} else {
-			int 	start,
-				end;
+	struct poptOption options[] = {
+		USERLAND_RESERVED_OPTIONS
+		{"datebook", 'd', POPT_ARG_VAL, &read_todos, 0,
+		 "Datebook only, no ToDos", NULL},
+		{"pubtext", 't', POPT_ARG_STRING, &pubtext, 0,
+		 "Replace text of items not started with a bullet with <pubtext>",
+		 "pubtext"},
+		{"file", 'f', POPT_ARG_STRING, &icalfile, 0,
+		 "Write the iCalendar data to <file> (overwrites existing <file>) instead of stdout",
+		 "file"},
+		POPT_TABLEEND
+	};
 
-			fprintf(ical, "set i [appointment]\n");
+	pc = poptGetContext("read-ical", argc, argv, options, 0);
+	poptSetOtherOptionHelp(pc," [file.pdb ...]\n\n"
+		"   Dumps the DatebookDB and/or ToDo applications to iCalendar format.\n"
+		"   Reads the given ToDoDB, DatebookDB or CalendarDB-PDat files\n"
+		"   instead of the Palm, if any.\n\n");
 
-			start =
-			    a.begin.tm_hour * 60 +
-			    a.begin.tm_min;
-			end =
-			    a.end.tm_hour * 60 +
-			    a.end.tm_min;
+	while ((c = poptGetNextOpt(pc)) >= 0) {
+		fprintf(stderr,"   ERROR: Unhandled option %d.\n",c);
+		return 1;
+	}
 
-			fprintf(ical, "$i starttime %d\n", start);
-			fprintf(ical, "$i length %d\n", end - start);
-		}
+	if (c < -1) {
+		plu_badoption(pc,c);
+		return 1;
+	}
 
-		/* Don't hilight private (secret) records */
-		if (attr & dlpRecAttrSecret) {
-			fprintf(ical, "$i hilite never\n");
-		}
+	files = poptGetArgs(pc);
 
-		/* Handle alarms */
-		if (a.alarm) {
-			if (a.event) {
-				if (a.advanceUnits == 2) {
-					fprintf(ical, "$i earlywarning %d\n", a.advance);
-				} else {
-					printf("Minute or hour alarm on untimed event ignored: %s\n", a.description);
-				}
-			} else {
-				switch (a.advanceUnits) {
-				  case 0:
-					  fprintf(ical, "$i alarms { %d }\n", a.advance);
-					  break;
-				  case 1:
-					  fprintf(ical, "$i alarms { %d }\n", a.advance * 60);
-					  break;
-				  case 2:
-					  fprintf(ical, "$i earlywarning %d\n", a.advance);
-					  break;
-				}
-			}
+	if (icalfile && strcmp(icalfile, "-") != 0) {
+		out = fopen(icalfile, "w");
+		if (out == NULL) {
+			int e = errno;
+			fprintf(stderr,"   ERROR: cannot create %s.\n"
+				"          %s\n", icalfile, strerror(e));
+			return 1;
 		}
-
-		/* '\x95' is the "bullet" chcter */
-		fprintf(ical, "$i text %s\n",
-			tclquote((pubtext
-				  && a.description[0] !=
-				  '\x95') ? pubtext : a.
-				 description));
-
-		fprintf(ical,
-			"set begin [date make %d %d %d]\n",
-			a.begin.tm_mday,
-			a.begin.tm_mon + 1,
-			a.begin.tm_year + 1900);
-
-		if (a.repeatFrequency) {
-			if (a.repeatType == repeatDaily) {
-				fprintf(ical,
-					"$i dayrepeat %d $begin\n", a.repeatFrequency);
-			} else if (a.repeatType == repeatMonthlyByDate) {
-				fprintf(ical, "$i month_day %d $begin %d\n", a.begin.tm_mon + 1, a.repeatFrequency);
-			} else if (a.repeatType == repeatMonthlyByDay) {
-				if (a.repeatDay >= domLastSun) {
-					fprintf(ical, "$i month_last_week_day %d 1 $begin %d\n", a.repeatDay % 7 + 1, a.repeatFrequency);
-				} else {
-					fprintf(ical, "$i month_week_day %d %d $begin %d\n", a.repeatDay % 7 + 1, a.repeatDay / 7 + 1, a.repeatFrequency);
-				}
-			} else if (a.repeatType == repeatWeekly) {
-				/*
-				 * Handle the case where the user said weekly repeat, but
-				 * really meant daily repeat every n*7 days.  Note: We can't
-				 * do days of the week and a repeat-frequency > 1, so do the
-				 * best we can and go on.
-				 */
-				if (a.repeatFrequency > 1) {
-					int ii, found;
-
-					for (ii = 0, found = 0; ii < 7; ii++) {
-						if (a.repeatDays [ii])
-							found++;
-					}
-					if (found > 1) {
-						fprintf(stderr,"   WARNING: Incomplete translation of %s\n", a.description);
-					}
-					fprintf(ical, "$i dayrepeat %d $begin\n", a.repeatFrequency * 7);
-				} else {
-					int ii;
-
-					fprintf(ical, "$i weekdays ");
-					for (ii = 0; ii < 7; ii++)
-						if (a.repeatDays [ii])
-							fprintf(ical, "%d ", ii + 1);
-					fprintf(ical, "\n");
-				}
-			} else if (a.repeatType == repeatYearly) {
-				fprintf(ical, "$i monthrepeat %d $begin\n", 12 * a.repeatFrequency);
-			}
-			fprintf(ical, "$i start $begin\n");
-			if (!a.repeatForever)
-				fprintf(ical,
-					"$i finish [date make %d %d %d]\n",
-					a.repeatEnd.tm_mday, a.repeatEnd.tm_mon + 1, a.repeatEnd.tm_year + 1900);
-			if (a.exceptions)
-				for (j = 0; j < a.exceptions; j++)
-					fprintf(ical, "$i deletion [date make %d %d %d]\n", a.exception[j].tm_mday, a.exception[j].tm_mon + 1, a.exception[j].tm_year + 1900);
-		} else
-			fprintf(ical, "$i date $begin\n");
-
-		sprintf(id_buf, "%lx", id_);
-		fprintf(ical, "$i option PilotRecordId %s\n", id_buf);
-		fprintf(ical, "cal add $i\n");
-
-		free_Appointment(&a);
-
+	} else {
+		out = stdout;
 	}
 
-	pi_buffer_free (recbuf);
-
-	fprintf(ical, "cal save [cal main]\n");
-	fprintf(ical, "exit\n");
-
-	pclose(ical);
-
-	/* Close the database */
-	dlp_CloseDB(sd, db);
+	pi_ical_begin(&ical, out, PRODID);
 
-	dlp_AddSyncLogEntry(sd, "read-ical successfully read Datebook from Palm.\n"
-				"Thank you for using pilot-link.\n");
-	dlp_EndOfSync(sd, 0);
-	pi_close(sd);
-	return 0;
+	if (files) {
+		for (; *files; files++)
+			if (export_file(&ical, *files) < 0)
+				failed = 1;
+	} else if (export_palm(&ical, read_todos) < 0) {
+		failed = 1;
+	}
 
-error_close:
-	if (ical) {
-		/* explicitly do NOT save on failure. since we've already unlinked
-		   the original ical file, we've still destroyed something. */
-		fprintf(ical, "exit\n");
-		pclose(ical);
+	if (pi_ical_end(&ical) < 0) {
+		fprintf(stderr, "   ERROR: writing the calendar failed.\n");
+		failed = 1;
 	}
-        pi_close(sd);
+	if (out != stdout)
+		fclose(out);
 
-error:
-        return -1;
+	return failed ? 1 : 0;
 }
 
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
@@ -32,6 +32,9 @@
 #include <unistd.h>
 #include <time.h>
 #include <utime.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "pi-file.h"
 #include "pi-socket.h"
@@ -48,6 +51,33 @@
 
 const char *progname;
 
+/* One picture of a batch conversion */
+struct picture {
+	struct PalmPixHeader header;
+	int	recno;
+	char	*fname;
+};
+
+/* A batch conversion: all records of the database in memory, and the
+   pictures found in them */
+struct batch {
+	void	**records;
+	size_t	*sizes;
+	int	num_records;
+	int	copied;			/* records were copied, free them */
+
+	struct picture *pictures;
+	int	num_pictures;
+	int	next;			/* next picture for a worker to take */
+
+	int	output_type,
+		bias,
+		flags;
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
 /***********************************************************************
  *
  * Function:    PalmPixState_pi_file
@@ -105,6 +135,7 @@ struct PalmPixState_pi_socket
 	struct PalmPixState state;
 	int 	sd,
 		db;
+	pi_buffer_t *buf;
 };
 
 
@@ -123,19 +154,17 @@ static int getrecord_pi_socket (struct PalmPixState *vstate, int recno,
 	void **buf, size_t *bufsize)
 {
 
-	static char buffer[65536];
-    static pi_buffer_t fakebuf;
-
 	struct PalmPixState_pi_socket *state =
 		(struct PalmPixState_pi_socket *) vstate;
 
-	*buf = buffer;
-    fakebuf.data = buffer;
-    fakebuf.allocated = 0;
-    fakebuf.used = 0;
+	if (dlp_ReadRecordByIndex (state->sd, state->db, recno, state->buf,
+		NULL, NULL, NULL) < 0)
+		return 1;
+
+	*buf = state->buf->data;
+	*bufsize = state->buf->used;
 
-	return dlp_ReadRecordByIndex (state->sd, state->db, recno, &fakebuf,
-		NULL, NULL, NULL) < 0 ? 1 : 0;
+	return 0;
 }
 
 
@@ -143,17 +172,15 @@ static int getrecord_pi_socket (struct PalmPixState *vstate, int recno,
  *
  * Function:    fmt_date
  *
- * Summary:
+ * Summary:     Format the date a picture was taken
  *
- * Parameters:  None
+ * Parameters:  picture header, buffer of at least 24 bytes
  *
- * Returns:     Nothing
+ * Returns:     the buffer
  *
  ***********************************************************************/
-static const char *fmt_date (const struct PalmPixHeader *h)
+static const char *fmt_date (const struct PalmPixHeader *h, char *buf)
 {
-	static char buf[24];
-
 	sprintf (buf, "%d-%02d-%02d %02d:%02d:%02d", h->year, h->month,
 		h->day, h->hour, h->min, h->sec);
 
@@ -194,8 +221,10 @@ void init_for_ppm (struct PalmPixState *state)
 void write_ppm (FILE *f, const struct PalmPixState *state,
 	const struct PalmPixHeader *header)
 {
+	char date[24];
+
 	fprintf (f, "P6\n# %s (taken at %s)\n%d %d\n255\n",
-		state->pixname, fmt_date (header), header->w, header->h);
+		state->pixname, fmt_date (header, date), header->w, header->h);
 
 	fwrite (state->pixmap, header->w * header->h * 3, 1, f);
 }
@@ -303,42 +332,20 @@ static int write_one (const struct PalmPixHeader *header,
 
 /***********************************************************************
  *
- * Function:    write_all
+ * Function:    write_file
  *
- * Summary:
+ * Summary:     Write a decoded picture to a file dated like the photo
  *
- * Parameters:  None
+ * Parameters:  file name, state holding the pixmap, picture header
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
-static int write_all (const struct PalmPixHeader *header,
-	struct PalmPixState *state, int recno, const char *ignored)
+static void write_file (const char *fname, const struct PalmPixState *state,
+	const struct PalmPixHeader *header)
 {
-	char fname[FILENAME_MAX], ext[10];
 	FILE *f;
 
-	init_for_ppm (state);
-	if (!unpack_PalmPix (state, header, recno, pixName | pixPixmap)) {
-		/* bail */
-		return recno;
-	}
-
-
-	sprintf( fname, "%s", state->pixname );
-
-	if( state->output_type == PALMPIX_OUT_PPM )
-		sprintf( ext, "_pp.ppm" );
-
-	else if( state->output_type == PALMPIX_OUT_PNG )
-		sprintf( ext, "_pp.png" );
-
-	if (plu_protect_files( fname, ext, sizeof(fname) ) < 1) {
-		return recno;
-	}
-
-	printf ("Generating %s...\n", fname);
-
 	f = fopen (fname, "wb");
 	if (f) {
                 struct  utimbuf timep   ;
@@ -356,12 +363,14 @@ static int write_all (const struct PalmPixHeader *header,
 			fclose (f);
 
                         /* Keep file date the same date as the photo */
+                        memset(&timeptr, 0, sizeof(timeptr));
                         timeptr.tm_year = header->year - 1900;
                         timeptr.tm_mon  = header->month -1;
                         timeptr.tm_mday = header->day;
                         timeptr.tm_hour = header->hour;
                         timeptr.tm_min  = header->min;
                         timeptr.tm_sec  = header->sec;
+                        timeptr.tm_isdst = -1;
                         timep.actime    = timep.modtime = mktime(&timeptr);
 
                         utime (fname,&timep);
@@ -369,11 +378,237 @@ static int write_all (const struct PalmPixHeader *header,
 		fprintf (stderr, "%s: can't write to %s\n",
 			progname, fname);
 	}
+}
 
-		free_PalmPix_data (state);
-		recno = state->highest_recno;
 
-	return recno;
+/***********************************************************************
+ *
+ * Function:    getrecord_batch
+ *
+ * Summary:     Return a record of a batch conversion from memory
+ *
+ * Parameters:  None
+ *
+ * Returns:     0 on success, -1 if there is no such record
+ *
+ ***********************************************************************/
+struct PalmPixState_batch
+{
+	struct PalmPixState state;
+	const struct batch *batch;
+};
+
+static int getrecord_batch (struct PalmPixState *vstate, int recno,
+	void **buf, size_t *bufsize)
+{
+	const struct batch *batch =
+		((struct PalmPixState_batch *) vstate)->batch;
+
+	if (recno < 0 || recno >= batch->num_records
+		|| batch->records[recno] == NULL)
+		return -1;
+
+	*buf = batch->records[recno];
+	*bufsize = batch->sizes[recno];
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    batch_worker
+ *
+ * Summary:     Take pictures of a batch one at a time, decode them and
+ *		write them to their files, until none are left. Each
+ *		worker has its own PalmPixState.
+ *
+ * Parameters:  the batch
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *batch_worker (void *arg)
+{
+	struct batch *batch = arg;
+	struct PalmPixState_batch s;
+
+	memset (&s, 0, sizeof (s));
+	s.state.getrecord = getrecord_batch;
+	s.state.output_type = batch->output_type;
+	s.state.bias = batch->bias;
+	s.state.flags = batch->flags;
+	s.batch = batch;
+	init_for_ppm (&s.state);
+
+	for (;;) {
+		struct picture *pic;
+
+#if HAVE_PTHREAD
+		pthread_mutex_lock (&batch->lock);
+#endif
+		pic = batch->next < batch->num_pictures
+			? &batch->pictures[batch->next++] : NULL;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock (&batch->lock);
+#endif
+		if (pic == NULL)
+			break;
+
+		if (!unpack_PalmPix (&s.state, &pic->header, pic->recno,
+			pixName | pixPixmap)) {
+			fprintf (stderr, "%s: can't decode %s\n",
+				progname, pic->fname);
+			continue;
+		}
+		write_file (pic->fname, &s.state, &pic->header);
+		free_PalmPix_data (&s.state);
+	}
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_all
+ *
+ * Summary:     Convert all pictures of a database. The records are read
+ *		in first, then the pictures are named, and then decoded
+ *		and written by a pool of worker threads.
+ *
+ * Parameters:  state reading the database, number of records, number
+ *		of threads (0 for one per CPU), whether the records
+ *		returned by the state must be copied
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void write_all (struct PalmPixState *state, int n, int jobs,
+	int copy)
+{
+	int 	i;
+	struct batch batch;
+	struct PalmPixState_batch s;
+#if HAVE_PTHREAD
+	pthread_t *threads;
+#endif
+
+	memset (&batch, 0, sizeof (batch));
+	batch.output_type = state->output_type;
+	batch.bias = state->bias;
+	batch.flags = state->flags;
+	batch.copied = copy;
+	batch.records = calloc (n > 0 ? n : 1, sizeof (void *));
+	batch.sizes = calloc (n > 0 ? n : 1, sizeof (size_t));
+	batch.pictures = calloc (n > 0 ? n : 1, sizeof (struct picture));
+	if (batch.records == NULL || batch.sizes == NULL
+		|| batch.pictures == NULL) {
+		fprintf (stderr, "%s: out of memory\n", progname);
+		goto done;
+	}
+
+	/* Read every record, from the device or the file */
+	for (i = 0; i < n; i++) {
+		void *buffer;
+		size_t bufsize;
+
+		if (state->getrecord (state, i, &buffer, &bufsize) != 0)
+			continue;
+		if (copy) {
+			batch.records[i] = malloc (bufsize ? bufsize : 1);
+			if (batch.records[i] == NULL) {
+				fprintf (stderr, "%s: out of memory\n",
+					progname);
+				goto done;
+			}
+			memcpy (batch.records[i], buffer, bufsize);
+		} else {
+			batch.records[i] = buffer;
+		}
+		batch.sizes[i] = bufsize;
+	}
+	batch.num_records = n;
+
+	/* Find the pictures and name their files. An empty file is
+	   created for each, so that pictures with the same name get
+	   different files. */
+	memset (&s, 0, sizeof (s));
+	s.state.getrecord = getrecord_batch;
+	s.batch = &batch;
+	for (i = 0; i < n; i++) {
+		struct picture *pic = &batch.pictures[batch.num_pictures];
+		char fname[FILENAME_MAX], ext[10];
+		FILE *f;
+
+		if (batch.records[i] == NULL
+			|| unpack_PalmPixHeader (&pic->header, batch.records[i],
+				batch.sizes[i]) == 0
+			|| unpack_PalmPix (&s.state, &pic->header, i,
+				pixName) == 0)
+			continue;
+		pic->recno = i;
+		i = s.state.highest_recno;
+
+		sprintf( fname, "%s", s.state.pixname );
+
+		if( state->output_type == PALMPIX_OUT_PNG )
+			sprintf( ext, "_pp.png" );
+		else
+			sprintf( ext, "_pp.ppm" );
+
+		if (plu_protect_files( fname, ext, sizeof(fname) ) < 1)
+			continue;
+
+		f = fopen (fname, "wb");
+		if (f == NULL) {
+			fprintf (stderr, "%s: can't write to %s\n",
+				progname, fname);
+			continue;
+		}
+		fclose (f);
+
+		printf ("Generating %s...\n", fname);
+		pic->fname = strdup (fname);
+		if (pic->fname != NULL)
+			batch.num_pictures++;
+	}
+	fflush (stdout);
+
+#if HAVE_PTHREAD
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > batch.num_pictures)
+		jobs = batch.num_pictures;
+
+	pthread_mutex_init(&batch.lock, NULL);
+	threads = calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, batch_worker, &batch))
+			break;
+	}
+	jobs = i;
+
+	/* if no thread could be started, do the work ourselves */
+	if (jobs == 0)
+		batch_worker(&batch);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&batch.lock);
+#else
+	batch_worker(&batch);
+#endif
+
+done:
+	for (i = 0; i < batch.num_pictures; i++)
+		free (batch.pictures[i].fname);
+	if (batch.copied && batch.records != NULL)
+		for (i = 0; i < n; i++)
+			free (batch.records[i]);
+	free (batch.pictures);
+	free (batch.records);
+	free (batch.sizes);
 }
 
 
@@ -391,10 +626,12 @@ static int write_all (const struct PalmPixHeader *header,
 static int list (const struct PalmPixHeader *h, struct PalmPixState *state,
 	int recno, const char *ignored)
 {
+	char date[24];
+
 	if (unpack_PalmPix (state, h, recno, pixName) != 0) {
 
 		printf ("%d x %d\t%d\t%s\t%s\n",
-			h->w, h->h, h->num, fmt_date (h), state->pixname);
+			h->w, h->h, h->num, fmt_date (h, date), state->pixname);
 		recno = state->highest_recno;
 	}
 	return recno;
@@ -443,10 +680,13 @@ int main (int argc, const char **argv) {
 	sd	= -1,
 	output_type = PALMPIX_OUT_PPM,
 	bias = 50,
-	flags = 0;
+	flags = 0,
+	jobs = 0;
 
+	/* Converting all pictures is done in a batch, other actions go
+	   through the records one at a time */
 	int (*action) (const struct PalmPixHeader *, struct PalmPixState *,
-		int, const char *) = write_all;
+		int, const char *) = NULL;
 
 	const 	char *pixname 	= NULL;
 	const char
@@ -464,6 +704,7 @@ int main (int argc, const char **argv) {
 		{"bias", 'b', POPT_ARG_INT,    &bias,      0 , "lighten or darken the image (0..49 darken, 51..100 lighten)", "bias"},
 		{"list", 'l', POPT_ARG_NONE,   NULL,      'l', "List picture information instead of converting", NULL},
 		{"name", 'n', POPT_ARG_STRING, &pixname,  'n', "Convert only <name>, and output to STDOUT as type", "name"},
+		{"jobs", 'j', POPT_ARG_INT,    &jobs,      0 , "Number of pictures converted in parallel (default: one per CPU)", "jobs"},
 		POPT_TABLEEND
 	};
 
@@ -484,6 +725,7 @@ int main (int argc, const char **argv) {
 			   special treatment. */
 		case 'l':
 			action = list;
+			break;
         	case 'n':
 	        	action = write_one;
         		break;
@@ -519,7 +761,7 @@ int main (int argc, const char **argv) {
 		int i = 0;
 
 		while((file_arg = poptGetArg(pc)) != NULL) {
-			struct pi_file *f = pi_file_open (file_arg);
+			struct pi_file *f = pi_file_open_mapped (file_arg);
 			i++;
 			if (f) {
 
@@ -529,17 +771,25 @@ int main (int argc, const char **argv) {
 					printf ("%s:\n", file_arg);
 
 				pi_file_get_info (f, &info);
-                if (info.flags & dlpDBFlagResource) {
+                if (!(info.flags & dlpDBFlagResource)) {
 
 				struct PalmPixState_pi_file s;
 				int n = 0;
 
+				memset (&s, 0, sizeof (s));
 				s.state.output_type = output_type;
+				s.state.bias = bias;
+				s.state.flags = flags;
 
 				pi_file_get_entries (f, &n);
 				s.state.getrecord = getrecord_pi_file;
 				s.f = f;
-				read_db (&s.state, n, action, pixname);
+				/* The records of a mapped file stay valid
+				   until it is closed */
+				if (action == NULL)
+					write_all (&s.state, n, jobs, 0);
+				else
+					read_db (&s.state, n, action, pixname);
 				} else {
 				fprintf (stderr,
 					"   ERROR: %s is not a valid record database\n",
@@ -569,6 +819,7 @@ int main (int argc, const char **argv) {
 			struct PalmPixState_pi_socket s;
 			int n = 0;
 
+			memset (&s, 0, sizeof (s));
 			s.state.output_type = output_type;
 		    s.state.bias = bias;
 		    s.state.flags = flags;
@@ -577,7 +828,12 @@ int main (int argc, const char **argv) {
 			s.state.getrecord = getrecord_pi_socket;
 			s.sd = sd;
 			s.db = db;
-			read_db (&s.state, n, action, pixname);
+			s.buf = pi_buffer_new (0xffff);
+			if (action == NULL)
+				write_all (&s.state, n, jobs, 1);
+			else
+				read_db (&s.state, n, action, pixname);
+			pi_buffer_free (s.buf);
 			dlp_CloseDB (sd, db);
 
 			dlp_AddSyncLogEntry (sd,
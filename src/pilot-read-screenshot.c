@@ -29,13 +29,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#ifdef HAVE_STDINT_H
-#include <stdint.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
 #endif
 
 #include "pi-source.h"
 #include "pi-file.h"
 #include "pi-header.h"
+#include "pi-screenshot.h"
 #include "pi-userland.h"
 
 #ifdef HAVE_PNG
@@ -56,31 +57,57 @@ struct ss_state {
 	unsigned char *pix_map;
 };
 
+/* One screenshot of a batch */
+struct shot {
+	struct ScreenShotHeader header;
+	int	recno;
+	char	*fname;
+};
 
+/* A batch conversion: all records of the database in memory, and the
+   screenshots found in them */
+struct batch {
+	void	**records;
+	size_t	*sizes;
+	int	num_records;
+	int	copied;			/* records were copied, free them */
+
+	struct shot *shots;
+	int	num_shots;
+	int	next;			/* next screenshot for a worker to take */
+
+	int	type;
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
 
-#define max(a,b) (( a > b ) ? a : b )
-#define min(a,b) (( a < b ) ? a : b )
 
 /***********************************************************************
  *
  * Function:	 write_png
  *
- * Summary:
+ * Summary:	Write a screenshot as a PNG image, grey if it has fewer
+ *		than 8 bits per pixel
  *
- * Parameters:  None
+ * Parameters:  file name, screenshot
  *
  * Returns:	  Nothing
  *
  ***********************************************************************/
 #ifdef HAVE_PNG
-void write_png ( char *fname, struct ss_state *state )
+void write_png ( const char *fname, struct ss_state *state )
 {
-	unsigned char *gray_buf;
+	unsigned char *gray_buf = NULL;
 	int i, j;
 	png_structp png_ptr;
 	png_infop info_ptr;
 	FILE *f;
 
+	f = fopen (fname, "wb");
+	if (f == NULL)
+		return;
+
 	if( state->depth < 8 )
 		gray_buf = malloc( state->w );
 
@@ -89,24 +116,21 @@ void write_png ( char *fname, struct ss_state *state )
 		png_error_ptr_NULL, png_error_ptr_NULL);
 
 	if (!png_ptr)
-		return;
+		goto done;
 
 	info_ptr = png_create_info_struct (png_ptr);
 	if (!info_ptr)
 	{
 		png_destroy_write_struct (&png_ptr, (png_infopp) NULL);
-		return;
+		goto done;
 	}
 
 	if (setjmp (png_jmpbuf (png_ptr)))
 	{
 		png_destroy_write_struct (&png_ptr, &info_ptr);
-		fclose (f);
-		return;
+		goto done;
 	}
 
-	f = fopen (fname, "wb");
-
 	png_init_io (png_ptr, f);
 
 	if( state->depth < 8 )
@@ -121,7 +145,7 @@ void write_png ( char *fname, struct ss_state *state )
 
 	png_write_info (png_ptr, info_ptr);
 
-	if( state->depth < 8 )
+	if( state->depth < 8 && gray_buf != NULL )
 	{
 		for (i = 0; i < state->h; i++)
 		{
@@ -129,34 +153,41 @@ void write_png ( char *fname, struct ss_state *state )
 				gray_buf[j] = state->pix_map[i*3*state->w+j*3];
 
 			png_write_row (png_ptr, gray_buf );
-			png_write_flush (png_ptr);
 		}
 	}
 	else
 	{
 		for (i = 0; i < state->h; i++)
-		{
 			png_write_row (png_ptr, &state->pix_map[i*3*state->w] );
-			png_write_flush (png_ptr);
-		}
 	}
 
 	png_write_end (png_ptr, info_ptr);
 	png_destroy_write_struct (&png_ptr, &info_ptr);
 
+done:
 	fclose( f );
-
-	if( state->depth < 8 )
-		free( gray_buf );
+	free( gray_buf );
 }
 #endif
 
-void write_ppm ( char *fname, struct ss_state *state)
+/***********************************************************************
+ *
+ * Function:	 write_ppm
+ *
+ * Summary:	Write a screenshot as a PPM image
+ *
+ * Parameters:  file name, screenshot
+ *
+ * Returns:	  Nothing
+ *
+ ***********************************************************************/
+void write_ppm ( const char *fname, struct ss_state *state)
 {
-	int i;
 	FILE *f;
 
 	f = fopen (fname, "wb");
+	if (f == NULL)
+		return;
 
 	fprintf (f, "P6\n# ");
 
@@ -166,8 +197,7 @@ void write_ppm ( char *fname, struct ss_state *state)
 
 	fprintf (f, "255\n" );
 
-	for( i = 0; i < 3*state->h*state->w; i += 3 )
-		fwrite( &state->pix_map[i], 3, 1, f);
+	fwrite( state->pix_map, 3 * state->w, state->h, f );
 
 	fclose( f );
 }
@@ -175,202 +205,255 @@ void write_ppm ( char *fname, struct ss_state *state)
 
 /***********************************************************************
  *
- * Function:	 WritePictures
+ * Function:	 batch_worker
  *
- * Summary:	FIXME
+ * Summary:	Take screenshots of a batch one at a time, convert them
+ *		and write them to their files, until none are left
  *
- * Parameters:
+ * Parameters:  the batch
  *
- * Returns:
+ * Returns:	NULL
  *
  ***********************************************************************/
-void WritePictures (int sd, int db, int type )
+static void *batch_worker (void *arg)
 {
-	char fname[FILENAME_MAX];
-	char extension[8];
-	int i, len, idx = 0, recs, imgNum = 0;
-//	unsigned char inBuf[61440], *pixelBuf;
-	pi_buffer_t *inBuf, *pixelBuf;
-	unsigned long clut[256], magic;
-	int attr, category, val, mask, j, k;
-	struct ss_state state;
-
-	if( type == OUT_PPM )
-		sprintf (extension, ".ppm");
-	else if( type == OUT_PNG )
-		sprintf (extension, ".png");
-	else
-		return;
-
-	inBuf = pi_buffer_new (61440);
-
-	if (sd)
-		while( 1 )
-		{
-			len =
-			 dlp_ReadRecordByIndex (sd, db, idx, inBuf, 0, &attr, &category);
-
-			if( len <= 0 )
-			{
-				/* EOF */
-				break;
+	struct batch *batch = arg;
+	unsigned char *joined = NULL;
+	size_t joined_size = 0;
+
+	for (;;) {
+		struct shot *shot;
+		struct ss_state state;
+		const unsigned char *data;
+		size_t len;
+		int i;
+
+#if HAVE_PTHREAD
+		pthread_mutex_lock (&batch->lock);
+#endif
+		shot = batch->next < batch->num_shots
+			? &batch->shots[batch->next++] : NULL;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock (&batch->lock);
+#endif
+		if (shot == NULL)
+			break;
+
+		/* A screenshot in one record is converted in place, the
+		   records of a bigger one are put end to end first */
+		data = (unsigned char *) batch->records[shot->recno]
+			+ shot->header.offset;
+		len = batch->sizes[shot->recno] - shot->header.offset;
+		if (shot->header.num_records > 1) {
+			size_t size = len;
+
+			for (i = 1; i < shot->header.num_records; i++)
+				size += batch->sizes[shot->recno + i];
+			if (size > joined_size) {
+				free (joined);
+				joined = malloc (size);
+				joined_size = joined ? size : 0;
 			}
-
-			idx++;
-			state.w = ( inBuf->data[4] << 8 )+ inBuf->data[5];
-			state.h = ( inBuf->data[6] << 8 ) + inBuf->data[7];
-			recs = inBuf->data[9];
-			state.depth = inBuf->data[8];
-			magic = ((unsigned long *)inBuf->data)[0];
-
-			if(  magic != 0xBECEDEFE && magic != 0xDEDEFEFE )
-			{
-				 /* no magic must version 1 db */
-	//			 fprintf( stderr, "No Magic !\n" );
-
-				 state.w = 160;
-				 state.h = 160;
-				 recs = 1;
-
-				switch( len )
-				{
-				case 3200:
-					state.depth = 1;
-					mask = 1;
-					break;
-
-				case 6400:
-					state.depth = 2;
-					mask = 3;
-					break;
-
-				case 12800:
-					state.depth = 4;
-					mask = 0x0f;
-					break;
-
-				case 26624:
-					state.depth = 8;
-					break;
-
-				case 51200:
-					state.depth = 16;
-					break;
-
-				default:
-					/* unknown record */
-					/* get next */
-					fprintf( stderr, "Unknown record" );
-					continue;
-				}
+			if (joined == NULL) {
+				fprintf( stderr, "Memory Allocation failed\n" );
+				continue;
+			}
+			memcpy (joined, data, len);
+			for (i = 1; i < shot->header.num_records; i++) {
+				memcpy (joined + len, batch->records[shot->recno + i],
+					batch->sizes[shot->recno + i]);
+				len += batch->sizes[shot->recno + i];
 			}
+			data = joined;
+		}
 
-			pixelBuf
-			= pi_buffer_new (state.h * state.w * state.depth / 8 + 10 + 1024);
+		state.w = shot->header.width;
+		state.h = shot->header.height;
+		state.depth = shot->header.depth;
+		state.pix_map = malloc( (size_t) state.h * state.w * 3 );
+		if( !state.pix_map )
+		{
+			fprintf( stderr, "Memory Allocation failed\n" );
+			continue;
+		}
 
-	//		pixelBuf = malloc( state.h * state.w * state.depth / 8 + 10 + 1024 );
-			state.pix_map = malloc( state.h * state.w * 3 );
+		if (!unpack_ScreenShot (&shot->header, data, len,
+				state.pix_map, 0)) {
+			fprintf( stderr, "%s: can't convert, %d bits per pixel\n",
+				shot->fname, state.depth );
+		} else if( batch->type == OUT_PPM ) {
+			write_ppm( shot->fname, &state );
+#ifdef HAVE_PNG
+		} else {
+			write_png( shot->fname, &state );
+#endif
+		}
 
-			if( !pixelBuf || !state.pix_map )
-			{
-				fprintf( stderr, "Memory Allocation failed\n" );
-				return;
-			}
+		free( state.pix_map );
+	}
 
-			if( magic == 0xBECEDEFE || magic == 0xDEDEFEFE )
-				memcpy( pixelBuf->data, &inBuf->data[10], len - 10 );
-			else
-				memcpy( pixelBuf->data, inBuf->data, len );
-
-			for( i=1; i< recs; i++ )
-			{
-				len =
-				dlp_ReadRecordByIndex (sd, db, idx, inBuf, 0, &attr, &category);
-				memcpy( &pixelBuf->data[i*61440-10], inBuf->data, len );
-				idx++;
-			}
+	free (joined);
+	return NULL;
+}
 
-			sprintf (fname, "ScreenShot%d", ++imgNum );
 
-			if (plu_protect_files (fname, extension, sizeof(fname)) < 1) {
-				goto cleanup;
-			}
+/***********************************************************************
+ *
+ * Function:	 WritePictures
+ *
+ * Summary:	Convert all screenshots of a database. The records are
+ *		read in first, then the screenshots are found and named,
+ *		and then converted and written by a pool of worker
+ *		threads.
+ *
+ * Parameters:	socket and database, or a file if sd is 0, output type,
+ *		number of threads (0 for one per CPU), number of the
+ *		last screenshot written, updated
+ *
+ * Returns:	Number of screenshots found
+ *
+ ***********************************************************************/
+int WritePictures (int sd, int db, pi_file_t *pf, int type, int jobs,
+	int *imgNum)
+{
+	char fname[FILENAME_MAX];
+	const char *extension;
+	int i, n = 0, attr, category;
+	struct batch batch;
+	pi_buffer_t *inBuf = NULL;
+#if HAVE_PTHREAD
+	pthread_t *threads;
+#endif
 
-			printf ("Generating %s...\n", fname);
-			fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
-				, state.h, state.w, recs, state.depth );
-
-			if( state.depth == 8 )
-			memcpy( clut, &inBuf->data[len-1024], 1024 );
-
-			switch( state.depth )
-			{
-				case 1:
-				case 2:
-				case 4:
-					for( i = 0; i < state.h*state.w/(8/state.depth); i++)
-					{
-						for( j=(8/state.depth-1), k=0; j >= 0; j--, k++ )
-						{
-							/* get right bits */
-							val = ((pixelBuf->data[i] >> (j * state.depth)) & mask);
-							/* invert */
-							val = mask - val;
-							/* stretch */
-							val *= (255/mask);
-
-							state.pix_map[3*(i*(8/state.depth)+k)] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+1] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+2] = val;
-						}
-		 			}
-			 	break;
-
-				case 8:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[3*i] =
-						*(1 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+1] =
-						*(2 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+2] =
-						*(3 + (char *)&clut[pixelBuf->data[i]]);
-					}
-				break;
+	if( type == OUT_PPM )
+		extension = ".ppm";
+	else if( type == OUT_PNG )
+		extension = ".png";
+	else
+		return 0;
+
+	memset (&batch, 0, sizeof (batch));
+	batch.type = type;
+
+	if (pf != NULL)
+		pi_file_get_entries (pf, &n);
+	else if (dlp_ReadOpenDBInfo (sd, db, &n) < 0)
+		return 0;
+
+	batch.records = calloc (n > 0 ? n : 1, sizeof (void *));
+	batch.sizes = calloc (n > 0 ? n : 1, sizeof (size_t));
+	batch.shots = calloc (n > 0 ? n : 1, sizeof (struct shot));
+	if (pf == NULL) {
+		inBuf = pi_buffer_new (SCREENSHOT_RECORD_SIZE);
+		batch.copied = 1;
+	}
+	if (batch.records == NULL || batch.sizes == NULL
+		|| batch.shots == NULL || (pf == NULL && inBuf == NULL)) {
+		fprintf( stderr, "Memory Allocation failed\n" );
+		goto done;
+	}
 
-				case 16:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[i*3] = pixelBuf->data[i*2] & 0xF8;
-						state.pix_map[i*3+1] = ((pixelBuf->data[i*2] & 0x07 ) << 5)
-						+ (( pixelBuf->data[i*2+1] & 0xE0 ) >> 3 );
-						state.pix_map[i*3+2] = ( pixelBuf->data[i*2+1] & 0x1F ) << 3;
-					}
-					break;
-
-				default:
-					fprintf( stderr, "I'm out of my depth :)\n" );
+	/* Read every record. Those of a mapped file stay valid until it
+	   is closed, those from the device are copied. */
+	for (i = 0; i < n; i++) {
+		if (pf != NULL) {
+			if (pi_file_read_record (pf, i, &batch.records[i],
+					&batch.sizes[i], NULL, NULL, NULL) < 0)
 				break;
-			}
+			continue;
+		}
 
-			if( type == OUT_PPM )
-				write_ppm( fname, &state );
-			#ifdef HAVE_PNG
-			else
-				write_png( fname, &state );
-			#endif
+		if (dlp_ReadRecordByIndex (sd, db, i, inBuf, 0, &attr,
+				&category) <= 0)
+			break;
+		batch.records[i] = malloc (inBuf->used);
+		if (batch.records[i] == NULL) {
+			fprintf( stderr, "Memory Allocation failed\n" );
+			break;
+		}
+		memcpy (batch.records[i], inBuf->data, inBuf->used);
+		batch.sizes[i] = inBuf->used;
+	}
+	batch.num_records = i;
+
+	/* Find the screenshots and name their files */
+	for (i = 0; i < batch.num_records; i++) {
+		struct shot *shot = &batch.shots[batch.num_shots];
+		FILE *f;
+
+		if (!unpack_ScreenShotHeader (&shot->header, batch.records[i],
+				batch.sizes[i])) {
+			/* unknown record, get next */
+			fprintf( stderr, "Unknown record\n" );
+			continue;
+		}
+		if (batch.sizes[i] < (size_t) shot->header.offset
+			|| i + shot->header.num_records > batch.num_records)
+			break;
+		shot->recno = i;
+		i += shot->header.num_records - 1;
 
-cleanup:
-			pi_buffer_free (pixelBuf);
-			//	  free( pixelBuf );
-			free( state.pix_map );
+		sprintf (fname, "ScreenShot%d", ++*imgNum );
 
-			//	  fclose (f);
+		if (plu_protect_files (fname, extension, sizeof(fname)) < 1)
+			continue;
+
+		f = fopen (fname, "wb");
+		if (f == NULL) {
+			fprintf (stderr, "   ERROR: can't write to %s\n", fname);
+			continue;
 		}
-	else
-		return;
+		fclose (f);
+
+		printf ("Generating %s...\n", fname);
+		fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
+			, shot->header.height, shot->header.width,
+			shot->header.num_records, shot->header.depth );
 
-	pi_buffer_free (inBuf);
+		shot->fname = strdup (fname);
+		if (shot->fname != NULL)
+			batch.num_shots++;
+	}
+	fflush (stdout);
+
+#if HAVE_PTHREAD
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > batch.num_shots)
+		jobs = batch.num_shots;
+
+	pthread_mutex_init(&batch.lock, NULL);
+	threads = calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, batch_worker, &batch))
+			break;
+	}
+	jobs = i;
+
+	/* if no thread could be started, do the work ourselves */
+	if (jobs == 0)
+		batch_worker(&batch);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&batch.lock);
+#else
+	batch_worker(&batch);
+#endif
+
+done:
+	if (inBuf != NULL)
+		pi_buffer_free (inBuf);
+	for (i = 0; i < batch.num_shots; i++)
+		free (batch.shots[i].fname);
+	if (batch.copied && batch.records != NULL)
+		for (i = 0; i < n; i++)
+			free (batch.records[i]);
+	free (batch.shots);
+	free (batch.records);
+	free (batch.sizes);
+
+	return batch.num_shots;
 }
 
 int main (int argc, const char *argv[])
@@ -379,10 +462,13 @@ int main (int argc, const char *argv[])
 	 db,
 	 sd = -1,
 	 dbcount = 0,
+	 imgNum = 0,
+	 jobs = 0,
 	  type = OUT_PPM;
 
 	const char
-                *pformat;
+                *pformat = NULL,
+                *file_arg;
 
 	struct PilotUser User;
 
@@ -391,11 +477,14 @@ int main (int argc, const char *argv[])
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
 		{"format", 	'f', POPT_ARG_STRING, &pformat, 0, "Specify picture output type (ppm or png)"},
+		{"jobs", 	'j', POPT_ARG_INT, &jobs, 0, "Number of screenshots converted in parallel (default: one per CPU)", "jobs"},
 		POPT_TABLEEND
 	};
 
 	po = poptGetContext("pilot-read-screenshot", argc, argv, options, 0);
-	poptSetOtherOptionHelp(po,"\n\n");
+	poptSetOtherOptionHelp(po,"[file] ...\n\n"
+		"   Convert all screenshots in the ScreenShotDB files given, or on the\n"
+		"   Palm handheld if no files are given, writing each to ScreenShot<n>\n\n");
 
 	if (argc<2) {
 		poptPrintUsage(po,stderr,0);
@@ -410,7 +499,11 @@ int main (int argc, const char *argv[])
 		plu_badoption(po,c);
 	}
 
-	if (!strncmp ("png", pformat, 3))
+	if (pformat == NULL)
+	{
+		type = OUT_PPM;
+	}
+	else if (!strncmp ("png", pformat, 3))
 	{
 #ifdef HAVE_PNG
 		type = OUT_PNG;
@@ -428,6 +521,33 @@ int main (int argc, const char *argv[])
 		type = OUT_PPM;
 	}
 
+	if (poptPeekArg(po) != NULL) {
+		while ((file_arg = poptGetArg(po)) != NULL) {
+			pi_file_t *pf = pi_file_open_mapped (file_arg);
+			struct DBInfo info;
+
+			if (pf == NULL) {
+				fprintf (stderr, "   ERROR: can't open %s\n",
+					file_arg);
+				continue;
+			}
+			pi_file_get_info (pf, &info);
+			if (info.flags & dlpDBFlagResource)
+				fprintf (stderr,
+					"   ERROR: %s is not a valid record database\n",
+					file_arg);
+			else
+				dbcount += WritePictures (0, 0, pf, type, jobs,
+					&imgNum);
+			pi_file_close (pf);
+		}
+
+		if (!plu_quiet) {
+			printf ("\nList complete. %d files found.\n", dbcount);
+		}
+		return 0;
+	}
+
 	sd = plu_connect ();
 
 	if (sd < 0)
@@ -436,14 +556,14 @@ int main (int argc, const char *argv[])
 	if (dlp_ReadUserInfo (sd, &User) < 0)
 	 	goto error_close;
 
-	if (dlp_OpenDB (sd, 0, dlpOpenRead, "ScreenShotDB", &db) < 0)
+	if (dlp_OpenDB (sd, 0, dlpOpenRead, ScreenShot_DB, &db) < 0)
 	{
 		fprintf (stderr,"   ERROR: Unable to open Screen Shot database on Palm.\n");
 		dlp_AddSyncLogEntry (sd, "Unable to open Screen Shot database.\n");
 		goto error_close;
 	}
 
-	WritePictures (sd, db, type );
+	dbcount = WritePictures (sd, db, NULL, type, jobs, &imgNum);
 
 	if (sd)
 	{
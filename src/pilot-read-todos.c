@@ -101,6 +101,7 @@ int main(int argc, const char *argv[])
 
 	pi_buffer_t    *recbuf,
         *appblock;
+	pi_arena_t     *arena;
 
 	poptContext po;
 
@@ -198,7 +199,10 @@ int main(int argc, const char *argv[])
 	unpack_ToDoAppInfo(&tai, appblock->data, appblock->used);
     pi_buffer_free(appblock);
 
+	/* ToDos are only printed, so their strings are left in the record
+	   buffer instead of being copied */
 	recbuf = pi_buffer_new (0xffff);
+	arena = pi_arena_new_borrowing(0);
 
 	for (i = 0;; i++) {
 		int 	attr,
@@ -228,9 +232,9 @@ int main(int argc, const char *argv[])
 		/* Skip deleted records */
 		if (attr & dlpRecAttrArchived) {
 			if (archived) {
-				unpack_ToDo(&todo, recbuf, todo_v1);
+				pi_arena_reset(arena);
+				unpack_ToDo_arena(&todo, recbuf, todo_v1, arena);
 				print_archived(&tai,&todo,category);
-				free_ToDo(&todo);
 			}
 			continue;
 		}
@@ -238,12 +242,13 @@ int main(int argc, const char *argv[])
 			continue;
 
 		if (!archived) {
-			unpack_ToDo(&todo, recbuf, todo_v1);
+			pi_arena_reset(arena);
+			unpack_ToDo_arena(&todo, recbuf, todo_v1, arena);
 			print_unarchived(&tai,&todo,category);
-			free_ToDo(&todo);
 		}
 	}
 
+    pi_arena_free (arena);
     pi_buffer_free (recbuf);
 
 	if (!filename) {
@@ -29,8 +29,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#ifdef HAVE_STDINT_H
-#include <stdint.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
 #endif
 
 #include "pi-source.h"
@@ -47,808 +47,99 @@
 
 #define pi_mktag(c1,c2,c3,c4) (((c1)<<24)|((c2)<<16)|((c3)<<8)|(c4))
 
-#define VEO_COLOUR_CORRECT 0x01
-#define VEO_BIAS           0x12
-
-uint8_t redLUT[256], greenLUT[256], blueLUT[256];
-
-double bias_factor = 0.50;
-
-
-/***********************************************************************
- *
- * Function:    fmt_date
- *
- * Summary:     Format the output date on the images
- *
- * Parameters:
- *
- * Returns:
- *
- ***********************************************************************/
-static const char *fmt_date (struct Veo *v)
-{
-   static char buf[24];
-
-   sprintf (buf, "%d-%02d-%02d", v->year, v->month, v->day);
-   return buf;
-
-}
+/* One picture of the batch: its header and records as read from the
+   device, and the file it goes to */
+struct picture {
+	Veo_t	v;
+	void	**records;
+	size_t	*sizes;
+	int	num_records;
+	char	*fname;
+};
+
+/* The pictures read so far, converted by WritePictures */
+struct batch {
+	struct picture *pictures;
+	int	num_pictures,
+		max_pictures,
+		next;			/* next picture for a worker to take */
+
+	int	type,
+		bias,
+		flags;
+	const char *progname;
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
 
-/***********************************************************************
- *
- * Function:	Decode
- *
- * Summary:	Decode one record from the Veo database.
- *
- * Parameters:	inP - the compressed record
- *              outP - the uncompressed record
- *              w - the width of the picture
- * Returns:	1 always
- *
- ***********************************************************************/
-int Decode (unsigned char *inP, unsigned char *outP, short w)
+struct VeoState_picture
 {
-   short shifter = 7, index = 0;
-   unsigned short tmp0, tmp3, tmp4, i, j;	/* d3 */
-   unsigned char *origOutP = outP;
-
-   shifter = 7;
-
-   for (j = 0; j < 2; j++)
-	 {
-		if (j == 1)
-		  origOutP += w * 2;
-
-		for (i = 0; i < 2; i++)
-		  {
-			 switch (i)
-			   {
-				case 0:
-				  outP = (unsigned char *) (origOutP + 1);
-				  break;
-				case 1:
-				  outP = (unsigned char *) (origOutP + w);
-				  break;
-			   }
-
-			 if (shifter != 7)
-			   {
-				  shifter = 7;
-				  inP++;
-			   }
-
-			 *outP = *inP++;
-
-			 outP += 2;		/* a3 */
-			 index = 2;
-
-			 while (index < w)
-			   {
-				  /* Top of decompress loop */
-				  tmp3 = 1 << shifter;
-
-				  tmp3 &= *inP;
-
-				  if ((shifter & 0xFF) <= 0)
-					{
-					   shifter = 7;
-					   inP++;
-					}
-				  else
-					{
-					   shifter--;
-					}
-
-				  if ((tmp3 & 0xFF) != 0)
-					{
-					   *outP = *(outP - 2);
-					}
-				  else
-					{
-					   tmp0 = inP[1];
-					   tmp4 = inP[0] << 8;
-
-					   tmp4 |= tmp0;
-
-					   tmp4 = tmp4 << (7 - shifter);
-
-					   if (shifter >= 5)
-						 {
-							shifter -= 5;
-						 }
-					   else
-						 {
-							inP++;
-							shifter += 3;
-						 }
-
-					   tmp4 = tmp4 >> 11;
-
-					   /* if((char)tmp4 <= 0) */
-					   if ((char) tmp4 == 0)
-						 {
-							tmp3 = inP[0] << 8 | inP[1];
-
-							tmp3 = tmp3 << (7 - shifter);
-
-							if (shifter >= 8)
-							  {
-								 shifter -= 8;
-							  }
-							else
-							  {
-								 inP++;
-								 shifter &= 0xf;
-							  }
-
-							*outP = tmp3 >> 8;
-						 }
-					   else
-						 {
-							if (tmp4 & 0x10)
-							  {
-								 tmp4 &= 0xf;
-
-								 *outP = *(outP - 2) - tmp4;
-							  }
-							else
-							  {
-								 tmp4 &= 0xf;
-
-								 *outP = *(outP - 2) + tmp4;
-							  }
-						 }
-					}
-				  outP += 2;
-				  index += 2;
-			   }
-			 /* End 'while (index < w)' */
-		  }
-
-		outP = origOutP;
-
-		if (shifter != 7)
-		  {
-			 shifter = 7;
-			 inP++;
-		  }
-
-		*outP = *inP++;
-
-		if (shifter != 7)
-		  {
-			 shifter = 7;
-			 inP++;
-		  }
-
-		outP[w + 1] = *inP++;
-
-		outP += 2;		/* a3 */
-		index = 2;
-
-		while (index < w)
-		  {
-	  /* Top of decompress loop */
-			 tmp3 = 1 << shifter;
-
-			 tmp3 &= *inP;
-
-			 if ((shifter & 0xFF) <= 0)
-			   {
-				  shifter = 7;
-				  inP++;
-			   }
-			 else
-			   {
-				  shifter--;
-			   }
-
-			 if ((tmp3 & 0xFF) != 0)
-			   {
-				  *outP = outP[w - 1];
-			   }
-			 else
-			   {
-				  tmp0 = inP[1];
-				  tmp4 = inP[0] << 8;
-
-				  tmp4 |= tmp0;
-
-				  tmp4 = tmp4 << (7 - shifter);
-
-				  if (shifter >= 5)
-					{
-					   shifter -= 5;
-					}
-				  else
-					{
-					   inP++;
-					   shifter += 3;
-					}
-
-				  tmp4 = tmp4 >> 11;
-
-				  if ((char) tmp4 == 0)
-					{
-					   tmp3 = inP[0] << 8 | inP[1];
-
-					   tmp3 = tmp3 << (7 - shifter);
-
-					   if (shifter >= 8)
-						 {
-							shifter -= 8;
-						 }
-					   else
-						 {
-							inP++;
-							shifter &= 0xf;
-						 }
-
-					   *outP = tmp3 >> 8;
-					}
-				  else
-					{
-					   if (tmp4 & 0x10)
-						 {
-							tmp4 &= 0xf;
-
-							*outP = outP[w - 1] - tmp4;
-						 }
-					   else
-						 {
-							tmp4 &= 0xf;
-							*outP = outP[w - 1] + tmp4;
-						 }
-					}
-			   }
-
-			 tmp3 = 1 << shifter;
-			 tmp3 &= *inP;
-
-			 if ((shifter & 0xFF) <= 0)
-			   {
-				  shifter = 7;
-				  inP++;
-			   }
-			 else
-			   {
-				  shifter--;
-			   }
-
-			 if ((tmp3 & 0xFF) != 0)
-			   {
-				  outP[w + 1] = *outP;
-			   }
-			 else
-			   {
-				  tmp0 = inP[1];
-				  tmp4 = inP[0] << 8;
-
-				  tmp4 |= tmp0;
-
-				  tmp4 = tmp4 << (7 - shifter);
-
-				  if (shifter >= 5)
-					{
-					   shifter -= 5;
-					}
-				  else
-					{
-					   inP++;
-					   shifter += 3;
-					}
-
-				  tmp4 = tmp4 >> 11;
-
-				  /* if((char)tmp4 <= 0) */
-				  if ((char) tmp4 == 0)
-					{
-					   tmp3 = inP[0] << 8 | inP[1];
-
-					   tmp3 = tmp3 << (7 - shifter);
-
-					   if (shifter >= 8)
-						 {
-							shifter -= 8;
-						 }
-					   else
-						 {
-							inP++;
-							shifter &= 0xf;
-						 }
-
-					   outP[w + 1] = tmp3 >> 8;
-					}
-				  else
-					{
-					   if (tmp4 & 0x10)
-						 {
-							tmp4 &= 0xf;
-
-							outP[w + 1] = *outP - tmp4;
-						 }
-					   else
-						 {
-							tmp4 &= 0xf;
-
-							outP[w + 1] = *outP + tmp4;
-						 }
-					}
-			   }
-			 outP += 2;
-			 index += 2;
-		  }
-		/* End 'while (index < w)' */
-
-	 }
-   /* End 'for (j = 0; j < 2; j++)' */
-   return (1);
-}
+	VeoState_t state;
+	const struct picture *pic;
+};
 
 /***********************************************************************
  *
- * Function:	GetPicData
+ * Function:    getrecord_picture
  *
- * Summary:     Requests one record of bayer data from the palm
- *              and then decodes it.
+ * Summary:     VeoState callback: return a record of a picture read
+ *		into memory
  *
- * Parameters:  r - the row we are looking for
- *              v - veo record
- *              row - the bayer data containg our row
+ * Parameters:  State, record number, record and size returned
  *
- * Returns:     the size of the encoded record
+ * Returns:     0 on success, -1 if there is no such record
  *
  ***********************************************************************/
-static int
-  GetPicData (uint32_t flags, int r, struct Veo *v, unsigned char *row)
+static int getrecord_picture (VeoState_t *vstate, int recno,
+	void **buf, size_t *bufsize)
 {
-   int attr, category, len;
-   pi_buffer_t *tmpRow;
+	const struct picture *pic =
+		((struct VeoState_picture *) vstate)->pic;
 
-   if (!v->sd)
-	 return (-1);
+	if (recno < 0 || recno >= pic->num_records
+		|| pic->records[recno] == NULL)
+		return -1;
 
-   /* Each record contains four rows of bayer data */
-   /* The compressed record can be upto twice as large as the
-    * uncompressed record ??? */
-   tmpRow = pi_buffer_new (5120);
+	*buf = pic->records[recno];
+	*bufsize = pic->sizes[recno];
 
-   len = dlp_ReadRecordByIndex (v->sd, v->db, 1 + r / 4, tmpRow, 0,
-								&attr, &category);
-
-   if (len < 0)
-	 return 0;
-
-   Decode (tmpRow->data, row, v->width);
-
-   pi_buffer_free(tmpRow);
-
-   return (len);
+	return 0;
 }
 
-#define max(a,b) (( a > b ) ? a : b )
-#define min(a,b) (( a < b ) ? a : b )
 
 /***********************************************************************
  *
- * Function:    Bias
- *
- *              Bias is based on the Fast Alternative to Perlin's Bias
- *              algorithm in Graphics Gems IV by
- *              Christophe Schlick schlick@labri.u-bordeuax.fr
- *
- * Summary:     Lighten or darken the image
- *
- * Parameters:
- *
- * Returns:
- *
- ***********************************************************************/
-static void Bias( double bias, int width, int height, uint8_t *data )
-{
-   int i;
-   double num, denom, t;
-
-   for( i=0; i<width*height; i++ )
-     {
-	t = (double)data[i]/256.0;
-	num = t;
-	denom = (1.0/bias - 2) * (1.0 - t) + 1;
-	data[i] = num/denom * 256.0;
-     }
-}
-
-int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, long flags )
-{
-	uint8_t *tmpRow;
-	uint8_t gMin, gMax, rMin, rMax, bMin, bMax;
-	float gInc, rInc, bInc, gCur, rCur, bCur;
-	float rMean = 0, gMean = 0, bMean = 0, maxMean;
-	uint16_t	width = v->width;
-	uint16_t	height = v->height;
-	int i;
-   	float redCeiling = 254;
-   	float greenCeiling = 252;
-   	float blueCeiling = 255;
-
-	memset( red, 0, 256 * sizeof( uint8_t ));
-	memset( green, 0, 256 * sizeof( uint8_t ));
-	memset( blue, 0, 256 * sizeof( uint8_t ));
-
-	gMin = rMin = bMin = 255;
-	gMax = rMax = bMax = 0;
-
-	tmpRow = malloc( 2560 );
-
-	GetPicData( 0, 0, v, tmpRow );
-
-	for( i=0; i<width; i += 2 )
-	{
-		gMin = min( gMin, tmpRow[i] );
-		rMin = min( rMin, tmpRow[i+width] );
-		bMin = min( bMin, tmpRow[i+1] );
-		gMin = min( gMin, tmpRow[i+width+1] );
-		gMax = max( gMax, tmpRow[i] );
-		rMax = max( rMax, tmpRow[i+width] );
-		bMax = max( bMax, tmpRow[i+1] );
-		gMax = max( gMax, tmpRow[i+width+1] );
-
-		rMean += tmpRow[i+width];
-		gMean += tmpRow[i];
-		gMean += tmpRow[i+width+1];
-		bMean += tmpRow[i+1];
-	}
-
-
-	if( width == 640 )
-	{
-		for( i=width*2; i<width*3; i += 2 )
-		{
-			gMin = min( gMin, tmpRow[i] );
-			rMin = min( rMin, tmpRow[i+width] );
-			bMin = min( bMin, tmpRow[i+1] );
-			gMin = min( gMin, tmpRow[i+width+1] );
-			gMax = max( gMax, tmpRow[i] );
-			rMax = max( rMax, tmpRow[i+width] );
-			bMax = max( bMax, tmpRow[i+1] );
-			gMax = max( gMax, tmpRow[i+width+1] );
-
-			rMean += tmpRow[i+width];
-			gMean += tmpRow[i];
-			gMean += tmpRow[i+width+1];
-			bMean += tmpRow[i+1];
-		}
-	}
-
-	GetPicData( 0, height/2, v, tmpRow );
-
-	for( i=0; i<width; i += 2 )
-	{
-		gMin = min( gMin, tmpRow[i] );
-		rMin = min( rMin, tmpRow[i+width] );
-		bMin = min( bMin, tmpRow[i+1] );
-		gMin = min( gMin, tmpRow[i+width+1] );
-		gMax = max( gMax, tmpRow[i] );
-		rMax = max( rMax, tmpRow[i+width] );
-		bMax = max( bMax, tmpRow[i+1] );
-		gMax = max( gMax, tmpRow[i+width+1] );
-
-		rMean += tmpRow[i+width];
-		gMean += tmpRow[i];
-		gMean += tmpRow[i+width+1];
-		bMean += tmpRow[i+1];
-	}
-
-	if( width == 640 )
-	{
-		for( i=width*2; i<width*3; i += 2 )
-		{
-			gMin = min( gMin, tmpRow[i] );
-			rMin = min( rMin, tmpRow[i+width] );
-			bMin = min( bMin, tmpRow[i+1] );
-			gMin = min( gMin, tmpRow[i+width+1] );
-			gMax = max( gMax, tmpRow[i] );
-			rMax = max( rMax, tmpRow[i+width] );
-			bMax = max( bMax, tmpRow[i+1] );
-			gMax = max( gMax, tmpRow[i+width+1] );
-
-			rMean += tmpRow[i+width];
-			gMean += tmpRow[i];
-			gMean += tmpRow[i+width+1];
-			bMean += tmpRow[i+1];
-		}
-	}
-
-	GetPicData( 0, height-1, v, tmpRow );
-
-	for( i=0; i<width; i += 2 )
-	{
-		gMin = min( gMin, tmpRow[i] );
-		rMin = min( rMin, tmpRow[i+width] );
-		bMin = min( bMin, tmpRow[i+1] );
-		gMin = min( gMin, tmpRow[i+width+1] );
-		gMax = max( gMax, tmpRow[i] );
-		rMax = max( rMax, tmpRow[i+width] );
-		bMax = max( bMax, tmpRow[i+1] );
-		gMax = max( gMax, tmpRow[i+width+1] );
-
-		rMean += tmpRow[i+width];
-		gMean += tmpRow[i];
-		gMean += tmpRow[i+width+1];
-		bMean += tmpRow[i+1];
-	}
-
-	if( width == 640 )
-	{
-		for( i=width*2; i<width*3; i += 2 )
-		{
-			gMin = min( gMin, tmpRow[i] );
-			rMin = min( rMin, tmpRow[i+width] );
-			bMin = min( bMin, tmpRow[i+1] );
-			gMin = min( gMin, tmpRow[i+width+1] );
-			gMax = max( gMax, tmpRow[i] );
-			rMax = max( rMax, tmpRow[i+width] );
-			bMax = max( bMax, tmpRow[i+1] );
-			gMax = max( gMax, tmpRow[i+width+1] );
-
-			rMean += tmpRow[i+width];
-			gMean += tmpRow[i];
-			gMean += tmpRow[i+width+1];
-			bMean += tmpRow[i+1];
-		}
-	}
-
-	rMean = rMean / ( 640 * 3 );
-	gMean = gMean / ( 640 * 6 );
-	bMean = bMean / ( 640 * 3 );
-
-	maxMean = max( gMean-gMin, max( bMean-bMin, rMean-rMin ));
-//	maxMean = max( gMean, max( bMean, rMean ));
-
-	rInc = maxMean / (rMean-rMin);
-   	gInc = maxMean / (gMean-gMin);
-   	bInc = maxMean / (bMean-bMin);
-
-   rCur = 0;
-   gCur = 0;
-   bCur = 0;
-
-   for (i = 0; i<256; i++)
-	 {
-	 	if( i < rMin )
-		 	red[i] = 0;
-		else
-		{
-			if( rCur < redCeiling )
-			  red[i] = rCur;
-			else
-			  red[i] = redCeiling;
-
-			rCur += rInc;
-		}
-
-		if( i < gMin )
-			green[i] = 0;
-		else
-		{
-			if( gCur < greenCeiling )
-			  green[i] = gCur;
-			else
-			  green[i] = greenCeiling;
-
-			gCur += gInc;
-		}
-
-		if( i < bMin )
-			blue[i] = 0;
-		else
-		{
-			if( bCur < blueCeiling )
-			  blue[i] = bCur;
-			else
-			  blue[i] = blueCeiling;
-
-			bCur += bInc;
-		}
-	 }
-
-	free( tmpRow );
-
-	return( 1 );
-}
-
-/***********************************************************************
+ * Function:    fmt_date
  *
- * Function:	Gen24bitRow
+ * Summary:     Format the output date on the images
  *
- * Summary:     It requests some decoded bayer pattern data from the palm
- *              and then interpolates one RGB row from that data.
+ * Parameters:  picture header, buffer of at least 24 bytes
  *
- * Parameters:  r - the row to be interpolated
- *              v - veo record
- *              row - the returned RGB data
- * Returns:     1 success
- *              -1 failure
+ * Returns:     the buffer
  *
  ***********************************************************************/
-int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
+static const char *fmt_date (const struct Veo *v, char *buf)
 {
-   int i, rawW, rawH, modR = r % 4;
-
-   unsigned char rowA[2560], rowB[2560];
-   unsigned char *rAP, *rBP, *rCP;
-
-   rawW = v->width / 2;
-   rawH = v->height / 2;
-
-   if (r == 0)
-	 {
-		if (-1 == GetPicData (flags, r, v, rowB))
-		  return (-1);
-		rAP = rBP = rowB;
-		rCP = rowB + v->width;
-
-	 }
-   else if (r == (v->height - 1))
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 2;
-		rCP = rBP = rowA + v->width * 3;
-
-	 }
-   else if (modR == 0)
-	 {
-		if (-1 == GetPicData (flags, r - 1, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r, v, rowB))
-		  return (-1);
-		rBP = rowB;
-		rCP = rowB + v->width;
-
-	 }
-   else if (modR == 3)
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 2;
-		rBP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r + 1, v, rowB))
-		  return (-1);
-		rCP = rowB;
-
-	 }
-   else
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * (modR - 1);
-		rBP = rowA + v->width * modR;
-		rCP = rowA + v->width * (modR + 1);
-	 }
-
-   /* Bayer Pattern
-    * GBGB
-    * RGRG
-    * GBGB
-    * RGRG */
-   if (r % 2 == 0)
-	 {
-      /* green blue center */
-		row[0] = (rAP[0] + rCP[0]) >> 1;
-		row[1] = rBP[0];
-		row[2] = rBP[1];
-
-      /* blue center */
-		row[3] = (rAP[0] + rCP[0] + rAP[2] + rCP[2]) >> 2;
-		row[4] = (rAP[1] + rBP[0] + rBP[2] + rCP[1]) >> 2;
-		row[5] = rBP[1];
-
-		for (i = 1; i < rawW - 1; i++)
-		  {
-	  /* green blue center */
-			 row[i * 6] = (rAP[i * 2] + rCP[i * 2]) >> 1;
-			 row[i * 6 + 1] = rBP[i * 2];
-			 row[i * 6 + 2] = (rBP[i * 2 - 1] + rBP[i * 2 + 1]) >> 1;
-
-	  /* blue center */
-			 row[i * 6 + 3] =
-			   (rAP[i * 2] + rCP[i * 2] + rAP[i * 2 + 2] + rCP[i * 2 + 2]) >> 2;
-			 row[i * 6 + 4] =
-			   (rAP[i * 2 + 1] + rBP[i * 2] + rBP[i * 2 + 2] +
-				rCP[i * 2 + 1]) >> 2;
-			 row[i * 6 + 5] = rBP[i * 2 + 1];
-		  }
-
-		i = rawW - 1;
-      /* green blue center */
-		row[i * 6] = (rAP[i * 2] + rCP[i * 2]) >> 1;
-		row[i * 6 + 1] = rBP[i * 2];
-		row[i * 6 + 2] = (rBP[i * 2 - 1] + rBP[i * 2 + 1]) >> 1;
-
-      /* blue center */
-		row[i * 6 + 3] = (rAP[i * 2] + rCP[i * 2]) >> 1;
-		row[i * 6 + 4] = (rAP[i * 2 + 1] + rBP[i * 2] + rCP[i * 2 + 1]) / 3;
-		row[i * 6 + 5] = rBP[i * 2 + 1];
-
-	 }
-   else
-	 {
-      /* red center */
-		row[0] = rBP[0];
-		row[1] = (rAP[0] + rBP[1] + rCP[0]) / 3;
-		row[2] = (rAP[1] + rCP[1]) >> 1;
-
-      /* green red center */
-		row[3] = (rBP[0] + rBP[2]) >> 1;
-		row[4] = rBP[1];
-		row[5] = (rAP[1] + rCP[1]) >> 1;
-
-		for (i = 1; i < rawW - 1; i++)
-		  {
-	  /* red center */
-			 row[i * 6] = rBP[i * 2];
-			 row[i * 6 + 1] =
-			   (rAP[i * 2] + rBP[i * 2 - 1] + rBP[i * 2 + 1] + rCP[i * 2]) >> 2;
-			 row[i * 6 + 2] =
-			   (rAP[i * 2 - 1] + rAP[i * 2 + 1] + rCP[i * 2 - 1] +
-				rCP[i * 2 + 1]) >> 2;
-
-	  /* green red center */
-			 row[i * 6 + 3] = (rBP[i * 2] + rBP[i * 2 + 2]) >> 1;
-			 row[i * 6 + 4] = rBP[i * 2 + 1];
-			 row[i * 6 + 5] = (rAP[i * 2 + 1] + rCP[i * 2 + 1]) >> 1;
-		  }
-
-		i = rawW - 1;
-
-      /* red center */
-		row[i * 6] = rBP[i * 2];
-		row[i * 6 + 1] =
-		  (rAP[i * 2] + rBP[i * 2 - 1] + rBP[i * 2 + 1] + rCP[i * 2]) >> 2;
-		row[i * 6 + 2] =
-		  (rAP[i * 2 - 1] + rAP[i * 2 + 1] + rCP[i * 2 - 1] +
-		   rCP[i * 2 + 1]) >> 2;
-
-      /* green red center */
-		row[i * 6 + 3] = rBP[i * 2];
-		row[i * 6 + 4] = rBP[i * 2 + 1];
-		row[i * 6 + 5] = (rAP[i * 2 + 1] + rCP[i * 2 + 1]) >> 1;
-	 }
-
-   if (flags & VEO_COLOUR_CORRECT)
-	 {
-		for (i = 0; i < v->width * 3; i += 3)
-		  {
-			 row[i] = redLUT[row[i]];
-			 row[i + 1] = greenLUT[row[i + 1]];
-			 row[i + 2] = blueLUT[row[i + 2]];
-		  }
-	 }
-
-   if (flags & VEO_BIAS)
-	 Bias( bias_factor, v->width*3, 1, row );
+   sprintf (buf, "%d-%02d-%02d", v->year, v->month, v->day);
+   return buf;
 
-   return (1);
 }
 
 /***********************************************************************
  *
  * Function:    write_png
  *
- * Summary:
+ * Summary:     Write a decoded picture as a PNG image
  *
- * Parameters:  None
+ * Parameters:  file, picture header, pixmap
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
 #ifdef HAVE_PNG
-void write_png (FILE * f, struct Veo *v, long flags)
+void write_png (FILE * f, const struct Veo *v, const unsigned char *pixmap)
 {
-   unsigned char outBuf[2560];
    int i;
    png_structp png_ptr;
    png_infop info_ptr;
@@ -870,7 +161,6 @@ void write_png (FILE * f, struct Veo *v, long flags)
    if (setjmp (png_jmpbuf (png_ptr)))
 	 {
 		png_destroy_write_struct (&png_ptr, &info_ptr);
-		fclose (f);
 		return;
 	 }
 
@@ -883,11 +173,7 @@ void write_png (FILE * f, struct Veo *v, long flags)
    png_write_info (png_ptr, info_ptr);
 
    for (i = 0; i < v->height; i++)
-	 {
-		Gen24bitRow (flags, i, v, outBuf);
-		png_write_row (png_ptr, outBuf);
-		png_write_flush (png_ptr);
-	 }
+	 png_write_row (png_ptr, (png_bytep) pixmap + i * v->width * 3);
 
    png_write_end (png_ptr, info_ptr);
    png_destroy_write_struct (&png_ptr, &info_ptr);
@@ -899,102 +185,253 @@ void write_png (FILE * f, struct Veo *v, long flags)
  *
  * Function:    write_ppm
  *
- * Summary:
+ * Summary:     Write a decoded picture as a PPM image
  *
- * Parameters:  None
+ * Parameters:  file, picture header, pixmap
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
-void write_ppm (FILE * f, struct Veo *v, long flags)
+void write_ppm (FILE * f, const struct Veo *v, const unsigned char *pixmap)
 {
-   unsigned char outBuf[2560];
-   int i;
+   char date[24];
 
    fprintf (f, "P6\n# ");
-
-   if (v->name != NULL)
-	 fprintf (f, "%s (created on %s)\n", v->name, fmt_date (v));
-
+   fprintf (f, "%s (created on %s)\n", v->name, fmt_date (v, date));
    fprintf (f, "%d %d\n255\n", v->width, v->height);
-
-   for (i = 0; i < v->height; i++)
-	 {
-		Gen24bitRow (flags, i, v, outBuf);
-
-		fwrite (outBuf, v->width * 3, 1, f);
-	 }
+   fwrite (pixmap, v->width * 3, v->height, f);
 }
 
 /***********************************************************************
  *
- * Function:    WritePicture
+ * Function:    ReadPicture
  *
- * Summary:	FIXME
+ * Summary:     Read all records of a picture's database and add it to
+ *		the batch. The file name is chosen now, and an empty
+ *		file created, so that it is not given to another picture.
  *
- * Parameters:
+ * Parameters:  socket, open database, picture name, batch
  *
- * Returns:
+ * Returns:     Nothing
  *
  ***********************************************************************/
-void WritePicture (int sd, int db, int type, char *name, const char *progname, long flags)
+static void ReadPicture (int sd, int db, const char *name,
+	struct batch *batch)
 {
    char fname[FILENAME_MAX];
+   const char *extension;
    FILE *f;
-   char extension[8];
-   static int len;
-   struct Veo v;
-   pi_buffer_t *inBuf;
-   int attr, category;
+   struct picture *pic;
+   pi_buffer_t *buf;
+   int i, attr, category;
+   size_t len;
+
+   if (batch->num_pictures == batch->max_pictures)
+	 {
+		int max = batch->max_pictures ? batch->max_pictures * 2 : 16;
+
+		pic = realloc (batch->pictures, max * sizeof (struct picture));
+		if (pic == NULL)
+		  {
+			 fprintf (stderr, "%s: out of memory\n", batch->progname);
+			 return;
+		  }
+		batch->pictures = pic;
+		batch->max_pictures = max;
+	 }
+   pic = &batch->pictures[batch->num_pictures];
+   memset (pic, 0, sizeof (*pic));
+
+   if (dlp_ReadOpenDBInfo (sd, db, &pic->num_records) < 0
+	   || pic->num_records < 1)
+	 return;
+   pic->records = calloc (pic->num_records, sizeof (void *));
+   pic->sizes = calloc (pic->num_records, sizeof (size_t));
+   buf = pi_buffer_new (5120);
+   if (pic->records == NULL || pic->sizes == NULL || buf == NULL)
+	 {
+		fprintf (stderr, "%s: out of memory\n", batch->progname);
+		goto fail;
+	 }
 
-   if (type == VEO_OUT_PNG)
-	 sprintf (extension, ".png");
-   else if (type == VEO_OUT_PPM)
-	 sprintf (extension, ".ppm");
+   for (i = 0; i < pic->num_records; i++)
+	 {
+		if (dlp_ReadRecordByIndex (sd, db, i, buf, 0, &attr,
+			   &category) < 0)
+		  continue;
+		pic->records[i] = malloc (buf->used ? buf->used : 1);
+		if (pic->records[i] == NULL)
+		  {
+			 fprintf (stderr, "%s: out of memory\n", batch->progname);
+			 goto fail;
+		  }
+		memcpy (pic->records[i], buf->data, buf->used);
+		pic->sizes[i] = buf->used;
+	 }
+
+   if (pic->records[0] == NULL)
+	 goto fail;
+   unpack_Veo (&pic->v, pic->records[0], pic->sizes[0]);
+   len = strlen (name);
+   if (len > sizeof (pic->v.name) - 1)
+	 len = sizeof (pic->v.name) - 1;
+   memcpy (pic->v.name, name, len);
+   pic->v.name[len] = '\0';
+
+   if (batch->type == VEO_OUT_PNG)
+	 extension = ".png";
+   else
+	 extension = ".ppm";
 
    sprintf (fname, "%s", name);
-   strcpy (v.name, name);
 
 	if (plu_protect_files (fname, extension, sizeof(fname) ) < 1) {
 		/* no suitable filename could be found. */
-		return;
+		goto fail;
 	}
 
+   f = fopen (fname, "wb");
+   if (f == NULL)
+	 {
+		fprintf (stderr, "%s: can't write to %s\n", batch->progname, fname);
+		goto fail;
+	 }
+   fclose (f);
+
    printf ("Generating %s...\n", fname);
+   pic->fname = strdup (fname);
+   if (pic->fname == NULL)
+	 goto fail;
+
+   pi_buffer_free (buf);
+   batch->num_pictures++;
+   return;
+
+  fail:
+   if (buf != NULL)
+	 pi_buffer_free (buf);
+   if (pic->records != NULL)
+	 for (i = 0; i < pic->num_records; i++)
+	   free (pic->records[i]);
+   free (pic->records);
+   free (pic->sizes);
+}
 
-   f = fopen (fname, "wb");
+/***********************************************************************
+ *
+ * Function:    batch_worker
+ *
+ * Summary:     Take pictures of the batch one at a time, decode them
+ *		and write them to their files, until none are left. Each
+ *		picture's records are freed once it is written.
+ *
+ * Parameters:  the batch
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *batch_worker (void *arg)
+{
+	struct batch *batch = arg;
+	struct VeoState_picture s;
 
-   if (f)
-	 {
-		if (sd)
-		  {
-             inBuf = pi_buffer_new (2560);
-			 len =
-			   dlp_ReadRecordByIndex (sd, db, 0, inBuf, 0, &attr, &category);
-			 unpack_Veo (&v, inBuf->data, inBuf->used);
-             pi_buffer_free (inBuf);
-			 v.sd = sd;
-			 v.db = db;
-		  }
-		else
-		  return;
+	memset (&s, 0, sizeof (s));
+	s.state.getrecord = getrecord_picture;
+	s.state.bias = batch->bias;
+	s.state.flags = batch->flags;
 
-		ColourCorrect (&v, redLUT, greenLUT, blueLUT, flags);
+	for (;;) {
+		struct picture *pic;
+		FILE *f;
+		int i;
 
-		if (type == VEO_OUT_PPM)
-		  write_ppm (f, &v, flags);
+#if HAVE_PTHREAD
+		pthread_mutex_lock (&batch->lock);
+#endif
+		pic = batch->next < batch->num_pictures
+			? &batch->pictures[batch->next++] : NULL;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock (&batch->lock);
+#endif
+		if (pic == NULL)
+			break;
+
+		s.pic = pic;
+		if (!unpack_VeoPicture (&s.state, &pic->v)) {
+			fprintf (stderr, "%s: can't decode %s\n",
+				batch->progname, pic->fname);
+		} else if ((f = fopen (pic->fname, "wb")) == NULL) {
+			fprintf (stderr, "%s: can't write to %s\n",
+				batch->progname, pic->fname);
+		} else {
+			if (batch->type == VEO_OUT_PPM)
+				write_ppm (f, &pic->v, s.state.pixmap);
 #ifdef HAVE_PNG
-		else if (type == VEO_OUT_PNG)
-		  write_png (f, &v, flags);
+			else if (batch->type == VEO_OUT_PNG)
+				write_png (f, &pic->v, s.state.pixmap);
 #endif
+			fclose (f);
+		}
+		free_VeoPicture (&s.state);
+
+		for (i = 0; i < pic->num_records; i++)
+			free (pic->records[i]);
+		free (pic->records);
+		free (pic->sizes);
+		pic->records = NULL;
+		pic->num_records = 0;
+	}
 
-		fclose (f);
-	 }
-   else
-	 {
-		fprintf (stderr, "%s: can't write to %s\n", progname, fname);
-	 }
+	return NULL;
+}
 
+/***********************************************************************
+ *
+ * Function:    WritePictures
+ *
+ * Summary:     Decode and write all pictures of the batch on a pool of
+ *		worker threads, then empty the batch
+ *
+ * Parameters:  the batch, number of threads (0 for one per CPU)
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void WritePictures (struct batch *batch, int jobs)
+{
+	int i;
+#if HAVE_PTHREAD
+	pthread_t *threads;
+
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > batch->num_pictures)
+		jobs = batch->num_pictures;
+
+	pthread_mutex_init(&batch->lock, NULL);
+	threads = calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, batch_worker, batch))
+			break;
+	}
+	jobs = i;
+
+	/* if no thread could be started, do the work ourselves */
+	if (jobs == 0)
+		batch_worker(batch);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&batch->lock);
+#else
+	batch_worker(batch);
+#endif
+
+	for (i = 0; i < batch->num_pictures; i++)
+		free (batch->pictures[i].fname);
+	free (batch->pictures);
+	batch->pictures = NULL;
+	batch->num_pictures = batch->max_pictures = batch->next = 0;
 }
 
 int main (int argc, const char *argv[])
@@ -1006,8 +443,10 @@ int main (int argc, const char *argv[])
 	action = VEO_ACTION_OUTPUT,
 	dbcount = 0,
 	type = VEO_OUT_PPM,
-	bias = 50;
-	long flags = 0;
+	bias = 50,
+	jobs = 0;
+	int flags = 0;
+	struct batch batch;
 	struct DBInfo info;
 	pi_buffer_t *buf;
 
@@ -1031,6 +470,8 @@ int main (int argc, const char *argv[])
 		{"colour", 'c', POPT_ARG_VAL | POPT_ARGFLAG_OR, &flags,
 		 VEO_COLOUR_CORRECT,
 		 "colour correct the output colours", NULL},
+		{"jobs", 'j', POPT_ARG_INT, &jobs, 0,
+		 "Number of pictures converted in parallel (default: one per CPU)", "jobs"},
 		{"type", 't', POPT_ARG_STRING, &imgtype, 't',
 		 "Specify picture output type (ppm or png)", "[ppm|png]"},
 		POPT_TABLEEND
@@ -1057,7 +498,6 @@ int main (int argc, const char *argv[])
 				  bias = 50;
 			   }
 
-			 bias_factor = (double)bias / 100.0;
 			 flags |= VEO_BIAS;
 			 break;
 		   case 't':
@@ -1091,6 +531,12 @@ int main (int argc, const char *argv[])
    if (dlp_ReadUserInfo (sd, &User) < 0)
 	 goto error_close;
 
+   memset (&batch, 0, sizeof (batch));
+   batch.type = type;
+   batch.bias = bias;
+   batch.flags = flags;
+   batch.progname = "read-veo";
+
    buf = pi_buffer_new (sizeof (struct DBInfo));
 	for (;;) {
 		if (dlp_ReadDBList (sd, 0, 0x80, i, buf) < 0)
@@ -1108,15 +554,17 @@ int main (int argc, const char *argv[])
 				case VEO_ACTION_OUTPUT_ONE:
 				  if (strcmp (info.name, picname))
 					break;
+				  /* fall through */
 
 				case VEO_ACTION_OUTPUT:
 				if (dlp_OpenDB (sd, 0, 0x80 | 0x40, info.name, &db) < 0) {
 					   fprintf (stderr,"   ERROR:Unable to open Veo database on Palm.\n");
 					   dlp_AddSyncLogEntry (sd, "Unable to open Veo database.\n");
+					   WritePictures(&batch, jobs);
 					   goto error_close;
 					}
 
-				  WritePicture(sd, db, type, info.name, "read-veo", flags);
+				  ReadPicture(sd, db, info.name, &batch);
 
 
 				if (sd) {
@@ -1129,6 +577,8 @@ int main (int argc, const char *argv[])
 		  }
 	 }
     pi_buffer_free(buf);
+	WritePictures(&batch, jobs);
+
 	if (sd) {
 		dlp_AddSyncLogEntry (sd,
 							 "Successfully read Veo photos from Palm.\n"
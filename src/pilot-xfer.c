@@ -42,6 +42,7 @@
 #include "pi-debug.h"
 #include "pi-socket.h"
 #include "pi-file.h"
+#include "pi-archive.h"
 #include "pi-header.h"
 #include "pi-util.h"
 #include "pi-userland.h"
@@ -94,6 +95,8 @@ typedef enum {
 #define BACKUP      (0x0001)
 #define UPDATE      (0x0002)
 #define SYNC        (0x0004)
+#define PACKED      (0x0008)
+#define DELTA       (0x0010)
 
 #define MEDIA_MASK  (0x0f00)
 #define MEDIA_RAM   (0x0000)
@@ -578,6 +581,197 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 	dlp_AddSyncLogEntry(sd, synclog);
 }
 
+
+/***********************************************************************
+ *
+ * Function:    palm_backup_packed
+ *
+ * Summary:     Back up the Palm into a single-file archive instead of
+ *              a directory of PRC/PDB files
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+palm_backup_packed(const char *filename, unsigned long int flags, int unsaved)
+{
+	int		i		= 0,
+			j,
+			orig_total	= 0,
+			filecount	= 1,
+			failed		= 0,
+			skipped		= 0;
+	long		totalsize	= 0;
+	char		(*orig_names)[32] = NULL,
+			synclog[128];
+	const char	*synctext       = (flags & UPDATE) ? "Synchronizing" : "Backing up";
+	pi_archive_t	*ar;
+	pi_buffer_t	*buffer;
+
+	ar = (flags & UPDATE) ? pi_archive_open(filename, 1)
+		: pi_archive_create(filename);
+	if (ar == NULL)
+	{
+		fprintf(stderr, "\n   ERROR: Unable to open archive '%s'.\n\n",
+				filename);
+		return;
+	}
+
+	/* Remember what was there, to find what has gone from the Palm */
+	if ((flags & SYNC) && pi_archive_count(ar) > 0)
+	{
+		orig_total = pi_archive_count(ar);
+		orig_names = malloc(orig_total * sizeof(*orig_names));
+		if (orig_names == NULL)
+			orig_total = 0;
+		for (j = 0; j < orig_total; j++)
+			memcpy(orig_names[j], pi_archive_get_entry(ar, j)->name,
+					sizeof(orig_names[j]));
+	}
+
+	buffer = pi_buffer_new (sizeof(struct DBInfo));
+
+	for (;;)
+	{
+		struct DBInfo	info;
+		struct pi_file	*f;
+		const pi_archive_entry_t *entry;
+		int				excl;
+		char			crid[5];
+
+		if (!pi_socket_connected(sd))
+		{
+			printf("\n   Connection broken - Exiting. All data was not backed up\n");
+			pi_archive_close(ar);
+			exit(EXIT_FAILURE);
+		}
+
+		if (dlp_ReadDBList(sd, 0, ((flags & MEDIA_MASK)
+						? dlpDBListROM : dlpDBListRAM), i, buffer) < 0)
+			break;
+
+		memcpy(&info, buffer->data, sizeof(struct DBInfo));
+		i = info.index + 1;
+
+		pi_untag(crid,info.creator);
+
+		if (dlp_OpenConduit(sd) < 0)
+		{
+			printf("\n   Exiting on cancel, all data was not backed up"
+					"\n   Stopped before backing up: '%s'\n\n", info.name);
+			pi_archive_close(ar);
+			exit(EXIT_FAILURE);
+		}
+
+		if (palm_creator(info.creator))
+		{
+			printf("   [-][skip][%s] Skipping OS file '%s'.\n",
+					crid, info.name);
+			continue;
+		}
+
+		for (excl = 0; excl < numexclude; excl++)
+			if (strcmp(exclude[excl], info.name) == 0)
+				break;
+
+		/* Excluded databases are kept in the archive, same as with -s
+		   on a directory */
+		for (j = 0; j < orig_total; j++)
+			if (strcmp(orig_names[j], info.name) == 0)
+				orig_names[j][0] = '\0';
+
+		if (excl < numexclude)
+		{
+			printf("   [-][excl] Excluding '%s'...\n", info.name);
+			continue;
+		}
+
+		if (info.creator == pi_mktag('a', '6', '8', 'k'))
+		{
+			printf("   [-][a68k][PACE] Skipping '%s'\n", info.name);
+			skipped++;
+			continue;
+		}
+
+		if (!unsaved
+				&& strcmp(info.name, "Unsaved Preferences") == 0)
+		{
+			printf("   [-][unsv] Skipping '%s'\n", info.name);
+			continue;
+		}
+
+		entry = pi_archive_find(ar, info.name);
+		if (entry && (flags & UPDATE) && entry->modifyDate == info.modifyDate)
+		{
+			printf("   [-][unch] Unchanged, skipping %s\n", info.name);
+			continue;
+		}
+
+		info.flags &= ~(dlpDBFlagOpen | dlpDBFlagReadOnly);
+
+		printf("   [+][%-4d]", filecount);
+		printf("[%s] %s '%s'", crid, synctext, info.name);
+		fflush(NULL);
+
+		f = pi_file_create(info.name, &info);
+		if (f == 0)
+		{
+			printf("\nFailed, unable to create file.\n");
+			break;
+		} else if (pi_file_retrieve(f, sd, 0, NULL) < 0)
+		{
+			printf("\n   [-][fail][%s] Failed, unable to retrieve '%s' from the Palm.",
+				crid, info.name);
+			failed++;
+			pi_file_discard(f);
+		} else if (pi_archive_close_file(ar, f) < 0)
+		{
+			printf("\n   [-][fail][%s] Failed, unable to store '%s' in the archive.",
+				crid, info.name);
+			failed++;
+		} else {
+			entry = pi_archive_find(ar, info.name);
+			totalsize += entry->size;
+			printf(", %lu bytes, %ld KiB... ",
+					entry->size, totalsize/1024);
+			fflush(NULL);
+		}
+
+		filecount++;
+
+		printf("\n");
+	}
+	pi_buffer_free(buffer);
+
+	for (j = 0; j < orig_total; j++)
+	{
+		if (orig_names[j][0] == '\0')
+			continue;
+		printf("Removing '%s'.\n", orig_names[j]);
+		pi_archive_remove(ar, orig_names[j]);
+	}
+	free(orig_names);
+
+	if (pi_archive_close(ar) < 0)
+	{
+		fprintf(stderr, "\n   ERROR: Unable to write the index of '%s'.\n",
+				filename);
+		failed++;
+	}
+
+	printf("\n   %s backup complete.", media_name(flags & MEDIA_MASK));
+
+	printf(" %d files backed up, %d skipped, %d file%s failed.\n",
+			(filecount ? filecount - 1 : 0),
+			skipped, failed, (failed == 1) ? "" : "s");
+
+	snprintf(synclog, sizeof(synclog), "%d files successfully backed up.\n\n"
+			"Thank you for using pilot-link.", filecount - 1);
+	dlp_AddSyncLogEntry(sd, synclog);
+}
+
 /***********************************************************************
  *
  * Function:    fetch_progress
@@ -952,18 +1146,19 @@ compare(struct db *d1, struct db *d2)
  *
  * Summary:     Send files to the Palm from disk, restoring Palm
  *
- * Parameters:  None
+ * Parameters:  dirname, flags (DELTA to only send changed records)
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
 static void
-palm_restore(const char *dirname)
+palm_restore(const char *dirname, int flags)
 {
 	int				dbcount		= 0,
 					i,
 					j,
 					max,
+					result,
 					save_errno	= errno;
 	size_t			size;
 	DIR				*dir;
@@ -1096,7 +1291,160 @@ palm_restore(const char *dirname)
 			exit(EXIT_FAILURE);
 		}
 
-		if (pi_file_install(f, sd, 0, NULL) < 0)
+		if (flags & DELTA)
+			result = pi_file_install_delta(f, sd, 0, NULL, NULL);
+		else
+			result = pi_file_install(f, sd, 0, NULL);
+
+		if (result < 0)
+		{
+			printf("failed.\n");
+		} else {
+			printf("OK\n");
+		}
+
+		pi_file_close(f);
+	}
+
+	for (i = 0; i < dbcount; i++)
+	{
+		free(db[i]);
+	}
+	free(db);
+
+	printf("Restore done\n");
+}
+
+/***********************************************************************
+ *
+ * Function:    palm_restore_packed
+ *
+ * Summary:     Send every database in a single-file archive to the Palm
+ *
+ * Parameters:  filename, flags (DELTA to only send changed records)
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+palm_restore_packed(const char *filename, int flags)
+{
+	int				dbcount,
+					i,
+					j,
+					max,
+					result;
+	size_t			size;
+	pi_archive_t	*ar;
+	const pi_archive_entry_t *entry;
+	struct db		**db		= NULL;
+	struct pi_file	*f;
+	struct  CardInfo Card;
+
+	Card.card = -1;
+	Card.more = 1;
+
+	if ((ar = pi_archive_open(filename, 0)) == NULL)
+	{
+		fprintf(stderr, "\n   ERROR: Cannot open archive %s.\n"
+				"   Does the file exist?\n\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	dbcount = pi_archive_count(ar);
+	db = (struct db **) calloc(dbcount + 1, sizeof(struct db *));
+	if (!db)
+	{
+		printf("Unable to allocate memory for archive entry table\n");
+		pi_archive_close(ar);
+		exit(EXIT_FAILURE);
+	}
+
+	/* The index already has name, creator, type and flags; only the
+	   largest block needs a look at the database itself */
+	for (i = 0; i < dbcount; i++)
+	{
+		entry = pi_archive_get_entry(ar, i);
+
+		db[i] = (struct db *) malloc(sizeof(struct db));
+		if (!db[i])
+		{
+			printf("Unable to allocate memory for archive entry table\n");
+			while (--i >= 0)
+				free(db[i]);
+			free(db);
+			pi_archive_close(ar);
+			exit(EXIT_FAILURE);
+		}
+		strcpy(db[i]->name, entry->name);
+		db[i]->creator	= entry->creator;
+		db[i]->type		= entry->type;
+		db[i]->flags	= entry->flags;
+		db[i]->maxblock	= 0;
+
+		if ((f = pi_archive_open_file(ar, entry->name)) == NULL)
+			continue;
+
+		pi_file_get_entries(f, &max);
+		for (j = 0; j < max; j++)
+		{
+			if (entry->flags & dlpDBFlagResource)
+				pi_file_read_resource(f, j, 0, &size, 0, 0);
+			else
+				pi_file_read_record(f, j, 0, &size, 0, 0, 0);
+
+			if (size > db[i]->maxblock)
+				db[i]->maxblock = size;
+		}
+		pi_file_close(f);
+	}
+
+	for (i = 0; i < dbcount; i++)
+	{
+		for (j = i + 1; j < dbcount; j++)
+		{
+			if (compare(db[i], db[j]) > 0)
+			{
+				struct db *temp = db[i];
+
+				db[i] = db[j];
+				db[j] = temp;
+			}
+		}
+	}
+
+	for (i = 0; i < dbcount; i++)
+	{
+		f = pi_archive_open_file(ar, db[i]->name);
+		if (f == 0) {
+			printf("Unable to open '%s'!\n", db[i]->name);
+			break;
+		}
+		printf("Restoring %s... ", db[i]->name);
+		fflush(stdout);
+
+		while (Card.more)
+		{
+			if (dlp_ReadStorageInfo(sd, Card.card + 1, &Card) < 0)
+				break;
+		}
+
+		entry = pi_archive_find(ar, db[i]->name);
+		if (entry->size > Card.ramFree)
+		{
+			fprintf(stderr, "\n\n");
+			fprintf(stderr, "   Insufficient space to install this file on your Palm.\n");
+			fprintf(stderr, "   We needed %lu and only had %lu available..\n\n",
+				entry->size, Card.ramFree);
+			exit(EXIT_FAILURE);
+		}
+
+		if (flags & DELTA)
+			result = pi_file_install_delta(f, sd, 0, NULL, NULL);
+		else
+			result = pi_file_install(f, sd, 0, NULL);
+
+		if (result < 0)
 		{
 			printf("failed.\n");
 		} else {
@@ -1111,6 +1459,7 @@ palm_restore(const char *dirname)
 		free(db[i]);
 	}
 	free(db);
+	pi_archive_close(ar);
 
 	printf("Restore done\n");
 }
@@ -2339,6 +2688,8 @@ main(int argc, const char *argv[])
 		{"rom",       0 , POPT_ARG_NONE, NULL, MEDIA_FLASH, "Modifies -b, -u, and -s, to back up non-OS dbs from Flash ROM", NULL},
 		{"with-os",   0 , POPT_ARG_NONE, NULL, MEDIA_ROM, "Modifies -b, -u, and -s, to back up OS dbs from Flash ROM", NULL},
 		{"illegal",   0 , POPT_ARG_NONE, &unsaved, 0, "Modifies -b, -u, and -s, to back up the illegal database Unsaved Preferences.prc (normally skipped)", NULL},
+		{"packed",   'k', POPT_BIT_SET, &sync_flags, PACKED, "Modifies -b, -u, -s and -r to use a single-file archive <file> instead of <dir>", NULL},
+		{"delta",     0 , POPT_BIT_SET, &sync_flags, DELTA, "Modifies -r to only send the records that differ from those on the Palm", NULL},
 
 		/* misc */
 		{"exec",     'x', POPT_ARG_STRING, NULL, 'x', "Execute a shell command for intermediate processing", "command"},
@@ -2349,7 +2700,7 @@ main(int argc, const char *argv[])
 		"\n"
 		"   Sync, backup, install, delete and more from your Palm device.\n"
 		"   This is the swiss-army-knife of the entire pilot-link suite.\n\n"
-		"   Use exactly one of -brsudfimlI; mix in -aexDPv, --rom and --with-os.\n\n";
+		"   Use exactly one of -brsudfimlI; mix in -aekxDPv, --rom and --with-os.\n\n";
 
 	pc = poptGetContext("pilot-xfer", argc, argv, options, 0);
 
@@ -2471,7 +2822,23 @@ main(int argc, const char *argv[])
 				return 1;
 			}
 
-                        if (stat (dirname, &sbuf) == 0)
+			if (sync_flags & PACKED)
+			{
+				if (archive_dir)
+				{
+					fprintf(stderr,"   ERROR: Cannot combine -a with a packed archive (-k).\n\n");
+					return 1;
+				}
+				if (stat (dirname, &sbuf) == 0 && S_ISDIR (sbuf.st_mode))
+				{
+					fprintf(stderr, "   ERROR: '%s' is a directory.\n"
+							"   Please supply an archive file name when using -k "
+							"and try again.\n\n", dirname);
+					fprintf(stderr,gracias);
+					return 1;
+				}
+			}
+                        else if (stat (dirname, &sbuf) == 0)
 			{
 				if (!S_ISDIR (sbuf.st_mode))
 				{
@@ -2536,10 +2903,16 @@ main(int argc, const char *argv[])
 				sync_flags |= UPDATE;
 			if (palm_op_sync == palm_operation)
 				sync_flags |= UPDATE | SYNC;
-			palm_backup(dirname, sync_flags, unsaved, archive_dir);
+			if (sync_flags & PACKED)
+				palm_backup_packed(dirname, sync_flags, unsaved);
+			else
+				palm_backup(dirname, sync_flags, unsaved, archive_dir);
 			break;
 		case palm_op_restore:
-			palm_restore(dirname);
+			if (sync_flags & PACKED)
+				palm_restore_packed(dirname, sync_flags);
+			else
+				palm_restore(dirname, sync_flags);
 			break;
 		case palm_op_merge:
 		case palm_op_install:
@@ -0,0 +1,364 @@
+/*
+ * $Id$
+ *
+ * archive-test.c: Check the single-file backup archive
+ *
+ * Record and resource databases are stored in a new archive, which is
+ * then listed and every member read back and compared with what was
+ * stored. Members are replaced and removed, and the archive must show
+ * the change once reopened. Damaged copies of the archive, truncated or
+ * with a bad magic, index offset, entry count, member bounds or index
+ * order, must be refused.
+ *
+ * Usage: archive-test
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-archive.h"
+#include "pi-macros.h"
+#include "pi-util.h"
+
+#define ARCHIVE_FILE	"archive-test.pba"
+#define DAMAGED_FILE	"archive-test-damaged.pba"
+#define DATABASES	12
+#define RECORDS		20
+#define HEADER_SIZE	8
+#define ENTRY_SIZE	64
+#define TRAILER_SIZE	16
+
+static int failed = 0;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Databases are stored in reverse name order, so the index has to sort
+   them; the last one holds resources */
+static void db_name(char *name, int n)
+{
+	sprintf(name, "Test DB %02d", DATABASES - 1 - n);
+}
+
+static size_t record_data(char *buf, int db, int record, int revision)
+{
+	return (size_t) sprintf(buf, "db %d record %d revision %d", db,
+		record, revision);
+}
+
+/* Store a database in the archive */
+static int store(pi_archive_t *ar, int n, int revision)
+{
+	int 	i,
+		resource = n == DATABASES - 1;
+	char 	buf[64];
+	size_t	size;
+	struct 	DBInfo info;
+	pi_file_t *pf;
+
+	memset(&info, 0, sizeof(info));
+	db_name(info.name, n);
+	info.flags = resource ? dlpDBFlagResource : dlpDBFlagBackup;
+	info.version = n;
+	info.type = resource ? pi_mktag('a', 'p', 'p', 'l')
+		: pi_mktag('D', 'A', 'T', 'A');
+	info.creator = pi_mktag('t', 's', 't', 'a' + n);
+
+	if ((pf = pi_file_create(info.name, &info)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	for (i = 0; i < RECORDS; i++) {
+		size = record_data(buf, n, i, revision);
+		if (resource)
+			pi_file_append_resource(pf, buf, size,
+				pi_mktag('c', 'o', 'd', 'e'), i);
+		else
+			pi_file_append_record(pf, buf, size, 0, i % 16,
+				(recordid_t) (i + 1));
+	}
+	return pi_archive_close_file(ar, pf);
+}
+
+/* Read a member back and check it holds what store() put in it */
+static int extract(pi_archive_t *ar, int n, int revision)
+{
+	int 	i,
+		entries,
+		attr,
+		category,
+		resource_id,
+		resource = n == DATABASES - 1;
+	char 	name[34],
+		buf[64];
+	void 	*data;
+	size_t	size;
+	unsigned long type;
+	recordid_t uid;
+	struct 	DBInfo info;
+	pi_file_t *pf;
+
+	db_name(name, n);
+	if ((pf = pi_archive_open_file(ar, name)) == NULL)
+		return 0;
+
+	pi_file_get_info(pf, &info);
+	pi_file_get_entries(pf, &entries);
+	if (strcmp(info.name, name) != 0 || entries != RECORDS
+	    || (int) info.version != n) {
+		pi_file_close(pf);
+		return 0;
+	}
+
+	for (i = 0; i < RECORDS; i++) {
+		size = record_data(buf, n, i, revision);
+		if (resource) {
+			if (pi_file_read_resource(pf, i, &data, &size, &type,
+					&resource_id) < 0
+			    || type != pi_mktag('c', 'o', 'd', 'e')
+			    || resource_id != i)
+				break;
+		} else {
+			if (pi_file_read_record(pf, i, &data, &size, &attr,
+					&category, &uid) < 0
+			    || category != i % 16 || uid != (recordid_t) i + 1)
+				break;
+		}
+		if (size != strlen(buf) || memcmp(data, buf, size) != 0)
+			break;
+	}
+	pi_file_close(pf);
+	return i == RECORDS;
+}
+
+/* Check the index lists the databases in name order */
+static int listed(pi_archive_t *ar, int count, int missing)
+{
+	int 	i,
+		n;
+	char 	name[34];
+	const pi_archive_entry_t *entry;
+
+	if (pi_archive_count(ar) != count)
+		return 0;
+	for (i = 0; i < count; i++) {
+		entry = pi_archive_get_entry(ar, i);
+		n = DATABASES - 1 - i;
+		if (n <= missing)
+			n--;
+		db_name(name, n);
+		if (entry == NULL || strcmp(entry->name, name) != 0
+		    || entry->creator != pi_mktag('t', 's', 't', 'a' + n)
+		    || entry->version != n
+		    || (entry->flags & dlpDBFlagResource)
+			!= (n == DATABASES - 1 ? dlpDBFlagResource : 0))
+			return 0;
+	}
+	return pi_archive_get_entry(ar, count) == NULL;
+}
+
+static void create_and_list(void)
+{
+	int 	i,
+		ok;
+	char 	name[34];
+	pi_archive_t *ar;
+
+	ar = pi_archive_create(ARCHIVE_FILE);
+	expect("archive created", ar != NULL);
+	if (ar == NULL)
+		return;
+	for (i = 0, ok = 1; i < DATABASES; i++)
+		ok = ok && store(ar, i, 0) >= 0;
+	expect("databases stored", ok);
+	expect("archive closed", pi_archive_close(ar) == 0);
+
+	ar = pi_archive_open(ARCHIVE_FILE, 0);
+	expect("archive opened", ar != NULL);
+	if (ar == NULL)
+		return;
+	expect("archive listed", listed(ar, DATABASES, -1));
+	for (i = 0, ok = 1; i < DATABASES; i++)
+		ok = ok && extract(ar, i, 0);
+	expect("databases extracted", ok);
+	expect("unknown database", pi_archive_find(ar, "No Such DB") == NULL
+		&& pi_archive_open_file(ar, "No Such DB") == NULL);
+	expect("read-only archive", store(ar, 0, 1) < 0);
+	pi_archive_close(ar);
+
+	/* replace one database and remove another */
+	ar = pi_archive_open(ARCHIVE_FILE, 1);
+	expect("archive opened for writing", ar != NULL);
+	if (ar == NULL)
+		return;
+	expect("database replaced", store(ar, 3, 1) >= 0);
+	db_name(name, 5);
+	expect("database removed", pi_archive_remove(ar, name) >= 0);
+	expect("removed database", pi_archive_remove(ar, name) < 0);
+	expect("archive closed after changes", pi_archive_close(ar) == 0);
+
+	ar = pi_archive_open(ARCHIVE_FILE, 0);
+	expect("changed archive opened", ar != NULL);
+	if (ar == NULL)
+		return;
+	expect("changed archive listed", listed(ar, DATABASES - 1, 5));
+	expect("replacement extracted", extract(ar, 3, 1));
+	expect("others unchanged", extract(ar, 4, 0) && extract(ar, 6, 0)
+		&& extract(ar, DATABASES - 1, 0));
+	expect("removed database gone", pi_archive_find(ar, name) == NULL);
+	pi_archive_close(ar);
+}
+
+/* Write a damaged copy of the archive and check it is refused */
+static void expect_refused(const char *what, const unsigned char *image,
+	size_t size)
+{
+	FILE 	*f;
+	pi_archive_t *ar;
+
+	if ((f = fopen(DAMAGED_FILE, "wb")) == NULL
+	    || fwrite(image, 1, size, f) != size || fclose(f) != 0) {
+		expect("damaged copy written", 0);
+		return;
+	}
+	ar = pi_archive_open(DAMAGED_FILE, 0);
+	expect(what, ar == NULL);
+	if (ar != NULL)
+		pi_archive_close(ar);
+}
+
+static void damaged(void)
+{
+	long 	size;
+	unsigned long index_offset;
+	unsigned char *image,
+		*copy,
+		*trailer,
+		*entry,
+		temp[ENTRY_SIZE];
+	FILE 	*f;
+
+	if ((f = fopen(ARCHIVE_FILE, "rb")) == NULL) {
+		expect("archive readable", 0);
+		return;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	image = malloc((size_t) size);
+	copy = malloc((size_t) size);
+	if (image == NULL || copy == NULL
+	    || fread(image, 1, (size_t) size, f) != (size_t) size) {
+		expect("archive read", 0);
+		fclose(f);
+		free(image);
+		free(copy);
+		return;
+	}
+	fclose(f);
+
+	/* the intact copy must be accepted, or the rest means nothing */
+	trailer = image + size - TRAILER_SIZE;
+	index_offset = get_long(trailer);
+	expect("trailer", get_long(trailer + 4) == DATABASES - 1
+		&& index_offset + (DATABASES - 1) * ENTRY_SIZE
+			+ TRAILER_SIZE == (unsigned long) size);
+	expect_refused("empty file", image, 0);
+	memcpy(copy, image, (size_t) size);
+	f = fopen(DAMAGED_FILE, "wb");
+	if (f != NULL) {
+		fwrite(copy, 1, (size_t) size, f);
+		fclose(f);
+	}
+	expect("intact copy accepted", f != NULL
+		&& pi_archive_close(pi_archive_open(DAMAGED_FILE, 0)) == 0);
+
+	expect_refused("header only", image, HEADER_SIZE);
+	expect_refused("truncated trailer", image, (size_t) size - 1);
+	expect_refused("truncated index", image, (size_t) size
+		- TRAILER_SIZE - ENTRY_SIZE / 2);
+	expect_refused("truncated images", image, (size_t) index_offset);
+
+	memcpy(copy, image, (size_t) size);
+	copy[0] ^= 0xff;
+	expect_refused("bad header magic", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	copy[size - 1] ^= 0xff;
+	expect_refused("bad trailer magic", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	set_long(copy + size - TRAILER_SIZE, index_offset + ENTRY_SIZE);
+	expect_refused("bad index offset", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	set_long(copy + size - TRAILER_SIZE + 4, DATABASES);
+	expect_refused("bad entry count", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	set_long(copy + size - TRAILER_SIZE + 4, 0xfffffff0UL);
+	expect_refused("huge entry count", copy, (size_t) size);
+
+	/* a member reaching into the index */
+	memcpy(copy, image, (size_t) size);
+	entry = copy + index_offset;
+	set_long(entry + 48, index_offset);
+	expect_refused("member past its end", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	set_long(entry + 44, 2);
+	expect_refused("member in the header", copy, (size_t) size);
+
+	memcpy(copy, image, (size_t) size);
+	memcpy(temp, entry, ENTRY_SIZE);
+	memcpy(entry, entry + ENTRY_SIZE, ENTRY_SIZE);
+	memcpy(entry + ENTRY_SIZE, temp, ENTRY_SIZE);
+	expect_refused("index out of order", copy, (size_t) size);
+
+	free(image);
+	free(copy);
+}
+
+int main(int argc, char *argv[])
+{
+	create_and_list();
+	damaged();
+
+	unlink(ARCHIVE_FILE);
+	unlink(DAMAGED_FILE);
+
+	if (failed) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
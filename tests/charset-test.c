@@ -0,0 +1,315 @@
+/*
+ * $Id$
+ *
+ * charset-test.c: Check the built-in CP1252 <-> UTF-8 conversions
+ *
+ * Every CP1252 byte is converted to UTF-8 and back, and must give the
+ * Unicode character it stands for; the bytes CP1252 leaves undefined
+ * must be refused. Invalid, overlong and truncated UTF-8 sequences, and
+ * characters CP1252 lacks, must be refused the other way. Then random
+ * strings, with high bytes at every offset so the eight-at-a-time ASCII
+ * scan stops in each position, go through the batch conversions and
+ * must match the conversions done one string at a time. Last, text
+ * appended with undefined bytes replaced must keep the rest intact.
+ *
+ * Usage: charset-test [strings]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-util.h"
+
+#define DEFAULT_STRINGS		2000
+#define MAX_LENGTH		40
+
+static int failed = 0;
+
+/* What CP1252 0x80 to 0x9F stand for, 0 where undefined */
+static const unsigned int high[32] = {
+	0x20AC, 0,      0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017D, 0,
+	0,      0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0,      0x017E, 0x0178
+};
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Decode the single UTF-8 character a string should hold, or return 0 */
+static unsigned int decode(const unsigned char *s)
+{
+	unsigned int u;
+	int 	n,
+		i;
+
+	if (s[0] < 0x80)
+		return s[1] == 0 ? s[0] : 0;
+	if ((s[0] & 0xE0) == 0xC0) {
+		u = s[0] & 0x1F;
+		n = 1;
+	} else if ((s[0] & 0xF0) == 0xE0) {
+		u = s[0] & 0x0F;
+		n = 2;
+	} else {
+		return 0;
+	}
+	for (i = 1; i <= n; i++) {
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+		u = (u << 6) | (s[i] & 0x3F);
+	}
+	return s[n + 1] == 0 ? u : 0;
+}
+
+static void every_byte(void)
+{
+	int 	c;
+	char 	in[2],
+		*utf8,
+		*back,
+		what[64];
+	unsigned int u;
+
+	for (c = 1; c < 256; c++) {
+		in[0] = c;
+		in[1] = '\0';
+		u = (c >= 0x80 && c < 0xA0) ? high[c - 0x80] : (unsigned int) c;
+
+		if (convert_FromPilotChar_WithCharset("UTF-8", in, 1, &utf8,
+				"CP1252") < 0) {
+			sprintf(what, "0x%02X to UTF-8", c);
+			expect(what, u == 0);
+			continue;
+		}
+		sprintf(what, "0x%02X is U+%04X", c, u);
+		expect(what, u != 0 && decode((unsigned char *) utf8) == u);
+
+		sprintf(what, "U+%04X back to CP1252", u);
+		if (convert_ToPilotChar_WithCharset("UTF-8", utf8,
+				strlen(utf8), &back, "CP1252") < 0) {
+			expect(what, 0);
+		} else {
+			expect(what, strcmp(back, in) == 0);
+			free(back);
+		}
+		free(utf8);
+	}
+}
+
+static void invalid_utf8(void)
+{
+	static const struct {
+		const char *text,
+			*what;
+	} bad[] = {
+		{ "\x80",			"lone continuation byte" },
+		{ "a\xBF" "b",			"continuation byte after ASCII" },
+		{ "\xFF",			"invalid lead byte" },
+		{ "\xC0\xAF",			"overlong '/'" },
+		{ "\xC1\xBF",			"overlong two byte sequence" },
+		{ "\xE0\x80\xAF",		"overlong three byte sequence" },
+		{ "\xE0\x9F\xBF",		"overlong U+07FF" },
+		{ "\xE0\x83\xA9",		"overlong e acute" },
+		{ "\xC3",			"truncated two byte sequence" },
+		{ "abc\xE2\x82",		"truncated three byte sequence" },
+		{ "\xE2\x82" "A",		"three byte sequence cut short" },
+		{ "\xC3\xC3\xA9",		"lead byte for continuation" },
+		{ "\xF0\x9F\x98\x80",		"four byte sequence" },
+		{ "\xED\xA0\x80",		"surrogate" },
+		{ "\xC4\x80",			"U+0100, not in CP1252" },
+		{ "\xC2\x81",			"U+0081, undefined in CP1252" },
+		{ "\xE2\x82\xAD",		"U+20AD, not in CP1252" },
+		{ NULL,				NULL }
+	};
+	int 	i;
+	char 	*out,
+		what[80];
+
+	for (i = 0; bad[i].text != NULL; i++) {
+		out = NULL;
+		sprintf(what, "refuse %s", bad[i].what);
+		expect(what, convert_ToPilotChar_WithCharset("UTF-8",
+			bad[i].text, strlen(bad[i].text), &out, "CP1252") < 0
+			&& out == NULL);
+	}
+
+	/* Only the bytes asked for are converted */
+	expect("byte count", convert_ToPilotChar_WithCharset("UTF-8",
+		"caf\xC3\xA9\xC3", 5, &out, "CP1252") == 0
+		&& strcmp(out, "caf\xE9") == 0);
+	free(out);
+	expect("truncated by byte count", convert_ToPilotChar_WithCharset(
+		"UTF-8", "caf\xC3\xA9", 4, &out, "CP1252") < 0);
+	expect("empty string", convert_FromPilotChar_WithCharset("UTF-8",
+		"", 0, &out, "CP1252") == 0 && out[0] == '\0');
+	free(out);
+}
+
+static void replacing(void)
+{
+	pi_buffer_t *buf = pi_buffer_new(4);
+
+	expect("replace undefined bytes", convert_FromPilotChar_Append(
+		"UTF-8", "CP1252", "\x81" "caf\xE9\x9D", 6, buf) == 0
+		&& buf->used == 12 && strcmp((char *) buf->data,
+			"\xEF\xBF\xBD" "caf\xC3\xA9\xEF\xBF\xBD") == 0);
+	expect("append after", convert_FromPilotChar_Append("UTF-8",
+		"CP1252", "\x80", 1, buf) == 0 && buf->used == 16
+		&& strcmp((char *) buf->data + 12, "\xE2\x82\xAC") == 0);
+	expect("replace broken UTF-8", convert_FromPilotChar_Append("CP1252",
+		"UTF-8", "a\xE2\x82" "b\xC4\x80\xC3\xA9", 8, buf) == 0
+		&& strcmp((char *) buf->data + 16, "a??b?\xE9") == 0);
+	pi_buffer_free(buf);
+}
+
+/* A random CP1252 string, avoiding the undefined bytes */
+static int random_text(char *s)
+{
+	int 	n = rand() % MAX_LENGTH,
+		i,
+		c;
+
+	for (i = 0; i < n; i++) {
+		do {
+			c = rand() % 4 ? ' ' + rand() % 95 : 0x80 + rand() % 128;
+		} while (c >= 0x80 && c < 0xA0 && high[c - 0x80] == 0);
+		s[i] = c;
+	}
+	s[n] = '\0';
+	return n;
+}
+
+static void batches(int strings)
+{
+	int 	i,
+		*bytes;
+	char 	*texts,
+		**in,
+		**utf8,
+		**back,
+		*arena,
+		*back_arena,
+		*one;
+
+	texts = malloc(strings * (MAX_LENGTH + 1));
+	in = malloc(strings * sizeof(char *));
+	utf8 = malloc(strings * sizeof(char *));
+	back = malloc(strings * sizeof(char *));
+	bytes = malloc(strings * sizeof(int));
+	if (!texts || !in || !utf8 || !back || !bytes) {
+		printf("FAILED: out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < strings; i++) {
+		in[i] = texts + i * (MAX_LENGTH + 1);
+		bytes[i] = random_text(in[i]);
+	}
+	/* NULL entries give NULL results */
+	in[strings / 2] = NULL;
+
+	if (convert_FromPilotChar_Batch("UTF-8", "CP1252", strings,
+			(const char *const *) in, bytes, utf8, &arena) < 0) {
+		expect("batch to UTF-8", 0);
+		goto done;
+	}
+	for (i = 0; i < strings; i++) {
+		if (in[i] == NULL) {
+			expect("NULL entry", utf8[i] == NULL);
+			continue;
+		}
+		if (convert_FromPilotChar_WithCharset("UTF-8", in[i],
+				bytes[i], &one, "CP1252") < 0) {
+			expect("single string to UTF-8", 0);
+			continue;
+		}
+		if (strcmp(one, utf8[i]) != 0) {
+			printf("FAILED: batch string %d differs\n", i);
+			failed = 1;
+		}
+		free(one);
+		bytes[i] = strlen(utf8[i]);
+	}
+
+	if (convert_ToPilotChar_Batch("UTF-8", "CP1252", strings,
+			(const char *const *) utf8, bytes, back,
+			&back_arena) < 0) {
+		expect("batch to CP1252", 0);
+	} else {
+		for (i = 0; i < strings; i++)
+			if (in[i] != NULL && strcmp(back[i], in[i]) != 0) {
+				printf("FAILED: string %d doesn't round "
+					"trip\n", i);
+				failed = 1;
+			}
+		free(back_arena);
+	}
+
+	/* One bad string fails the whole batch */
+	utf8[strings - 1] = "\xC3";
+	bytes[strings - 1] = 1;
+	back_arena = (char *) &back_arena;
+	expect("batch with a bad string", convert_ToPilotChar_Batch("UTF-8",
+		"CP1252", strings, (const char *const *) utf8, bytes, back,
+		&back_arena) < 0 && back_arena == NULL);
+	free(arena);
+
+done:
+	free(texts);
+	free(in);
+	free(utf8);
+	free(back);
+	free(bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	int 	strings = DEFAULT_STRINGS;
+
+	if (argc > 1)
+		strings = atoi(argv[1]);
+	if (strings < 2) {
+		fprintf(stderr, "Usage: %s [strings]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	every_byte();
+	invalid_utf8();
+	batches(strings);
+	replacing();
+
+	if (failed)
+		printf("FAILED\n");
+	else
+		printf("All tests passed\n");
+	return failed;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,246 @@
+/*
+ * $Id$
+ *
+ * csv-test.c: Check the CSV reader and writer
+ *
+ * A few hand written records check quoting, CRLF line ends, comments,
+ * extra separators and unterminated quotes. Then random records, whose
+ * fields hold quotes, delimiters, line ends, backslashes and blanks, are
+ * written and read back with each delimiter and set of flags, and must
+ * come back unchanged. Some fields are longer than the read buffer, so
+ * records straddle refills and the buffer has to grow. The time taken
+ * to read and write is reported.
+ *
+ * Usage: csv-test [records]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-csv.h"
+
+#define DEFAULT_RECORDS		20000
+#define FIELDS			8
+
+static int failed = 0;
+
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/* Open a temporary stream holding text */
+static FILE *text_stream(const char *text)
+{
+	FILE 	*f = tmpfile();
+
+	if (f == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	fputs(text, f);
+	rewind(f);
+	return f;
+}
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Check the next record read has the fields listed, '|' separated */
+static void expect_record(pi_csv_reader_t *r, const char *fields,
+	const char *what)
+{
+	int 	n = pi_csv_read_record(r),
+		i;
+	char 	*copy = strdup(fields),
+		*s,
+		*next;
+
+	for (i = 0, s = copy; s != NULL; i++, s = next) {
+		next = strchr(s, '|');
+		if (next)
+			*next++ = '\0';
+		if (i >= n || strcmp(r->fields[i].data, s) != 0
+		    || r->fields[i].len != strlen(s)) {
+			printf("FAILED: %s: field %d is '%s', not '%s'\n",
+				what, i, i < n ? r->fields[i].data : "(none)",
+				s);
+			failed = 1;
+		}
+	}
+	if (i != n) {
+		printf("FAILED: %s: %d fields, not %d\n", what, n, i);
+		failed = 1;
+	}
+	free(copy);
+}
+
+static void hand_written(void)
+{
+	FILE 	*f;
+	pi_csv_reader_t *r;
+	pi_csv_labels_t t;
+	char 	labels[4][16] = { "Work", "", "HOME", "work" };
+
+	f = text_stream("a,\"b \"\"x\"\"\",c\r\n"
+		"\"multi\r\nline\",,\n"
+		"\n"
+		"\"tail\"junk,z");
+	r = pi_csv_reader_new(f, ',', 0);
+	expect_record(r, "a|b \"x\"|c", "quotes and CRLF");
+	expect_record(r, "multi\r\nline||", "line end in quotes");
+	expect_record(r, "", "blank line");
+	expect_record(r, "tailjunk|z", "data after the quote, no final line end");
+	expect("end of stream", pi_csv_read_record(r) == 0);
+	pi_csv_reader_free(r);
+	fclose(f);
+
+	f = text_stream("# comment \"unbalanced\n"
+		"  \"cat\" ; \"Work\";\"Smith\",  plain  ,x\\ty\\q\n"
+		"\"open");
+	r = pi_csv_reader_new(f, ',',
+		PI_CSV_TRIM | PI_CSV_COMMENTS | PI_CSV_BACKSLASH);
+	r->separators = ";";
+	expect("separators", pi_csv_read_record(r) == 5
+		&& r->fields[0].term == ';' && r->fields[1].term == ';'
+		&& r->fields[2].term == ',' && r->fields[4].term == '\n'
+		&& r->fields[0].quoted && !r->fields[3].quoted);
+	expect("trimmed", strcmp(r->fields[3].data, "plain  ") == 0);
+	expect("escapes", strcmp(r->fields[4].data, "x\ty\\q") == 0);
+	expect_record(r, "open", "unterminated quote");
+	pi_csv_reader_free(r);
+	fclose(f);
+
+	pi_csv_labels_init(&t, labels[0], 4, sizeof(labels[0]));
+	expect("label case", pi_csv_labels_find(&t, "WORK") == 0);
+	expect("label index", pi_csv_labels_find(&t, "home") == 2);
+	expect("empty label", pi_csv_labels_find(&t, "") == -1);
+	expect("missing label", pi_csv_labels_find(&t, "Fax") == -1);
+	expect("label width",
+		pi_csv_labels_find(&t, "home is where the heart is") == -1);
+}
+
+static char *random_field(int big)
+{
+	static const char chars[] = "abcXYZ019 \t\"\\,;\n\r'#";
+	int 	len = big ? 70000 + rand() % 10000 : rand() % 24,
+		i;
+	char 	*s = malloc(len + 1);
+
+	for (i = 0; i < len; i++)
+		s[i] = chars[rand() % (sizeof(chars) - 1)];
+	s[len] = '\0';
+	return s;
+}
+
+static void round_trip(int records, int delimiter, int wflags, int rflags)
+{
+	char 	**fields = malloc(records * FIELDS * sizeof(char *));
+	FILE 	*f = tmpfile();
+	pi_csv_writer_t w;
+	pi_csv_reader_t *r;
+	int 	i,
+		j,
+		n;
+	double 	start;
+	long 	size;
+
+	pi_csv_writer_init(&w, f, delimiter, wflags);
+	for (i = 0; i < records * FIELDS; i++)
+		fields[i] = random_field(i % 5003 == 17);
+
+	start = now();
+	for (i = 0; i < records; i++)
+		for (j = 0; j < FIELDS; j++)
+			if (pi_csv_write_field(&w, fields[i * FIELDS + j],
+					j < FIELDS - 1 ? 0 : '\n') < 0)
+				failed = 1;
+	fflush(f);
+	size = ftell(f);
+	printf("delimiter 0x%02x, flags %d/%d: wrote %ld bytes in %.3fs",
+		delimiter, wflags, rflags, size, now() - start);
+
+	rewind(f);
+	r = pi_csv_reader_new(f, delimiter, rflags);
+	start = now();
+	for (i = 0; (n = pi_csv_read_record(r)) > 0; i++) {
+		if (i >= records || n != FIELDS) {
+			printf("\nFAILED: record %d has %d fields\n", i, n);
+			failed = 1;
+			break;
+		}
+		for (j = 0; j < FIELDS; j++)
+			if (strcmp(r->fields[j].data,
+					fields[i * FIELDS + j]) != 0) {
+				printf("\nFAILED: record %d field %d differs\n",
+					i, j);
+				failed = 1;
+				break;
+			}
+	}
+	printf(", read in %.3fs\n", now() - start);
+	if (i != records) {
+		printf("FAILED: read %d records of %d\n", i, records);
+		failed = 1;
+	}
+
+	pi_csv_reader_free(r);
+	fclose(f);
+	for (i = 0; i < records * FIELDS; i++)
+		free(fields[i]);
+	free(fields);
+}
+
+int main(int argc, char *argv[])
+{
+	int 	records = DEFAULT_RECORDS;
+
+	if (argc > 1)
+		records = atoi(argv[1]);
+	if (records < 1) {
+		fprintf(stderr, "Usage: %s [records]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	hand_written();
+	round_trip(records, ',', 0, 0);
+	round_trip(records, ';', PI_CSV_QUOTE_ALL, 0);
+	round_trip(records, '\t', PI_CSV_BACKSLASH, PI_CSV_BACKSLASH);
+	round_trip(records, ',', PI_CSV_BACKSLASH | PI_CSV_QUOTE_ALL,
+		PI_CSV_BACKSLASH | PI_CSV_TRIM | PI_CSV_COMMENTS);
+
+	if (failed)
+		printf("FAILED\n");
+	else
+		printf("All tests passed\n");
+	return failed;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,458 @@
+/*
+ * $Id$
+ *
+ * diff-test.c: Check the database diff and its patch format
+ *
+ * A target database is made from a base one by removing, modifying,
+ * re-categorizing and adding records, and changing the appInfo block.
+ * Their diff is written as a patch and read back, and must come back
+ * unchanged. The patch is then applied to the base database, taking the
+ * record contents from the target as a patch is meant to be used, and
+ * the result must not differ from the target. A resource database diff
+ * is round tripped too. Patches with a truncated header, missing lines,
+ * a wrong entry count, an unknown version or an unknown change must be
+ * rejected.
+ *
+ * Usage: diff-test
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-diff.h"
+#include "pi-util.h"
+
+#define BASE_FILE	"diff-test-base.pdb"
+#define TARGET_FILE	"diff-test-target.pdb"
+#define APPLIED_FILE	"diff-test-applied.pdb"
+#define RECORDS		300
+#define ADDED		25
+
+static int failed = 0;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Open a temporary stream holding text */
+static FILE *text_stream(const char *text)
+{
+	FILE 	*f = tmpfile();
+
+	if (f == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	fputs(text, f);
+	rewind(f);
+	return f;
+}
+
+static pi_file_t *new_file(const char *name, int resource)
+{
+	struct 	DBInfo info;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "DiffTestDB");
+	info.flags = resource ? dlpDBFlagResource : 0;
+	info.type = pi_mktag('D', 'A', 'T', 'A');
+	info.creator = pi_mktag('d', 'i', 'f', 'f');
+	return pi_file_create(name, &info);
+}
+
+/* Fill a record with data that depends on its ID and a revision */
+static size_t record_data(char *buf, recordid_t uid, int revision)
+{
+	return (size_t) sprintf(buf, "record %lu revision %d %.*s",
+		(unsigned long) uid, revision, (int) (uid % 40),
+		"........................................");
+}
+
+/* Write the base and target databases. Every 7th record is removed,
+   every 11th modified, every 13th moved to another category, and new
+   records are added at the end. Returns the numbers of each. */
+static void make_files(int *removed, int *modified, int *attributes)
+{
+	int 	i;
+	char 	buf[128];
+	size_t	size;
+	pi_file_t *base = new_file(BASE_FILE, 0),
+		*target = new_file(TARGET_FILE, 0);
+
+	*removed = *modified = *attributes = 0;
+	pi_file_set_app_info(base, "old categories", 14);
+	pi_file_set_app_info(target, "new categories!", 15);
+
+	for (i = 1; i <= RECORDS; i++) {
+		size = record_data(buf, i, 0);
+		pi_file_append_record(base, buf, size, 0, i % 16, i);
+
+		if (i % 7 == 0) {
+			(*removed)++;
+			continue;
+		}
+		if (i % 11 == 0) {
+			(*modified)++;
+			size = record_data(buf, i, 1);
+		}
+		if (i % 13 == 0 && i % 11 != 0) {
+			(*attributes)++;
+			pi_file_append_record(target, buf, size, 0,
+				(i + 1) % 16, i);
+		} else {
+			pi_file_append_record(target, buf, size, 0, i % 16, i);
+		}
+	}
+	for (i = 0; i < ADDED; i++) {
+		size = record_data(buf, 1000 + i, 0);
+		pi_file_append_record(target, buf, size, 0, 3, 1000 + i);
+	}
+
+	pi_file_close(base);
+	pi_file_close(target);
+}
+
+static int same_diff(const pi_diff_t *a, const pi_diff_t *b)
+{
+	int 	i;
+
+	if (strcmp(a->name, b->name) != 0
+	    || a->resource_flag != b->resource_flag
+	    || a->app_info_changed != b->app_info_changed
+	    || a->old_app_info_hash != b->old_app_info_hash
+	    || a->new_app_info_hash != b->new_app_info_hash
+	    || a->sort_info_changed != b->sort_info_changed
+	    || a->added != b->added || a->removed != b->removed
+	    || a->modified != b->modified
+	    || a->attributes != b->attributes
+	    || a->num_entries != b->num_entries)
+		return 0;
+
+	for (i = 0; i < a->num_entries; i++) {
+		const pi_diff_entry_t *x = &a->entries[i],
+			*y = &b->entries[i];
+
+		if (x->change != y->change || x->uid != y->uid
+		    || x->type != y->type
+		    || x->resource_id != y->resource_id
+		    || x->old_attrs != y->old_attrs
+		    || x->new_attrs != y->new_attrs
+		    || x->old_size != y->old_size
+		    || x->new_size != y->new_size
+		    || x->old_hash != y->old_hash
+		    || x->new_hash != y->new_hash)
+			return 0;
+	}
+	return 1;
+}
+
+/* Write a diff and read it back */
+static pi_diff_t *round_trip(const pi_diff_t *diff)
+{
+	FILE 	*f = tmpfile();
+	pi_diff_t *back;
+
+	if (f == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	expect("patch written", pi_diff_write(diff, f) == 0);
+	rewind(f);
+	back = pi_diff_read(f);
+	fclose(f);
+	return back;
+}
+
+/* Find the change of a record in a diff */
+static const pi_diff_entry_t *find_change(const pi_diff_t *diff,
+	recordid_t uid)
+{
+	int 	i;
+
+	for (i = 0; i < diff->num_entries; i++)
+		if (diff->entries[i].uid == uid)
+			return &diff->entries[i];
+	return NULL;
+}
+
+/* Apply a patch to the base file, with record contents from the target,
+   checking the patch matches both on the way. Returns the number of
+   mismatches. */
+static int apply(const pi_diff_t *diff, pi_file_t *base, pi_file_t *target)
+{
+	int 	i,
+		entries,
+		attr,
+		category,
+		bad = 0;
+	void 	*buf;
+	size_t	size;
+	recordid_t uid;
+	pi_file_t *out = new_file(APPLIED_FILE, 0);
+	const pi_diff_entry_t *entp;
+
+	if (diff->app_info_changed)
+		pi_file_get_app_info(target, &buf, &size);
+	else
+		pi_file_get_app_info(base, &buf, &size);
+	pi_file_set_app_info(out, buf, size);
+
+	/* unchanged records stay, changed ones must be as the patch says */
+	pi_file_get_entries(base, &entries);
+	for (i = 0; i < entries; i++) {
+		pi_file_read_record(base, i, &buf, &size, &attr, &category,
+			&uid);
+		entp = find_change(diff, uid);
+		if (entp == NULL) {
+			pi_file_append_record(out, buf, size, attr, category,
+				uid);
+			continue;
+		}
+		if (entp->change == PI_DIFF_ADDED || entp->old_size != size
+		    || entp->old_hash != pi_hash64(buf, size)
+		    || entp->old_attrs != ((attr & 0xf0) | category))
+			bad++;
+	}
+
+	/* the others come from the target */
+	for (i = 0; i < diff->num_entries; i++) {
+		entp = &diff->entries[i];
+		if (entp->change == PI_DIFF_REMOVED)
+			continue;
+		if (pi_file_read_record_by_id(target, entp->uid, &buf, &size,
+				NULL, &attr, &category) < 0
+		    || entp->new_size != size
+		    || entp->new_hash != pi_hash64(buf, size)
+		    || entp->new_attrs != ((attr & 0xf0) | category)) {
+			bad++;
+			continue;
+		}
+		pi_file_append_record(out, buf, size, attr, category,
+			entp->uid);
+	}
+
+	pi_file_close(out);
+	return bad;
+}
+
+static void records(void)
+{
+	int 	removed,
+		modified,
+		attributes,
+		entries;
+	pi_file_t *base,
+		*target,
+		*applied;
+	pi_diff_t *diff,
+		*back,
+		*check;
+
+	make_files(&removed, &modified, &attributes);
+	base = pi_file_open(BASE_FILE);
+	target = pi_file_open(TARGET_FILE);
+	if (base == NULL || target == NULL) {
+		expect("files written", 0);
+		return;
+	}
+
+	diff = pi_diff_files(base, target);
+	if (diff == NULL) {
+		expect("diff", 0);
+		return;
+	}
+	expect("changes counted", diff->added == ADDED
+		&& diff->removed == removed && diff->modified == modified
+		&& diff->attributes == attributes
+		&& diff->num_entries == ADDED + removed + modified
+			+ attributes);
+	expect("appInfo changed", diff->app_info_changed);
+
+	back = round_trip(diff);
+	expect("patch read", back != NULL);
+	if (back != NULL) {
+		expect("patch unchanged", same_diff(diff, back));
+		expect("indexes unset", back->num_entries == 0
+			|| (back->entries[0].old_index == -1
+			    && back->entries[0].new_index == -1));
+
+		expect("patch matches", apply(back, base, target) == 0);
+		applied = pi_file_open(APPLIED_FILE);
+		check = applied ? pi_diff_files(target, applied) : NULL;
+		expect("patch applied", check != NULL
+			&& check->num_entries == 0
+			&& !check->app_info_changed);
+		pi_file_get_entries(target, &entries);
+		expect("record count", check != NULL && entries
+			== RECORDS - removed + ADDED);
+		pi_diff_free(check);
+		if (applied)
+			pi_file_close(applied);
+		pi_diff_free(back);
+	}
+
+	pi_diff_free(diff);
+	pi_file_close(base);
+	pi_file_close(target);
+}
+
+static void resources(void)
+{
+	pi_file_t *base = new_file(BASE_FILE, 1),
+		*target = new_file(TARGET_FILE, 1);
+	pi_diff_t *diff,
+		*back;
+
+	pi_file_append_resource(base, "code zero", 9,
+		pi_mktag('c', 'o', 'd', 'e'), 0);
+	pi_file_append_resource(base, "code one", 8,
+		pi_mktag('c', 'o', 'd', 'e'), 1);
+	pi_file_append_resource(base, "form", 4,
+		pi_mktag('t', 'F', 'R', 'M'), 1000);
+	pi_file_append_resource(target, "code zero", 9,
+		pi_mktag('c', 'o', 'd', 'e'), 0);
+	pi_file_append_resource(target, "code one, fixed", 15,
+		pi_mktag('c', 'o', 'd', 'e'), 1);
+	pi_file_append_resource(target, "string", 6,
+		pi_mktag('t', 'S', 'T', 'R'), 1000);
+	pi_file_close(base);
+	pi_file_close(target);
+
+	base = pi_file_open(BASE_FILE);
+	target = pi_file_open(TARGET_FILE);
+	diff = base && target ? pi_diff_files(base, target) : NULL;
+	expect("resource diff", diff != NULL && diff->resource_flag
+		&& diff->added == 1 && diff->removed == 1
+		&& diff->modified == 1);
+	if (diff != NULL) {
+		back = round_trip(diff);
+		expect("resource patch", back != NULL
+			&& same_diff(diff, back));
+		pi_diff_free(back);
+		pi_diff_free(diff);
+	}
+	if (base)
+		pi_file_close(base);
+	if (target)
+		pi_file_close(target);
+}
+
+static void bad_patches(void)
+{
+	static const char header[] =
+		"PILOT-DIFF 1\n"
+		"db\tMemo DB\t0\n"
+		"appinfo\t0\t0000000000000001\t0000000000000001\n"
+		"sortinfo\t0\t0000000000000000\t0000000000000000\n";
+	static const char change[] =
+		"M\t42\t3\t3\t10\t12\t00000000000000aa\t00000000000000bb\n";
+	static const struct {
+		const char *what,
+			*text;
+	} bad[] = {
+		{ "empty patch", "" },
+		{ "magic only", "PILOT-DIFF 1\n" },
+		{ "no appinfo line", "PILOT-DIFF 1\ndb\tMemo DB\t0\n" },
+		{ "truncated appinfo line", "PILOT-DIFF 1\ndb\tMemo DB\t0\n"
+			"appinfo\t0\t00000000\n" },
+		{ "no database name", "PILOT-DIFF 1\ndb\t0\n" },
+		{ "unknown version", "PILOT-DIFF 9\ndb\tMemo DB\t0\n" },
+	};
+	char 	text[512];
+	int 	i;
+	FILE 	*f;
+	pi_diff_t *diff;
+
+	for (i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i++) {
+		f = text_stream(bad[i].text);
+		diff = pi_diff_read(f);
+		expect(bad[i].what, diff == NULL);
+		pi_diff_free(diff);
+		fclose(f);
+	}
+
+	/* the same changes, with the right and wrong counts */
+	sprintf(text, "%s%s%s", header, change, "end\t1\n");
+	f = text_stream(text);
+	diff = pi_diff_read(f);
+	expect("good patch", diff != NULL && diff->num_entries == 1
+		&& diff->modified == 1 && diff->entries[0].uid == 42
+		&& diff->entries[0].new_size == 12
+		&& diff->entries[0].new_hash == 0xbb
+		&& strcmp(diff->name, "Memo DB") == 0);
+	pi_diff_free(diff);
+	fclose(f);
+
+	sprintf(text, "%s%s%s", header, change, "end\t2\n");
+	f = text_stream(text);
+	expect("too high a count", pi_diff_read(f) == NULL);
+	fclose(f);
+
+	sprintf(text, "%s%s%s%s", header, change, change, "end\t1\n");
+	f = text_stream(text);
+	expect("too low a count", pi_diff_read(f) == NULL);
+	fclose(f);
+
+	sprintf(text, "%s%s", header, change);
+	f = text_stream(text);
+	expect("no end line", pi_diff_read(f) == NULL);
+	fclose(f);
+
+	sprintf(text, "%s%s%s", header, "X\t42\t3\t3\t10\t12\t0\t0\n",
+		"end\t1\n");
+	f = text_stream(text);
+	expect("unknown change", pi_diff_read(f) == NULL);
+	fclose(f);
+
+	sprintf(text, "%s%s%s", header, "M\t42\t3\t3\t10\n", "end\t1\n");
+	f = text_stream(text);
+	expect("truncated change", pi_diff_read(f) == NULL);
+	fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+	records();
+	resources();
+	bad_patches();
+
+	unlink(BASE_FILE);
+	unlink(TARGET_FILE);
+	unlink(APPLIED_FILE);
+
+	if (failed) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
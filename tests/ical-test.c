@@ -0,0 +1,400 @@
+/*
+ * $Id$
+ *
+ * ical-test.c: Check the iCalendar writer
+ *
+ * Appointments and a todo are written and each component must come out
+ * exactly as expected: long lines folded at 75 octets but never inside a
+ * UTF-8 sequence or an escape, commas, semicolons, backslashes and line
+ * breaks escaped, weekly, monthly by day and last week repeat rules, and
+ * exceptions of timed and untimed events. Every line of the whole
+ * calendar must then fit in 75 octets.
+ *
+ * Usage: ical-test
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-dlp.h"
+#include "pi-ical.h"
+
+#define STAMP		"20260101T000000Z"
+#define OUTPUT_SIZE	4096
+
+static int failed = 0;
+static FILE *out;
+static pi_ical_t ical;
+static long mark;
+static char output[OUTPUT_SIZE];
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Read what was written since the last call */
+static const char *written(void)
+{
+	size_t	n;
+
+	fflush(out);
+	fseek(out, mark, SEEK_SET);
+	n = fread(output, 1, sizeof(output) - 1, out);
+	output[n] = '\0';
+	fseek(out, 0, SEEK_END);
+	mark = ftell(out);
+	return output;
+}
+
+static void expect_output(const char *what, const char *expected)
+{
+	const char *got = written();
+
+	if (strcmp(got, expected) != 0) {
+		printf("FAILED: %s:\n--- expected\n%s--- got\n%s---\n",
+			what, expected, got);
+		failed = 1;
+	}
+}
+
+static void set_date(struct tm *t, int year, int month, int day, int hour,
+	int minute)
+{
+	memset(t, 0, sizeof(*t));
+	t->tm_year = year - 1900;
+	t->tm_mon = month - 1;
+	t->tm_mday = day;
+	t->tm_hour = hour;
+	t->tm_min = minute;
+}
+
+/* A timed appointment without repeat, alarm or note */
+static void appointment(struct Appointment *a, char *description)
+{
+	memset(a, 0, sizeof(*a));
+	set_date(&a->begin, 2026, 10, 19, 9, 30);
+	set_date(&a->end, 2026, 10, 19, 10, 0);
+	a->repeatType = repeatNone;
+	a->repeatForever = 1;
+	a->description = description;
+}
+
+static void folding(void)
+{
+	char 	text[128];
+	struct Appointment a;
+
+	/* 8 octets of name and 66 of text: a 2 octet character would end
+	   at octet 76, so the line is folded before it */
+	memset(text, 'a', 66);
+	strcpy(text + 66, "\xc3\xa9" "bc");
+	appointment(&a, text);
+	pi_ical_write_appointment(&ical, 1, 0, &a);
+	expect_output("fold before a multibyte character",
+		"BEGIN:VEVENT\r\n"
+		"UID:1.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n"
+		" \xc3\xa9" "bc\r\n"
+		"END:VEVENT\r\n");
+
+	/* with one octet less it ends the line exactly */
+	memset(text, 'a', 65);
+	strcpy(text + 65, "\xc3\xa9" "b");
+	appointment(&a, text);
+	pi_ical_write_appointment(&ical, 2, 0, &a);
+	expect_output("multibyte character ending a line",
+		"BEGIN:VEVENT\r\n"
+		"UID:2.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\xc3\xa9\r\n"
+		" b\r\n"
+		"END:VEVENT\r\n");
+
+	/* an escape is moved to the next line whole */
+	memset(text, 'a', 66);
+	strcpy(text + 66, ",z");
+	appointment(&a, text);
+	pi_ical_write_appointment(&ical, 3, 0, &a);
+	expect_output("fold before an escape",
+		"BEGIN:VEVENT\r\n"
+		"UID:3.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n"
+		" \\,z\r\n"
+		"END:VEVENT\r\n");
+}
+
+static void escaping(void)
+{
+	char 	description[] = "Lunch, then; a\\b",
+		note[] = "line one\nline two\r\nthree";
+	struct Appointment a;
+
+	appointment(&a, description);
+	a.note = note;
+	pi_ical_write_appointment(&ical, 0x1f, dlpRecAttrSecret, &a);
+	expect_output("escaping",
+		"BEGIN:VEVENT\r\n"
+		"UID:1f.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:Lunch\\, then\\; a\\\\b\r\n"
+		"DESCRIPTION:line one\\nline two\\nthree\r\n"
+		"CLASS:PRIVATE\r\n"
+		"END:VEVENT\r\n");
+}
+
+static void repeats(void)
+{
+	char 	description[] = "Repeat";
+	struct tm exception[2];
+	struct Appointment a;
+
+	/* every other Monday and Wednesday until the end of the year */
+	appointment(&a, description);
+	a.repeatType = repeatWeekly;
+	a.repeatForever = 0;
+	set_date(&a.repeatEnd, 2026, 12, 31, 0, 0);
+	a.repeatFrequency = 2;
+	a.repeatDays[1] = a.repeatDays[3] = 1;
+	a.repeatWeekstart = 1;
+	pi_ical_write_appointment(&ical, 0x10, 0, &a);
+	expect_output("weekly",
+		"BEGIN:VEVENT\r\n"
+		"UID:10.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;WKST=MO;UNTIL=20261231T235900\r\n"
+		"END:VEVENT\r\n");
+
+	/* no day given: the day of the first occurrence */
+	a.repeatDays[1] = a.repeatDays[3] = 0;
+	a.repeatFrequency = 1;
+	a.repeatForever = 1;
+	a.repeatWeekstart = 0;
+	pi_ical_write_appointment(&ical, 0x11, 0, &a);
+	expect_output("weekly on the first day",
+		"BEGIN:VEVENT\r\n"
+		"UID:11.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=WEEKLY;BYDAY=MO;WKST=SU\r\n"
+		"END:VEVENT\r\n");
+
+	/* the second Tuesday of every third month */
+	appointment(&a, description);
+	set_date(&a.begin, 2026, 10, 13, 14, 0);
+	set_date(&a.end, 2026, 10, 13, 15, 30);
+	a.repeatType = repeatMonthlyByDay;
+	a.repeatFrequency = 3;
+	a.repeatDay = dom2ndTue;
+	pi_ical_write_appointment(&ical, 0x12, 0, &a);
+	expect_output("monthly by day",
+		"BEGIN:VEVENT\r\n"
+		"UID:12.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261013T140000\r\n"
+		"DTEND:20261013T153000\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=MONTHLY;INTERVAL=3;BYDAY=2TU\r\n"
+		"END:VEVENT\r\n");
+
+	/* the last Friday of the month, all day, with an alarm */
+	appointment(&a, description);
+	a.event = 1;
+	set_date(&a.begin, 2026, 10, 30, 0, 0);
+	set_date(&a.end, 2026, 10, 30, 0, 0);
+	a.repeatType = repeatMonthlyByDay;
+	a.repeatFrequency = 1;
+	a.repeatDay = domLastFri;
+	a.alarm = 1;
+	a.advance = 2;
+	a.advanceUnits = advDays;
+	pi_ical_write_appointment(&ical, 0x13, 0, &a);
+	expect_output("last week",
+		"BEGIN:VEVENT\r\n"
+		"UID:13.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART;VALUE=DATE:20261030\r\n"
+		"DTEND;VALUE=DATE:20261031\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=MONTHLY;BYDAY=-1FR\r\n"
+		"BEGIN:VALARM\r\n"
+		"ACTION:DISPLAY\r\n"
+		"TRIGGER:-P2D\r\n"
+		"DESCRIPTION:Repeat\r\n"
+		"END:VALARM\r\n"
+		"END:VEVENT\r\n");
+
+	/* daily but for two days */
+	appointment(&a, description);
+	a.repeatType = repeatDaily;
+	a.repeatFrequency = 1;
+	set_date(&exception[0], 2026, 10, 20, 0, 0);
+	set_date(&exception[1], 2026, 10, 22, 0, 0);
+	a.exceptions = 2;
+	a.exception = exception;
+	pi_ical_write_appointment(&ical, 0x14, 0, &a);
+	expect_output("timed exceptions",
+		"BEGIN:VEVENT\r\n"
+		"UID:14.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART:20261019T093000\r\n"
+		"DTEND:20261019T100000\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=DAILY\r\n"
+		"EXDATE:20261020T093000,20261022T093000\r\n"
+		"END:VEVENT\r\n");
+
+	/* a birthday, but not in 2027 */
+	appointment(&a, description);
+	a.event = 1;
+	set_date(&a.begin, 2026, 12, 31, 0, 0);
+	a.repeatType = repeatYearly;
+	a.repeatForever = 0;
+	set_date(&a.repeatEnd, 2030, 12, 31, 0, 0);
+	set_date(&exception[0], 2027, 12, 31, 0, 0);
+	a.exceptions = 1;
+	a.exception = exception;
+	pi_ical_write_appointment(&ical, 0x15, 0, &a);
+	expect_output("untimed exceptions",
+		"BEGIN:VEVENT\r\n"
+		"UID:15.datebook@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"DTSTART;VALUE=DATE:20261231\r\n"
+		"DTEND;VALUE=DATE:20270101\r\n"
+		"SUMMARY:Repeat\r\n"
+		"RRULE:FREQ=YEARLY;UNTIL=20301231\r\n"
+		"EXDATE;VALUE=DATE:20271231\r\n"
+		"END:VEVENT\r\n");
+}
+
+static void todo(void)
+{
+	char 	description[] = "File taxes",
+		note[] = "Forms A, B";
+	struct ToDo t;
+
+	memset(&t, 0, sizeof(t));
+	set_date(&t.due, 2027, 4, 15, 0, 0);
+	t.priority = 2;
+	t.description = description;
+	t.note = note;
+	pi_ical_write_todo(&ical, 0x20, 0, "Home;Office", &t);
+	expect_output("todo",
+		"BEGIN:VTODO\r\n"
+		"UID:20.todo@pilot-link\r\n"
+		"DTSTAMP:" STAMP "\r\n"
+		"SUMMARY:File taxes\r\n"
+		"DESCRIPTION:Forms A\\, B\r\n"
+		"DUE;VALUE=DATE:20270415\r\n"
+		"PRIORITY:3\r\n"
+		"STATUS:NEEDS-ACTION\r\n"
+		"CATEGORIES:Home\\;Office\r\n"
+		"END:VTODO\r\n");
+}
+
+/* Check every line of the calendar fits, and continues with a space
+   followed by the start of a character */
+static void line_lengths(void)
+{
+	char 	*line,
+		*next;
+	long 	size;
+	size_t	n;
+	char 	*all;
+
+	fflush(out);
+	size = ftell(out);
+	all = malloc((size_t) size + 1);
+	if (all == NULL) {
+		expect("memory", 0);
+		return;
+	}
+	rewind(out);
+	n = fread(all, 1, (size_t) size, out);
+	all[n] = '\0';
+
+	expect("calendar begins", strncmp(all, "BEGIN:VCALENDAR\r\n"
+		"VERSION:2.0\r\n", 28) == 0);
+	for (line = all; *line; line = next + 2) {
+		if ((next = strstr(line, "\r\n")) == NULL) {
+			expect("last line ended", 0);
+			break;
+		}
+		expect("line length", next - line <= 75);
+		expect("folded inside a character", *line != ' '
+			|| (line[1] & 0xc0) != 0x80);
+	}
+	expect("calendar ends", n >= 15
+		&& strcmp(all + n - 15, "END:VCALENDAR\r\n") == 0);
+	free(all);
+}
+
+int main(int argc, char *argv[])
+{
+	if ((out = tmpfile()) == NULL) {
+		perror("tmpfile");
+		return 1;
+	}
+
+	expect("begin", pi_ical_begin(&ical, out,
+		"-//pilot-link//ical-test//EN") == 0);
+	strcpy(ical.stamp, STAMP);
+	written();
+
+	folding();
+	escaping();
+	repeats();
+	todo();
+
+	expect("end", pi_ical_end(&ical) == 0);
+	line_lengths();
+	fclose(out);
+
+	if (failed) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,620 @@
+/*
+ * $Id$
+ *
+ * install-delta-test.c: Check pi_file_install_delta() against a fake
+ * handheld
+ *
+ * The DLP calls pi-file.c makes are answered by a database kept in
+ * memory. Local files are installed over it unchanged, with records
+ * added, removed, modified or only re-categorized, over records deleted
+ * or gone on the handheld, and through a diff that does or no longer
+ * does match the handheld. After each install the handheld must hold
+ * exactly the records and header of the file, and only the records that
+ * differ may have been written. A database of another creator, a
+ * resource database and a handheld whose records can't be read must be
+ * installed whole.
+ *
+ * Usage: install-delta-test
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-diff.h"
+#include "pi-error.h"
+#include "pi-util.h"
+
+#define DB_NAME		"DeltaTestDB"
+#define BASE_FILE	"install-delta-base.pdb"
+#define LOCAL_FILE	"install-delta-test.pdb"
+#define MAX_RECORDS	32
+
+struct record {
+	recordid_t uid;
+	int	category;
+	const char *data;
+};
+
+struct fake_record {
+	recordid_t uid;
+	int	attrs,
+		category,
+		vanished;	/* listed, but gone when read */
+	size_t	size;
+	char	data[64];
+};
+
+/* The database on the fake handheld */
+static struct {
+	int	exists,
+		count,
+		read_error;
+	struct DBInfo info;
+	char	app_info[64];
+	size_t	app_info_size;
+	struct fake_record records[MAX_RECORDS];
+	recordid_t next_uid;
+} device;
+
+/* What the install asked of it */
+static struct {
+	int	created,
+		reads,
+		writes,
+		deletes,
+		app_writes,
+		set_info;
+} calls;
+
+static const struct record base[] = {
+	{ 1, 0, "one" },
+	{ 2, 1, "two" },
+	{ 3, 1, "three" },
+	{ 4, 2, "four" },
+	{ 5, 0, "five" }
+};
+
+#define NUM_BASE	((int) (sizeof(base) / sizeof(base[0])))
+
+static int failed = 0;
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+static struct fake_record *find_record(recordid_t uid)
+{
+	int 	i;
+
+	for (i = 0; i < device.count; i++)
+		if (device.records[i].uid == uid)
+			return &device.records[i];
+	return NULL;
+}
+
+static int not_found(int sd)
+{
+	pi_set_palmos_error(sd, dlpErrNotFound);
+	return pi_set_error(sd, PI_ERR_DLP_PALMOS);
+}
+
+/* The DLP calls pi-file.c makes, answered by the fake handheld */
+
+int dlp_OpenDB(int sd, int cardno, int mode, PI_CONST char *dbname,
+	       int *dbhandle)
+{
+	if (!device.exists || strcmp(dbname, device.info.name) != 0)
+		return not_found(sd);
+	*dbhandle = 1;
+	return 0;
+}
+
+int dlp_CloseDB(int sd, int dbhandle)
+{
+	return 0;
+}
+
+int dlp_CreateDB(int sd, unsigned long creator, unsigned long type,
+		 int cardno, int flags, unsigned int version,
+		 PI_CONST char *dbname, int *dbhandle)
+{
+	memset(&device, 0, sizeof(device));
+	device.exists = 1;
+	device.next_uid = 100;
+	strncpy(device.info.name, dbname, sizeof(device.info.name) - 1);
+	device.info.flags = flags & ~dlpDBFlagOpen;
+	device.info.version = version;
+	device.info.type = type;
+	device.info.creator = creator;
+	calls.created++;
+	*dbhandle = 1;
+	return 0;
+}
+
+int dlp_DeleteDB(int sd, int cardno, PI_CONST char *dbname)
+{
+	if (!device.exists || strcmp(dbname, device.info.name) != 0)
+		return not_found(sd);
+	device.exists = 0;
+	return 0;
+}
+
+int dlp_FindDBByName(int sd, int cardno, PI_CONST char *dbname,
+		     unsigned long *localid, int *dbhandle,
+		     struct DBInfo *dbInfo, struct DBSizeInfo *dbSize)
+{
+	return not_found(sd);
+}
+
+int dlp_FindDBByOpenHandle(int sd, int dbhandle, int *cardno,
+			   unsigned long *localid, struct DBInfo *dbInfo,
+			   struct DBSizeInfo *dbSize)
+{
+	if (dbInfo)
+		*dbInfo = device.info;
+	return 0;
+}
+
+int dlp_SetDBInfo(int sd, int dbhandle, int flags, int clearFlags,
+		  unsigned int version, time_t createDate, time_t modifyDate,
+		  time_t backupDate, unsigned long type,
+		  unsigned long creator)
+{
+	device.info.flags = (device.info.flags | flags) & ~clearFlags;
+	device.info.version = version;
+	device.info.createDate = createDate;
+	device.info.modifyDate = modifyDate;
+	device.info.backupDate = backupDate;
+	device.info.type = type;
+	device.info.creator = creator;
+	calls.set_info++;
+	return 0;
+}
+
+int dlp_ReadOpenDBInfo(int sd, int dbhandle, int *numrecs)
+{
+	*numrecs = device.count;
+	return 0;
+}
+
+int dlp_ReadRecordIDList(int sd, int dbhandle, int sort, int start, int max,
+			 recordid_t *recuids, int *count)
+{
+	for (*count = 0; *count < max && start + *count < device.count;
+	     (*count)++)
+		recuids[*count] = device.records[start + *count].uid;
+	return 0;
+}
+
+int dlp_ReadRecordById(int sd, int dbhandle, recordid_t recuid,
+		       pi_buffer_t *retbuf, int *recindex, int *recattrs,
+		       int *category)
+{
+	struct fake_record *rec = find_record(recuid);
+
+	calls.reads++;
+	if (device.read_error)
+		return pi_set_error(sd, PI_ERR_DLP_COMMAND);
+	if (rec == NULL || rec->vanished)
+		return not_found(sd);
+
+	pi_buffer_clear(retbuf);
+	pi_buffer_append(retbuf, rec->data, rec->size);
+	if (recindex)
+		*recindex = (int) (rec - device.records);
+	if (recattrs)
+		*recattrs = rec->attrs;
+	if (category)
+		*category = rec->category;
+	return (int) rec->size;
+}
+
+int dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex,
+			  pi_buffer_t *retbuf, recordid_t *recuid,
+			  int *recattrs, int *category)
+{
+	return pi_set_error(sd, PI_ERR_DLP_UNSUPPORTED);
+}
+
+int dlp_ReadResourceByIndex(int sd, int dbhandle, unsigned int resindex,
+			    pi_buffer_t *retbuf, unsigned long *restype,
+			    int *resid)
+{
+	return pi_set_error(sd, PI_ERR_DLP_UNSUPPORTED);
+}
+
+int dlp_WriteRecord(int sd, int dbhandle, int flags, recordid_t recuid,
+		    int catid, PI_CONST void *databuf, size_t datasize,
+		    recordid_t *newrecuid)
+{
+	struct fake_record *rec = recuid ? find_record(recuid) : NULL;
+
+	if (datasize > sizeof(rec->data))
+		return pi_set_error(sd, PI_ERR_DLP_DATASIZE);
+	if (rec == NULL) {
+		if (device.count == MAX_RECORDS)
+			return pi_set_error(sd, PI_ERR_DLP_DATASIZE);
+		rec = &device.records[device.count++];
+		rec->uid = recuid ? recuid : device.next_uid++;
+	}
+	rec->attrs = flags;
+	rec->category = catid;
+	rec->vanished = 0;
+	rec->size = datasize;
+	memcpy(rec->data, databuf, datasize);
+	calls.writes++;
+	if (newrecuid)
+		*newrecuid = rec->uid;
+	return 0;
+}
+
+int dlp_WriteResource(int sd, int dbhandle, unsigned long restype,
+		      int resid, PI_CONST void *databuf, size_t datasize)
+{
+	calls.writes++;
+	return 0;
+}
+
+int dlp_DeleteRecord(int sd, int dbhandle, int all, recordid_t recuid)
+{
+	struct fake_record *rec = find_record(recuid);
+
+	if (rec == NULL || rec->vanished)
+		return not_found(sd);
+	memmove(rec, rec + 1, (size_t) (device.records + device.count
+		- rec - 1) * sizeof(*rec));
+	device.count--;
+	calls.deletes++;
+	return 0;
+}
+
+int dlp_ReadAppBlock(int sd, int dbhandle, int offset, int reqbytes,
+		     pi_buffer_t *retbuf)
+{
+	pi_buffer_clear(retbuf);
+	pi_buffer_append(retbuf, device.app_info, device.app_info_size);
+	return (int) device.app_info_size;
+}
+
+int dlp_WriteAppBlock(int sd, int dbhandle, PI_CONST void *databuf,
+		      size_t datasize)
+{
+	memcpy(device.app_info, databuf, datasize);
+	device.app_info_size = datasize;
+	calls.app_writes++;
+	return 0;
+}
+
+int dlp_ResetSystem(int sd)
+{
+	return 0;
+}
+
+int dlp_EndOfSync(int sd, int status)
+{
+	return 0;
+}
+
+/* Put the base records on the handheld, with an older header */
+static void load_device(void)
+{
+	int 	i;
+
+	memset(&device, 0, sizeof(device));
+	device.exists = 1;
+	device.next_uid = 100;
+	strcpy(device.info.name, DB_NAME);
+	device.info.flags = dlpDBFlagBackup;
+	device.info.version = 1;
+	device.info.type = pi_mktag('D', 'A', 'T', 'A');
+	device.info.creator = pi_mktag('d', 'l', 't', 'a');
+	device.info.createDate = 1000000000;
+	device.info.modifyDate = 1000000000;
+	strcpy(device.app_info, "categories");
+	device.app_info_size = strlen(device.app_info);
+
+	for (i = 0; i < NUM_BASE; i++) {
+		device.records[i].uid = base[i].uid;
+		device.records[i].category = base[i].category;
+		device.records[i].size = strlen(base[i].data);
+		memcpy(device.records[i].data, base[i].data,
+			device.records[i].size);
+	}
+	device.count = NUM_BASE;
+	memset(&calls, 0, sizeof(calls));
+}
+
+/* Write a local file holding some records and open it for reading */
+static pi_file_t *make_file(const char *path, const struct record *records,
+	int count, unsigned long creator, int resource)
+{
+	int 	i;
+	struct 	DBInfo info;
+	pi_file_t *pf;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, DB_NAME);
+	info.flags = resource ? dlpDBFlagResource : dlpDBFlagBackup;
+	info.version = 3;
+	info.type = pi_mktag('D', 'A', 'T', 'A');
+	info.creator = creator;
+	info.createDate = 1100000000;
+	info.modifyDate = 1200000000;
+	info.backupDate = 1150000000;
+
+	if ((pf = pi_file_create(path, &info)) == NULL)
+		return NULL;
+	pi_file_set_app_info(pf, "categories", strlen("categories"));
+	for (i = 0; i < count; i++) {
+		if (resource)
+			pi_file_append_resource(pf, (void *) records[i].data,
+				strlen(records[i].data), pi_mktag('c', 'o',
+				'd', 'e'), (int) records[i].uid);
+		else
+			pi_file_append_record(pf, (void *) records[i].data,
+				strlen(records[i].data), 0,
+				records[i].category, records[i].uid);
+	}
+	if (pi_file_close(pf) < 0)
+		return NULL;
+	return pi_file_open(path);
+}
+
+/* Check the handheld holds exactly the records, version and flags of a
+   file, and with dates set its dates too. pi_file_install() doesn't set
+   dates. */
+static int same_as(pi_file_t *pf, int dates)
+{
+	int 	i,
+		entries,
+		attr,
+		category,
+		live = 0;
+	void 	*buffer;
+	size_t	size;
+	recordid_t uid;
+	struct DBInfo info;
+	struct fake_record *rec;
+
+	pi_file_get_info(pf, &info);
+	pi_file_get_entries(pf, &entries);
+
+	for (i = 0; i < device.count; i++)
+		if (!device.records[i].vanished
+		    && !(device.records[i].attrs & dlpRecAttrDeleted))
+			live++;
+	if (live != entries)
+		return 0;
+
+	for (i = 0; i < entries; i++) {
+		if (pi_file_read_record(pf, i, &buffer, &size, &attr,
+				&category, &uid) < 0)
+			return 0;
+		rec = find_record(uid);
+		if (rec == NULL || rec->vanished || rec->size != size
+		    || memcmp(rec->data, buffer, size) != 0
+		    || rec->attrs != attr || rec->category != category)
+			return 0;
+	}
+
+	if (dates && (device.info.createDate != info.createDate
+			|| device.info.modifyDate != info.modifyDate
+			|| device.info.backupDate != info.backupDate))
+		return 0;
+	return device.info.version == info.version
+		&& (device.info.flags & ~dlpDBFlagOpen)
+			== (info.flags & ~dlpDBFlagOpen);
+}
+
+/* Install a local file over the base records on the handheld */
+static int install(int sd, const struct record *records, int count,
+	unsigned long creator, int resource, const pi_diff_t *diff,
+	pi_file_t **ppf)
+{
+	int 	result;
+	pi_file_t *pf;
+
+	*ppf = pf = make_file(LOCAL_FILE, records, count, creator, resource);
+	if (pf == NULL)
+		return PI_ERR_FILE_ERROR;
+	result = pi_file_install_delta(pf, sd, 0, diff, NULL);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	sd,
+		result;
+	unsigned long creator = pi_mktag('d', 'l', 't', 'a');
+	struct record records[MAX_RECORDS];
+	pi_file_t *pf,
+		*base_pf;
+	pi_diff_t *diff;
+
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_DLP);
+	if (sd < 0) {
+		printf("FAILED: can't create a socket\n");
+		return 1;
+	}
+	memcpy(records, base, sizeof(base));
+
+	/* Nothing changed: only the header is set */
+	load_device();
+	result = install(sd, records, NUM_BASE, creator, 0, NULL, &pf);
+	expect("unchanged: install", result >= 0);
+	expect("unchanged: contents", same_as(pf, 1));
+	expect("unchanged: nothing written", calls.writes == 0
+		&& calls.deletes == 0 && calls.app_writes == 0);
+	expect("unchanged: not re-created", calls.created == 0);
+	expect("unchanged: header set", calls.set_info == 1);
+	pi_file_close(pf);
+
+	/* A record added */
+	load_device();
+	records[NUM_BASE].uid = 6;
+	records[NUM_BASE].category = 3;
+	records[NUM_BASE].data = "six";
+	result = install(sd, records, NUM_BASE + 1, creator, 0, NULL, &pf);
+	expect("added: install", result >= 0);
+	expect("added: contents", same_as(pf, 1));
+	expect("added: one record written", calls.writes == 1
+		&& calls.deletes == 0 && calls.created == 0);
+	pi_file_close(pf);
+
+	/* A record removed */
+	load_device();
+	memcpy(records, base, sizeof(base));
+	records[2] = records[NUM_BASE - 1];
+	result = install(sd, records, NUM_BASE - 1, creator, 0, NULL, &pf);
+	expect("removed: install", result >= 0);
+	expect("removed: contents", same_as(pf, 1));
+	expect("removed: one record deleted", calls.writes == 0
+		&& calls.deletes == 1 && find_record(3) == NULL);
+	pi_file_close(pf);
+
+	/* A record modified */
+	load_device();
+	memcpy(records, base, sizeof(base));
+	records[1].data = "TWO";
+	result = install(sd, records, NUM_BASE, creator, 0, NULL, &pf);
+	expect("modified: install", result >= 0);
+	expect("modified: contents", same_as(pf, 1));
+	expect("modified: one record written", calls.writes == 1
+		&& calls.deletes == 0);
+	pi_file_close(pf);
+
+	/* Only the category of a record changed */
+	load_device();
+	memcpy(records, base, sizeof(base));
+	records[3].category = 7;
+	result = install(sd, records, NUM_BASE, creator, 0, NULL, &pf);
+	expect("attributes: install", result >= 0);
+	expect("attributes: contents", same_as(pf, 1));
+	expect("attributes: one record written", calls.writes == 1
+		&& calls.deletes == 0);
+	pi_file_close(pf);
+
+	/* Records deleted on the handheld but not purged, or gone since
+	   they were listed, are written again or left alone */
+	load_device();
+	memcpy(records, base, sizeof(base));
+	device.records[4].attrs = dlpRecAttrDeleted;
+	device.records[2].vanished = 1;
+	device.records[device.count].uid = 9;
+	device.records[device.count++].vanished = 1;
+	result = install(sd, records, NUM_BASE, creator, 0, NULL, &pf);
+	expect("deleted: install", result >= 0);
+	expect("deleted: contents", same_as(pf, 1));
+	expect("deleted: two records written", calls.writes == 2
+		&& calls.created == 0);
+	pi_file_close(pf);
+
+	/* Another application's database of the same name is replaced */
+	load_device();
+	result = install(sd, records, NUM_BASE,
+		pi_mktag('o', 't', 'h', 'r'), 0, NULL, &pf);
+	expect("creator: install", result >= 0);
+	expect("creator: re-created", calls.created == 1);
+	expect("creator: contents", same_as(pf, 0)
+		&& device.info.creator == pi_mktag('o', 't', 'h', 'r'));
+	pi_file_close(pf);
+
+	/* Resource databases are always installed whole */
+	load_device();
+	result = install(sd, records, NUM_BASE, creator, 1, NULL, &pf);
+	expect("resource: install", result >= 0);
+	expect("resource: re-created", calls.created == 1
+		&& (device.info.flags & dlpDBFlagResource)
+		&& calls.writes == NUM_BASE && calls.reads == 0);
+	pi_file_close(pf);
+
+	/* So are databases whose records can't be read back */
+	load_device();
+	device.read_error = 1;
+	records[1].data = "TWO";
+	result = install(sd, records, NUM_BASE, creator, 0, NULL, &pf);
+	expect("read error: install", result >= 0);
+	expect("read error: re-created", calls.created == 1);
+	expect("read error: contents", same_as(pf, 0));
+	pi_file_close(pf);
+
+	/* A diff made against what the handheld holds is applied without
+	   reading any record */
+	base_pf = make_file(BASE_FILE, base, NUM_BASE, creator, 0);
+	expect("diff: base file", base_pf != NULL);
+	if (base_pf != NULL) {
+		memcpy(records, base, sizeof(base));
+		records[1].data = "TWO";
+		records[3].category = 7;
+		records[2] = records[NUM_BASE - 1];
+		records[NUM_BASE - 1].uid = 6;
+		records[NUM_BASE - 1].category = 3;
+		records[NUM_BASE - 1].data = "six";
+		pf = make_file(LOCAL_FILE, records, NUM_BASE, creator, 0);
+		diff = pf ? pi_diff_files(base_pf, pf) : NULL;
+		expect("diff: computed", diff != NULL);
+		if (diff != NULL) {
+			load_device();
+			result = pi_file_install_delta(pf, sd, 0, diff, NULL);
+			expect("diff: install", result >= 0);
+			expect("diff: contents", same_as(pf, 1));
+			expect("diff: nothing read", calls.reads == 0);
+			expect("diff: only changes written",
+				calls.writes == 3 && calls.deletes == 1);
+
+			/* Once the handheld moved on, the diff no longer
+			   applies and the handheld is compared with */
+			load_device();
+			device.count--;
+			result = pi_file_install_delta(pf, sd, 0, diff, NULL);
+			expect("stale diff: install", result >= 0);
+			expect("stale diff: contents", same_as(pf, 1));
+			expect("stale diff: compared", calls.reads > 0);
+			pi_diff_free(diff);
+		}
+		if (pf != NULL)
+			pi_file_close(pf);
+		pi_file_close(base_pf);
+	}
+
+	unlink(BASE_FILE);
+	unlink(LOCAL_FILE);
+	pi_close(sd);
+
+	if (failed) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,264 @@
+/*
+ * $Id$
+ *
+ * palmpix-bench.c: Benchmark of the PalmPix image decoder
+ *
+ * A 640x480 PalmPix picture is made up in memory: random channel data
+ * is a valid compressed image, since every bit pattern decodes to some
+ * pixel difference. The picture is then decoded again and again with
+ * unpack_PalmPix(), without and with colour correction, bias and
+ * histogram stretch, once with the portable code and once with the
+ * vector kernels for the processor if there are any. Each pass reports
+ * images and megapixels per second. Both ways must give the same
+ * pixmaps, otherwise the program fails.
+ *
+ * Usage: palmpix-bench [images]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-palmpix.h"
+
+#define DEFAULT_IMAGES	50
+#define WIDTH		640
+#define HEIGHT		480
+
+/* Compressed channel size, safely above what a 320x240 channel of
+   random codes takes */
+#define CHANNEL_SIZE	60000
+#define RECORD_SIZE	4096
+
+#define HEADER_RECNO	0
+#define NUM_RECORDS	(4 + 4 * ((CHANNEL_SIZE + RECORD_SIZE - 1) / RECORD_SIZE))
+
+typedef struct {
+	struct PalmPixState state;	/* must come first */
+	unsigned char *records[NUM_RECORDS];
+	size_t 	sizes[NUM_RECORDS];
+} BenchState;
+
+static const struct {
+	const char *name;
+	int 	flags,
+		bias;
+} passes[] = {
+	{ "plain", 0, 50 },
+	{ "colour", PALMPIX_COLOUR_CORRECTION, 50 },
+	{ "bias", 0, 65 },
+	{ "stretch", PALMPIX_HISTOGRAM_STRETCH, 50 },
+	{ "all", PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH, 40 }
+};
+
+#define NUM_PASSES	((int) (sizeof(passes) / sizeof(passes[0])))
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    getrecord
+ *
+ * Summary:     PalmPixState callback: return one of the made up records
+ *
+ * Parameters:  State, record number, record and size returned
+ *
+ * Returns:     0 on success, -1 if there is no such record
+ *
+ ***********************************************************************/
+static int getrecord(struct PalmPixState *state, int recno, void **buffer,
+	size_t *bufsize)
+{
+	BenchState *bs = (BenchState *) state;
+
+	if (recno < 0 || recno >= NUM_RECORDS || bs->records[recno] == NULL)
+		return -1;
+
+	*buffer = bs->records[recno];
+	*bufsize = bs->sizes[recno];
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    make_picture
+ *
+ * Summary:     Make up the records of a picture: header, name, two
+ *		unused records, then the four compressed channels
+ *
+ * Parameters:  State
+ *
+ * Returns:     0 on success, -1 if out of memory
+ *
+ ***********************************************************************/
+static int make_picture(BenchState *bs)
+{
+	unsigned char *header;
+	int 	recno = HEADER_RECNO + 4,
+		k,
+		i;
+	static const int size_offset[4] = { 16, 19, 22, 25 };
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		bs->records[i] = (unsigned char *) calloc(1, RECORD_SIZE);
+		if (bs->records[i] == NULL)
+			return -1;
+		bs->sizes[i] = 0;
+	}
+
+	header = bs->records[HEADER_RECNO];
+	bs->sizes[HEADER_RECNO] = 196;
+	header[0] = NUM_RECORDS - 4;
+	header[2] = 1;
+	header[3] = 1;
+	header[4] = 20;
+	header[5] = 1;
+	header[9] = 1;
+	header[10] = WIDTH & 0xff;
+	header[11] = WIDTH >> 8;
+	header[12] = HEIGHT & 0xff;
+	header[13] = HEIGHT >> 8;
+	for (k = 0; k < 4; k++) {
+		header[size_offset[k]] = CHANNEL_SIZE & 0xff;
+		header[size_offset[k] + 1] = CHANNEL_SIZE >> 8;
+	}
+
+	strcpy((char *) bs->records[HEADER_RECNO + 1], "Bench picture");
+	bs->sizes[HEADER_RECNO + 1] = 32;
+
+	srand(1);
+	for (k = 0; k < 4; k++) {
+		int 	left = CHANNEL_SIZE;
+
+		while (left > 0) {
+			int 	n = left < RECORD_SIZE ? left : RECORD_SIZE;
+
+			for (i = 0; i < n; i++)
+				bs->records[recno][i] = rand() >> 4;
+			bs->sizes[recno++] = n;
+			left -= n;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	images = DEFAULT_IMAGES,
+		pass,
+		scalar,
+		n,
+		i,
+		failed = 0;
+	size_t 	size = WIDTH * HEIGHT * 3;
+	unsigned char *reference;
+	struct PalmPixHeader header;
+	BenchState bs;
+
+	if (argc > 1)
+		images = atoi(argv[1]);
+	if (images < 1) {
+		fprintf(stderr, "Usage: %s [images]\n", argv[0]);
+		return 1;
+	}
+
+	memset(&bs, 0, sizeof(bs));
+	reference = (unsigned char *) malloc(size);
+	if (reference == NULL || make_picture(&bs) < 0) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	if (!unpack_PalmPixHeader(&header, bs.records[HEADER_RECNO], 196)) {
+		fprintf(stderr, "Bad picture header\n");
+		return 1;
+	}
+
+	bs.state.getrecord = getrecord;
+	bs.state.offset_r = 0;
+	bs.state.offset_g = 1;
+	bs.state.offset_b = 2;
+
+	for (pass = 0; pass < NUM_PASSES; pass++) {
+		for (scalar = 1; scalar >= 0; scalar--) {
+			double 	start,
+				elapsed;
+
+			bs.state.bias = passes[pass].bias;
+			bs.state.flags = passes[pass].flags
+				| (scalar ? PALMPIX_SCALAR : 0);
+
+			start = now();
+			for (n = 0; n < images; n++) {
+				if (!unpack_PalmPix(&bs.state, &header,
+						HEADER_RECNO, pixPixmap)) {
+					fprintf(stderr, "Decoding failed\n");
+					return 1;
+				}
+				if (n == 0 && scalar)
+					memcpy(reference, bs.state.pixmap, size);
+				else if (n == 0
+					 && memcmp(reference, bs.state.pixmap,
+						   size) != 0) {
+					fprintf(stderr, "%s: pixmaps differ\n",
+						passes[pass].name);
+					failed = 1;
+				}
+				free_PalmPix_data(&bs.state);
+			}
+			elapsed = now() - start;
+
+			printf("%-8s %-6s %8.1f images/s %7.1f Mpixels/s\n",
+				passes[pass].name, scalar ? "scalar" : "vector",
+				elapsed > 0 ? images / elapsed : 0.0,
+				elapsed > 0 ? images * (double) WIDTH * HEIGHT
+					/ elapsed / 1e6 : 0.0);
+		}
+	}
+
+	for (i = 0; i < NUM_RECORDS; i++)
+		free(bs.records[i]);
+	free(reference);
+
+	if (failed)
+		return 1;
+	printf("consistency: ok\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
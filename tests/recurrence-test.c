@@ -0,0 +1,656 @@
+/*
+ * $Id$
+ *
+ * recurrence-test.c: Check the occurrence index against brute force
+ *
+ * Random appointments of every repeat type are put in an occurrence
+ * index, and random ranges are looked up in it. For each range the
+ * occurrences are also found the slow way, by testing every day of the
+ * range against the repeat rule of every appointment, with calendar
+ * arithmetic of its own. Both must agree. The check is repeated after
+ * records are removed, replaced and added, and on an index read from a
+ * datebook file written with pack_Appointment(). The time taken by both
+ * ways is reported.
+ *
+ * Usage: recurrence-test [appointments [queries]]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-source.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-recurrence.h"
+
+#define DEFAULT_APPOINTMENTS	300
+#define DEFAULT_QUERIES		200
+#define MAX_EXCEPTIONS		4
+#define TEST_FILE		"recurrence-test.pdb"
+
+typedef struct {
+	recordid_t id;
+	int 	live;
+	struct Appointment a;
+	struct tm exception[MAX_EXCEPTIONS];
+} Record;
+
+typedef struct {
+	recordid_t id;
+	long 	begin;		/* minutes since 1970 */
+	long 	end;
+} Occurrence;
+
+typedef struct {
+	Occurrence *list;
+	int 	count,
+		size;
+} OccurrenceList;
+
+static const int month_days[12] =
+	{ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    leap, days_in_month
+ *
+ * Summary:     Calendar facts, the long way round
+ *
+ * Parameters:  Year, month (0-11)
+ *
+ * Returns:     Non-zero for leap years, number of days
+ *
+ ***********************************************************************/
+static int leap(int y)
+{
+	return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+static int days_in_month(int y, int m)
+{
+	return month_days[m] + (m == 1 && leap(y));
+}
+
+/***********************************************************************
+ *
+ * Function:    day_number
+ *
+ * Summary:     Days from 1970-01-01 to a date, by counting years and
+ *		months
+ *
+ * Parameters:  Year, month (0-11), day of the month
+ *
+ * Returns:     Day number
+ *
+ ***********************************************************************/
+static long day_number(int y, int m, int d)
+{
+	long 	n = 0;
+	int 	i;
+
+	for (i = 1970; i < y; i++)
+		n += leap(i) ? 366 : 365;
+	for (i = y; i < 1970; i++)
+		n -= leap(i) ? 366 : 365;
+	for (i = 0; i < m; i++)
+		n += days_in_month(y, i);
+	return n + d - 1;
+}
+
+static long tm_day(const struct tm *t)
+{
+	return day_number(t->tm_year + 1900, t->tm_mon, t->tm_mday);
+}
+
+/***********************************************************************
+ *
+ * Function:    civil
+ *
+ * Summary:     Date of a day number, from gmtime()
+ *
+ * Parameters:  Day number, struct tm returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void civil(long day, struct tm *t)
+{
+	time_t 	s = (time_t) day * 86400;
+
+	*t = *gmtime(&s);
+}
+
+/***********************************************************************
+ *
+ * Function:    matches
+ *
+ * Summary:     Whether an appointment has an occurrence on a day,
+ *		straight from its repeat fields
+ *
+ * Parameters:  Appointment, day number
+ *
+ * Returns:     Non-zero if it has
+ *
+ ***********************************************************************/
+static int matches(const struct Appointment *a, long day)
+{
+	long 	first = tm_day(&a->begin);
+	int 	freq = a->repeatFrequency > 0 ? a->repeatFrequency : 1,
+		i;
+	struct tm t;
+
+	if (day < first)
+		return 0;
+	if (a->repeatType == repeatNone)
+		return day == first;
+	if (!a->repeatForever && day > tm_day(&a->repeatEnd))
+		return 0;
+	for (i = 0; i < a->exceptions; i++)
+		if (tm_day(&a->exception[i]) == day)
+			return 0;
+
+	civil(day, &t);
+	switch (a->repeatType) {
+	case repeatDaily:
+		return (day - first) % freq == 0;
+	case repeatWeekly: {
+		long 	week,
+			week0;
+		int 	set = 0;
+
+		for (i = 0; i < 7; i++)
+			set |= a->repeatDays[i];
+		if (set ? !a->repeatDays[t.tm_wday]
+		    : t.tm_wday != a->begin.tm_wday)
+			return 0;
+		week = day - (t.tm_wday - a->repeatWeekstart + 7) % 7;
+		week0 = first - (a->begin.tm_wday - a->repeatWeekstart + 7) % 7;
+		return ((week - week0) / 7) % freq == 0;
+	}
+	case repeatMonthlyByDay:
+		if (((t.tm_year - a->begin.tm_year) * 12 + t.tm_mon
+		     - a->begin.tm_mon) % freq != 0
+		    || t.tm_wday != a->repeatDay % 7)
+			return 0;
+		if (a->repeatDay / 7 == 4)
+			return t.tm_mday + 7 > days_in_month(t.tm_year + 1900,
+				t.tm_mon);
+		return (t.tm_mday - 1) / 7 == a->repeatDay / 7;
+	case repeatMonthlyByDate:
+		return ((t.tm_year - a->begin.tm_year) * 12 + t.tm_mon
+			- a->begin.tm_mon) % freq == 0
+			&& t.tm_mday == a->begin.tm_mday;
+	case repeatYearly:
+		return (t.tm_year - a->begin.tm_year) % freq == 0
+			&& t.tm_mon == a->begin.tm_mon
+			&& t.tm_mday == a->begin.tm_mday;
+	default:
+		return 0;
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    random_date
+ *
+ * Summary:     A random date between 1995 and 2024, often late in the
+ *		month
+ *
+ * Parameters:  struct tm returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void random_date(struct tm *t)
+{
+	int 	y = 1995 + rand() % 30,
+		m = rand() % 12,
+		n = days_in_month(y, m);
+
+	memset(t, 0, sizeof(*t));
+	t->tm_year = y - 1900;
+	t->tm_mon = m;
+	t->tm_mday = rand() % 3 ? 1 + rand() % n : n - rand() % 3;
+	t->tm_isdst = -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    random_appointment
+ *
+ * Summary:     Make up an appointment with a random repeat rule
+ *
+ * Parameters:  Record
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void random_appointment(Record *r)
+{
+	struct Appointment *a = &r->a;
+	long 	first;
+	int 	i,
+		n;
+
+	memset(a, 0, sizeof(*a));
+	random_date(&a->begin);
+	first = tm_day(&a->begin);
+	civil(first, &a->begin);
+	a->begin.tm_isdst = -1;
+	a->end = a->begin;
+
+	a->event = rand() % 5 == 0;
+	if (!a->event) {
+		a->begin.tm_hour = rand() % 24;
+		a->begin.tm_min = rand() % 60;
+		a->end.tm_hour = a->begin.tm_hour + rand() % (24 - a->begin.tm_hour);
+		a->end.tm_min = rand() % 60;
+		if (a->end.tm_hour == a->begin.tm_hour
+		    && a->end.tm_min < a->begin.tm_min)
+			a->end.tm_min = a->begin.tm_min;
+	}
+
+	a->repeatType = (enum repeatTypes) (rand() % 6);
+	a->repeatFrequency = 1 + rand() % 4;
+	a->repeatForever = rand() % 3 == 0;
+	if (!a->repeatForever) {
+		long 	last = first + rand() % 4000;
+
+		/* the latest date a datebook record can hold */
+		if (last > day_number(2031, 11, 31))
+			last = day_number(2031, 11, 31);
+		civil(last, &a->repeatEnd);
+		a->repeatEnd.tm_isdst = -1;
+	}
+	a->repeatDay = (enum DayOfMonthType) (rand() % 35);
+	for (i = 0; i < 7; i++)
+		a->repeatDays[i] = rand() % 3 == 0;
+	a->repeatWeekstart = rand() % 2;
+
+	n = a->repeatType == repeatNone ? 0 : rand() % (MAX_EXCEPTIONS + 1);
+	a->exception = r->exception;
+	for (a->exceptions = 0; a->exceptions < n; a->exceptions++) {
+		long 	d = first + rand() % 60;
+
+		/* make most of them fall on an occurrence */
+		while (!matches(a, d) && d < first + 800)
+			d++;
+		civil(d, &r->exception[a->exceptions]);
+		r->exception[a->exceptions].tm_isdst = -1;
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    add_occurrence
+ *
+ * Summary:     pi_datebook_index_query() callback: collect an
+ *		occurrence
+ *
+ * Parameters:  Record ID, start and end, list
+ *
+ * Returns:     0 to go on
+ *
+ ***********************************************************************/
+static int add_occurrence(recordid_t id, const struct tm *begin,
+	const struct tm *end, void *data)
+{
+	OccurrenceList *l = (OccurrenceList *) data;
+	Occurrence *o;
+
+	if (l->count == l->size) {
+		l->size = l->size ? l->size * 2 : 256;
+		l->list = (Occurrence *) realloc(l->list,
+			l->size * sizeof(Occurrence));
+		if (l->list == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	o = &l->list[l->count++];
+	o->id = id;
+	o->begin = tm_day(begin) * 1440 + begin->tm_hour * 60 + begin->tm_min;
+	o->end = tm_day(end) * 1440 + end->tm_hour * 60 + end->tm_min;
+	return 0;
+}
+
+static int compare_occurrences(const void *x, const void *y)
+{
+	const Occurrence *a = (const Occurrence *) x,
+		*b = (const Occurrence *) y;
+
+	if (a->id != b->id)
+		return a->id < b->id ? -1 : 1;
+	return a->begin < b->begin ? -1 : a->begin > b->begin;
+}
+
+/***********************************************************************
+ *
+ * Function:    brute_force
+ *
+ * Summary:     Find the occurrences overlapping a range by testing
+ *		every day of it
+ *
+ * Parameters:  Records, number of them, range in minutes, list returned
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void brute_force(const Record *records, int n, long from, long to,
+	OccurrenceList *l)
+{
+	struct tm begin,
+		end;
+	long 	day;
+	int 	i;
+
+	l->count = 0;
+	for (i = 0; i < n; i++) {
+		const struct Appointment *a = &records[i].a;
+		int 	start,
+			length;
+
+		if (!records[i].live)
+			continue;
+		start = a->event ? 0 : a->begin.tm_hour * 60 + a->begin.tm_min;
+		length = a->event ? 1440
+			: a->end.tm_hour * 60 + a->end.tm_min - start;
+
+		/* an occurrence the day before can run into the range */
+		for (day = from / 1440 - 1; day <= to / 1440; day++) {
+			long 	s = day * 1440 + start;
+
+			if (s >= to || s + (length ? length : 1) <= from
+			    || !matches(a, day))
+				continue;
+			civil(day, &begin);
+			begin.tm_hour = start / 60;
+			begin.tm_min = start % 60;
+			civil(day + (start + length) / 1440, &end);
+			end.tm_hour = (start + length) % 1440 / 60;
+			end.tm_min = (start + length) % 60;
+			add_occurrence(records[i].id, &begin, &end, l);
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    check_queries
+ *
+ * Summary:     Look up random ranges in an index and by brute force
+ *
+ * Parameters:  Index, records, number of them, number of queries, name
+ *		of the check
+ *
+ * Returns:     Number of ranges that did not agree
+ *
+ ***********************************************************************/
+static int check_queries(pi_datebook_index_t *idx, const Record *records,
+	int n, int queries, const char *name)
+{
+	OccurrenceList got,
+		want;
+	double 	indexed = 0,
+		brute = 0,
+		start;
+	long 	total = 0;
+	int 	q,
+		i,
+		failed = 0;
+	struct tm from,
+		to;
+
+	memset(&got, 0, sizeof(got));
+	memset(&want, 0, sizeof(want));
+	srand(7);
+
+	for (q = 0; q < queries; q++) {
+		long 	lo,
+			hi;
+
+		random_date(&from);
+		from.tm_hour = rand() % 24;
+		from.tm_min = rand() % 60;
+		lo = tm_day(&from) * 1440 + from.tm_hour * 60 + from.tm_min;
+		hi = lo + rand() % (q % 4 ? 3 * 1440 : 90 * 1440);
+		civil(hi / 1440, &to);
+		to.tm_hour = hi % 1440 / 60;
+		to.tm_min = hi % 60;
+
+		got.count = 0;
+		start = now();
+		pi_datebook_index_query(idx, &from, &to, add_occurrence, &got);
+		indexed += now() - start;
+
+		start = now();
+		brute_force(records, n, lo, hi, &want);
+		brute += now() - start;
+
+		qsort(got.list, got.count, sizeof(Occurrence),
+			compare_occurrences);
+		qsort(want.list, want.count, sizeof(Occurrence),
+			compare_occurrences);
+		total += want.count;
+
+		if (got.count != want.count
+		    || (want.count && memcmp(got.list, want.list,
+				want.count * sizeof(Occurrence)) != 0)) {
+			printf("%s: range %ld-%ld: %d occurrences, expected %d\n",
+				name, lo, hi, got.count, want.count);
+			for (i = 0; i < want.count && i < got.count; i++)
+				if (compare_occurrences(&got.list[i],
+						&want.list[i]) != 0)
+					break;
+			printf("  first difference: record %lu at %ld, "
+				"expected record %lu at %ld\n",
+				i < got.count ? got.list[i].id : 0,
+				i < got.count ? got.list[i].begin : 0,
+				i < want.count ? want.list[i].id : 0,
+				i < want.count ? want.list[i].begin : 0);
+			failed++;
+		}
+	}
+
+	printf("%-10s %5d queries %7ld occurrences  index %8.0f/s  "
+		"brute force %6.0f/s\n", name, queries, total,
+		indexed > 0 ? queries / indexed : 0.0,
+		brute > 0 ? queries / brute : 0.0);
+
+	free(got.list);
+	free(want.list);
+	return failed;
+}
+
+/***********************************************************************
+ *
+ * Function:    write_file
+ *
+ * Summary:     Write the live records to a datebook file, with a
+ *		deleted copy of some of them that the index must skip
+ *
+ * Parameters:  Records, number of them
+ *
+ * Returns:     0 on success, -1 on error
+ *
+ ***********************************************************************/
+static int write_file(const Record *records, int n)
+{
+	struct DBInfo info;
+	pi_file_t *pf;
+	pi_buffer_t *buf;
+	int 	i;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "DatebookDB");
+	info.type = makelong("DATA");
+	info.creator = makelong("date");
+
+	pf = pi_file_create(TEST_FILE, &info);
+	buf = pi_buffer_new(256);
+	if (pf == NULL || buf == NULL)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (!records[i].live)
+			continue;
+		if (pack_Appointment(&records[i].a, buf, datebook_v1) < 0
+		    || pi_file_append_record(pf, buf->data, buf->used, 0, 0,
+			    records[i].id) < 0)
+			return -1;
+		if (i % 10 == 0
+		    && pi_file_append_record(pf, buf->data, buf->used,
+			    dlpRecAttrDeleted, 0, records[i].id + 1) < 0)
+			return -1;
+	}
+
+	pi_buffer_free(buf);
+	return pi_file_close(pf);
+}
+
+int main(int argc, char *argv[])
+{
+	int 	num = DEFAULT_APPOINTMENTS,
+		queries = DEFAULT_QUERIES,
+		total,
+		failed = 0,
+		i;
+	Record 	*records;
+	pi_datebook_index_t *idx,
+		*fidx;
+	pi_file_t *pf;
+	double 	start;
+
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2)
+		queries = atoi(argv[2]);
+	if (num < 1 || queries < 1) {
+		fprintf(stderr, "Usage: %s [appointments [queries]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	/* room for the records added later */
+	total = num + num / 4;
+	records = (Record *) calloc(total, sizeof(Record));
+	idx = pi_datebook_index_new();
+	if (records == NULL || idx == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	start = now();
+	for (i = 0; i < num; i++) {
+		/* IDs that are even, so id + 1 is free for deleted copies */
+		records[i].id = 0x100000 + 2 * i;
+		records[i].live = 1;
+		random_appointment(&records[i]);
+		if (pi_datebook_index_set_appointment(idx, records[i].id,
+				&records[i].a) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+	}
+	printf("built      %5d records in %.3f s\n", num, now() - start);
+	failed += check_queries(idx, records, num, queries, "built");
+
+	/* remove a third, replace a third, then add some more */
+	srand(2);
+	for (i = 0; i < num; i += 3) {
+		if (pi_datebook_index_remove(idx, records[i].id) != 1)
+			failed++;
+		records[i].live = 0;
+		if (pi_datebook_index_remove(idx, records[i].id) != 0)
+			failed++;
+	}
+	for (i = 1; i < num; i += 3) {
+		random_appointment(&records[i]);
+		pi_datebook_index_set_appointment(idx, records[i].id,
+			&records[i].a);
+	}
+	for (i = num; i < total; i++) {
+		records[i].id = 0x100000 + 2 * i;
+		records[i].live = 1;
+		random_appointment(&records[i]);
+		pi_datebook_index_set_appointment(idx, records[i].id,
+			&records[i].a);
+	}
+	if (pi_datebook_index_count(idx) != total - (num + 2) / 3) {
+		printf("updated: %d records, expected %d\n",
+			pi_datebook_index_count(idx), total - (num + 2) / 3);
+		failed++;
+	}
+	failed += check_queries(idx, records, total, queries, "updated");
+
+	if (write_file(records, total) < 0) {
+		fprintf(stderr, "Cannot write %s\n", TEST_FILE);
+		return 1;
+	}
+	fidx = pi_datebook_index_new();
+	pf = pi_file_open_mapped(TEST_FILE);
+	if (fidx == NULL || pf == NULL) {
+		fprintf(stderr, "Cannot read %s\n", TEST_FILE);
+		return 1;
+	}
+	i = pi_datebook_index_read_file(fidx, pf);
+	if (i != pi_datebook_index_count(idx)) {
+		printf("file: %d records read, expected %d\n", i,
+			pi_datebook_index_count(idx));
+		failed++;
+	}
+	failed += check_queries(fidx, records, total, queries, "file");
+	pi_file_close(pf);
+	remove(TEST_FILE);
+
+	pi_datebook_index_free(idx);
+	pi_datebook_index_free(fidx);
+	free(records);
+
+	if (failed) {
+		printf("%d checks failed\n", failed);
+		return 1;
+	}
+	printf("consistency: ok\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
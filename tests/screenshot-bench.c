@@ -0,0 +1,149 @@
+/*
+ * $Id$
+ *
+ * screenshot-bench.c: Benchmark of the screenshot pixel conversion
+ *
+ * A 320x320 screenshot of random pixels is made up for each depth, with
+ * a random colour table at 8 bits per pixel. Each is converted to RGB
+ * again and again with unpack_ScreenShot(), once with the portable code
+ * and once with the kernels for the processor. Each pass reports images
+ * and megapixels per second. Both ways must give the same pixmaps,
+ * otherwise the program fails.
+ *
+ * Usage: screenshot-bench [images]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-screenshot.h"
+
+#define DEFAULT_IMAGES	500
+#define WIDTH		320
+#define HEIGHT		320
+
+static const int depths[] = { 1, 2, 4, 8, 16 };
+
+#define NUM_DEPTHS	((int) (sizeof(depths) / sizeof(depths[0])))
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	images = DEFAULT_IMAGES,
+		d,
+		scalar,
+		n,
+		failed = 0;
+	size_t 	size = WIDTH * HEIGHT * 3,
+		len,
+		i;
+	unsigned char *data,
+		*pixmap,
+		*reference;
+	struct ScreenShotHeader header;
+
+	if (argc > 1)
+		images = atoi(argv[1]);
+	if (images < 1) {
+		fprintf(stderr, "Usage: %s [images]\n", argv[0]);
+		return 1;
+	}
+
+	header.width = WIDTH;
+	header.height = HEIGHT;
+	header.depth = 16;
+	header.num_records = 1;
+	header.offset = 0;
+
+	data = (unsigned char *) malloc(ScreenShot_data_size(&header));
+	pixmap = (unsigned char *) malloc(size);
+	reference = (unsigned char *) malloc(size);
+	if (data == NULL || pixmap == NULL || reference == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	for (d = 0; d < NUM_DEPTHS; d++) {
+		header.depth = depths[d];
+		len = ScreenShot_data_size(&header);
+		for (i = 0; i < len; i++)
+			data[i] = rand() >> 4;
+
+		for (scalar = 1; scalar >= 0; scalar--) {
+			double 	start,
+				elapsed;
+
+			start = now();
+			for (n = 0; n < images; n++) {
+				if (!unpack_ScreenShot(&header, data, len, pixmap,
+						scalar ? SCREENSHOT_SCALAR : 0)) {
+					fprintf(stderr, "Conversion failed\n");
+					return 1;
+				}
+			}
+			elapsed = now() - start;
+
+			if (scalar) {
+				memcpy(reference, pixmap, size);
+			} else if (memcmp(reference, pixmap, size) != 0) {
+				fprintf(stderr, "%d bpp: pixmaps differ\n",
+					depths[d]);
+				failed = 1;
+			}
+
+			printf("%2d bpp   %-6s %8.1f images/s %7.1f Mpixels/s\n",
+				depths[d], scalar ? "scalar" : "vector",
+				elapsed > 0 ? images / elapsed : 0.0,
+				elapsed > 0 ? images * (double) WIDTH * HEIGHT
+					/ elapsed / 1e6 : 0.0);
+		}
+	}
+
+	free(data);
+	free(pixmap);
+	free(reference);
+
+	if (failed)
+		return 1;
+	printf("consistency: ok\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
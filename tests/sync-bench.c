@@ -0,0 +1,377 @@
+/*
+ * $Id$
+ *
+ * sync-bench.c: Benchmark of the device record handling in libpisync
+ *
+ * Runs sync_MergeFromPilot() over 20000 records, slow then fast, against
+ * a fake device that answers the DLP calls from memory. The conduit keeps
+ * a copy of every record it is given, as a conduit that adds records to
+ * its own store would. Every 1000th record is larger than 64 KiB, as DLP
+ * 1.4 devices allow, and every kept record must come out intact.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-dlp.h"
+#include "pi-buffer.h"
+#include "pi-sync.h"
+
+#define NUM_RECORDS	20000
+#define LARGE_EVERY	1000
+#define LARGE_SIZE	(100 * 1024)
+
+static unsigned char *source;
+static size_t source_size;
+static size_t offsets[NUM_RECORDS + 1];
+
+/* Records kept by the conduit, by record ID - 1 */
+static PilotRecord *kept[NUM_RECORDS];
+
+/* Next record dlp_ReadNextModifiedRec() returns */
+static int modified_cursor;
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    make_records
+ *
+ * Summary:     Build the contents of the records the "device" sends
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void make_records(void)
+{
+	int 	i;
+	size_t	j,
+		size;
+	unsigned long seed = 12345;
+
+	offsets[0] = 0;
+	for (i = 0; i < NUM_RECORDS; i++) {
+		seed = seed * 1103515245 + 12345;
+		size = (i % LARGE_EVERY == LARGE_EVERY - 1)
+			? LARGE_SIZE : 32 + (seed >> 16) % 1000;
+		offsets[i + 1] = offsets[i] + size;
+	}
+
+	source_size = offsets[NUM_RECORDS];
+	source = malloc(source_size);
+	for (j = 0; j < source_size; j++)
+		source[j] = (unsigned char) (j * 7 + (j >> 8));
+}
+
+/***********************************************************************
+ *
+ * Function:    device_send
+ *
+ * Summary:     Put a record of the fake device in a DLP reply. Every
+ *		record is new since the last sync.
+ *
+ * Parameters:  Record index, reply buffer, record ID, attributes and
+ *		category (each may be NULL)
+ *
+ * Returns:     Record length, or PI_ERR_DLP_PALMOS past the last record
+ *
+ ***********************************************************************/
+static int
+device_send(int i, pi_buffer_t *retbuf, recordid_t *recuid, int *recattrs,
+	    int *category)
+{
+	size_t	size;
+
+	if (i < 0 || i >= NUM_RECORDS)
+		return PI_ERR_DLP_PALMOS;
+
+	size = offsets[i + 1] - offsets[i];
+	if (retbuf) {
+		pi_buffer_clear(retbuf);
+		pi_buffer_append(retbuf, source + offsets[i], size);
+	}
+	if (recuid)
+		*recuid = i + 1;
+	if (recattrs)
+		*recattrs = dlpRecAttrDirty;
+	if (category)
+		*category = i % 16;
+
+	return size;
+}
+
+/* The DLP calls libpisync makes, answered by the fake device */
+
+int dlp_OpenDB(int sd, int cardno, int mode, PI_CONST char *dbname,
+	       int *dbhandle)
+{
+	*dbhandle = 1;
+	modified_cursor = 0;
+	return 0;
+}
+
+int dlp_CloseDB(int sd, int dbhandle)
+{
+	return 0;
+}
+
+int dlp_CleanUpDatabase(int sd, int dbhandle)
+{
+	return 0;
+}
+
+int dlp_ResetSyncFlags(int sd, int dbhandle)
+{
+	return 0;
+}
+
+int dlp_ReadOpenDBInfo(int sd, int dbhandle, int *numrecs)
+{
+	*numrecs = NUM_RECORDS;
+	return 0;
+}
+
+int dlp_ReadRecordIDList(int sd, int dbhandle, int sort, int start, int max,
+			 recordid_t *recuids, int *count)
+{
+	for (*count = 0; *count < max && start + *count < NUM_RECORDS;
+	     (*count)++)
+		recuids[*count] = start + *count + 1;
+	return 0;
+}
+
+int dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex,
+			  pi_buffer_t *retbuf, recordid_t *recuid,
+			  int *recattrs, int *category)
+{
+	return device_send(recindex, retbuf, recuid, recattrs, category);
+}
+
+int dlp_ReadRecordById(int sd, int dbhandle, recordid_t recuid,
+		       pi_buffer_t *retbuf, int *recindex, int *recattrs,
+		       int *category)
+{
+	if (recindex)
+		*recindex = recuid - 1;
+	return device_send(recuid - 1, retbuf, NULL, recattrs, category);
+}
+
+int dlp_ReadNextModifiedRec(int sd, int dbhandle, pi_buffer_t *retbuf,
+			    recordid_t *recuid, int *recindex, int *recattrs,
+			    int *category)
+{
+	if (recindex)
+		*recindex = modified_cursor;
+	return device_send(modified_cursor++, retbuf, recuid, recattrs,
+		category);
+}
+
+int dlp_DeleteRecord(int sd, int dbhandle, int all, recordid_t recuid)
+{
+	return PI_ERR_DLP_PALMOS;
+}
+
+int dlp_WriteRecord(int sd, int dbhandle, int flags, recordid_t recuid,
+		    int catid, PI_CONST void *databuf, size_t datasize,
+		    recordid_t *newrecuid)
+{
+	return PI_ERR_DLP_PALMOS;
+}
+
+/* The conduit callbacks. The desktop starts empty, so every record is
+   added. */
+
+static int Pre(SyncHandler *sh, int dbhandle, int *slow)
+{
+	*slow = *(int *) sh->data;
+	return 0;
+}
+
+static int Post(SyncHandler *sh, int dbhandle)
+{
+	return 0;
+}
+
+static int SetStatusCleared(SyncHandler *sh, DesktopRecord *drecord)
+{
+	return 0;
+}
+
+static int Compare(SyncHandler *sh, PilotRecord *precord,
+		   DesktopRecord *drecord)
+{
+	return 1;
+}
+
+static int AddRecord(SyncHandler *sh, PilotRecord *precord)
+{
+	recordid_t id = precord->recID;
+
+	if (id == 0 || id > NUM_RECORDS || kept[id - 1] != NULL)
+		return -1;
+	kept[id - 1] = sync_CopyPilotRecord(precord);
+	return 0;
+}
+
+static int Match(SyncHandler *sh, PilotRecord *precord,
+		 DesktopRecord **drecord)
+{
+	*drecord = NULL;
+	return 0;
+}
+
+static int FreeMatch(SyncHandler *sh, DesktopRecord *drecord)
+{
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    check
+ *
+ * Summary:     Count the records the conduit didn't keep, or kept
+ *		damaged
+ *
+ * Parameters:  None
+ *
+ * Returns:     Number of bad records
+ *
+ ***********************************************************************/
+static int check(void)
+{
+	int 	i,
+		bad = 0;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		size_t	size = offsets[i + 1] - offsets[i];
+
+		if (kept[i] == NULL || kept[i]->len != size
+		    || memcmp(kept[i]->buffer, source + offsets[i], size))
+			bad++;
+	}
+
+	return bad;
+}
+
+/***********************************************************************
+ *
+ * Function:    release
+ *
+ * Summary:     Free the kept records
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void release(void)
+{
+	int 	i;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		if (kept[i] != NULL)
+			sync_FreePilotRecord(kept[i]);
+		kept[i] = NULL;
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    run
+ *
+ * Summary:     Merge every record from the fake device and report it
+ *
+ * Parameters:  Non-zero for a slow sync
+ *
+ * Returns:     Number of bad records, counting a failed merge as one
+ *
+ ***********************************************************************/
+static int run(int slow)
+{
+	int 	result,
+		bad;
+	double 	start,
+		elapsed;
+	SyncHandler sh;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.name = "BenchDB";
+	sh.data = &slow;
+	sh.Pre = Pre;
+	sh.Post = Post;
+	sh.SetStatusCleared = SetStatusCleared;
+	sh.Compare = Compare;
+	sh.AddRecord = AddRecord;
+	sh.Match = Match;
+	sh.FreeMatch = FreeMatch;
+
+	start = now();
+	result = sync_MergeFromPilot(&sh);
+	elapsed = now() - start;
+
+	bad = check();
+	release();
+
+	printf("%s: %8.3f s, %10.0f records/s, %d records damaged%s\n",
+		slow ? "slow" : "fast", elapsed,
+		elapsed > 0 ? NUM_RECORDS / elapsed : 0.0, bad,
+		result < 0 ? ", merge failed" : "");
+
+	return bad + (result < 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int 	bad = 0;
+
+	make_records();
+
+	printf("%d records, %lu bytes, %d larger than %d bytes\n",
+		NUM_RECORDS, (unsigned long) source_size,
+		NUM_RECORDS / LARGE_EVERY, DLP_BUF_SIZE);
+	bad += run(1);
+	bad += run(0);
+
+	free(source);
+
+	return bad ? 1 : 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,181 @@
+/*
+ * $Id$
+ *
+ * sync-index-test.c: Check the hash index of desktop records
+ *
+ * Records are added with and without IDs, then re-keyed over and over
+ * the way SetPilotID callbacks do: new records get their first ID, others
+ * get a different one or lose theirs. After every round each record must
+ * be found under its current ID and no longer under any former one. The
+ * index must also refuse records it was never given, and ForEachModified
+ * must visit each record updated as modified once. The time taken by the
+ * re-keying is reported.
+ *
+ * Usage: sync-index-test [records [rounds]]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-dlp.h"
+#include "pi-sync.h"
+
+#define DEFAULT_RECORDS		20000
+#define DEFAULT_ROUNDS		20
+
+static int failed = 0;
+
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+static void expect(const char *what, int ok)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Check every record is found under its ID, and count those that aren't */
+static int check_all(SyncIndex *index, DesktopRecord *recs, int count)
+{
+	int 	i,
+		bad = 0;
+
+	for (i = 0; i < count; i++)
+		if (recs[i].recID != 0
+		    && sync_IndexFind(index, recs[i].recID) != &recs[i])
+			bad++;
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	records = DEFAULT_RECORDS,
+		rounds = DEFAULT_ROUNDS,
+		round,
+		i,
+		stale = 0,
+		missing = 0,
+		visited;
+	recordid_t next_id = 1,
+		old;
+	double 	start;
+	DesktopRecord *recs,
+		stranger,
+		*d;
+	SyncIndex *index;
+	SyncHandler sh;
+	PilotRecord precord;
+
+	if (argc > 1)
+		records = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (records < 4 || rounds < 1) {
+		fprintf(stderr, "Usage: %s [records [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	recs = calloc(records, sizeof(DesktopRecord));
+	index = sync_NewIndex();
+	if (recs == NULL || index == NULL) {
+		printf("FAILED: out of memory\n");
+		return 1;
+	}
+
+	/* Every third record is new on the desktop, without an ID */
+	for (i = 0; i < records; i++) {
+		recs[i].recID = i % 3 == 0 ? 0 : next_id++;
+		expect("add", sync_IndexAdd(index, &recs[i]) == 0);
+	}
+	expect("found after adding", check_all(index, recs, records) == 0);
+	expect("no record 0", sync_IndexFind(index, 0) == NULL);
+
+	memset(&stranger, 0, sizeof(stranger));
+	stranger.recID = 1;
+	expect("refuse a record never added",
+		sync_IndexUpdate(index, &stranger) == PI_ERR_GENERIC_ARGUMENT);
+
+	start = now();
+	for (round = 0; round < rounds; round++) {
+		for (i = round % 2; i < records; i += 2) {
+			old = recs[i].recID;
+			/* Now and then a record loses its ID */
+			recs[i].recID = (i + round) % 11 == 0 ? 0 : next_id++;
+			if (sync_IndexUpdate(index, &recs[i]) < 0) {
+				expect("update", 0);
+				continue;
+			}
+			if (old != 0 && sync_IndexFind(index, old) != NULL)
+				stale++;
+			if (recs[i].recID != 0
+			    && sync_IndexFind(index, recs[i].recID) != &recs[i])
+				missing++;
+		}
+		missing += check_all(index, recs, records);
+	}
+	printf("%d records re-keyed %d times in %.3fs\n", records / 2,
+		rounds, now() - start);
+	if (stale || missing) {
+		printf("FAILED: %d old IDs still found, %d records missing\n",
+			stale, missing);
+		failed = 1;
+	}
+
+	/* Updating without a change, or with the same ID, is harmless */
+	expect("update unchanged", sync_IndexUpdate(index, &recs[1]) == 0
+		&& sync_IndexFind(index, recs[1].recID) == &recs[1]);
+
+	/* ForEachModified visits each record updated as modified once */
+	for (i = 0; i < records; i += 4) {
+		recs[i].flags = dlpRecAttrDirty;
+		sync_IndexUpdate(index, &recs[i]);
+		sync_IndexUpdate(index, &recs[i]);
+	}
+	memset(&sh, 0, sizeof(sh));
+	sync_UseIndex(&sh, index);
+	visited = 0;
+	for (d = NULL; sh.ForEachModified(&sh, &d) == 0 && d != NULL; )
+		visited++;
+	expect("modified records", visited == (records + 3) / 4);
+
+	memset(&precord, 0, sizeof(precord));
+	precord.recID = recs[2].recID;
+	expect("match", sh.Match(&sh, &precord, &d) == 0
+		&& d == (precord.recID ? &recs[2] : NULL));
+
+	sync_FreeIndex(index);
+	free(recs);
+
+	if (failed)
+		printf("FAILED\n");
+	else
+		printf("All tests passed\n");
+	return failed;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,961 @@
+/*
+ * $Id$
+ *
+ * sync-mock-bench.c: Benchmark of the libpisync engine against a fake
+ * device
+ *
+ * The DLP calls libpisync makes are answered by the in-memory device
+ * below instead of libpisock, so sync_Synchronize(), sync_CopyToPilot()
+ * and sync_CopyFromPilot() run without a handheld. The conduit keeps its
+ * desktop records in memory too. Both sides start with the same records,
+ * then a given percentage of them is changed on each side: modified,
+ * deleted, or added on the desktop.
+ *
+ * Records hold two fields, a title and a note. Records changed on both
+ * sides mostly have different fields changed, which the three-way pass
+ * merges instead of keeping both versions.
+ *
+ * The fast and slow syncs are run again with the pipelined engine, a
+ * reader thread and matcher threads, and must leave both sides exactly as
+ * the serial engine did.
+ *
+ * Each pass reports records per second, the allocations made by the
+ * engine and conduit, the DLP calls it would have sent to a device and
+ * the number of records left on the device.
+ * After the syncs both sides must hold the same records, otherwise the
+ * program fails.
+ *
+ * Usage: sync-mock-bench [records [percent changed]]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-dlp.h"
+#include "pi-buffer.h"
+#include "pi-util.h"
+#include "pi-sync.h"
+
+#define DEFAULT_RECORDS	10000
+#define DEFAULT_PERCENT	10
+#define DATA_SIZE	96
+
+#define PASS_FAST	0
+#define PASS_SLOW	1
+#define PASS_THREE_WAY	2
+#define PASS_COPY_TO	3
+#define PASS_COPY_FROM	4
+#define PASS_FAST_PIPED	5
+#define PASS_SLOW_PIPED	6
+#define NUM_PASSES	7
+
+#define PIPELINE_DEPTH	16
+#define MATCH_WORKERS	4
+
+/* Both stores keep at most this many records per original one */
+#define CAPACITY(n)	((n) * 3 + 16)
+
+typedef struct {
+	int 	present,
+		attrs,
+		catID,
+		len;
+	recordid_t recID;
+	char 	data[DATA_SIZE];
+} DeviceRecord;
+
+typedef struct {
+	DesktopRecord d;	/* must come first */
+	int 	removed,
+		len;
+	char 	data[DATA_SIZE];
+} StoreRecord;
+
+typedef struct {
+	unsigned long reads,
+		writes,
+		deletes,
+		other;
+} DLPCount;
+
+static int records, percent;
+
+/* The fake device. Record IDs are handed out in order, so id_pos[] can
+   map them straight to positions. */
+static DeviceRecord *device;
+static int num_device, *device_order, num_order, order_stale,
+	*id_pos, modified_cursor;
+static recordid_t next_id;
+static DLPCount dlp;
+
+/* The desktop store. Record IDs map to store records through store_of[]. */
+static StoreRecord *store;
+static int num_store, *store_of;
+
+/* State after the "last sync", for the three-way pass */
+static SyncCache *cache;
+
+/* Digest of both sides after each pass, to compare the pipelined passes
+   with the serial ones */
+static uint64_t outcome[NUM_PASSES];
+
+static int counting;
+static unsigned long allocations;
+
+#ifdef __GLIBC__
+/* Count the allocations made during a pass by wrapping the C library's
+   allocator. Other C libraries don't offer a portable way to do this, and
+   the count is reported as 0 there. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* The pipelined passes allocate from several threads */
+void *malloc(size_t size)
+{
+	if (counting)
+		__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (counting)
+		__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    chosen
+ *
+ * Summary:     Tell whether a record is among the changed ones on a
+ *		side. Each side picks a different, evenly spread set, which
+ *		overlap in about percent^2 of the records.
+ *
+ * Parameters:  Record number, side (0 or 1)
+ *
+ * Returns:     Non-zero if the record changed
+ *
+ ***********************************************************************/
+static int chosen(int i, int side)
+{
+	return (i * (side ? 37 : 73) + side * 50) % 100 < percent;
+}
+
+/***********************************************************************
+ *
+ * Function:    device_position
+ *
+ * Summary:     Find a record on the device by ID
+ *
+ * Parameters:  Record ID
+ *
+ * Returns:     Position in device[], or -1 if not there
+ *
+ ***********************************************************************/
+static int device_position(recordid_t id)
+{
+	if (id == 0 || id >= (recordid_t) CAPACITY(records)
+	    || id_pos[id] < 0 || !device[id_pos[id]].present)
+		return -1;
+
+	return id_pos[id];
+}
+
+/***********************************************************************
+ *
+ * Function:    device_record
+ *
+ * Summary:     Find a record on the device by index, as the device
+ *		numbers them
+ *
+ * Parameters:  Index
+ *
+ * Returns:     Position in device[], or -1 past the last record
+ *
+ ***********************************************************************/
+static int device_record(int index)
+{
+	int 	i;
+
+	if (order_stale) {
+		num_order = 0;
+		for (i = 0; i < num_device; i++)
+			if (device[i].present)
+				device_order[num_order++] = i;
+		order_stale = 0;
+	}
+
+	return index < num_order ? device_order[index] : -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    device_send
+ *
+ * Summary:     Put a device record in a DLP reply
+ *
+ * Parameters:  Position, reply buffer, record ID, index, attributes and
+ *		category (each may be NULL)
+ *
+ * Returns:     Record length
+ *
+ ***********************************************************************/
+static int
+device_send(int pos, pi_buffer_t *retbuf, recordid_t *recuid, int *recindex,
+	    int *recattrs, int *category)
+{
+	DeviceRecord *r = &device[pos];
+
+	if (retbuf) {
+		pi_buffer_clear(retbuf);
+		pi_buffer_append(retbuf, r->data, r->len);
+	}
+	if (recuid)
+		*recuid = r->recID;
+	if (recindex)
+		*recindex = 0;
+	if (recattrs)
+		*recattrs = r->attrs;
+	if (category)
+		*category = r->catID;
+
+	return r->len;
+}
+
+/* The DLP calls libpisync makes, answered by the fake device */
+
+int dlp_OpenDB(int sd, int cardno, int mode, PI_CONST char *dbname,
+	       int *dbhandle)
+{
+	dlp.other++;
+	*dbhandle = 1;
+	modified_cursor = 0;
+	return 0;
+}
+
+int dlp_CloseDB(int sd, int dbhandle)
+{
+	dlp.other++;
+	return 0;
+}
+
+int dlp_CleanUpDatabase(int sd, int dbhandle)
+{
+	int 	i;
+
+	dlp.other++;
+	for (i = 0; i < num_device; i++)
+		if (device[i].attrs & (dlpRecAttrDeleted | dlpRecAttrArchived))
+			device[i].present = 0;
+	order_stale = 1;
+	return 0;
+}
+
+int dlp_ResetSyncFlags(int sd, int dbhandle)
+{
+	int 	i;
+
+	dlp.other++;
+	for (i = 0; i < num_device; i++)
+		device[i].attrs &= ~dlpRecAttrDirty;
+	return 0;
+}
+
+int dlp_ReadOpenDBInfo(int sd, int dbhandle, int *numrecs)
+{
+	dlp.other++;
+	device_record(0);
+	*numrecs = num_order;
+	return 0;
+}
+
+int dlp_ReadRecordIDList(int sd, int dbhandle, int sort, int start, int max,
+			 recordid_t *recuids, int *count)
+{
+	int 	pos;
+
+	dlp.reads++;
+	for (*count = 0; *count < max
+		     && (pos = device_record(start + *count)) >= 0; (*count)++)
+		recuids[*count] = device[pos].recID;
+	return 0;
+}
+
+int dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex,
+			  pi_buffer_t *retbuf, recordid_t *recuid,
+			  int *recattrs, int *category)
+{
+	int 	pos = device_record(recindex);
+
+	dlp.reads++;
+	if (pos < 0)
+		return PI_ERR_DLP_PALMOS;
+	return device_send(pos, retbuf, recuid, NULL, recattrs, category);
+}
+
+int dlp_ReadRecordById(int sd, int dbhandle, recordid_t recuid,
+		       pi_buffer_t *retbuf, int *recindex, int *recattrs,
+		       int *category)
+{
+	int 	pos = device_position(recuid);
+
+	dlp.reads++;
+	if (pos < 0)
+		return PI_ERR_DLP_PALMOS;
+	return device_send(pos, retbuf, NULL, recindex, recattrs, category);
+}
+
+int dlp_ReadNextModifiedRec(int sd, int dbhandle, pi_buffer_t *retbuf,
+			    recordid_t *recuid, int *recindex, int *recattrs,
+			    int *category)
+{
+	dlp.reads++;
+	while (modified_cursor < num_device) {
+		int 	pos = modified_cursor++;
+
+		if (device[pos].present
+		    && (device[pos].attrs & dlpRecAttrDirty))
+			return device_send(pos, retbuf, recuid, recindex,
+				recattrs, category);
+	}
+	return PI_ERR_DLP_PALMOS;
+}
+
+int dlp_DeleteRecord(int sd, int dbhandle, int all, recordid_t recuid)
+{
+	int 	pos;
+
+	dlp.deletes++;
+	if (all) {
+		for (pos = 0; pos < num_device; pos++)
+			device[pos].present = 0;
+	} else if ((pos = device_position(recuid)) >= 0) {
+		device[pos].present = 0;
+	}
+	order_stale = 1;
+	return 0;
+}
+
+int dlp_WriteRecord(int sd, int dbhandle, int flags, recordid_t recuid,
+		    int catid, PI_CONST void *databuf, size_t datasize,
+		    recordid_t *newrecuid)
+{
+	int 	pos = device_position(recuid);
+	DeviceRecord *r;
+
+	dlp.writes++;
+	if (datasize > DATA_SIZE)
+		return PI_ERR_DLP_PALMOS;
+
+	if (pos < 0) {
+		if (num_device == CAPACITY(records))
+			return PI_ERR_DLP_PALMOS;
+		if (recuid == 0)
+			recuid = next_id++;
+		pos = num_device++;
+		id_pos[recuid] = pos;
+		order_stale = 1;
+	}
+
+	r = &device[pos];
+	r->present = 1;
+	r->recID = recuid;
+	r->attrs = flags & dlpRecAttrSecret;
+	r->catID = catid;
+	r->len = datasize;
+	memcpy(r->data, databuf, datasize);
+	if (newrecuid)
+		*newrecuid = recuid;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    store_add
+ *
+ * Summary:     Add a record to the desktop store
+ *
+ * Parameters:  Record ID, category, flags, data, length
+ *
+ * Returns:     The new record, or NULL if the store is full
+ *
+ ***********************************************************************/
+static StoreRecord *
+store_add(recordid_t id, int catID, int flags, const void *data, size_t len)
+{
+	StoreRecord *r;
+
+	if (num_store == CAPACITY(records) || len > DATA_SIZE)
+		return NULL;
+
+	r = &store[num_store];
+	r->d.recID = id;
+	r->d.catID = catID;
+	r->d.flags = flags;
+	r->removed = 0;
+	r->len = len;
+	memcpy(r->data, data, len);
+	if (id != 0)
+		store_of[id] = num_store;
+	num_store++;
+
+	return r;
+}
+
+/* The conduit callbacks */
+
+static int Pre(SyncHandler *sh, int dbhandle, int *slow)
+{
+	*slow = *(int *) sh->data;
+	return 0;
+}
+
+static int Post(SyncHandler *sh, int dbhandle)
+{
+	return 0;
+}
+
+static int SetPilotID(SyncHandler *sh, DesktopRecord *drecord, recordid_t id)
+{
+	drecord->recID = id;
+	store_of[id] = (StoreRecord *) drecord - store;
+	return 0;
+}
+
+static int SetStatusCleared(SyncHandler *sh, DesktopRecord *drecord)
+{
+	drecord->flags = 0;
+	return 0;
+}
+
+static int ForEach(SyncHandler *sh, DesktopRecord **drecord)
+{
+	int 	i = *drecord ? (StoreRecord *) *drecord - store + 1 : 0;
+
+	while (i < num_store && store[i].removed)
+		i++;
+	*drecord = i < num_store ? &store[i].d : NULL;
+	return 0;
+}
+
+static int ForEachModified(SyncHandler *sh, DesktopRecord **drecord)
+{
+	int 	i = *drecord ? (StoreRecord *) *drecord - store + 1 : 0;
+
+	while (i < num_store && (store[i].removed || !(store[i].d.flags
+		& (dlpRecAttrDirty | dlpRecAttrDeleted | dlpRecAttrArchived))))
+		i++;
+	*drecord = i < num_store ? &store[i].d : NULL;
+	return 0;
+}
+
+static int Compare(SyncHandler *sh, PilotRecord *precord,
+		   DesktopRecord *drecord)
+{
+	StoreRecord *r = (StoreRecord *) drecord;
+
+	return r->len != (int) precord->len
+		|| memcmp(r->data, precord->buffer, r->len) != 0;
+}
+
+static int AddRecord(SyncHandler *sh, PilotRecord *precord)
+{
+	return store_add(precord->recID, precord->catID, 0, precord->buffer,
+		precord->len) ? 0 : -1;
+}
+
+static int ReplaceRecord(SyncHandler *sh, DesktopRecord *drecord,
+			 PilotRecord *precord)
+{
+	StoreRecord *r = (StoreRecord *) drecord;
+
+	if (precord->len > DATA_SIZE)
+		return -1;
+	r->d.catID = precord->catID;
+	r->len = precord->len;
+	memcpy(r->data, precord->buffer, precord->len);
+	return 0;
+}
+
+static int DeleteRecord(SyncHandler *sh, DesktopRecord *drecord)
+{
+	((StoreRecord *) drecord)->removed = 1;
+	return 0;
+}
+
+static int ArchiveRecord(SyncHandler *sh, DesktopRecord *drecord,
+			 int archive)
+{
+	if (archive)
+		((StoreRecord *) drecord)->removed = 1;
+	else
+		drecord->flags &= ~dlpRecAttrArchived;
+	return 0;
+}
+
+static int Match(SyncHandler *sh, PilotRecord *precord,
+		 DesktopRecord **drecord)
+{
+	int 	i;
+
+	*drecord = NULL;
+	if (precord->recID == 0 || precord->recID >= (recordid_t) CAPACITY(records))
+		return 0;
+	i = store_of[precord->recID];
+	if (i >= 0 && !store[i].removed && store[i].d.recID == precord->recID)
+		*drecord = &store[i].d;
+	return 0;
+}
+
+static int FreeMatch(SyncHandler *sh, DesktopRecord *drecord)
+{
+	return 0;
+}
+
+static int Prepare(SyncHandler *sh, DesktopRecord *drecord,
+		   PilotRecord *precord)
+{
+	StoreRecord *r = (StoreRecord *) drecord;
+
+	precord->recID = drecord->recID;
+	precord->catID = drecord->catID;
+	precord->flags = drecord->flags;
+	precord->buffer = r->data;
+	precord->len = r->len;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    Merge
+ *
+ * Summary:     Merge callback: take each field from the side that
+ *		changed it
+ *
+ * Parameters:  None
+ *
+ * Returns:     0 if merged, 1 if a field changed on both sides
+ *
+ ***********************************************************************/
+static int Merge(SyncHandler *sh, const PilotRecord *base,
+		 PilotRecord *precord, DesktopRecord *drecord)
+{
+	int 	f,
+		len = 0;
+	char 	merged[DATA_SIZE];
+	const char *field[3][2],
+		*end[3][2];
+	StoreRecord *r = (StoreRecord *) drecord;
+	const char *text[3] = { base->buffer, precord->buffer, r->data };
+	int 	size[3] = { base->len, precord->len, r->len };
+
+	for (f = 0; f < 3; f++) {
+		const char *nl = memchr(text[f], '\n', size[f]);
+
+		if (nl == NULL)
+			return 1;
+		field[f][0] = text[f];
+		end[f][0] = nl;
+		field[f][1] = nl + 1;
+		end[f][1] = text[f] + size[f];
+	}
+
+	for (f = 0; f < 2; f++) {
+		int 	n[3],
+			side,
+			k;
+
+		for (k = 0; k < 3; k++)
+			n[k] = end[k][f] - field[k][f];
+
+		/* Base, device or desktop: whichever differs from base */
+		if (n[1] != n[0] || memcmp(field[1][f], field[0][f], n[0])) {
+			if (n[2] != n[0]
+			    || memcmp(field[2][f], field[0][f], n[0]))
+				return 1;
+			side = 1;
+		} else {
+			side = 2;
+		}
+		if (len + n[side] + 1 > DATA_SIZE)
+			return 1;
+		memcpy(merged + len, field[side][f], n[side]);
+		len += n[side];
+		if (f == 0)
+			merged[len++] = '\n';
+	}
+
+	memcpy(r->data, merged, len);
+	r->len = len;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    record_text
+ *
+ * Summary:     Write the fields of a record
+ *
+ * Parameters:  Buffer, record number, category, text added to the
+ *		title and the note
+ *
+ * Returns:     Length
+ *
+ ***********************************************************************/
+static int record_text(char *buf, int i, int catID, const char *title,
+		       const char *note)
+{
+	return sprintf(buf, "Record %d%s\ncategory %d%s", i, title, catID,
+		note);
+}
+
+/***********************************************************************
+ *
+ * Function:    setup
+ *
+ * Summary:     Fill the device and the desktop store with the same
+ *		records, then change some of them on each side
+ *
+ * Parameters:  Pass, the three-way pass also fills the cache
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void setup(int pass)
+{
+	int 	i,
+		capacity = CAPACITY(records);
+	DeviceRecord *r;
+	StoreRecord *s;
+
+	for (i = 0; i < capacity; i++)
+		id_pos[i] = store_of[i] = -1;
+	num_device = num_store = 0;
+	order_stale = 1;
+	next_id = 1;
+	memset(&dlp, 0, sizeof(dlp));
+
+	for (i = 0; i < records; i++) {
+		r = &device[num_device];
+		r->present = 1;
+		r->recID = next_id++;
+		r->catID = i % 16;
+		r->attrs = 0;
+		r->len = record_text(r->data, i, r->catID, "", "");
+		id_pos[r->recID] = num_device++;
+
+		s = store_add(r->recID, r->catID, 0, r->data, r->len);
+
+		if (pass == PASS_THREE_WAY) {
+			sync_CacheSet(cache, r->recID, r->catID, 0,
+				pi_hash64(r->data, r->len));
+			sync_CacheSetBody(cache, r->recID, r->data, r->len);
+		}
+
+		if (chosen(i, 0)) {
+			if (i % 4 == 0) {
+				r->attrs = dlpRecAttrDeleted | dlpRecAttrDirty;
+			} else {
+				/* One in three is a real conflict with the
+				   desktop, if also changed there */
+				r->attrs = dlpRecAttrDirty;
+				r->len = i % 3 == 0
+					? record_text(r->data, i, r->catID, "",
+						", noted on the device")
+					: record_text(r->data, i, r->catID,
+						", changed on the device", "");
+			}
+		}
+
+		if (chosen(i, 1)) {
+			if (i % 4 == 0) {
+				s->d.flags = dlpRecAttrDeleted;
+			} else if (i % 4 == 1) {
+				char 	data[DATA_SIZE];
+				int 	len = record_text(data, i, i % 16,
+					" from the desktop", "");
+
+				store_add(0, i % 16, dlpRecAttrDirty, data, len);
+			} else {
+				s->d.flags = dlpRecAttrDirty;
+				s->len = record_text(s->data, i, s->d.catID,
+					"", ", noted on the desktop");
+			}
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    consistent
+ *
+ * Summary:     Check that the device and the desktop store hold the same
+ *		records
+ *
+ * Parameters:  None
+ *
+ * Returns:     Number of records that differ
+ *
+ ***********************************************************************/
+static int consistent(void)
+{
+	int 	i,
+		pos,
+		desktop = 0,
+		bad = 0;
+
+	for (i = 0; i < num_store; i++) {
+		StoreRecord *s = &store[i];
+
+		if (s->removed)
+			continue;
+		desktop++;
+		pos = device_position(s->d.recID);
+		if (pos < 0 || device[pos].len != s->len
+		    || memcmp(device[pos].data, s->data, s->len) != 0)
+			bad++;
+	}
+
+	device_record(0);
+	return bad + abs(num_order - desktop);
+}
+
+/***********************************************************************
+ *
+ * Function:    fold
+ *
+ * Summary:     Add a record to a digest
+ *
+ * Parameters:  Digest, record ID, category, data, length
+ *
+ * Returns:     The new digest
+ *
+ ***********************************************************************/
+static uint64_t fold(uint64_t h, recordid_t id, int catID, const char *data,
+		     int len)
+{
+	h = (h ^ id ^ ((uint64_t) catID << 32)) * 1099511628211ULL;
+	return (h ^ pi_hash64(data, len)) * 1099511628211ULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    digest
+ *
+ * Summary:     Digest the records on both sides, in the order they are
+ *		kept
+ *
+ * Parameters:  None
+ *
+ * Returns:     The digest
+ *
+ ***********************************************************************/
+static uint64_t digest(void)
+{
+	int 	i;
+	uint64_t h = 14695981039346656037ULL;
+
+	for (i = 0; i < num_device; i++)
+		if (device[i].present)
+			h = fold(h, device[i].recID, device[i].catID,
+				device[i].data, device[i].len);
+	for (i = 0; i < num_store; i++)
+		if (!store[i].removed)
+			h = fold(h, store[i].d.recID, store[i].d.catID,
+				store[i].data, store[i].len);
+	return h;
+}
+
+/***********************************************************************
+ *
+ * Function:    run
+ *
+ * Summary:     Run and report one pass
+ *
+ * Parameters:  Pass
+ *
+ * Returns:     Number of records that differ afterwards for the syncs,
+ *		0 for the copies, plus one if a pipelined pass doesn't end
+ *		like the serial one
+ *
+ ***********************************************************************/
+static int run(int pass)
+{
+	static const char *names[] = {
+		"fast sync", "slow sync", "3-way sync", "copy to",
+		"copy from", "fast piped", "slow piped"
+	};
+	int 	slow = pass == PASS_SLOW || pass == PASS_SLOW_PIPED,
+		result,
+		bad = 0;
+	double 	start,
+		elapsed;
+	SyncHandler sh;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.name = "BenchDB";
+	sh.data = &slow;
+	sh.Pre = Pre;
+	sh.Post = Post;
+	sh.SetPilotID = SetPilotID;
+	sh.SetStatusCleared = SetStatusCleared;
+	sh.ForEach = ForEach;
+	sh.ForEachModified = ForEachModified;
+	sh.Compare = Compare;
+	sh.AddRecord = AddRecord;
+	sh.ReplaceRecord = ReplaceRecord;
+	sh.DeleteRecord = DeleteRecord;
+	sh.ArchiveRecord = ArchiveRecord;
+	sh.Match = Match;
+	sh.FreeMatch = FreeMatch;
+	sh.Prepare = Prepare;
+
+	if (pass == PASS_THREE_WAY) {
+		/* No such directory: the cache starts empty and isn't
+		   saved */
+		cache = sync_OpenCache("/nonexistent", 0, sh.name);
+		sh.cache = cache;
+		sh.three_way = 1;
+		sh.Merge = Merge;
+	}
+	if (pass == PASS_FAST_PIPED || pass == PASS_SLOW_PIPED) {
+		sh.pipeline = PIPELINE_DEPTH;
+		sh.match_workers = MATCH_WORKERS;
+	}
+
+	setup(pass);
+	allocations = 0;
+	counting = 1;
+	start = now();
+
+	switch (pass) {
+	case PASS_FAST:
+	case PASS_SLOW:
+	case PASS_THREE_WAY:
+	case PASS_FAST_PIPED:
+	case PASS_SLOW_PIPED:
+		result = sync_Synchronize(&sh);
+		break;
+	case PASS_COPY_TO:
+		result = sync_CopyToPilot(&sh);
+		break;
+	default:
+		result = sync_CopyFromPilot(&sh);
+		break;
+	}
+
+	elapsed = now() - start;
+	counting = 0;
+
+	device_record(0);
+	if (pass != PASS_COPY_TO && pass != PASS_COPY_FROM)
+		bad = consistent();
+	if (sh.cache != NULL)
+		sync_FreeCache(sh.cache);
+	if (result < 0)
+		bad++;
+
+	outcome[pass] = digest();
+	if ((pass == PASS_FAST_PIPED && outcome[pass] != outcome[PASS_FAST])
+	    || (pass == PASS_SLOW_PIPED
+		&& outcome[pass] != outcome[PASS_SLOW]))
+		bad++;
+
+	printf("%-10s %10.0f %10lu %8lu %8lu %8lu %8lu %8d %s\n",
+		names[pass], elapsed > 0 ? records / elapsed : 0.0, allocations,
+		dlp.reads + dlp.writes + dlp.deletes + dlp.other,
+		dlp.reads, dlp.writes, dlp.deletes, num_order,
+		result < 0 ? "failed" : (bad ? "differ" : "ok"));
+
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	pass,
+		bad = 0;
+
+	records = argc > 1 ? atoi(argv[1]) : DEFAULT_RECORDS;
+	percent = argc > 2 ? atoi(argv[2]) : DEFAULT_PERCENT;
+	if (records <= 0 || percent < 0 || percent > 100) {
+		fprintf(stderr, "usage: %s [records [percent changed]]\n",
+			argv[0]);
+		return 2;
+	}
+
+	device = malloc(CAPACITY(records) * sizeof(DeviceRecord));
+	device_order = malloc(CAPACITY(records) * sizeof(int));
+	id_pos = malloc(CAPACITY(records) * sizeof(int));
+	store = malloc(CAPACITY(records) * sizeof(StoreRecord));
+	store_of = malloc(CAPACITY(records) * sizeof(int));
+
+	printf("%d records, %d%% changed on each side\n", records, percent);
+	printf("%-10s %10s %10s %8s %8s %8s %8s %8s\n", "pass",
+		"records/s", "allocs", "DLP", "reads", "writes", "deletes",
+		"after");
+	for (pass = PASS_FAST; pass < NUM_PASSES; pass++)
+		bad += run(pass);
+
+	free(device);
+	free(device_order);
+	free(id_pos);
+	free(store);
+	free(store_of);
+
+	return bad ? 1 : 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,422 @@
+/*
+ * $Id$
+ *
+ * unpack-bench.c: Benchmark of unpacking records with malloc() against
+ * unpacking them into an arena
+ *
+ * A set of Address, Contact, ToDo and Memo records is packed, then
+ * unpacked again and again, once with unpack_*() and free_*(), and once
+ * with unpack_*_arena() and a pi_arena_reset() after each record, and
+ * once more with an arena that borrows the strings from the record
+ * buffers instead of copying them. Each pass reports records per second
+ * and allocations per record. The records unpacked each way must be the
+ * same, otherwise the program fails.
+ *
+ * Usage: unpack-bench [records [rounds]]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-arena.h"
+#include "pi-address.h"
+#include "pi-contact.h"
+#include "pi-todo.h"
+#include "pi-memo.h"
+
+#define DEFAULT_RECORDS	10000
+#define DEFAULT_ROUNDS	10
+
+#define KIND_ADDRESS	0
+#define KIND_CONTACT	1
+#define KIND_TODO	2
+#define KIND_MEMO	3
+#define NUM_KINDS	4
+
+static const char *kind_names[NUM_KINDS] =
+	{ "Address", "Contact", "ToDo", "Memo" };
+
+static int counting;
+static unsigned long allocations;
+
+#ifdef __GLIBC__
+/* Count the allocations made during a pass by wrapping the C library's
+   allocator. Other C libraries don't offer a portable way to do this, and
+   the count is reported as 0 there. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    pack_record
+ *
+ * Summary:     Pack the n-th record of a kind, with a few of its fields
+ *		filled in
+ *
+ * Parameters:  Kind, record number, buffer
+ *
+ * Returns:     Result of the pack function
+ *
+ ***********************************************************************/
+static int pack_record(int kind, int n, pi_buffer_t *buf)
+{
+	char 	text[8][64];
+	int 	i,
+		result = -1;
+
+	for (i = 0; i < 8; i++)
+		sprintf(text[i], "Field %d of record %d", i, n);
+
+	switch (kind) {
+	case KIND_ADDRESS: {
+		Address_t addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.showPhone = n % 5;
+		for (i = 0; i < 5; i++)
+			addr.phoneLabel[i] = i;
+		addr.entry[entryLastname] 	= text[0];
+		addr.entry[entryFirstname] 	= text[1];
+		addr.entry[entryCompany] 	= text[2];
+		addr.entry[entryPhone1] 	= text[3];
+		addr.entry[entryPhone2] 	= text[4];
+		addr.entry[entryAddress] 	= text[5];
+		addr.entry[entryCity] 		= text[6];
+		addr.entry[entryNote] 		= text[7];
+		result = pack_Address(&addr, buf, address_v1);
+		break;
+	}
+	case KIND_CONTACT: {
+		struct Contact c;
+		unsigned char picture[66];
+		Blob_t 	blob;
+
+		memset(&c, 0, sizeof(c));
+		for (i = 0; i < 8; i++)
+			c.entry[i * 4] = text[i];
+
+		if (n % 2 == 0) {
+			/* A small picture on every other contact */
+			memset(picture, n & 0xff, sizeof(picture));
+			memcpy(blob.type, BLOB_TYPE_PICTURE_ID, 4);
+			blob.length = sizeof(picture);
+			blob.data = picture;
+			Contact_add_blob(&c, &blob);
+		}
+		result = pack_Contact(&c, buf, contacts_v11);
+		for (i = 0; i < MAX_BLOBS; i++) {
+			if (c.blob[i] != NULL) {
+				free(c.blob[i]->data);
+				free(c.blob[i]);
+			}
+		}
+		break;
+	}
+	case KIND_TODO: {
+		ToDo_t 	todo;
+
+		memset(&todo, 0, sizeof(todo));
+		todo.indefinite = 1;
+		todo.priority = 1 + n % 5;
+		todo.description = text[0];
+		todo.note = text[1];
+		result = pack_ToDo(&todo, buf, todo_v1);
+		break;
+	}
+	case KIND_MEMO: {
+		Memo_t 	memo;
+		char 	body[512];
+
+		body[0] = '\0';
+		for (i = 0; i < 8; i++) {
+			strcat(body, text[i]);
+			strcat(body, "\n");
+		}
+		memo.text = body;
+		result = pack_Memo(&memo, buf, memo_v1);
+		break;
+	}
+	}
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    same_string
+ *
+ * Summary:     Compare two possibly NULL strings
+ *
+ * Parameters:  Strings
+ *
+ * Returns:     Nonzero if they are equal
+ *
+ ***********************************************************************/
+static int same_string(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_record
+ *
+ * Summary:     Unpack a record with malloc() or into an arena, then
+ *		optionally compare it with the other way and free it
+ *
+ * Parameters:  Kind, record, arena or NULL, whether to compare
+ *
+ * Returns:     0 on success, -1 if unpacking failed or the two ways
+ *		differ
+ *
+ ***********************************************************************/
+static int unpack_record(int kind, pi_buffer_t *buf, pi_arena_t *arena,
+	int check)
+{
+	int 	i,
+		result = 0;
+
+	switch (kind) {
+	case KIND_ADDRESS: {
+		Address_t a, b;
+
+		if (unpack_Address_arena(&a, buf, address_v1, arena) < 0)
+			return -1;
+		if (check) {
+			unpack_Address(&b, buf, address_v1);
+			for (i = 0; i < 19; i++)
+				if (!same_string(a.entry[i], b.entry[i]))
+					result = -1;
+			if (a.showPhone != b.showPhone
+			    || memcmp(a.phoneLabel, b.phoneLabel,
+				    sizeof(a.phoneLabel)) != 0)
+				result = -1;
+			free_Address(&b);
+		}
+		if (arena == NULL)
+			free_Address(&a);
+		break;
+	}
+	case KIND_CONTACT: {
+		struct Contact a, b;
+
+		if (unpack_Contact_arena(&a, buf, contacts_v11, arena) < 0)
+			return -1;
+		if (check) {
+			unpack_Contact(&b, buf, contacts_v11);
+			for (i = 0; i < NUM_CONTACT_ENTRIES; i++)
+				if (!same_string(a.entry[i], b.entry[i]))
+					result = -1;
+			if ((a.picture == NULL) != (b.picture == NULL)
+			    || (a.picture != NULL
+				&& (a.picture->length != b.picture->length
+				    || memcmp(a.picture->data,
+					    b.picture->data,
+					    a.picture->length) != 0)))
+				result = -1;
+			free_Contact(&b);
+		}
+		if (arena == NULL)
+			free_Contact(&a);
+		break;
+	}
+	case KIND_TODO: {
+		ToDo_t 	a, b;
+
+		if (unpack_ToDo_arena(&a, buf, todo_v1, arena) < 0)
+			return -1;
+		if (check) {
+			unpack_ToDo(&b, buf, todo_v1);
+			if (!same_string(a.description, b.description)
+			    || !same_string(a.note, b.note)
+			    || a.priority != b.priority)
+				result = -1;
+			free_ToDo(&b);
+		}
+		if (arena == NULL)
+			free_ToDo(&a);
+		break;
+	}
+	case KIND_MEMO: {
+		Memo_t 	a, b;
+
+		if (unpack_Memo_arena(&a, buf, memo_v1, arena) < 0)
+			return -1;
+		if (check) {
+			unpack_Memo(&b, buf, memo_v1);
+			if (!same_string(a.text, b.text))
+				result = -1;
+			free_Memo(&b);
+		}
+		if (arena == NULL)
+			free_Memo(&a);
+		break;
+	}
+	}
+
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	int 	records = DEFAULT_RECORDS,
+		rounds = DEFAULT_ROUNDS,
+		kind,
+		pass,
+		round,
+		n,
+		failed = 0;
+	pi_buffer_t **bufs;
+	pi_arena_t *arena,
+		*borrowing;
+	static const char *pass_names[3] = { "malloc", "arena", "borrow" };
+
+	if (argc > 1)
+		records = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (records < 1 || rounds < 1) {
+		fprintf(stderr, "Usage: %s [records [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	bufs = (pi_buffer_t **) malloc(records * sizeof(pi_buffer_t *));
+	arena = pi_arena_new(0);
+	borrowing = pi_arena_new_borrowing(0);
+	if (bufs == NULL || arena == NULL || borrowing == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (kind = 0; kind < NUM_KINDS; kind++) {
+		for (n = 0; n < records; n++) {
+			bufs[n] = pi_buffer_new(256);
+			if (pack_record(kind, n, bufs[n]) < 0) {
+				fprintf(stderr, "Packing %s record %d failed\n",
+					kind_names[kind], n);
+				return 1;
+			}
+		}
+
+		/* All ways must give the same records */
+		for (n = 0; n < records; n++) {
+			if (unpack_record(kind, bufs[n], arena, 1) < 0
+			    || unpack_record(kind, bufs[n], borrowing, 1) < 0) {
+				fprintf(stderr, "%s record %d differs\n",
+					kind_names[kind], n);
+				failed = 1;
+				break;
+			}
+			pi_arena_reset(arena);
+			pi_arena_reset(borrowing);
+		}
+
+		for (pass = 0; pass < 3; pass++) {
+			pi_arena_t *a = pass == 0 ? NULL
+				: pass == 1 ? arena : borrowing;
+			double 	start,
+				elapsed;
+
+			allocations = 0;
+			counting = 1;
+			start = now();
+			for (round = 0; round < rounds; round++) {
+				for (n = 0; n < records; n++) {
+					unpack_record(kind, bufs[n], a, 0);
+					if (a != NULL)
+						pi_arena_reset(a);
+				}
+			}
+			elapsed = now() - start;
+			counting = 0;
+
+			printf("%-8s %-7s %10.0f records/s %6.2f allocs/record\n",
+				kind_names[kind], pass_names[pass],
+				elapsed > 0
+				? (double) records * rounds / elapsed : 0.0,
+				(double) allocations / records / rounds);
+		}
+
+		for (n = 0; n < records; n++)
+			pi_buffer_free(bufs[n]);
+	}
+
+	pi_arena_free(arena);
+	pi_arena_free(borrowing);
+	free(bufs);
+
+	if (failed)
+		return 1;
+	printf("consistency: ok\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,409 @@
+/*
+ * $Id$
+ *
+ * veo-bench.c: Benchmark of the Veo camera decoder
+ *
+ * A database of Veo pictures is made up in memory: random record data
+ * is a valid compressed picture, since every bit pattern decodes to some
+ * pixel. Every fourth picture is taken at 320x240, the others at 640x480.
+ * The pictures are decoded with unpack_VeoPicture(), without and with
+ * colour correction and bias, reporting images and megapixels per second
+ * of processor time. Then all of them are decoded again by a pool of 1,
+ * 2, ... threads, as pilot-read-veo does, reporting images per second of
+ * wall clock time. The pool must give the same pixmaps as decoding one
+ * picture after the other, otherwise the program fails.
+ *
+ * Usage: veo-bench [pictures [threads]]
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-veo.h"
+
+#define DEFAULT_PICTURES	20
+#define DEFAULT_THREADS		4
+
+#define HEADER_SIZE	25
+/* Compressed record size, above what four rows of random codes take */
+#define RECORD_SIZE	4600
+
+typedef struct {
+	Veo_t	v;
+	unsigned char **records;
+	size_t	*sizes;
+	int	num_records;
+	unsigned long checksum;		/* of the pixmap decoded alone */
+} Picture;
+
+typedef struct {
+	VeoState_t state;		/* must come first */
+	const Picture *pic;
+} BenchState;
+
+typedef struct {
+	Picture *pictures;
+	int	num_pictures,
+		next,
+		failed;
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+} Pool;
+
+static const struct {
+	const char *name;
+	int 	flags,
+		bias;
+} passes[] = {
+	{ "plain", 0, 50 },
+	{ "colour", VEO_COLOUR_CORRECT, 50 },
+	{ "bias", VEO_BIAS, 65 },
+	{ "all", VEO_COLOUR_CORRECT | VEO_BIAS, 40 }
+};
+
+#define NUM_PASSES	((int) (sizeof(passes) / sizeof(passes[0])))
+
+/***********************************************************************
+ *
+ * Function:    now
+ *
+ * Summary:     Processor time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/***********************************************************************
+ *
+ * Function:    wall
+ *
+ * Summary:     Wall clock time in seconds
+ *
+ * Parameters:  None
+ *
+ * Returns:     Seconds
+ *
+ ***********************************************************************/
+static double wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/***********************************************************************
+ *
+ * Function:    getrecord
+ *
+ * Summary:     VeoState callback: return one of the made up records
+ *
+ * Parameters:  State, record number, record and size returned
+ *
+ * Returns:     0 on success, -1 if there is no such record
+ *
+ ***********************************************************************/
+static int getrecord(VeoState_t *state, int recno, void **buffer,
+	size_t *bufsize)
+{
+	const Picture *pic = ((BenchState *) state)->pic;
+
+	if (recno < 0 || recno >= pic->num_records)
+		return -1;
+
+	*buffer = pic->records[recno];
+	*bufsize = pic->sizes[recno];
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    make_picture
+ *
+ * Summary:     Make up the records of a picture: the header, then one
+ *		record for every four rows
+ *
+ * Parameters:  Picture, resolution, 0 for 640x480 or 1 for 320x240
+ *
+ * Returns:     0 on success, -1 if out of memory
+ *
+ ***********************************************************************/
+static int make_picture(Picture *pic, int resolution)
+{
+	unsigned char *header;
+	int 	height = resolution ? 240 : 480,
+		i,
+		k;
+
+	pic->num_records = 1 + height / 4;
+	pic->records = (unsigned char **) calloc(pic->num_records,
+		sizeof(unsigned char *));
+	pic->sizes = (size_t *) calloc(pic->num_records, sizeof(size_t));
+	if (pic->records == NULL || pic->sizes == NULL)
+		return -1;
+
+	header = pic->records[0] = (unsigned char *) calloc(1, HEADER_SIZE);
+	if (header == NULL)
+		return -1;
+	pic->sizes[0] = HEADER_SIZE;
+	header[2] = resolution;
+	header[20] = 7;		/* 2002-01-01 */
+	header[22] = 1;
+	header[24] = 1;
+
+	for (i = 1; i < pic->num_records; i++) {
+		pic->records[i] = (unsigned char *) malloc(RECORD_SIZE);
+		if (pic->records[i] == NULL)
+			return -1;
+		for (k = 0; k < RECORD_SIZE; k++)
+			pic->records[i][k] = rand() >> 4;
+		pic->sizes[i] = RECORD_SIZE;
+	}
+
+	unpack_Veo(&pic->v, header, HEADER_SIZE);
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    checksum
+ *
+ * Summary:     Checksum of a picture's pixmap
+ *
+ * Parameters:  Picture, pixmap
+ *
+ * Returns:     Checksum
+ *
+ ***********************************************************************/
+static unsigned long checksum(const Picture *pic, const unsigned char *pixmap)
+{
+	unsigned long sum = 0;
+	size_t 	i,
+		size = (size_t) pic->v.width * pic->v.height * 3;
+
+	for (i = 0; i < size; i++)
+		sum = sum * 31 + pixmap[i];
+	return sum;
+}
+
+/***********************************************************************
+ *
+ * Function:    pool_worker
+ *
+ * Summary:     Take pictures from the pool one at a time and decode
+ *		them, until none are left
+ *
+ * Parameters:  Pool
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *pool_worker(void *arg)
+{
+	Pool 	*pool = (Pool *) arg;
+	BenchState bs;
+
+	memset(&bs, 0, sizeof(bs));
+	bs.state.getrecord = getrecord;
+	bs.state.flags = VEO_COLOUR_CORRECT;
+
+	for (;;) {
+		Picture *pic;
+
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&pool->lock);
+#endif
+		pic = pool->next < pool->num_pictures
+			? &pool->pictures[pool->next++] : NULL;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&pool->lock);
+#endif
+		if (pic == NULL)
+			break;
+
+		bs.pic = pic;
+		if (!unpack_VeoPicture(&bs.state, &pic->v)
+		    || checksum(pic, bs.state.pixmap) != pic->checksum)
+			pool->failed = 1;
+		free_VeoPicture(&bs.state);
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    run_pool
+ *
+ * Summary:     Decode all pictures with a pool of threads
+ *
+ * Parameters:  Pool, number of threads
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void run_pool(Pool *pool, int threads)
+{
+#if HAVE_PTHREAD
+	pthread_t *tids;
+	int 	i;
+
+	pool->next = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	tids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+	for (i = 0; tids && i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, pool_worker, pool))
+			break;
+	}
+	threads = i;
+	if (threads == 0)
+		pool_worker(pool);
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	pthread_mutex_destroy(&pool->lock);
+#else
+	pool->next = 0;
+	pool_worker(pool);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	int 	num_pictures = DEFAULT_PICTURES,
+		max_threads = DEFAULT_THREADS,
+		threads,
+		pass,
+		n,
+		i;
+	double 	pixels = 0;
+	Picture *pictures;
+	Pool 	pool;
+	BenchState bs;
+
+	if (argc > 1)
+		num_pictures = atoi(argv[1]);
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+	if (num_pictures < 1 || max_threads < 1) {
+		fprintf(stderr, "Usage: %s [pictures [threads]]\n", argv[0]);
+		return 1;
+	}
+#if !HAVE_PTHREAD
+	max_threads = 1;
+#endif
+
+	pictures = (Picture *) calloc(num_pictures, sizeof(Picture));
+	if (pictures == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	srand(1);
+	for (n = 0; n < num_pictures; n++) {
+		if (make_picture(&pictures[n], n % 4 == 3) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		pixels += (double) pictures[n].v.width * pictures[n].v.height;
+	}
+
+	memset(&bs, 0, sizeof(bs));
+	bs.state.getrecord = getrecord;
+
+	for (pass = 0; pass < NUM_PASSES; pass++) {
+		double 	start,
+			elapsed;
+
+		bs.state.bias = passes[pass].bias;
+		bs.state.flags = passes[pass].flags;
+
+		start = now();
+		for (n = 0; n < num_pictures; n++) {
+			bs.pic = &pictures[n];
+			if (!unpack_VeoPicture(&bs.state, &pictures[n].v)) {
+				fprintf(stderr, "Decoding failed\n");
+				return 1;
+			}
+			if (bs.state.flags == VEO_COLOUR_CORRECT)
+				pictures[n].checksum = checksum(&pictures[n],
+					bs.state.pixmap);
+			free_VeoPicture(&bs.state);
+		}
+		elapsed = now() - start;
+
+		printf("%-8s %8.1f images/s %7.1f Mpixels/s\n",
+			passes[pass].name,
+			elapsed > 0 ? num_pictures / elapsed : 0.0,
+			elapsed > 0 ? pixels / elapsed / 1e6 : 0.0);
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	pool.pictures = pictures;
+	pool.num_pictures = num_pictures;
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		double 	start,
+			elapsed;
+
+		start = wall();
+		run_pool(&pool, threads);
+		elapsed = wall() - start;
+
+		printf("pool     %d thread%s %8.1f images/s\n", threads,
+			threads == 1 ? " " : "s",
+			elapsed > 0 ? num_pictures / elapsed : 0.0);
+	}
+
+	for (n = 0; n < num_pictures; n++) {
+		for (i = 0; i < pictures[n].num_records; i++)
+			free(pictures[n].records[i]);
+		free(pictures[n].records);
+		free(pictures[n].sizes);
+	}
+	free(pictures);
+
+	if (pool.failed) {
+		fprintf(stderr, "pool: pixmaps differ\n");
+		return 1;
+	}
+	printf("consistency: ok\n");
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */